@@ -0,0 +1,518 @@
+/*ms----------------------------------------------------------------------------
+
+   tilebench.c
+
+   Purpose:
+      To time tilesig on a RAMS tile, a procedure at a time and end to
+      end, and to check its output against a golden checksum.  With
+      tilegen it needs no production tile.
+
+   Build:
+      cc -O2 -DTILESIG_LIBRARY -o tilebench tilebench.c tilesig.c \
+         -lm -lpthread
+
+   Interface: tilebench -tile <dir>
+         [-reps n]         - end to end runs, the best reported, default 3
+         [-quick]          - a sixteenth of the procedure calls
+         [-out file]       - output written, default tilebench.img, the
+                             index beside it as <file>.idx
+         [-golden file]    - check the output against the checksums in
+                             file, or write them there if it is missing
+         [-keep]           - leave the output files
+         [-- tilesig options]  - for every run, as -threads 4 -format tiff
+
+   Description:
+      GetSigma0      - ns per pixel through the per-pixel path, random
+                       pixels of random frames.
+      ApplyEqnAtPt   - ns per term by term evaluation of the frames'
+                       radiometric offset equations.
+      FindOffsetAtPt - ns per lookup of the sorted scan and of
+                       FindOffsetInGrid, near the ties of the frame with
+                       the most of them.  The two must agree bit for bit.
+      write_sub      - one pass through the subtiles on this thread,
+                       timing load_sub, convert_sub and write_sub apart,
+                       with write_sub in MB/s, and then close_output,
+                       which flushes what write_sub gathered.
+      end to end     - Depend through give_head as tilesig runs them,
+                       -reps times, in megapixels/s of the best.
+
+      The serial pass and every end to end run must write the same
+      output, and with -golden it must match the checksums there, so a
+      tile made by tilegen with a given seed pins the output of a
+      change.  A golden file holds for one tile and one set of tilesig
+      output options.  Exits 0 if every check held, 1 if any failed.
+
+----------------------------------------------------------------------------me*/
+
+/* ---- Include Files ---- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tilesig.h"
+
+#define BATCH_N 4096               /* points made once, used over again */
+
+typedef struct {
+   char   *tile, *out, *golden;
+   char    index[1024];
+   char  **argv;                   /* for ParseArgs, tilesig's own form */
+   int     argc, reps, keep;
+   long    n_calls;
+} Bench_t;
+
+typedef struct {                   /* one run of the tile              */
+   double  keys, read, convert, write, close, total;
+   long    pixels, bytes;
+   uint64_t out_sum, index_sum;
+} Run_t;
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double uniform(double lo, double hi)
+{
+   return lo + (hi - lo) * (rand() / (RAND_MAX + 1.0));
+}
+
+/* ---- FNV-1a of a whole file, 0 if it can't be read ---- */
+static uint64_t sum_file(const char *path)
+{
+   unsigned char buf[65536];
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   size_t   nn, ii;
+   FILE    *fp;
+
+   if((fp = fopen(path, "rb")) == NULL)
+      return 0;
+   while((nn = fread(buf, 1, sizeof(buf), fp)) > 0)
+      for(ii = 0; ii < nn; ii++)
+         hash = (hash ^ buf[ii]) * 0x100000001b3ULL;
+   fclose(fp);
+   return hash;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   time_sigma0
+
+    Purpose:   GetSigma0 for random pixels of random frames anywhere
+               over the tile's subtiles.
+
+----------------------------------------------------------------------------fe*/
+
+static void time_sigma0(Data_t *data, long n_calls)
+{
+   static Sample_t pts[BATCH_N];
+   volatile double sink = 0;
+   Options_t options;
+   Subtile_t *sub;
+   Sample_t pt;
+   double   t0, t1;
+   long     nn, bad = 0;
+   int      ii;
+
+   memset(&options, 0, sizeof(options));
+   for(ii = 0; ii < BATCH_N; ii++) {
+      sub = &data->subs[rand() % data->n_subs];
+      pts[ii].x = uniform(sub->min_x, sub->max_x);
+      pts[ii].y = uniform(sub->min_y, sub->max_y);
+      pts[ii].value = (int)uniform(500, 30000);
+      pts[ii].index_value = rand() % data->n_frames;
+      }
+
+   t0 = now();
+   for(nn = 0; nn < n_calls; nn++) {
+      pt = pts[nn % BATCH_N];
+      bad += GetSigma0(&options, data, &pt);
+      sink = pt.s0;
+      }
+   t1 = now();
+   (void)sink;
+
+   printf("GetSigma0:      %ld pixels, %.1f ns each%s\n", n_calls,
+          (t1 - t0) / n_calls * 1e9, bad ? ", some failed" : "");
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   time_equations
+
+    Purpose:   ApplyEqnAtPt on each frame's radiometric offset in turn,
+               at random points over the tile.
+
+----------------------------------------------------------------------------fe*/
+
+static void time_equations(Data_t *data, long n_calls)
+{
+   static double xx[BATCH_N], yy[BATCH_N];
+   volatile double sink = 0;
+   coeffs_t *eq;
+   Subtile_t *sub;
+   double    t0, t1, sum = 0;
+   long      nn;
+   int       ii, top = 0;
+
+   for(ii = 0; ii < BATCH_N; ii++) {
+      sub = &data->subs[rand() % data->n_subs];
+      xx[ii] = uniform(sub->min_x, sub->max_x);
+      yy[ii] = uniform(sub->min_y, sub->max_y);
+      }
+   for(ii = 0; ii < data->n_frames; ii++)
+      if(data->frames[ii].frm_offset.order > top)
+         top = data->frames[ii].frm_offset.order;
+
+   t0 = now();
+   for(nn = 0; nn < n_calls; nn++) {
+      eq = &data->frames[(nn / BATCH_N) % data->n_frames].frm_offset;
+      if(eq->n_coeffs > 0)
+         sum += ApplyEqnAtPt(xx[nn % BATCH_N], yy[nn % BATCH_N], eq);
+      }
+   t1 = now();
+   sink = sum;
+   (void)sink;
+
+   printf("ApplyEqnAtPt:   %ld points, %.1f ns each, up to order %d\n",
+          n_calls, (t1 - t0) / n_calls * 1e9, top);
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   time_ties
+
+    Purpose:   FindOffsetAtPt and FindOffsetInGrid at points within a
+               spacing of the busiest frame's ties.
+
+    Returns:   Number of points where they differ
+
+----------------------------------------------------------------------------fe*/
+
+static long time_ties(Data_t *data, long n_calls)
+{
+   static double xx[BATCH_N], yy[BATCH_N];
+   volatile double sink = 0;
+   EdgeTies_t *ties = NULL;
+   EdgeTie_t  *tie;
+   double      t0, t1, t2, sum = 0;
+   long        nn, wrong = 0;
+   int         ii;
+
+   for(ii = 0; ii < data->n_frames; ii++)
+      if(ties == NULL ||
+         data->frames[ii].frm_edgeties.n_ties > ties->n_ties)
+         ties = &data->frames[ii].frm_edgeties;
+   if(ties == NULL || ties->n_ties == 0) {
+      printf("FindOffsetAtPt: no frame has edge ties\n");
+      return 0;
+      }
+
+   for(ii = 0; ii < BATCH_N; ii++) {
+      tie = &ties->tie[rand() % ties->n_ties];
+      xx[ii] = tie->map_xy.x + uniform(-1, 1) * ties->spacing;
+      yy[ii] = tie->map_xy.y + uniform(-1, 1) * ties->spacing;
+      if(FindOffsetAtPt(xx[ii], yy[ii], ties->tie, ties->n_ties,
+                        ties->spacing) !=
+         FindOffsetInGrid(xx[ii], yy[ii], ties))
+         wrong++;
+      }
+
+   t0 = now();
+   for(nn = 0; nn < n_calls; nn++)
+      sum += FindOffsetAtPt(xx[nn % BATCH_N], yy[nn % BATCH_N], ties->tie,
+                            ties->n_ties, ties->spacing);
+   t1 = now();
+   for(nn = 0; nn < n_calls; nn++)
+      sum += FindOffsetInGrid(xx[nn % BATCH_N], yy[nn % BATCH_N], ties);
+   t2 = now();
+   sink = sum;
+   (void)sink;
+
+   printf("FindOffsetAtPt: %d ties, %.1f ns each, FindOffsetInGrid %.1f ns, "
+          "%ld differ\n", ties->n_ties, (t1 - t0) / n_calls * 1e9,
+          (t2 - t1) / n_calls * 1e9, wrong);
+   return wrong;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   run_tile
+
+    Purpose:   Run tilesig on the tile in-process, the steps main takes,
+               with the subtiles through calculate_subs or, if serial,
+               through load_sub, convert_sub and write_sub on this
+               thread with each one timed.
+
+    Returns:   0 on success, 1 if a step failed
+
+----------------------------------------------------------------------------fe*/
+
+static int run_tile(Bench_t *bench, int serial, Run_t *run)
+{
+   Options_t *options = (Options_t *)calloc(1, sizeof(Options_t));
+   Data_t    *data    = (Data_t *)calloc(1, sizeof(Data_t));
+   Subtile_t *sub;
+   double     t0, t1;
+   int        ii, failed = 0, status = 1;
+
+   memset(run, 0, sizeof(*run));
+   if(options == NULL || data == NULL ||
+      (data->tile_dir = strdup(bench->tile)) == NULL) {
+      printf("tilebench: out of memory\n");
+      free(options);
+      free(data);
+      return 1;
+      }
+   if(ParseArgs(bench->argc, bench->argv, options))
+      goto done;
+   if(options->tiles || options->do_point || options->points ||
+      options->serve) {
+      printf("tilebench: -tiles, -point, -points and -serve are not "
+             "benchmarked\n");
+      goto done;
+      }
+
+   t0 = now();
+   if(Depend(options, data))
+      goto done;
+   run->keys = now() - t0;
+   for(ii = 0; ii < data->n_subs; ii++)
+      run->pixels += (long)data->subs[ii].clip_nx * data->subs[ii].clip_ny;
+   if(prepare_output(data, options))
+      goto done;
+
+   if(!serial)
+      failed = calculate_subs(data, options);
+   else for(ii = 0; ii < data->n_subs; ii++) {
+      sub = &data->subs[ii];
+      t1 = now();
+      if(load_sub(sub, options, data)) {
+         sub->failed = failed = 1;
+         skip_sub(sub, data);
+         continue;
+         }
+      run->read += now() - t1;
+      t1 = now();
+      if(convert_sub(sub, options, data)) {
+         sub->failed = failed = 1;
+         skip_sub(sub, data);
+         continue;
+         }
+      run->convert += now() - t1;
+      t1 = now();
+      if(overview_sub(sub, data, options) || write_sub(sub, data, options)) {
+         sub->failed = failed = 1;
+         continue;
+         }
+      run->write += now() - t1;
+      run->bytes += (long)sub->clip_nx * sub->clip_ny * sizeof(short);
+      }
+   if(failed && fill_output(data, options, 1))
+      goto done;
+   t1 = now();
+   if(close_output(data, options) || give_head(data, options))
+      goto done;
+   run->close = now() - t1;
+   run->total = now() - t0;
+
+   run->out_sum   = sum_file(options->output_file);
+   run->index_sum = sum_file(options->index_file);
+   status = failed;
+
+done:
+   FreeTile(data);
+   free(options);
+   return status;
+}
+
+/* ---- the output, its index and any raw overviews, with headers ---- */
+static void remove_output(Bench_t *bench)
+{
+   static const char *ext[3] = { "", ".h", ".corners" };
+   char path[1100];
+   int  ii, kk;
+
+   for(ii = 0; ii < 3; ii++) {
+      snprintf(path, sizeof(path), "%s%s", bench->out, ext[ii]);
+      unlink(path);
+      snprintf(path, sizeof(path), "%s%s", bench->index, ext[ii]);
+      unlink(path);
+      for(kk = 0; kk < 16; kk++) {
+         snprintf(path, sizeof(path), "%s.ov%d%s", bench->out, 2 << kk,
+                  ext[ii]);
+         unlink(path);
+         }
+      }
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   check_golden
+
+    Purpose:   Compare the output checksums with those in the golden
+               file, or write them there if it doesn't exist yet.
+
+    Returns:   0 if they match or were written, 1 otherwise
+
+----------------------------------------------------------------------------fe*/
+
+static int check_golden(Bench_t *bench, const Run_t *run)
+{
+   unsigned long long out_sum, index_sum;
+   FILE *fp;
+   int   nn;
+
+   if((fp = fopen(bench->golden, "r")) != NULL) {
+      nn = fscanf(fp, " output %llx index %llx", &out_sum, &index_sum);
+      fclose(fp);
+      if(nn != 2) {
+         printf("golden:         can't read %s\n", bench->golden);
+         return 1;
+         }
+      if(out_sum != run->out_sum || index_sum != run->index_sum) {
+         printf("golden:         output %016llx index %016llx, %s has "
+                "%016llx and %016llx\n",
+                (unsigned long long)run->out_sum,
+                (unsigned long long)run->index_sum, bench->golden,
+                out_sum, index_sum);
+         return 1;
+         }
+      printf("golden:         output matches %s\n", bench->golden);
+      return 0;
+      }
+
+   if((fp = fopen(bench->golden, "w")) == NULL ||
+      fprintf(fp, "output %016llx\nindex %016llx\n",
+              (unsigned long long)run->out_sum,
+              (unsigned long long)run->index_sum) < 0 || fclose(fp)) {
+      printf("golden:         Unable to write %s\n", bench->golden);
+      return 1;
+      }
+   printf("golden:         wrote %s\n", bench->golden);
+   return 0;
+}
+
+static void bench_usage(char *cmd)
+{
+   printf("usage: %s -tile <dir> [-reps n] [-quick] [-out file] "
+          "[-golden file] [-keep]\n", cmd);
+   printf("          [-- tilesig options]\n");
+}
+
+int main(int argc, char *argv[])
+{
+   Bench_t bench;
+   Data_t *data;
+   Run_t   serial, run, best;
+   long    bad = 0;
+   int     ii, rep, n_extra = 0;
+   char  **extra = NULL;
+
+   memset(&bench, 0, sizeof(bench));
+   bench.out = "tilebench.img";
+   bench.reps = 3;
+   bench.n_calls = 1L << 20;
+
+   for(ii = 1; ii < argc; ii++) {
+      if(!strcmp(argv[ii], "--")) {
+         extra = &argv[ii + 1];
+         n_extra = argc - ii - 1;
+         break;
+         }
+      if(!strcmp(argv[ii], "-quick"))
+         bench.n_calls = 1L << 16;
+      else if(!strcmp(argv[ii], "-keep"))
+         bench.keep = 1;
+      else if(ii + 1 < argc && !strcmp(argv[ii], "-tile"))
+         bench.tile = argv[++ii];
+      else if(ii + 1 < argc && !strcmp(argv[ii], "-reps"))
+         bench.reps = atoi(argv[++ii]);
+      else if(ii + 1 < argc && !strcmp(argv[ii], "-out"))
+         bench.out = argv[++ii];
+      else if(ii + 1 < argc && !strcmp(argv[ii], "-golden"))
+         bench.golden = argv[++ii];
+      else {
+         bench_usage(argv[0]);
+         return 1;
+         }
+      }
+   if(bench.tile == NULL || bench.reps < 1) {
+      bench_usage(argv[0]);
+      return 1;
+      }
+
+   /* ---- tilesig's arguments: its output, then whatever came after -- */
+   snprintf(bench.index, sizeof(bench.index), "%s.idx", bench.out);
+   bench.argv = (char **)calloc(n_extra + 6, sizeof(char *));
+   bench.argv[bench.argc++] = "tilesig";
+   bench.argv[bench.argc++] = "-out";
+   bench.argv[bench.argc++] = bench.out;
+   bench.argv[bench.argc++] = "-index";
+   bench.argv[bench.argc++] = bench.index;
+   for(ii = 0; ii < n_extra; ii++)
+      bench.argv[bench.argc++] = extra[ii];
+
+   /* ---- the procedures, on the tile's tables ---- */
+   if((data = LoadTile(bench.tile, 0)) == NULL) {
+      printf("tilebench: can't load the tile in %s\n", bench.tile);
+      return 1;
+      }
+   printf("tile:           %s, %d subtiles of %d pixels, %d frames, "
+          "%d blocks\n", bench.tile, data->n_subs, data->image_size,
+          data->n_frames, data->n_blocks);
+   srand(1);
+   time_sigma0(data, bench.n_calls);
+   time_equations(data, bench.n_calls);
+   bad += time_ties(data, bench.n_calls);
+   FreeTile(data);
+
+   /* ---- one pass on this thread, each step timed ---- */
+   if(run_tile(&bench, 1, &serial)) {
+      printf("tilebench: the serial pass failed\n");
+      return 1;
+      }
+   printf("load_sub:       %.3f s\n", serial.read);
+   printf("convert_sub:    %.3f s, %.1f ns a pixel\n", serial.convert,
+          serial.convert / serial.pixels * 1e9);
+   printf("write_sub:      %.3f s, %.1f MB/s\n", serial.write,
+          serial.write > 0 ? serial.bytes / serial.write / 1e6 : 0);
+   printf("close_output:   %.3f s\n", serial.close);
+
+   /* ---- end to end, the best of -reps ---- */
+   memset(&best, 0, sizeof(best));
+   best.total = HUGE_VAL;
+   for(rep = 0; rep < bench.reps; rep++) {
+      if(run_tile(&bench, 0, &run)) {
+         printf("tilebench: run %d failed\n", rep + 1);
+         return 1;
+         }
+      if(run.out_sum != serial.out_sum || run.index_sum != serial.index_sum) {
+         printf("end to end:     run %d output differs from the serial "
+                "pass\n", rep + 1);
+         bad++;
+         }
+      if(run.total < best.total)
+         best = run;
+      }
+   printf("end to end:     %.2f Mpixels, best of %d %.3f s, %.1f Mpixels/s, "
+          "%.3f s of it loading keys\n", best.pixels / 1e6, bench.reps,
+          best.total, best.pixels / best.total / 1e6, best.keys);
+
+   if(bench.golden)
+      bad += check_golden(&bench, &best);
+   if(!bench.keep)
+      remove_output(&bench);
+   free(bench.argv);
+
+   printf("%s\n", bad ? "FAILED" : "all checks held");
+   return bad != 0;
+}
@@ -0,0 +1,591 @@
+/*ms----------------------------------------------------------------------------
+
+   tilegen.c
+
+   Purpose:
+      To write a synthetic RAMS tile that tilesig can convert, so its
+      speed can be measured and its output checked without one of the
+      production tiles.
+
+   Build:
+      cc -O2 -o tilegen tilegen.c -lm
+
+   Interface: tilegen -out <dir>
+         [-subs n]           - number of subtiles, default 16
+         [-size px]          - subtile width in image pixels, default 1024
+         [-res m]            - image pixel spacing, default 100
+         [-index_scale k]    - image pixels per index pixel, default 4
+         [-frames n]         - frames, 1 to 256, default 64
+         [-blocks n]         - blocks, default 4
+         [-frame_order n]    - order of the frame equations, default 2
+         [-block_order n]    - order of the block equations, default 1
+         [-tie_density d]    - edge ties per km of frame or block edge,
+                               default 2
+         [-tie_spacing m]    - edge tie spacing, default 1500
+         [-nodata f]         - fraction of index cells with no data,
+                               default 0.05
+         [-mix f]            - fraction of index cells given a frame
+                               other than the one covering them,
+                               default 0.02
+         [-img_order <big|little|native>]  - byte order of the IMG files
+         [-seed n]           - default 1
+
+   Description:
+      The subtiles are laid out as near to a square as their number
+      allows, left to right and bottom to top from 500000, -1200000, and
+      named S<row><column> as RAMS names them.  MASTER.TXT lists them.
+
+      Frames are rectangles in swaths running north to south across the
+      tile, the swaths shared out among the blocks, and each frame's
+      index cells are its own but for the -mix fraction that take a
+      frame at random, as overlaps and seams do.  A frame or block has
+      edge ties along its boundary at -tie_density, and its radiometric
+      offset and scale are smooth polynomials of its order over the
+      tile, written out in map coordinates the way the production keys
+      are.  Block geometric balancing is a shift of tens of metres with
+      a small rotation and scale.
+
+      Pixels are the amplitude of a backscatter of -25 to -5 dB varying
+      slowly over the tile, with 4 look speckle, scaled by the frame's
+      conversion parameters.  A -nodata fraction of index cells are all
+      no data.
+
+      The same options and seed write the same tile.  Exits 0 on
+      success, 1 on failure.
+
+----------------------------------------------------------------------------me*/
+
+/* ---- Include Files ---- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define NO_DATA_VAL  -9999
+#define MAX_ORDER    6
+#define MAX_FRAMES   256           /* an IDX pixel is one byte */
+#define X0           500000.0
+#define Y0          -1200000.0
+
+typedef struct {
+   int     subs, size, index_scale, frames, blocks;
+   int     frame_order, block_order, swap;
+   double  res, tie_density, tie_spacing, nodata, mix;
+   uint64_t seed;
+   char   *out;
+} Gen_t;
+
+typedef struct {           /* a frame's or block's rectangle          */
+   double  min_x, max_x, min_y, max_y;
+   double  cnvt_scale, min_pwr, db_bias;
+   int     block;
+} Area_t;
+
+static uint64_t rng_state;
+
+/* ---- splitmix64, so a seed writes the same tile everywhere ---- */
+static uint64_t next_rand(void)
+{
+   uint64_t zz = (rng_state += 0x9e3779b97f4a7c15ULL);
+
+   zz = (zz ^ (zz >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   zz = (zz ^ (zz >> 27)) * 0x94d049bb133111ebULL;
+   return zz ^ (zz >> 31);
+}
+
+/* uniform in [0, 1) */
+static double uniform(void)
+{
+   return (next_rand() >> 11) * 0x1p-53;
+}
+
+static double between(double lo, double hi)
+{
+   return lo + (hi - lo) * uniform();
+}
+
+static double choose(int nn, int kk)
+{
+   double cc = 1;
+   int    ii;
+
+   for(ii = 1; ii <= kk; ii++)
+      cc = cc * (nn - kk + ii) / ii;
+   return cc;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   put_equation
+
+    Purpose:   Write a random smooth polynomial of the given order as a
+               key file coefficient line.  It is made in coordinates
+               centred on (cx, cy) and scaled by half_w, so each term
+               is about mag over the tile, then multiplied out into the
+               powers of map x and y that ApplyEqnAtPt takes: for each
+               order from the highest down, x to that order first,
+               with the constant last.
+
+----------------------------------------------------------------------------fe*/
+
+static void put_equation(FILE *fp, const char *label, int order, double mag,
+                         double cx, double cy, double half_w)
+{
+   double cc[MAX_ORDER + 1][MAX_ORDER + 1];   /* in scaled coordinates */
+   double aa[MAX_ORDER + 1][MAX_ORDER + 1];   /* in map coordinates    */
+   double term;
+   int    ii, jj, pp, qq, oo;
+
+   memset(aa, 0, sizeof(aa));
+   for(ii = 0; ii <= order; ii++)
+      for(jj = 0; ii + jj <= order; jj++)
+         cc[ii][jj] = between(-mag, mag) / (ii + jj + 1);
+
+   for(ii = 0; ii <= order; ii++)
+      for(jj = 0; ii + jj <= order; jj++)
+         for(pp = 0; pp <= ii; pp++)
+            for(qq = 0; qq <= jj; qq++) {
+               term = cc[ii][jj] * choose(ii, pp) * choose(jj, qq) *
+                      pow(-cx, ii - pp) * pow(-cy, jj - qq) /
+                      pow(half_w, ii + jj);
+               aa[pp][qq] += term;
+               }
+
+   fprintf(fp, "%s:", label);
+   for(oo = order; oo >= 1; oo--)
+      for(pp = oo; pp >= 0; pp--)
+         fprintf(fp, " %.15e", aa[pp][oo - pp]);
+   fprintf(fp, " %.15e\n", aa[0][0]);
+}
+
+static int cmp_x(const void *aa, const void *bb)
+{
+   double xa = *(const double *)aa, xb = *(const double *)bb;
+
+   return xa < xb ? -1 : xa > xb;
+}
+
+/* ---- ties along an area's edge, density per km, in x order as
+        FindOffsetAtPt needs them ---- */
+static long put_ties(FILE *fp, const Area_t *area, const Gen_t *gen)
+{
+   double step, edge, along, *xyt;
+   long   nn, kk;
+   int    side;
+
+   edge = 2 * (area->max_x - area->min_x) + 2 * (area->max_y - area->min_y);
+   nn = (long)(edge / 1000 * gen->tie_density + 0.5);
+   if(nn <= 0)
+      return 0;
+   if((xyt = (double *)malloc(nn * 3 * sizeof(double))) == NULL) {
+      printf("tilegen: no memory for %ld edge ties\n", nn);
+      return -1;
+      }
+   step = edge / nn;
+   for(kk = 0; kk < nn; kk++) {
+      along = (kk + uniform()) * step;
+      for(side = 0; side < 3; side++) {
+         edge = side & 1 ? area->max_y - area->min_y
+                         : area->max_x - area->min_x;
+         if(along < edge)
+            break;
+         along -= edge;
+         }
+      switch(side) {
+         case 0:  xyt[3*kk] = area->min_x + along; xyt[3*kk+1] = area->min_y; break;
+         case 1:  xyt[3*kk] = area->max_x; xyt[3*kk+1] = area->min_y + along; break;
+         case 2:  xyt[3*kk] = area->max_x - along; xyt[3*kk+1] = area->max_y; break;
+         default: xyt[3*kk] = area->min_x; xyt[3*kk+1] = area->max_y - along; break;
+         }
+      xyt[3*kk]   += between(-0.25, 0.25) * gen->tie_spacing;
+      xyt[3*kk+1] += between(-0.25, 0.25) * gen->tie_spacing;
+      xyt[3*kk+2]  = between(-15, 15);
+      }
+   qsort(xyt, nn, 3 * sizeof(double), cmp_x);
+
+   fprintf(fp, "Edge tie number: %ld\n", nn);
+   fprintf(fp, "Edge tie spacing: %g\n", gen->tie_spacing);
+   fprintf(fp, "Edge ties\n");
+   for(kk = 0; kk < nn; kk++)
+      fprintf(fp, "%.3f %.3f %.4f\n", xyt[3*kk], xyt[3*kk+1], xyt[3*kk+2]);
+   fprintf(fp, "\n");
+   free(xyt);
+   return nn;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   put_keys
+
+    Purpose:   Lay the frames out in swaths over the tile and write
+               MASTER.TXT, FRAMES.KEY and BLOCKS.KEY.
+
+    Returns:   0 on success, 1 if a file can't be written
+
+----------------------------------------------------------------------------fe*/
+
+static int put_keys(const Gen_t *gen, int cols, int rows, Area_t *frames,
+                    Area_t *blocks, long *n_ties)
+{
+   char    path[1024];
+   FILE   *fp;
+   double  tile = gen->size * gen->res;
+   double  width = cols * tile, height = rows * tile;
+   double  cx = X0 + width / 2, cy = Y0 + height / 2;
+   double  half_w = (width > height ? width : height) / 2;
+   long    nn = 0;
+   int     n_swaths, n_segs, ii, jj, ss, gg;
+
+   /* ---- MASTER.TXT ---- */
+   snprintf(path, sizeof(path), "%s/MASTER.TXT", gen->out);
+   if((fp = fopen(path, "w")) == NULL) {
+      printf("tilegen: Unable to create %s\n", path);
+      return 1;
+      }
+   fprintf(fp, "RAMS master file\n");
+   fprintf(fp, "Image pixel spacing: %g\n", gen->res);
+   fprintf(fp, "Index tile pixel spacing: %g\n", gen->res * gen->index_scale);
+   fprintf(fp, "Subtile size: %g\n", tile);
+   fprintf(fp, "Number of sub-tiles: %d\n", gen->subs);
+   for(ii = 0; ii < gen->subs; ii++) {
+      jj = ii / cols;
+      fprintf(fp, "Subtile: S%0*d%0*d %.1f %.1f %.1f %.1f\n",
+              rows > 100 ? 3 : 2, jj, cols > 100 ? 3 : 2, ii % cols,
+              X0 + (ii % cols) * tile, Y0 + jj * tile,
+              X0 + (ii % cols + 1) * tile, Y0 + (jj + 1) * tile);
+      }
+   if(fclose(fp)) {
+      printf("tilegen: Unable to write %s\n", path);
+      return 1;
+      }
+
+   /* ---- frames in swaths, the swaths dealt out to the blocks ---- */
+   n_swaths = (int)ceil(sqrt(gen->frames));
+   n_segs   = (gen->frames + n_swaths - 1) / n_swaths;
+   for(ii = 0; ii < gen->blocks; ii++) {
+      blocks[ii].min_x = blocks[ii].min_y = HUGE_VAL;
+      blocks[ii].max_x = blocks[ii].max_y = -HUGE_VAL;
+      }
+   for(ii = 0; ii < gen->frames; ii++) {
+      ss = ii % n_swaths;
+      gg = ii / n_swaths;
+      frames[ii].min_x = X0 + width * ss / n_swaths;
+      frames[ii].max_x = X0 + width * (ss + 1) / n_swaths;
+      frames[ii].min_y = Y0 + height * gg / n_segs;
+      frames[ii].max_y = Y0 + height * (gg + 1) / n_segs;
+      if(ii + n_swaths >= gen->frames)      /* the last of its swath */
+         frames[ii].max_y = Y0 + height;
+      frames[ii].block      = ss % gen->blocks;
+      frames[ii].cnvt_scale = between(40000, 50000);
+      frames[ii].min_pwr    = between(-20, 0);
+      frames[ii].db_bias    = between(-1, 1);
+      jj = frames[ii].block;
+      if(frames[ii].min_x < blocks[jj].min_x) blocks[jj].min_x = frames[ii].min_x;
+      if(frames[ii].max_x > blocks[jj].max_x) blocks[jj].max_x = frames[ii].max_x;
+      if(frames[ii].min_y < blocks[jj].min_y) blocks[jj].min_y = frames[ii].min_y;
+      if(frames[ii].max_y > blocks[jj].max_y) blocks[jj].max_y = frames[ii].max_y;
+      }
+
+   /* ---- FRAMES.KEY ---- */
+   snprintf(path, sizeof(path), "%s/IMGINDEX.DIR/FRAMES.KEY", gen->out);
+   if((fp = fopen(path, "w")) == NULL) {
+      printf("tilegen: Unable to create %s\n", path);
+      return 1;
+      }
+   for(ii = 0; ii < gen->frames; ii++) {
+      fprintf(fp, "Frame Index %d: Block_%03d F%04d\n", ii, frames[ii].block,
+              ii);
+      fprintf(fp, "Conversion parameters: %.4f %.4f\n", frames[ii].cnvt_scale,
+              frames[ii].min_pwr);
+      put_equation(fp, "Radiometric balancing offset", gen->frame_order, 15,
+                   cx, cy, half_w);
+      put_equation(fp, "Radiometric balancing scale", gen->frame_order, 0.03,
+                   cx, cy, half_w);
+      if((nn = put_ties(fp, &frames[ii], gen)) < 0) {
+         fclose(fp);
+         return 1;
+         }
+      *n_ties += nn;
+      }
+   if(fclose(fp)) {
+      printf("tilegen: Unable to write %s\n", path);
+      return 1;
+      }
+
+   /* ---- BLOCKS.KEY ---- */
+   snprintf(path, sizeof(path), "%s/IMGINDEX.DIR/BLOCKS.KEY", gen->out);
+   if((fp = fopen(path, "w")) == NULL) {
+      printf("tilegen: Unable to create %s\n", path);
+      return 1;
+      }
+   for(ii = 0; ii < gen->blocks; ii++) {
+      fprintf(fp, "Block Index %d: Block_%03d\n", ii, ii);
+      put_equation(fp, "Radiometric balancing offset", gen->block_order, 10,
+                   cx, cy, half_w);
+      put_equation(fp, "Radiometric balancing scale", gen->block_order, 0.02,
+                   cx, cy, half_w);
+      fprintf(fp, "Geometric balancing parameters: %.6f %.6f %.9f %.9e\n",
+              between(-30, 30), between(-30, 30), 1 + between(-1e-5, 1e-5),
+              between(-1e-6, 1e-6));
+      if(blocks[ii].min_x > blocks[ii].max_x)    /* no frames, no edges */
+         continue;
+      if((nn = put_ties(fp, &blocks[ii], gen)) < 0) {
+         fclose(fp);
+         return 1;
+         }
+      *n_ties += nn;
+      }
+   if(fclose(fp)) {
+      printf("tilegen: Unable to write %s\n", path);
+      return 1;
+      }
+   return 0;
+}
+
+/* ---- the frame whose rectangle holds x, y ---- */
+static int frame_at(const Gen_t *gen, const Area_t *frames, double xx,
+                    double yy)
+{
+   int ii;
+
+   for(ii = 0; ii < gen->frames; ii++)
+      if(xx >= frames[ii].min_x && xx < frames[ii].max_x &&
+         yy >= frames[ii].min_y && yy < frames[ii].max_y)
+         return ii;
+   return gen->frames - 1;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   put_sub
+
+    Purpose:   Write one subtile's IMG and IDX.  Rows run north to
+               south from the subtile's top edge, as tilesig reads them.
+
+    Returns:   0 on success, 1 if a file can't be written
+
+----------------------------------------------------------------------------fe*/
+
+static int put_sub(const Gen_t *gen, int ss, int cols, int rows,
+                   const Area_t *frames, short *img, unsigned char *idx,
+                   long *n_null)
+{
+   char     path[1024], name[24];
+   FILE    *fp;
+   double   tile = gen->size * gen->res, cell = gen->res * gen->index_scale;
+   double   min_x = X0 + (ss % cols) * tile, max_y = Y0 + (ss / cols + 1) * tile;
+   double   xx, yy, db, power, speck, dn;
+   const Area_t *frame;
+   int      n_index = gen->size / gen->index_scale;
+   int      ii, jj, kk, empty;
+   uint16_t uu;
+
+   snprintf(name, sizeof(name), "S%0*d%0*d", rows > 100 ? 3 : 2, ss / cols,
+            cols > 100 ? 3 : 2, ss % cols);
+
+   for(ii = 0; ii < n_index; ii++)
+      for(jj = 0; jj < n_index; jj++) {
+         xx = min_x + (jj + 0.5) * cell;
+         yy = max_y - (ii + 0.5) * cell;
+         idx[ii * n_index + jj] = uniform() < gen->mix ?
+                                  (int)(next_rand() % gen->frames) :
+                                  frame_at(gen, frames, xx, yy);
+         }
+
+   for(ii = 0; ii < gen->size; ii++) {
+      yy = max_y - (ii + 0.5) * gen->res;
+      for(jj = 0; jj < gen->size; jj++) {
+         kk = (ii / gen->index_scale) * n_index + jj / gen->index_scale;
+         xx = min_x + (jj + 0.5) * gen->res;
+         frame = &frames[idx[kk]];
+
+         /* ---- whole index cells of no data, drawn at their corner ---- */
+         if(ii % gen->index_scale == 0 && jj % gen->index_scale == 0)
+            empty = uniform() < gen->nodata;
+         else
+            empty = img[(ii - ii % gen->index_scale) * gen->size +
+                        jj - jj % gen->index_scale] == NO_DATA_VAL;
+         if(empty) {
+            img[ii * gen->size + jj] = NO_DATA_VAL;
+            (*n_null)++;
+            continue;
+            }
+
+         db = -15 + frame->db_bias + 6 * sin(xx / 7000) * cos(yy / 9000) +
+              3 * sin((xx + yy) / 2300);
+         for(kk = 0, speck = 0; kk < 4; kk++)
+            speck -= log(1 - uniform());
+         power = pow(10, db / 10) * speck / 4;
+         dn = sqrt(power) * frame->cnvt_scale + frame->min_pwr;
+         img[ii * gen->size + jj] = dn < 1 ? 1 : dn > 32767 ? 32767 : (short)dn;
+         }
+      }
+
+   if(gen->swap)
+      for(kk = 0; kk < gen->size * gen->size; kk++) {
+         uu = (uint16_t)img[kk];
+         img[kk] = (short)(uint16_t)(uu << 8 | uu >> 8);
+         }
+
+   snprintf(path, sizeof(path), "%s/IMAGES.DIR/%s.IMG", gen->out, name);
+   if((fp = fopen(path, "wb")) == NULL ||
+      fwrite(img, sizeof(short), (size_t)gen->size * gen->size, fp) !=
+         (size_t)gen->size * gen->size || fclose(fp)) {
+      printf("tilegen: Unable to write %s\n", path);
+      return 1;
+      }
+   snprintf(path, sizeof(path), "%s/INDICES.DIR/%s.IDX", gen->out, name);
+   if((fp = fopen(path, "wb")) == NULL ||
+      fwrite(idx, 1, (size_t)n_index * n_index, fp) !=
+         (size_t)n_index * n_index || fclose(fp)) {
+      printf("tilegen: Unable to write %s\n", path);
+      return 1;
+      }
+   return 0;
+}
+
+static void usage(char *cmd)
+{
+   printf("usage: %s -out <dir> [-subs n] [-size px] [-res m] "
+          "[-index_scale k]\n", cmd);
+   printf("          [-frames n] [-blocks n] [-frame_order n] "
+          "[-block_order n]\n");
+   printf("          [-tie_density d] [-tie_spacing m] [-nodata f] "
+          "[-mix f]\n");
+   printf("          [-img_order <big|little|native>] [-seed n]\n");
+}
+
+static int make_dir(const char *dir, const char *sub)
+{
+   char path[1024];
+
+   snprintf(path, sizeof(path), "%s%s%s", dir, sub ? "/" : "", sub ? sub : "");
+   if(mkdir(path, 0777) && access(path, W_OK)) {
+      printf("tilegen: Unable to create %s\n", path);
+      return 1;
+      }
+   return 0;
+}
+
+int main(int argc, char *argv[])
+{
+   Gen_t   gen;
+   Area_t *frames, *blocks;
+   short  *img;
+   unsigned char *idx;
+   long    n_ties = 0, n_null = 0;
+   int     ii, cols, rows, big = 0x0100;
+
+   memset(&gen, 0, sizeof(gen));
+   gen.subs = 16;
+   gen.size = 1024;
+   gen.res = 100;
+   gen.index_scale = 4;
+   gen.frames = 64;
+   gen.blocks = 4;
+   gen.frame_order = 2;
+   gen.block_order = 1;
+   gen.tie_density = 2;
+   gen.tie_spacing = 1500;
+   gen.nodata = 0.05;
+   gen.mix = 0.02;
+   gen.seed = 1;
+
+   for(ii = 1; ii < argc; ii++) {
+      if(ii + 1 >= argc) {
+         usage(argv[0]);
+         return 1;
+         }
+      if(!strcmp(argv[ii], "-out"))
+         gen.out = argv[++ii];
+      else if(!strcmp(argv[ii], "-subs"))
+         gen.subs = atoi(argv[++ii]);
+      else if(!strcmp(argv[ii], "-size"))
+         gen.size = atoi(argv[++ii]);
+      else if(!strcmp(argv[ii], "-res"))
+         gen.res = atof(argv[++ii]);
+      else if(!strcmp(argv[ii], "-index_scale"))
+         gen.index_scale = atoi(argv[++ii]);
+      else if(!strcmp(argv[ii], "-frames"))
+         gen.frames = atoi(argv[++ii]);
+      else if(!strcmp(argv[ii], "-blocks"))
+         gen.blocks = atoi(argv[++ii]);
+      else if(!strcmp(argv[ii], "-frame_order"))
+         gen.frame_order = atoi(argv[++ii]);
+      else if(!strcmp(argv[ii], "-block_order"))
+         gen.block_order = atoi(argv[++ii]);
+      else if(!strcmp(argv[ii], "-tie_density"))
+         gen.tie_density = atof(argv[++ii]);
+      else if(!strcmp(argv[ii], "-tie_spacing"))
+         gen.tie_spacing = atof(argv[++ii]);
+      else if(!strcmp(argv[ii], "-nodata"))
+         gen.nodata = atof(argv[++ii]);
+      else if(!strcmp(argv[ii], "-mix"))
+         gen.mix = atof(argv[++ii]);
+      else if(!strcmp(argv[ii], "-seed"))
+         gen.seed = strtoull(argv[++ii], NULL, 10);
+      else if(!strcmp(argv[ii], "-img_order")) {
+         ii++;
+         if(!strcmp(argv[ii], "big"))
+            gen.swap = *(char *)&big == 0;
+         else if(!strcmp(argv[ii], "little"))
+            gen.swap = *(char *)&big != 0;
+         else if(strcmp(argv[ii], "native")) {
+            usage(argv[0]);
+            return 1;
+            }
+         }
+      else {
+         usage(argv[0]);
+         return 1;
+         }
+      }
+
+   if(gen.out == NULL || gen.subs < 1 || gen.res <= 0 ||
+      gen.index_scale < 1 || gen.size < gen.index_scale ||
+      gen.size % gen.index_scale || gen.frames < 1 ||
+      gen.frames > MAX_FRAMES || gen.blocks < 1 ||
+      gen.frame_order < 1 || gen.frame_order > MAX_ORDER ||
+      gen.block_order < 1 || gen.block_order > MAX_ORDER ||
+      gen.tie_density < 0 || gen.tie_spacing <= 0) {
+      printf("tilegen: -out is needed, -size a multiple of -index_scale, "
+             "-frames 1 to %d and orders 1 to %d\n", MAX_FRAMES, MAX_ORDER);
+      usage(argv[0]);
+      return 1;
+      }
+   rng_state = gen.seed;
+
+   cols = (int)ceil(sqrt(gen.subs));
+   rows = (gen.subs + cols - 1) / cols;
+   frames = (Area_t *)calloc(gen.frames, sizeof(Area_t));
+   blocks = (Area_t *)calloc(gen.blocks, sizeof(Area_t));
+   img = (short *)malloc((size_t)gen.size * gen.size * sizeof(short));
+   idx = (unsigned char *)malloc((size_t)gen.size * gen.size);
+   if(frames == NULL || blocks == NULL || img == NULL || idx == NULL) {
+      printf("tilegen: out of memory\n");
+      return 1;
+      }
+
+   if(make_dir(gen.out, NULL) || make_dir(gen.out, "IMGINDEX.DIR") ||
+      make_dir(gen.out, "IMAGES.DIR") || make_dir(gen.out, "INDICES.DIR") ||
+      put_keys(&gen, cols, rows, frames, blocks, &n_ties))
+      return 1;
+   for(ii = 0; ii < gen.subs; ii++)
+      if(put_sub(&gen, ii, cols, rows, frames, img, idx, &n_null))
+         return 1;
+
+   printf("%s: %d subtiles of %d pixels, %d frames, %d blocks, %ld edge "
+          "ties, %.1f%% no data\n", gen.out, gen.subs, gen.size, gen.frames,
+          gen.blocks, n_ties,
+          100.0 * n_null / ((double)gen.subs * gen.size * gen.size));
+   free(frames);
+   free(blocks);
+   free(img);
+   free(idx);
+   return 0;
+}
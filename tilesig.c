@@ -11,6 +11,7 @@
       usage     - To print a usage message 
       GetSigma0 - To get value from line & sample that a selected x,y map to.
       ParseArgs - To set defaults and parse the command line.
+      LoadTile, GetSigma0Block, FreeTile - in-process conversion, see tilesig.h
 
    Description:
       This program takes each pixel value from a final image subtiles and
@@ -27,6 +28,28 @@
    Interface: tilesig -out output_image
          [-h]      - (help) print usage
          [-db]      - print additional internal info
+         [-points]  - x y sigma0 frame block for every x y in a file
+         [-tiles]   - mosaic of the tile directories listed in a file
+         [-bbox]    - convert only the region min_x min_y max_x max_y
+         [-polygon] - convert only the region inside a ring of vertices
+         [-serve]   - answer point and window queries on a socket or stdin
+         [-resident] - subtiles -serve keeps mapped
+         [-threads] - number of subtiles to convert concurrently
+         [-prefetch] - subtiles read ahead of the converters
+         [-io]      - read ahead with io_uring or a thread
+         [-in_order] - byte order of the IMG files, default native
+         [-out_order] - byte order of the output, default native
+         [-format]  - raw mosaic, or tiled GeoTIFF one tile per subtile
+         [-compress] - GeoTIFF compression, deflate if built with zlib
+                       else lzw
+         [-overviews] - reduced resolution levels built as it goes
+         [-stats]   - JSON report of time per stage and work counts
+         [-cache]   - binary metadata cache file, or off
+         [-simd]    - force the avx512, avx2 or scalar row kernel
+         [-incremental] - forward difference equations along rows
+         [-approx]  - interpolate corrections within a dB error bound
+         [-math]    - exact (libm) or fast exp10/log10, same output
+         [-mission] - mamm (the default) or amm1 conversion parameters
 
    Environment
       This program needs to have access to the following files:
@@ -35,6 +58,10 @@
         BLOCKS.KEY
         FRAMES.KEY
 
+      and keeps what it parsed from them in TILESIG.CACHE if it can.
+      They are in the current directory, or with -tiles in each of
+      the tile directories listed.
+
    Author:   ripped apart and recombined by millerjd
 
    Algorithm:
@@ -50,164 +77,43 @@
 
 /* ---- Include Files ---- */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                     /* fallocate */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "tilesig.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TILESIG_X86 1
+#endif
 
-#define MAMM 1
-
-#define INDEX_DIR "IMGINDEX.DIR"
-
-#define NO_DATA_VAL  -9999
-#define OUT_NULL     -32767
-#define DATA_SCALE    1638.35
-#define OFFSET        30.0
-#define OUT_OFFSET    32766
-
-/* ---- Local data types ---- */
-
-typedef struct {           /* command line options...      */
-   char   *output_file;     /* output file name            */
-   char   *index_file;      /* index file name            */
-   double  map_x;           /* user specified coordinate  */
-   double  map_y;
-   int     do_point;        /* flag that user gave point   */
-   int     depend;          /* Was "-depend" specified?    */
-   int     debug;           /* Was "-db" specified?        */
-   int     help;            /* Was "-h" specified?         */
-} Options_t;
-
-typedef struct IntXY_t {
-   int x, y;
-} IntXY_t;
-
-typedef struct DoubleXY_t {
-   double x, y;
-} DoubleXY_t;
-
-typedef struct coeff_s {
-   double value;
-   struct coeff_s *next;
-} coeff_t;
-
-typedef struct {
-   coeff_t *firstcoeff;
-   int     n_coeffs;
-} coeffs_t;
-
-typedef struct {
-    DoubleXY_t  map_xy;     /* map coords of chip center in parent image */
-    DoubleXY_t  ul;         /* coords of upper-left chip corner in parent */
-    double      avg;        /* chip magnitude */
-    double      target;     /* target avg for balancing */
-} EdgeTie_t;
-
-typedef struct {
-    EdgeTie_t   *tie;       /* array of edge ties */
-    int         n_ties;     /* number of ties in array */
-    IntXY_t     size;       /* size of chip */
-    double      spacing;    /* spacing between ties */
-} EdgeTies_t;
-
-
-typedef struct {           /* Block definition */
-   int           id;              /* block id associated with frame */
-   char         *name;            /* block name from master file    */
-   coeffs_t      blk_offset;      /* list of coefficients           */
-   coeffs_t      blk_scale;       /* list of coefficients           */
-   coeffs_t      blk_geom;        /* list of coefficients           */
-   EdgeTies_t    blk_edgeties;    /* edge balancing pts for block   */
-   } Block_t;
-
-typedef struct {           /* Frame definition            */
-   int           index;            /* index number from index file   */
-   char         *name;             /* frame name from master file    */
-   int           block_id;         /* id of associated block         */
-   double        min_pwr;          /* conversion min power parameter */
-   double        cnvt_scale;       /* conversion scale paramter      */
-   coeffs_t      frm_offset;       /* list of coefficients           */
-   coeffs_t      frm_scale;        /* list of coefficients           */
-   EdgeTies_t    frm_edgeties;     /* edge balancing pts for frame   */
-   Block_t      *block;            /* block reference for index      */
-   } Frame_t;
-
-typedef struct {           /* Subtile definition            */
-   char  name[12];          /* base subtile name             */
-   double min_x;           /* map extents                   */
-   double max_x;
-   double min_y;
-   double max_y;
-   int    img_ul_x;        /* pixel extents in output file  */
-   int    img_ul_y;
-   int    img_lr_x;
-   int    img_lr_y;
-   int    index_ul_x;        /* pixel extents in output file  */
-   int    index_ul_y;
-   short         *buf;
-   unsigned char *i_buf; 
-   }  Subtile_t;
-
-typedef struct {           /* Subtile definition            */
-   char  *name;            /* base subtile name             */
-   float *buf;
-   double min_x;           /* map extents                   */
-   double max_x;
-   double min_y;
-   double max_y;
-   int    size_x;
-   int    size_y;
-   int    fd;
-   }  Image_t;
-
-typedef struct {           /* data to be passed around like some cheap tart */
- /*  Variables to be changed on the fly */
-   double      x;               /* current x coord to convert         */
-   double      y;               /* current y coord to convert         */
-   double      geo_x;           /* geometric map x adjustment         */
-   double      geo_y;           /* geometric map y adjustment         */
-   double      s0;              /* returned sigma nought value        */
-   double      value;           /* input image value                  */
-   int         index_value;     /* image index value                  */
- /* this stuff will stay put */
-   double      image_res;       /* image pixel spacing                */
-   double      index_res;       /* index image pixel spacing          */
-   double      tile_size;       /* edge length of square subtile      */
-   int         image_size;      /* number of pixels/lines on a side   */
-   int         index_size;      /* number of pixels/lines on a side   */
-   Frame_t    *frames;          /* array of frames                    */
-   int         n_frames;        /* number of frames expected in index */
-   Block_t    *blocks;          /* array of blocks                    */
-   int         n_blocks;        /* number of blocks in tile           */
-   Subtile_t  *subs;            /* array of subs to be calculated     */
-   int         n_subs;          /* number of subtiles in tile         */
-   Image_t    *output_image;    /* output data */
-   Image_t    *index_image;     /* output data */
-} Data_t;
-
-/* ---- Function Prototypes ---- */
-
-/* user interface */
-void usage(char *cmd);
-int ParseArgs(int argc, char *argv[], Options_t *options);
-
-/* upfront collection of parameters */
-
-int Depend( Options_t *options, Data_t *data);
-coeffs_t *get_coeffs(char *line, Options_t *);
-int calculate_output_parameters(Data_t *data, Options_t *options);
-
-/* bulk of the work goes here */
-int GetSigma0 (Options_t *options, Data_t *data);
-int calculate_sub(Subtile_t *sub, Options_t *options, Data_t *data);
-double ApplyEqnAtPt(double xx, double yy, coeffs_t *coeffs);
-double FindOffsetAtPt(double xx, double yy, EdgeTie_t *tie_array, int n_ties, double spacing);
-
-/* write to output */
-int prepare_output(Data_t *data, Options_t *options);
-int write_sub(Subtile_t *sub, Data_t *data, Options_t *options);
-int give_head(Data_t *data, Options_t *options);
+/* io_uring through raw syscalls, there is no liburing to lean on */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#ifdef __NR_io_uring_setup
+#define TILESIG_URING 1
+#endif
+#endif
+#endif
 
 /*fs----------------------------------------------------------------------------
 
@@ -219,14 +125,16 @@ int give_head(Data_t *data, Options_t *options);
 
 ----------------------------------------------------------------------------fe*/
 
+#ifndef TILESIG_LIBRARY
 int main(int argc, char *argv[])
 {
    Options_t *options;
    Data_t    *data;
-   int        ii;
+   int        status;
 
    options = (Options_t *)calloc(1, sizeof(Options_t));
    data    = (Data_t *)calloc(1, sizeof(Data_t));
+   data->tile_dir = strdup(".");
 
    /* ---- Parse command line ---- */
 
@@ -235,6 +143,7 @@ int main(int argc, char *argv[])
       usage(argv[0]);
       exit (1);
       }
+   stats_thread(data, options, "main");
 
 
    /* ---- collect dependencies: ---- */
@@ -247,35 +156,49 @@ int main(int argc, char *argv[])
    if(options->depend)
       exit(0);
 
-   if(options->do_point == 0)
-      prepare_output(data, options);
+   if(options->points) {
+      status = query_points(data, options);
+      exit(write_stats(data, options) || status);
+      }
 
-   for(ii = 0; ii < data->n_subs; ii++) {
-      calculate_sub(&data->subs[ii], options, data);
-/*
-      if(calculate_sub(&data->subs[ii], options, data) ){
-         printf("%s: error generating output for %s\n", argv[0], data->subs[ii].name);
-         exit (1);
-         }
-*/
+   if(options->serve) {
+      status = serve(data, options);
+      exit(write_stats(data, options) || status);
+      }
+
+   if(options->do_point == 0 && prepare_output(data, options)) {
+      printf("%s: error preparing output\n", argv[0]);
+      exit (1);
+      }
+
+   /* ---- Subtiles that failed get no data rather than holes ---- */
+   if(calculate_subs(data, options) && options->do_point == 0 &&
+      fill_output(data, options, 1)) {
+      printf("%s: error filling failed subtiles\n", argv[0]);
+      exit (1);
       }
 
    if(options->do_point == 1)
-       exit(0);
+       exit(write_stats(data, options));
 
-   close(data->output_image->fd);
-   if(data->index_image)
-      close(data->index_image->fd);
+   if(close_output(data, options)) {
+      printf("%s: error finishing output\n", argv[0]);
+      exit (1);
+      }
 
    if(give_head(data, options) ){
       printf("%s: error writing image header", argv[0]);
       exit (1);
       }
 
+   if(write_stats(data, options))
+      exit (1);
+
    /* ---- Return success ---- */
 
    exit(0);
 }
+#endif /* TILESIG_LIBRARY */
 
 
 /*fs----------------------------------------------------------------------------
@@ -296,7 +219,7 @@ int main(int argc, char *argv[])
 
 int ParseArgs(int argc, char *argv[], Options_t *options)
 {
-   int ii;
+   int ii, jj, *order;
 
    if(argc < 2) {
       printf("insufficient arguments\n");
@@ -322,6 +245,152 @@ int ParseArgs(int argc, char *argv[], Options_t *options)
          options->do_point = 1;
          continue;
          }
+      if(!strcmp(argv[ii], "-tiles")) {
+         ii++;
+         options->tiles = argv[ii];
+         continue;
+         }
+      if(!strcmp(argv[ii], "-bbox")) {
+         for(jj = 0; jj < 4; jj++)
+            sscanf(argv[++ii], "%lf", &options->bbox[jj]);
+         options->do_bbox = 1;
+         continue;
+         }
+      if(!strcmp(argv[ii], "-polygon")) {
+         ii++;
+         options->polygon = argv[ii];
+         continue;
+         }
+      if(!strcmp(argv[ii], "-points")) {
+         ii++;
+         options->points = argv[ii];
+         continue;
+         }
+      if(!strcmp(argv[ii], "-serve")) {
+         ii++;
+         options->serve = argv[ii];
+         continue;
+         }
+      if(!strcmp(argv[ii], "-resident")) {
+         ii++;
+         sscanf(argv[ii], "%d", &options->resident);
+         continue;
+         }
+      if(!strcmp(argv[ii], "-threads")) {
+         ii++;
+         sscanf(argv[ii], "%d", &options->n_threads);
+         continue;
+         }
+      if(!strcmp(argv[ii], "-incremental")) {
+         ii++;
+         sscanf(argv[ii], "%d", &options->fd_every);
+         continue;
+         }
+      if(!strcmp(argv[ii], "-approx")) {
+         ii++;
+         sscanf(argv[ii], "%lf", &options->approx);
+         continue;
+         }
+      if(!strcmp(argv[ii], "-mission")) {
+         ii++;
+         if(!strcmp(argv[ii], "amm1"))
+            options->mission = MISSION_AMM1;
+         else if(!strcmp(argv[ii], "mamm"))
+            options->mission = MISSION_MAMM;
+         else {
+            printf("-mission takes mamm or amm1, not %s\n", argv[ii]);
+            return 1;
+            }
+         continue;
+         }
+      if(!strcmp(argv[ii], "-math")) {
+         ii++;
+         if(!strcmp(argv[ii], "fast"))
+            options->fast_math = 1;
+         else if(strcmp(argv[ii], "exact")) {
+            printf("-math takes exact or fast, not %s\n", argv[ii]);
+            return 1;
+            }
+         continue;
+         }
+      if(!strcmp(argv[ii], "-prefetch")) {
+         ii++;
+         sscanf(argv[ii], "%d", &options->prefetch);
+         continue;
+         }
+      if(!strcmp(argv[ii], "-io")) {
+         ii++;
+         if(strcmp(argv[ii], "uring") && strcmp(argv[ii], "thread")) {
+            printf("-io takes uring or thread, not %s\n", argv[ii]);
+            return 1;
+            }
+         options->io = argv[ii];
+         continue;
+         }
+      if(!strcmp(argv[ii], "-in_order") || !strcmp(argv[ii], "-out_order")) {
+         order = !strcmp(argv[ii], "-in_order") ? &options->in_order
+                                                : &options->out_order;
+         ii++;
+         if(!strcmp(argv[ii], "big"))
+            *order = ORDER_BIG;
+         else if(!strcmp(argv[ii], "little"))
+            *order = ORDER_LITTLE;
+         else if(!strcmp(argv[ii], "native"))
+            *order = ORDER_NATIVE;
+         else {
+            printf("%s takes big, little or native, not %s\n", argv[ii - 1],
+                   argv[ii]);
+            return 1;
+            }
+         continue;
+         }
+      if(!strcmp(argv[ii], "-format")) {
+         ii++;
+         if(!strcmp(argv[ii], "tiff"))
+            options->tiff = 1;
+         else if(strcmp(argv[ii], "raw")) {
+            printf("-format takes raw or tiff, not %s\n", argv[ii]);
+            return 1;
+            }
+         continue;
+         }
+      if(!strcmp(argv[ii], "-compress")) {
+         ii++;
+         if(!strcmp(argv[ii], "none"))
+            options->compress = 1;
+         else if(!strcmp(argv[ii], "lzw"))
+            options->compress = 5;
+         else if(!strcmp(argv[ii], "deflate"))
+            options->compress = 8;
+         else if(!strcmp(argv[ii], "zstd"))
+            options->compress = 50000;
+         else {
+            printf("-compress takes none, lzw, deflate or zstd, not %s\n",
+                   argv[ii]);
+            return 1;
+            }
+         continue;
+         }
+      if(!strcmp(argv[ii], "-overviews")) {
+         ii++;
+         sscanf(argv[ii], "%d", &options->overviews);
+         continue;
+         }
+      if(!strcmp(argv[ii], "-stats")) {
+         ii++;
+         options->stats = argv[ii];
+         continue;
+         }
+      if(!strcmp(argv[ii], "-cache")) {
+         ii++;
+         options->cache = argv[ii];
+         continue;
+         }
+      if(!strcmp(argv[ii], "-simd")) {
+         ii++;
+         options->simd = argv[ii];
+         continue;
+         }
       if(!strcmp(argv[ii], "-db")) {
          ii++;
          sscanf(argv[ii], "%d", &options->debug);
@@ -336,7 +405,16 @@ int ParseArgs(int argc, char *argv[], Options_t *options)
          }
      }
 
-   if(options->do_point)
+#ifdef TILESIG_ZLIB
+   if(options->compress == 0)
+      options->compress = 8;
+#endif
+   if(options->compress == 0)
+      options->compress = 5;
+   options->swap_in  = order_swaps(options->in_order);
+   options->swap_out = order_swaps(options->out_order);
+
+   if(options->do_point || options->points || options->serve)
       return 0;
 
    if(options->output_file == NULL) {
@@ -369,1105 +447,8306 @@ void usage(char *cmd)
    printf( "  %s [-out output_file]\n\n", cmd);
    printf( "    -index index_file\n");
    printf( "    -point <x y>         - calculate for sigma_0 at given point\n");
+   printf( "    -points <file|->     - sigma_0 at every x y in file, or stdin\n");
+   printf( "    -tiles <list|dir>    - mosaic the tile directories listed in a file\n");
+   printf( "    -bbox <min_x min_y max_x max_y> - only the subtiles and pixels in the box\n");
+   printf( "    -polygon <file>      - only pixels in the x y ring in file\n");
+   printf( "    -serve <socket|->    - answer queries on a Unix socket, or stdin\n");
+   printf( "    -resident <n>        - subtiles -serve keeps mapped (default 16)\n");
+   printf( "    -threads <n>         - convert n subtiles at a time\n");
+   printf( "    -prefetch <n>        - read n subtiles ahead (default threads + 1)\n");
+   printf( "    -io <uring|thread>   - how to read ahead (default uring if it works)\n");
+   printf( "    -in_order <big|little|native>  - byte order of the IMG files\n");
+   printf( "    -out_order <big|little|native> - byte order of the output\n");
+   printf( "    -format <raw|tiff>   - raw mosaic or tiled GeoTIFF output\n");
+   printf( "    -compress <none|lzw|deflate|zstd> - GeoTIFF tile compression\n");
+   printf( "    -overviews <n>       - levels 2x to 2^n x coarser, power averaged\n");
+   printf( "    -cache <file|off>    - metadata cache (default TILESIG.CACHE in the tile)\n");
+   printf( "    -simd <avx512|avx2|scalar> - force the row kernel\n");
+   printf( "    -incremental <n>     - step equations along rows, exact every n pixels\n");
+   printf( "    -approx <db>         - interpolate corrections, within db of exact\n");
+   printf( "    -math <exact|fast>   - libm or Exp10Fast/Log10Fast, same output\n");
+   printf( "    -mission <mamm|amm1> - order of the conversion parameters (mamm)\n");
+   printf( "    -stats <file>        - write time per stage and counters as JSON\n");
    printf( "    -db    <print_level> - set debug output level\n");
    printf( "    -h                   - print usage\n\n");
 }
 
 /*fs----------------------------------------------------------------------------
 
-    Procedure:   int Depend(options, data)
-
-    Purpose:   To read program dependencies
-
-      A switch "-depend" could be used to check the dependencies
-      of the program and print the paths of key files known to
-      be missing.  Currently, any missing dependencies result in
-      an error.
+    Procedure:   host_big, order_swaps
 
-    Returns:   Returns 0 on success or 1 on failure.
+    Purpose:   Whether this host is big endian, and whether data in
+               ORDER_BIG, _LITTLE or _NATIVE order needs its shorts
+               swapped to or from host order.
 
 ----------------------------------------------------------------------------fe*/
-int Depend(Options_t *options, Data_t *data)
-{
-   //static char fn[] = "Depend";
-   char name[13];
-   char path[256], line[512];
-   char *strptr;
-   int ii, jj;
-   int  do_ties = 0;
-   FILE *fp;
-
-   Subtile_t *sub;
-   Frame_t   *frame;
-   Block_t   *block;
-   EdgeTie_t *tie;
-
-   if(options->debug > 0)
-       printf("collecting dependencies\n");
-
-   /* ---- Init ---- */
-
-   fp = NULL;
 
-  /* Read MASTER.TXT file */
-
-   if(options->debug > 5)
-       printf("reading MASTER.TXT\n");
+int host_big(void)
+{
+   const unsigned short one = 1;
 
-   fp = fopen("MASTER.TXT", "r");
-   if(fp == NULL) {
-      printf("missing MASTER.TXT\n");
-      return 1;
-      }
-
-   ii = 0;
-   while(fgets(line, 511, fp)) {
-      if(strstr(line, "Image pixel spacing")) {
-          strptr = strstr(line, ":");
-          strptr++;
-          sscanf(strptr, "%lf", &data->image_res);
-          if(options->debug >= 10)
-              printf("Image pixel spacing = %lf\n", data->image_res);
-          }
-      if(strstr(line, "Index tile pixel spacing")) {
-          strptr = strstr(line, ":");
-          strptr++;
-          sscanf(strptr, "%lf", &data->index_res);
-          if(options->debug >= 10)
-              printf("Index tile pixel spacing = %lf\n", data->index_res);
-          }
-      if(strstr(line, "Subtile size")) {
-          strptr = strstr(line, ":");
-          strptr++;
-          sscanf(strptr, "%lf", &data->tile_size);
-          if(options->debug >= 10)
-              printf("Subtile size = %lf\n", data->tile_size);
-          data->image_size = data->tile_size / data->image_res;
-          data->index_size = data->tile_size / data->index_res;
-
-          if(options->debug >= 10) {
-             printf("image size = %d\n", data->image_size);
-             printf("index size = %d\n", data->index_size);
-             }
-          }
-
-      if(strstr(line, "Number of sub-tiles")) {
-          strptr = strstr(line, ":");
-          strptr++;
-          sscanf(strptr, "%d", &data->n_subs);
-          if(data->n_subs == 0) {
-             printf("No subitles in MASTER.TXT\n");
-             return 1;
-             }
-          data->subs = (Subtile_t *)calloc(data->n_subs, sizeof(Subtile_t));
-          if(options->debug >= 10) 
-             printf("number of subs = %d\n", data->n_subs);
-          }
-
-      if(strstr(line, "Subtile") && data->subs) {
-           strptr = strstr(line, ":");
-           strptr++;
-           sub = &data->subs[ii];
-           sscanf(strptr, "%s %lf %lf %lf %lf", sub->name, &sub->min_x,
-                  &sub->min_y, &sub->max_x, &sub->max_y);
-           if(options->debug >= 15) {
-              printf("%d: %s %.0lf %.0lf %.0lf %.0lf\n", ii, sub->name, sub->min_x,
-                  sub->min_y, sub->max_x, sub->max_y);
-              }
-           ii++;
-           }
-       }
+   return *(const unsigned char *)&one == 0;
+}
 
-   fclose(fp);
+int order_swaps(int order)
+{
+   return order != ORDER_NATIVE && (order == ORDER_BIG) != host_big();
+}
 
-  /* Read Frames.key file */
+/*fs----------------------------------------------------------------------------
 
-   sprintf(path, "%s/FRAMES.KEY", INDEX_DIR);
-   fp = fopen(path, "r");
-   if(fp == NULL) {
-      printf("missing %s\n", path);
-      return 1;
-      }
+    Procedure:   stats_thread, write_stats
+
+    Purpose:   -stats file: wall time in each stage of the run and
+               counters of the work done, kept per thread and written
+               to file as JSON when the run ends.
+
+               Each thread that takes part calls stats_thread as it
+               starts, which gives it its own Stats_t, so nothing it
+               counts is shared or locked.  Without -stats no thread
+               gets one and every measuring point is a test of a null
+               pointer, made once per row, run, subtile or write, never
+               per pixel.
+
+               convert_row times its corrections, power, decibel and
+               quantize stages once a row.  An edge tie lookup is too
+               short to time each one, so with -stats the run kernels
+               leave a row's lookups for run_ties, which does them in
+               one batch that is timed as a whole.  edge_ties is those
+               batches; it is part of corrections, and what is left of
+               corrections is the polynomials, exp10 and the geometric
+               inversion.  Lookups made a pixel at a time, for -math
+               fast rechecks and frames with malformed equations, are
+               neither counted nor split out.
+
+    Returns:   write_stats returns 0 on success, 1 if the file can't
+               be written.
 
-   if(options->debug >= 5)
-       printf("reading %s\n", path);
+----------------------------------------------------------------------------fe*/
 
- /* count up the number of index frame references and allocate array of frames */
+static __thread Stats_t *thread_stats;     /* this thread's, NULL = off */
+static pthread_mutex_t   stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
-   ii = 0;
-   while(fgets(line, 511, fp)) {
-      if(strstr(line, "Frame Index")) ii++;
-      }
-   rewind(fp);
-   data->frames = (Frame_t *)calloc(ii, sizeof(Frame_t));
-   data->n_frames = ii;
-   ii = 0;
+static char *stage_name[N_STAGES] = {
+   "keys", "setup", "read", "wait", "convert", "corrections", "edge_ties",
+   "power", "log10", "quantize", "overviews", "pack", "write", "fill",
+   "close" };
 
-   if(options->debug >= 5)
-      printf("initializing %d index entries\n", data->n_frames);
-
-   while(fgets(line, 511, fp)) {
-
-      if(strstr(line, "Frame Index")) { // ready to go with new frame
-         frame = &data->frames[ii];
-         strptr = strstr(line, "Block");
-         frame->name = (char *)malloc(strlen(strptr));
-         strcpy(frame->name, strptr);
-         frame->name[strlen(strptr)-1] = '\0'; // get rid of newline
-         frame->index = ii;
-         sscanf(strptr + 6, "%d", &frame->block_id);
-         ii++;
-         do_ties = 0;
-         if(options->debug >= 15) 
-             printf("  %s \n", frame->name);
-         }
+static char *count_name[N_COUNTS] = {
+   "subtiles", "rows", "pixels", "no_data", "invalid", "rechecked",
+   "tie_lookups", "tie_candidates", "bytes_read", "bytes_written" };
 
-      if(strstr(line, "Conversion parameters")) {
-         strptr = strstr(line, ":");
-         strptr++;
-         sscanf(strptr, "%lf %lf", &frame->cnvt_scale, &frame->min_pwr);
-         }
+double wall_now(void)
+{
+   struct timespec ts;
 
-   /* Get radiometric balancing coefficients */
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-      if(strstr(line, "Radiometric balancing offset")) {
-           if(options->debug >= 20)
-              printf("reading frame radiometric offset coefficients\n");
-           frame->frm_offset = *get_coeffs(line, options);
-           }
+void stats_thread(Data_t *data, Options_t *options, char *name)
+{
+   Stats_t *st, **end;
+
+   if(options->stats == NULL || thread_stats)
+      return;
+   if((st = (Stats_t *)calloc(1, sizeof(Stats_t))) == NULL)
+      return;                       /* this thread just goes uncounted */
+   st->name = name;
+   st->born = wall_now();
+
+   pthread_mutex_lock(&stats_lock);
+   for(end = &data->stats; *end; end = &(*end)->next)
+      ;
+   *end = st;
+   pthread_mutex_unlock(&stats_lock);
+   thread_stats = st;
+}
 
-      if(strstr(line, "Radiometric balancing scale")) {
-           if(options->debug >= 20)
-              printf("reading frame radiometric scale coefficients\n");
-           frame->frm_scale = *get_coeffs(line, options);
-           }
+/* ---- the measuring points, all nothing without -stats ---- */
+static inline double stats_start(void)
+{
+   return thread_stats ? wall_now() : 0;
+}
 
-    /* edge tie grunt */
+static inline void stats_stop(int stage, double t0)
+{
+   if(thread_stats)
+      thread_stats->t[stage] += wall_now() - t0;
+}
 
-      if(strstr(line, "Edge tie number")) {
-         strptr = strstr(line, ":");
-         strptr++;
-         sscanf(strptr, "%d", &frame->frm_edgeties.n_ties);
-         if(options->debug >= 15) 
-            printf("number of frame ties %d\n", frame->frm_edgeties.n_ties);
-         }
+static inline void stats_count(int count, long nn)
+{
+   if(thread_stats)
+      thread_stats->n[count] += nn;
+}
 
-      if(strstr(line, "Edge tie spacing")) {
-         strptr = strstr(line, ":");
-         strptr++;
-         sscanf(strptr, "%lf", &frame->frm_edgeties.spacing);
-         if(options->debug >= 15) 
-            printf("frame edgeties spacing %lf\n", frame->frm_edgeties.spacing);
-         }
+/* ---- convert_row's: add the time since t0 to a stage, and now is t0 */
+static inline double stats_lap(Stats_t *st, int stage, double t0)
+{
+   double now = wall_now();
 
-      if(strstr(line, "Edge ties") && frame->frm_edgeties.n_ties > 0) {
-         frame->frm_edgeties.tie = (EdgeTie_t *) calloc(frame->frm_edgeties.n_ties, sizeof(EdgeTie_t));
-         jj = 0;
-         do_ties = 1;
-         continue;
-         }
+   st->t[stage] += now - t0;
+   return now;
+}
 
-      if(do_ties) {
-         if(strlen(line) < 3) continue;
-         tie = &frame->frm_edgeties.tie[jj];
-         sscanf(line, "%lf %lf %lf", &tie->map_xy.x, &tie->map_xy.y, &tie->target);
-         if(options->debug >= 20) 
-            printf("%lf %lf %lf\n", tie->map_xy.x, tie->map_xy.y, tie->target);
-         jj++;
-         }
-      }
+/* ---- and a row's pixels, given its bad and redone counts before it */
+static void count_row(const Row_t *row, int n_invalid, int n_recheck)
+{
+   Stats_t *st = row->stats;
+   long     n_null = 0;
+   int      jj;
+
+   for(jj = 0; jj < row->n; jj++)
+      n_null += row->dn[jj] == NO_DATA_VAL;
+   n_invalid = row->n_invalid - n_invalid;
+   st->n[COUNT_ROWS]++;
+   st->n[COUNT_PIXELS]  += row->n;
+   st->n[COUNT_NO_DATA] += n_null - n_invalid;
+   st->n[COUNT_INVALID] += n_invalid;
+   st->n[COUNT_RECHECK] += row->n_recheck - n_recheck;
+}
 
-   fclose(fp);
+/* ---- one Stats_t's stages and counters, with the derived ones ---- */
+static void put_stats(FILE *fp, const Stats_t *st, const char *indent)
+{
+   long nn;
+   int  ii;
+
+   fprintf(fp, "%s\"seconds\": {", indent);
+   for(ii = 0; ii < N_STAGES; ii++)
+      fprintf(fp, "%s\n%s  \"%s\": %.6f", ii ? "," : "", indent,
+              stage_name[ii], st->t[ii]);
+   fprintf(fp, ",\n%s  \"polynomials\": %.6f\n%s},\n", indent,
+           st->t[STAGE_CORRECT] > st->t[STAGE_TIES] ?
+              st->t[STAGE_CORRECT] - st->t[STAGE_TIES] : 0, indent);
+
+   fprintf(fp, "%s\"counts\": {", indent);
+   for(ii = 0; ii < N_COUNTS; ii++)
+      fprintf(fp, "%s\n%s  \"%s\": %ld", ii ? "," : "", indent,
+              count_name[ii], st->n[ii]);
+   nn = st->n[COUNT_PIXELS] - st->n[COUNT_NO_DATA] - st->n[COUNT_INVALID];
+   fprintf(fp, ",\n%s  \"converted\": %ld", indent, nn);
+   fprintf(fp, ",\n%s  \"candidates_per_lookup\": %.3f\n%s}", indent,
+           st->n[COUNT_LOOKUPS] ?
+              (double)st->n[COUNT_TIES] / st->n[COUNT_LOOKUPS] : 0, indent);
+}
 
-   /* Read Blocks.key file */
+int write_stats(Data_t *data, Options_t *options)
+{
+   Stats_t  total, *st;
+   FILE    *fp;
+   double   now = wall_now();
+   int      ii, n_threads = 0;
 
-   sprintf(path, "%s/BLOCKS.KEY", INDEX_DIR);
-   fp = fopen(path, "r");
-   if(fp == NULL) {
-      printf("missing %s\n", path);
+   if(options->stats == NULL || data->stats == NULL)
+      return 0;
+   if((fp = fopen(options->stats, "w")) == NULL) {
+      printf("write_stats: Unable to create %s\n", options->stats);
       return 1;
       }
 
- /* count up the number of index frame references and allocate array of frames */
+   memset(&total, 0, sizeof(total));
+   for(st = data->stats; st; st = st->next, n_threads++) {
+      for(ii = 0; ii < N_STAGES; ii++)
+         total.t[ii] += st->t[ii];
+      for(ii = 0; ii < N_COUNTS; ii++)
+         total.n[ii] += st->n[ii];
+      }
 
-   ii = 0;
-   while(fgets(line, 511, fp)) {
-      if(strstr(line, "Block Index")) ii++;
+   fprintf(fp, "{\n");
+   fprintf(fp, "  \"wall_seconds\": %.6f,\n", now - data->stats->born);
+   fprintf(fp, "  \"kernel\": \"%s\",\n",
+           data->kernel ? data->kernel->name : "none");
+   fprintf(fp, "  \"subtiles\": %d,\n", data->n_subs);
+   fprintf(fp, "  \"n_threads\": %d,\n", n_threads);
+   fprintf(fp, "  \"total\": {\n");
+   put_stats(fp, &total, "    ");
+   fprintf(fp, "\n  },\n  \"threads\": [");
+   for(st = data->stats; st; st = st->next) {
+      fprintf(fp, "%s\n    {\n      \"name\": \"%s\",\n", st == data->stats ?
+              "" : ",", st->name);
+      fprintf(fp, "      \"alive_seconds\": %.6f,\n", now - st->born);
+      put_stats(fp, st, "      ");
+      fprintf(fp, "\n    }");
       }
-   rewind(fp);
-   data->blocks = (Block_t *)calloc(ii, sizeof(Block_t ));
-   data->n_blocks = ii;
-   ii = 0;
+   fprintf(fp, "\n  ]\n}\n");
 
-   do_ties = 0;
-   while(fgets(line, 511, fp)) {
-      if(strstr(line, "Block Index")) {
-         block = &data->blocks[ii];
-         strptr = strstr(line, ":");
-         strptr = strstr(strptr, "Block");
-         sscanf(strptr, "%s", name);
-         block->name = (char *)malloc(strlen(name));
-         strcpy(block->name, name);
-         sscanf(strptr + 6, "%d", &block->id);
-         if(options->debug >= 15) 
-             printf("  %s\n", block->name);
-         ii++;
-         do_ties = 0;
-         }
+   if(fclose(fp)) {
+      printf("write_stats: Unable to write %s\n", options->stats);
+      return 1;
+      }
+   return 0;
+}
 
+/*fs----------------------------------------------------------------------------
 
-   /* Get coefficients */
+    Procedure:   int Depend(options, data)
 
-      if(strstr(line, "Radiometric balancing offset")) {
-           if(options->debug >= 20)
-              printf("reading block radiometric offset coefficients\n");
-           block->blk_offset = *get_coeffs(line, options);
-           }
+    Purpose:   To read program dependencies
 
-      if(strstr(line, "Radiometric balancing scale")) {
-           if(options->debug >= 20)
-              printf("reading block radiometric scale coefficients\n");
-           block->blk_scale = *get_coeffs(line, options);
-           }
+      A switch "-depend" could be used to check the dependencies
+      of the program and print the paths of key files known to
+      be missing.  Currently, any missing dependencies result in
+      an error.
 
-      if(strstr(line, "Geometric balancing parameters")) {
-           if(options->debug >= 20)
-              printf("reading block geometric coefficients\n");
-           block->blk_geom = *get_coeffs(line, options);
-           }
+      The tables are kept in a binary cache by save_cache, and
+      while the key files are as they were, load_cache maps that
+      instead of parsing them again.  With -tiles, load_tiles does
+      that for every tile and data becomes their mosaic.
 
-      /* ---- Read edge ties for block ---- */
+    Returns:   Returns 0 on success or 1 on failure.
 
-      if(strstr(line, "Edge tie number")) {
-         strptr = strstr(line, ":");
-         strptr++;
-         sscanf(strptr, "%d", &block->blk_edgeties.n_ties);
-         if(options->debug >= 15) 
-            printf("number of block ties %d\n", block->blk_edgeties.n_ties);
-         }
+----------------------------------------------------------------------------fe*/
+int Depend(Options_t *options, Data_t *data)
+{
+   double t0 = stats_start();
+   int    ii;
 
-      if(strstr(line, "Edge tie spacing")) {
-         strptr = strstr(line, ":");
-         strptr++;
-         sscanf(strptr, "%lf", &block->blk_edgeties.spacing);
-         if(options->debug >= 15) 
-            printf("block edgeties spacing %lf\n", block->blk_edgeties.spacing);
-         }
+   if(options->debug > 0)
+       printf("collecting dependencies\n");
 
-      if(strstr(line, "Edge ties") && block->blk_edgeties.n_ties > 0) {
-         block->blk_edgeties.tie = (EdgeTie_t *) calloc(block->blk_edgeties.n_ties, sizeof(EdgeTie_t));
-         jj = 0;
-         do_ties = 1;
-         continue;
-         }
+   if(options->tiles ? load_tiles(options, data) : load_tables(options, data))
+      return 1;
+   stats_stop(STAGE_KEYS, t0);
+   t0 = stats_start();
 
-      if(do_ties) {
-         if(strlen(line) < 3) continue;
-         tie = &block->blk_edgeties.tie[jj];
-         sscanf(line, "%lf %lf %lf", &tie->map_xy.x, &tie->map_xy.x, &tie->target);
-         if(options->debug >= 20) 
-            printf("%lf %lf %lf\n", tie->map_xy.x, tie->map_xy.x, tie->target);
-         jj++;
-         }
+   if((data->kernel = select_row_kernel(options->simd)) == NULL) {
+      printf("row kernel %s is not available on this cpu\n", options->simd);
+      return 1;
+      }
+   if(options->debug >= 5)
+      printf("using %s row kernel\n", data->kernel->name);
+   data->mission = options->mission;
+   for(ii = 0; ii < data->n_tiles; ii++) {
+      data->tiles[ii]->kernel  = data->kernel;
+      data->tiles[ii]->mission = data->mission;
       }
 
-   fclose(fp);
+   if(calculate_output_parameters(data, options))
+      return 1;
+   for(ii = 0; ii < data->n_tiles; ii++)
+      data->tiles[ii]->roi = data->roi;
 
-   calculate_output_parameters(data, options);
+   stats_stop(STAGE_SETUP, t0);
+   return 0;
+}
 
+/* ---- one tile's tables, from its cache or its key files ---- */
+int load_tables(Options_t *options, Data_t *data)
+{
+   KeyStamp_t stamp[N_KEY_FILES];
+   int        stamped;
+
+   stamped = stamp_keys(options, data, stamp) == 0;
+   if(!stamped || load_cache(options, data, stamp)) {
+      if(read_keys(options, data) || compile_tile(data, options))
+         return 1;
+      if(stamped)
+         save_cache(options, data, stamp);
+      }
    return 0;
 }
 
 /*fs----------------------------------------------------------------------------
 
-    Procedure:   get_coeffs
+    Procedure:   read_keys
 
-    Purpose:   extract a list of coefficients from a line
+    Purpose:   Parse MASTER.TXT, FRAMES.KEY and BLOCKS.KEY into the
+               subtile, frame and block tables and hook each frame up
+               to its block.
 
-    Exits:   coefficients upon success, else null
+               Each file is mapped and read once, a line at a time, and
+               each line handled by the keyword it starts with.  Lines
+               may be any length and end in LF or CR LF.  The frame and
+               block arrays, coefficient lists and edge ties grow as
+               they are read rather than being counted first, and a
+               missing or short field leaves its value as it was
+               instead of reading past it.  Numbers go through
+               scan_double, which rounds exactly as sscanf.
+
+    Returns:   Returns 0 on success or 1 on failure.
 
 ----------------------------------------------------------------------------fe*/
 
-coeffs_t *get_coeffs(char *line, Options_t *options)
+typedef struct {           /* a mapped key file, read a line at a time */
+   const char *pos;             /* start of the next line             */
+   const char *end;
+} Scan_t;
+
+static inline int is_blank(char cc)
+{
+   return cc == ' ' || cc == '\t' || cc == '\r' || cc == '\v' || cc == '\f';
+}
+
+static inline int is_digit(char cc)
 {
-   coeff_t *coeffptr = NULL;
-   coeffs_t *coeffs;
-   char *strptr = strstr(line, ":");
-   char temp_line[512], *next_word;
+   return cc >= '0' && cc <= '9';
+}
 
-   coeffs = (coeffs_t *)calloc(1, sizeof(coeffs_t));
+/* ---- the next line, trimmed of blanks and its CR LF, 0 at the end ---- */
+static int next_line(Scan_t *scan, const char **line, const char **eol)
+{
+   const char *nl;
 
-   strptr++;
-   strcpy(temp_line, strptr);
+   if(scan->pos >= scan->end)
+      return 0;
+   nl = (const char *)memchr(scan->pos, '\n', scan->end - scan->pos);
+   *line = scan->pos;
+   *eol  = nl ? nl : scan->end;
+   scan->pos = nl ? nl + 1 : scan->end;
+   while(*line < *eol && is_blank(**line))
+      (*line)++;
+   while(*eol > *line && is_blank((*eol)[-1]))
+      (*eol)--;
+   return 1;
+}
 
-   next_word = strtok(temp_line, " ");
+/* ---- whether the line starts with key, and its value after the colon ---- */
+static int keyword(const char *line, const char *eol, const char *key,
+                   const char **value)
+{
+   size_t      nn = strlen(key);
+   const char *colon;
 
-   while(next_word) {
-      if(coeffs->firstcoeff == NULL) {
-          coeffptr = coeffs->firstcoeff = (coeff_t *)calloc(1, sizeof(coeff_t));
-      } else  {
-          coeffptr->next = (coeff_t *)calloc(1, sizeof(coeff_t));
-          coeffptr = coeffptr->next;
-          }
-      sscanf(next_word, "%lf", &coeffptr->value);
-      if(options->debug >= 20)
-          printf("     %le\n", coeffptr->value);
-      coeffs->n_coeffs++;
-      next_word = strtok(NULL, " ");
-      if(next_word[0] =='\n') break;
-      }
-   return coeffs;
+   if((size_t)(eol - line) < nn || memcmp(line, key, nn))
+      return 0;
+   colon = (const char *)memchr(line + nn, ':', eol - line - nn);
+   *value = colon ? colon + 1 : eol;
+   return 1;
 }
 
-/*fs----------------------------------------------------------------------------
+/* ---- 10^n for the n a double holds exactly ---- */
+static const double exact_pow10[] = {
+   1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-    Procedure:   calculate_output_parameters
+/*
+ * A decimal number at *pp, advancing past it.  Those with at most 19
+ * significant digits, a mantissa below 2^53 and a power of ten the
+ * table holds are one exact conversion and one correctly rounded
+ * multiply or divide (Clinger's fast path), so they come out as strtod
+ * would give them.  Anything else, or anything not followed by a blank,
+ * is copied out and given to strtod, the way sscanf would see it.
+ */
+static int scan_double(const char **pp, const char *end, double *value)
+{
+   const char *ss = *pp, *start, *stop;
+   char        small[128], *copy, *tail;
+   uint64_t    mant = 0;
+   int         neg = 0, any = 0, n_dig = 0, exp10 = 0, ee, e_neg;
+   size_t      len;
+   double      vv;
+
+   while(ss < end && is_blank(*ss))
+      ss++;
+   start = ss;
+
+   if(ss < end && (*ss == '+' || *ss == '-'))
+      neg = *ss++ == '-';
+   for(; ss < end && is_digit(*ss); ss++) {
+      any = 1;
+      if(mant == 0 && *ss == '0')
+         continue;
+      if(n_dig++ < 19)
+         mant = mant * 10 + (*ss - '0');
+      else
+         exp10++;
+      }
+   if(ss < end && *ss == '.')
+      for(ss++; ss < end && is_digit(*ss); ss++) {
+         any = 1;
+         if(mant == 0 && *ss == '0') {
+            exp10--;
+            continue;
+            }
+         if(n_dig++ < 19) {
+            mant = mant * 10 + (*ss - '0');
+            exp10--;
+            }
+         }
+   if(any && ss + 1 < end && (*ss == 'e' || *ss == 'E')) {
+      stop = ss + 1;
+      e_neg = 0;
+      if(*stop == '+' || *stop == '-')
+         e_neg = *stop++ == '-';
+      if(stop < end && is_digit(*stop)) {
+         for(ee = 0; stop < end && is_digit(*stop); stop++)
+            if(ee < 100000)
+               ee = ee * 10 + (*stop - '0');
+         exp10 += e_neg ? -ee : ee;
+         ss = stop;
+         }
+      }
 
-    Purpose:   Calculate output file size and extents as well as
-               the subtile pixel coordinates for each subtile
+   if(any && n_dig <= 19 && (ss == end || is_blank(*ss)) &&
+      mant <= ((uint64_t)1 << 53) && exp10 >= -22 && exp10 <= 22) {
+      vv = (double)mant;
+      vv = exp10 < 0 ? vv / exact_pow10[-exp10] : vv * exact_pow10[exp10];
+      *value = neg ? -vv : vv;
+      *pp = ss;
+      return 1;
+      }
 
-    Exits:   Exit status is 0 on success, 1 on failure
+   /* ---- the slow way, strtod on a terminated copy of the word ---- */
+   for(stop = start; stop < end && !is_blank(*stop); stop++)
+      ;
+   if((len = stop - start) == 0)
+      return 0;
+   copy = len < sizeof(small) ? small : (char *)malloc(len + 1);
+   if(copy == NULL)
+      return 0;
+   memcpy(copy, start, len);
+   copy[len] = '\0';
+   vv = strtod(copy, &tail);
+   if(tail != copy) {
+      *value = vv;
+      *pp = start + (tail - copy);
+      }
+   if(copy != small)
+      free(copy);
+   return tail != copy;
+}
 
-----------------------------------------------------------------------------fe*/
+static int scan_int(const char **pp, const char *end, int *value)
+{
+   const char *ss = *pp;
+   long long   nn = 0;
+   int         neg = 0;
+
+   while(ss < end && is_blank(*ss))
+      ss++;
+   if(ss < end && (*ss == '+' || *ss == '-'))
+      neg = *ss++ == '-';
+   if(ss == end || !is_digit(*ss))
+      return 0;
+   for(; ss < end && is_digit(*ss); ss++)
+      if(nn <= INT_MAX)
+         nn = nn * 10 + (*ss - '0');
+   if(nn > INT_MAX)
+      nn = INT_MAX;
+   *value = neg ? -(int)nn : (int)nn;
+   *pp = ss;
+   return 1;
+}
 
-int calculate_output_parameters(Data_t *data, Options_t *options)
+/* ---- the next blank delimited word, NULL if there is none ---- */
+static const char *scan_word(const char **pp, const char *end, size_t *len)
 {
-   Subtile_t *sub;
-   Image_t *out, *index = NULL;
-   int    ii, jj;
-   double min_x, min_y, max_x, max_y;
-
-   min_x = data->subs[0].min_x;
-   min_y = data->subs[0].min_y;
-   max_x = data->subs[0].max_x;
-   max_y = data->subs[0].max_y;
+   const char *ss = *pp, *word;
+
+   while(ss < end && is_blank(*ss))
+      ss++;
+   for(word = ss; ss < end && !is_blank(*ss); ss++)
+      ;
+   *pp = ss;
+   *len = ss - word;
+   return *len ? word : NULL;
+}
 
- /* get overall extent */
+static char *copy_text(const char *text, size_t len)
+{
+   char *copy = (char *)malloc(len + 1);
 
-   for(ii = 0; ii < data->n_subs; ii++) {
-      sub = &data->subs[ii];
-      if(min_x > sub->min_x) min_x = sub->min_x;
-      if(min_y > sub->min_y) min_y = sub->min_y;
-      if(max_x < sub->max_x) max_x = sub->max_x;
-      if(max_y < sub->max_y) max_y = sub->max_y;
+   if(copy) {
+      memcpy(copy, text, len);
+      copy[len] = '\0';
       }
+   return copy;
+}
 
-   out = (Image_t *)calloc(1, sizeof(Image_t));
+/* ---- a whole key file in memory, or nothing for an empty one ---- */
+static int map_key(const char *path, Input_t *input, Scan_t *scan)
+{
+   struct stat st;
 
-   if(options->index_file)
-      index = (Image_t *)calloc(1, sizeof(Image_t));
+   memset(input, 0, sizeof(*input));
+   if(stat(path, &st)) {
+      printf("missing %s\n", path);
+      return 1;
+      }
+   if(st.st_size > 0 && open_input(path, st.st_size, 0, input))
+      return 1;
+   scan->pos = (const char *)input->addr;
+   scan->end = scan->pos + input->size;
+   return 0;
+}
 
-   out->min_x = min_x;
-   out->min_y = min_y;
-   out->max_x = max_x;
-   out->max_y = max_y;
+static int read_master(Options_t *options, Data_t *data, Scan_t *scan)
+{
+   const char *line, *eol, *pp, *word;
+   Subtile_t  *sub;
+   size_t      len;
+   int         ii = 0;
+
+   while(next_line(scan, &line, &eol)) {
+      if(keyword(line, eol, "Image pixel spacing", &pp)) {
+         scan_double(&pp, eol, &data->image_res);
+         if(options->debug >= 10)
+            printf("Image pixel spacing = %lf\n", data->image_res);
+         }
+      else if(keyword(line, eol, "Index tile pixel spacing", &pp)) {
+         scan_double(&pp, eol, &data->index_res);
+         if(options->debug >= 10)
+            printf("Index tile pixel spacing = %lf\n", data->index_res);
+         }
+      else if(keyword(line, eol, "Subtile size", &pp)) {
+         scan_double(&pp, eol, &data->tile_size);
+         data->image_size = data->tile_size / data->image_res;
+         data->index_size = data->tile_size / data->index_res;
+         if(options->debug >= 10) {
+            printf("Subtile size = %lf\n", data->tile_size);
+            printf("image size = %d\n", data->image_size);
+            printf("index size = %d\n", data->index_size);
+            }
+         }
+      else if(keyword(line, eol, "Number of sub-tiles", &pp)) {
+         data->n_subs = 0;
+         scan_int(&pp, eol, &data->n_subs);
+         if(data->n_subs <= 0) {
+            printf("No subitles in MASTER.TXT\n");
+            return 1;
+            }
+         free(data->subs);
+         data->subs = (Subtile_t *)calloc(data->n_subs, sizeof(Subtile_t));
+         if(data->subs == NULL) {
+            printf("no memory for %d subtiles\n", data->n_subs);
+            return 1;
+            }
+         ii = 0;
+         if(options->debug >= 10)
+            printf("number of subs = %d\n", data->n_subs);
+         }
+      else if(keyword(line, eol, "Subtile", &pp) && data->subs &&
+              ii < data->n_subs) {
+         sub = &data->subs[ii];
+         if((word = scan_word(&pp, eol, &len)) != NULL) {
+            if(len > sizeof(sub->name) - 1)
+               len = sizeof(sub->name) - 1;
+            memcpy(sub->name, word, len);
+            }
+         scan_double(&pp, eol, &sub->min_x);
+         scan_double(&pp, eol, &sub->min_y);
+         scan_double(&pp, eol, &sub->max_x);
+         scan_double(&pp, eol, &sub->max_y);
+         if(options->debug >= 15)
+            printf("%d: %s %.0lf %.0lf %.0lf %.0lf\n", ii, sub->name, sub->min_x,
+                   sub->min_y, sub->max_x, sub->max_y);
+         ii++;
+         }
+      }
+   return 0;
+}
 
-   out->size_x = (max_x - min_x) / data->image_res;
-   out->size_y = (max_y - min_y) / data->image_res;
+/* ---- coefficients from pp to the end of the line ---- */
+static int scan_coeffs(const char *pp, const char *eol, coeffs_t *coeffs,
+                       Options_t *options)
+{
+   double *grown, vv;
+   int     size = 0;
+
+   free(coeffs->value);
+   free(coeffs->horner);
+   coeffs->value = NULL;
+   coeffs->horner = NULL;
+   coeffs->n_coeffs = 0;
+   coeffs->order = -1;
+
+   while(scan_double(&pp, eol, &vv)) {
+      if(coeffs->n_coeffs == size) {
+         size = size ? 2 * size : 16;
+         grown = (double *)realloc(coeffs->value, size * sizeof(double));
+         if(grown == NULL)
+            return 1;
+         coeffs->value = grown;
+         }
+      coeffs->value[coeffs->n_coeffs++] = vv;
+      if(options->debug >= 20)
+         printf("     %le\n", vv);
+      }
+   return 0;
+}
 
-   if(index) {
-      index->size_x = (max_x - min_x) / data->index_res;
-      index->size_y = (max_y - min_y) / data->index_res;
+/* ---- a tie line, the array doubling as it fills ---- */
+static int add_tie(EdgeTies_t *ties, int *size, const double *xyt)
+{
+   EdgeTie_t *grown, *tie;
+
+   if(ties->n_ties == *size) {
+      *size = *size ? 2 * *size : 64;
+      grown = (EdgeTie_t *)realloc(ties->tie, *size * sizeof(EdgeTie_t));
+      if(grown == NULL)
+         return 1;
+      ties->tie = grown;
       }
+   tie = &ties->tie[ties->n_ties++];
+   memset(tie, 0, sizeof(EdgeTie_t));
+   tie->map_xy.x = xyt[0];
+   tie->map_xy.y = xyt[1];
+   tie->target   = xyt[2];
+   return 0;
+}
 
-   if(options->debug >= 5) {
-        printf("output extent %.0lf to %.0lf Easting,  %.0lf to %.0lf Northing\n",
-                min_x, max_x, min_y, max_y);
-        printf("image size will be %d  %d\n", out->size_x, out->size_y);
-        }
+/* ---- the ties read stand, whatever "Edge tie number" said ---- */
+static void end_ties(Options_t *options, EdgeTies_t *ties, int n_said)
+{
+   if(ties == NULL)
+      return;
+   if(ties->tie == NULL)
+      ties->n_ties = 0;
+   else if(ties->n_ties != n_said && options->debug >= 5)
+      printf("  read %d edge ties, Edge tie number said %d\n", ties->n_ties,
+             n_said);
+}
 
-   for(ii = 0; ii < data->n_subs; ii++) {
-      sub = &data->subs[ii];
-      sub->img_ul_x = (sub->min_x - out->min_x) / data->image_res;
-      sub->img_lr_x = (sub->max_x - out->min_x) / data->image_res;
-      sub->img_ul_y = (out->max_y - sub->max_y) / data->image_res;
-      sub->img_lr_y = (out->max_y - sub->min_y) / data->image_res;
-      sub->index_ul_x = (sub->min_x - out->min_x) / data->index_res;
-      sub->index_ul_y = (out->max_y - sub->max_y) / data->index_res;
-      if(options->debug >= 20) 
-          printf("%s:  %d  %d  %d  %d\n", sub->name, sub->img_ul_x, 
-                  sub->img_lr_x, sub->img_ul_y, sub->img_lr_y);
+/*
+ * FRAMES.KEY, or BLOCKS.KEY if blocks is set.  The two share their
+ * radiometric and edge tie lines; frames add conversion parameters and
+ * blocks their geometric balancing.
+ */
+static int read_index(Options_t *options, Data_t *data, Scan_t *scan,
+                      int blocks)
+{
+   const char *line, *eol, *pp, *word;
+   Frame_t    *frame = NULL;
+   Block_t    *block = NULL;
+   coeffs_t   *offset = NULL, *scale = NULL;
+   EdgeTies_t *ties = NULL;
+   void       *grown;
+   double      xyt[3];
+   size_t      len, each = blocks ? sizeof(Block_t) : sizeof(Frame_t);
+   int         nn = 0, size = 0, n_tie = 0, n_said = 0, in_ties = 0;
+
+   while(next_line(scan, &line, &eol)) {
+      if(line == eol)
+         continue;
+
+      /* ---- most of a key file is tie lines, try them first ---- */
+      if(in_ties && (is_digit(*line) || *line == '-' || *line == '+' ||
+                     *line == '.')) {
+         pp = line;
+         if(scan_double(&pp, eol, &xyt[0]) && scan_double(&pp, eol, &xyt[1]) &&
+            scan_double(&pp, eol, &xyt[2])) {
+            /* BLOCKS.KEY ties have always been taken as x = the second
+               column and y = 0; the sscanf was handed map_xy.x twice.
+               Kept so block edge offsets match earlier runs. */
+            if(blocks) {
+               xyt[0] = xyt[1];
+               xyt[1] = 0;
+               }
+            if(add_tie(ties, &n_tie, xyt)) {
+               printf("no memory for edge ties\n");
+               return 1;
+               }
+            if(options->debug >= 20)
+               printf("%lf %lf %lf\n", xyt[0], xyt[1], xyt[2]);
+            continue;
+            }
+         }
+
+      if(keyword(line, eol, blocks ? "Block Index" : "Frame Index", &pp)) {
+         end_ties(options, ties, n_said);
+         in_ties = 0;
+         if(nn == size) {
+            size = size ? 2 * size : 64;
+            grown = realloc(blocks ? (void *)data->blocks : (void *)data->frames,
+                            size * each);
+            if(grown == NULL) {
+               printf("no memory for %d %s\n", size, blocks ? "blocks" : "frames");
+               return 1;
+               }
+            memset((char *)grown + nn * each, 0, (size - nn) * each);
+            if(blocks)
+               data->blocks = (Block_t *)grown;
+            else
+               data->frames = (Frame_t *)grown;
+            }
+
+         word = eol - pp >= 5 ? (const char *)memmem(pp, eol - pp, "Block", 5)
+                              : NULL;
+         if(blocks) {
+            block = &data->blocks[nn];
+            pp = word ? word : pp;
+            word = scan_word(&pp, eol, &len);
+            block->name = copy_text(word ? word : "", len);
+            if(word && len > 6) {
+               pp = word + 6;
+               scan_int(&pp, eol, &block->id);
+               }
+            offset = &block->blk_offset;
+            scale  = &block->blk_scale;
+            ties   = &block->blk_edgeties;
+            if(options->debug >= 15)
+               printf("  %s\n", block->name);
+            }
+         else {
+            frame = &data->frames[nn];
+            while(word == NULL && pp < eol && is_blank(*pp))
+               pp++;
+            frame->name = copy_text(word ? word : pp, eol - (word ? word : pp));
+            frame->index = nn;
+            if(word == NULL)
+               frame->block_id = -1;
+            else if(eol - word > 6) {
+               pp = word + 6;
+               scan_int(&pp, eol, &frame->block_id);
+               }
+            offset = &frame->frm_offset;
+            scale  = &frame->frm_scale;
+            ties   = &frame->frm_edgeties;
+            if(options->debug >= 15)
+               printf("  %s \n", frame->name);
+            }
+         nn++;
+         if(blocks)
+            data->n_blocks = nn;
+         else
+            data->n_frames = nn;
+         if((blocks ? block->name : frame->name) == NULL) {
+            printf("no memory for names\n");
+            return 1;
+            }
+         continue;
+         }
+
+      if(ties == NULL)                  /* nothing before the first index */
+         continue;
+
+      if(!blocks && keyword(line, eol, "Conversion parameters", &pp)) {
+         scan_double(&pp, eol, &frame->cnvt_scale);
+         scan_double(&pp, eol, &frame->min_pwr);
+         }
+      else if(keyword(line, eol, "Radiometric balancing offset", &pp)) {
+         if(options->debug >= 20)
+            printf("reading radiometric offset coefficients\n");
+         if(scan_coeffs(pp, eol, offset, options))
+            return 1;
+         }
+      else if(keyword(line, eol, "Radiometric balancing scale", &pp)) {
+         if(options->debug >= 20)
+            printf("reading radiometric scale coefficients\n");
+         if(scan_coeffs(pp, eol, scale, options))
+            return 1;
+         }
+      else if(blocks && keyword(line, eol, "Geometric balancing parameters", &pp)) {
+         if(options->debug >= 20)
+            printf("reading block geometric coefficients\n");
+         if(scan_coeffs(pp, eol, &block->blk_geom, options))
+            return 1;
+         }
+      else if(keyword(line, eol, "Edge tie number", &pp)) {
+         scan_int(&pp, eol, &ties->n_ties);
+         if(options->debug >= 15)
+            printf("number of ties %d\n", ties->n_ties);
+         }
+      else if(keyword(line, eol, "Edge tie spacing", &pp)) {
+         scan_double(&pp, eol, &ties->spacing);
+         if(options->debug >= 15)
+            printf("edgeties spacing %lf\n", ties->spacing);
+         }
+      else if(keyword(line, eol, "Edge ties", &pp) && ties->n_ties > 0) {
+         n_said = ties->n_ties;
+         free(ties->tie);
+         ties->tie = NULL;
+         ties->n_ties = 0;
+         n_tie = 0;
+         in_ties = 1;
+         }
+      }
+   end_ties(options, ties, n_said);
+   return 0;
+}
+
+int read_keys(Options_t *options, Data_t *data)
+{
+   static const char *what[3] = { "MASTER.TXT", INDEX_DIR "/FRAMES.KEY",
+                                  INDEX_DIR "/BLOCKS.KEY" };
+   char     path[1024];
+   Input_t  input;
+   Scan_t   scan;
+   int      ii, jj, status;
+
+   for(ii = 0; ii < 3; ii++) {
+      snprintf(path, sizeof(path), "%s/%s", data->tile_dir, what[ii]);
+      if(options->debug >= 5)
+         printf("reading %s\n", path);
+      if(map_key(path, &input, &scan))
+         return 1;
+      status = ii == 0 ? read_master(options, data, &scan)
+                       : read_index(options, data, &scan, ii == 2);
+      close_input(&input);
+      if(status)
+         return 1;
       }
+   if(options->debug >= 5)
+      printf("%d subtiles, %d frames, %d blocks\n", data->n_subs,
+             data->n_frames, data->n_blocks);
+
+   /* ---- Hook each frame up to its block ---- */
 
    for(ii = 0; ii < data->n_frames; ii++) {
       for(jj = 0; jj < data->n_blocks; jj++) {
          if(data->frames[ii].block_id == data->blocks[jj].id)
             break;
          }
+      if(jj == data->n_blocks) {
+         printf("frame %s has no block %d in BLOCKS.KEY\n",
+                data->frames[ii].name, data->frames[ii].block_id);
+         return 1;
+         }
       data->frames[ii].block = &data->blocks[jj];
       if(options->debug >= 25)
           printf("assigning block %d to frame %s\n", data->blocks[jj].id, data->frames[ii].name);
       }
 
-   data->output_image = out;
-   data->index_image =  index;
-
    return 0;
 }
 
 /*fs----------------------------------------------------------------------------
 
-    Procedure:   calculate_sub
+    Procedure:   load_tiles
 
-    Purpose:   Get sigma nought value for a subtile and write it to output
+    Purpose:   -tiles: set data up as a mosaic of the RAMS tiles listed
+               in a file, one directory per line with blank lines and
+               # comments skipped, or of the one directory given.
 
-    Exits:   Exit status is 0 on success, 1 on failure
+               Every tile is loaded into a Data_t of its own by
+               load_tables, -threads at a time, so its frame and block
+               tables and its TILESIG.CACHE stay its own.  data->subs
+               is all their subtiles, each pointing back at its tile
+               with sub->tile, sorted top to bottom and left to right
+               so the writer's bands fill in across tiles together.
+               A subtile with the same extent as one from a tile listed
+               before it is dropped.  From there on the mosaic is one
+               tile to the output layer, and the read and convert
+               stages use tile_of to find a subtile's tables.
 
-----------------------------------------------------------------------------fe*/
+               The tiles must have the same pixel spacings and subtile
+               size.  They each use their own cache, so -cache can only
+               be off.
 
-int calculate_sub(Subtile_t *sub, Options_t *options, Data_t *data)
-{
-   char *name = sub->name;
-   FILE *fp;
-   char path[256];
-   static char fn[] = "calculate_sub";
-   int   n_pixels = data->image_size;
-   int buf_size = n_pixels * n_pixels;
-   int scale = data->index_res / data->image_res;
-   int i_size = data->index_size * data->index_size;
+    Exits:   Exit status is 0 on success, 1 if a tile won't load or
+             doesn't match the first
 
-   int ii, jj, offset, i_offset;
-   short *buf = NULL;
-   unsigned char *i_buf = NULL; 
+----------------------------------------------------------------------------fe*/
 
-   float min_x, max_y;
-   short *out_buf     = NULL;
-   short no_data_val  = NO_DATA_VAL;
-   short out_null     = OUT_NULL;
-   float data_scale   = DATA_SCALE;
-   short out_val, off = OFFSET;
+static inline Data_t *tile_of(Data_t *data, const Subtile_t *sub)
+{
+   return sub->tile ? sub->tile : data;
+}
 
-   if(options->do_point) {
-       if((options->map_x < sub->min_x) ||
-         (options->map_x > sub->max_x) ||
-         (options->map_y < sub->min_y) ||
-         (options->map_y > sub->max_y)) return 0;
+typedef struct {           /* shared by the -tiles loaders */
+   Options_t       *options;
+   Data_t          *data;           /* the mosaic                    */
+   Data_t         **tiles;
+   int              n_tiles;
+   int              next;           /* next tile to load              */
+   int              n_failed;
+   pthread_mutex_t  lock;
+} Loader_t;
+
+static void *load_stage(void *arg)
+{
+   Loader_t *ld = (Loader_t *)arg;
+   int       ii;
+
+   stats_thread(ld->data, ld->options, "load");
+   for(;;) {
+      pthread_mutex_lock(&ld->lock);
+      ii = ld->next++;
+      pthread_mutex_unlock(&ld->lock);
+      if(ii >= ld->n_tiles)
+         return NULL;
+      if(load_tables(ld->options, ld->tiles[ii])) {
+         printf("load_tiles: can't load tile %s\n", ld->tiles[ii]->tile_dir);
+         pthread_mutex_lock(&ld->lock);
+         ld->n_failed++;
+         pthread_mutex_unlock(&ld->lock);
+         }
       }
- 
-   buf = (short *)calloc(buf_size, sizeof(short));
-   out_buf = (short *)calloc(buf_size, sizeof(short));
-   i_buf = (unsigned char *)calloc(i_size, 1);
+}
 
-   if(options->debug >= 1)
-       printf("processing %s\n", sub->name);
+/* ---- the directories in the list, or the list if it is one ---- */
+static int list_tiles(Data_t *data, const char *list)
+{
+   struct stat st;
+   Input_t     input;
+   Scan_t      scan;
+   Data_t    **grown;
+   const char *line, *eol;
+   int         cap = 0;
+
+   if(stat(list, &st) == 0 && S_ISDIR(st.st_mode)) {
+      if((data->tiles = (Data_t **)calloc(1, sizeof(Data_t *))) == NULL ||
+         (data->tiles[0] = (Data_t *)calloc(1, sizeof(Data_t))) == NULL)
+         return 1;
+      data->tiles[0]->tile_dir = strdup(list);
+      data->n_tiles = 1;
+      return 0;
+      }
 
-   /* ---- Open <tile name>.IMG file ---- */
-   sprintf(path,"IMAGES.DIR/%s.IMG", name);
-   if ((fp = fopen(path, "rb")) == NULL) {
-      printf("%s: Unable to open %s\n", fn, path);
+   if(map_key(list, &input, &scan))
       return 1;
+   while(next_line(&scan, &line, &eol)) {
+      if(line == eol || *line == '#')
+         continue;
+      if(data->n_tiles == cap) {
+         cap = cap ? 2 * cap : 64;
+         grown = (Data_t **)realloc(data->tiles, cap * sizeof(Data_t *));
+         if(grown == NULL) {
+            close_input(&input);
+            return 1;
+            }
+         data->tiles = grown;
+         }
+      if((data->tiles[data->n_tiles] = (Data_t *)calloc(1, sizeof(Data_t))) == NULL) {
+         close_input(&input);
+         return 1;
+         }
+      data->tiles[data->n_tiles++]->tile_dir = copy_text(line, eol - line);
       }
-
-   fread(buf, sizeof(short), buf_size, fp);
-   fclose(fp);
-
-   /* ---- Open <tile name>.IDX file ---- */
-   sprintf(path,"INDICES.DIR/%s.IDX", name);
-   if ((fp = fopen(path, "rb")) == NULL) {
-      printf("%s: Unable to open %s\n", fn, path);
+   close_input(&input);
+   if(data->n_tiles == 0) {
+      printf("load_tiles: no tile directories in %s\n", list);
       return 1;
-     }
+      }
+   return 0;
+}
 
-   fread(i_buf, 1, i_size, fp);
+/* ---- mosaic order: top row first, then left column, then tile ---- */
+typedef struct {           /* a subtile's corner, for sorting */
+   double max_y, min_x;
+   int    index;
+   } MosaicKey_t;
 
-   /* ---- Close up ---- */
-   fclose(fp);
-   fp = NULL;
+static int cmp_mosaic(const void *aa, const void *bb)
+{
+   const MosaicKey_t *k1 = (const MosaicKey_t *)aa;
+   const MosaicKey_t *k2 = (const MosaicKey_t *)bb;
+
+   if(k1->max_y != k2->max_y)
+      return k1->max_y > k2->max_y ? -1 : 1;
+   if(k1->min_x != k2->min_x)
+      return k1->min_x < k2->min_x ? -1 : 1;
+   return k1->index - k2->index;
+}
 
-   min_x = sub->min_x;
-   max_y = sub->max_y;
+int load_tiles(Options_t *options, Data_t *data)
+{
+   static char  fn[] = "load_tiles";
+   Loader_t     ld;
+   Data_t      *tile;
+   Subtile_t   *all, *sub, *last;
+   pthread_t   *workers;
+   MosaicKey_t *order;
+   int          ii, jj, nn, n_threads = options->n_threads, started;
+
+   if(options->cache && strcmp(options->cache, "off")) {
+      printf("%s: each tile keeps its own cache, -cache can only be off\n", fn);
+      return 1;
+      }
+   if(list_tiles(data, options->tiles)) {
+      printf("%s: can't list the tiles in %s\n", fn, options->tiles);
+      return 1;
+      }
 
-  /* do the point thing */
-   if(options->do_point) {
-      if(options->debug > 0) options->debug += 30; // crank up the debug
-      ii = (sub->max_y - options->map_y) / data->image_res;
-      jj = (options->map_x - sub->min_x) / data->image_res;
-      offset = ii * n_pixels + jj;
-      i_offset = ii/scale * n_pixels/scale+ jj/scale;
-      data->value = (double)buf[offset];
-      if (data->value == no_data_val) {
-         printf("%lf %lf: %lf\n", options->map_x, options->map_y, (double)no_data_val);
-         return 0;
+   /* ---- load them, the calling thread one of the loaders ---- */
+   memset(&ld, 0, sizeof(ld));
+   ld.options = options;
+   ld.data    = data;
+   ld.tiles   = data->tiles;
+   ld.n_tiles = data->n_tiles;
+   pthread_mutex_init(&ld.lock, NULL);
+   if(n_threads > data->n_tiles)
+      n_threads = data->n_tiles;
+   workers = n_threads > 1 ? (pthread_t *)calloc(n_threads, sizeof(pthread_t))
+                           : NULL;
+   for(started = 1; workers && started < n_threads; started++)
+      if(pthread_create(&workers[started], NULL, load_stage, &ld))
+         break;
+   load_stage(&ld);
+   while(workers && --started >= 1)
+      pthread_join(workers[started], NULL);
+   free(workers);
+   pthread_mutex_destroy(&ld.lock);
+   if(ld.n_failed)
+      return 1;
+
+   /* ---- they must share a pixel grid ---- */
+   tile = data->tiles[0];
+   for(ii = nn = 0; ii < data->n_tiles; ii++) {
+      if(data->tiles[ii]->image_res != tile->image_res ||
+         data->tiles[ii]->index_res != tile->index_res ||
+         data->tiles[ii]->tile_size != tile->tile_size) {
+         printf("%s: %s has %g, %g and %g spacings and size, %s has "
+                "%g, %g and %g\n", fn, data->tiles[ii]->tile_dir,
+                data->tiles[ii]->image_res, data->tiles[ii]->index_res,
+                data->tiles[ii]->tile_size, tile->tile_dir, tile->image_res,
+                tile->index_res, tile->tile_size);
+         return 1;
          }
-      data->index_value = (int)i_buf[i_offset];
-      data->x = options->map_x;
-      data->y = options->map_y;
-      GetSigma0(options, data);
-      out_val = (short)((data->s0 + off) * data_scale) - OUT_OFFSET;
-      printf("%lf %lf: %lf\n", options->map_x, options->map_y, data->s0);
-      if(options->debug > 40) // print this if the user specified a debug level >= 10
-         printf("16bit encoded value = %d\n", out_val);
-      return 0;
+      nn += data->tiles[ii]->n_subs;
       }
+   data->image_res  = tile->image_res;
+   data->index_res  = tile->index_res;
+   data->tile_size  = tile->tile_size;
+   data->image_size = tile->image_size;
+   data->index_size = tile->index_size;
+
+   /* ---- all the subtiles, in mosaic order, less repeats ---- */
+   all   = (Subtile_t *)malloc((nn + 1) * sizeof(Subtile_t));
+   order = (MosaicKey_t *)malloc((nn + 1) * sizeof(MosaicKey_t));
+   data->subs = (Subtile_t *)malloc((nn + 1) * sizeof(Subtile_t));
+   if(all == NULL || order == NULL || data->subs == NULL) {
+      printf("%s: no memory for %d subtiles\n", fn, nn);
+      free(all);
+      free(order);
+      return 1;
+      }
+   for(ii = nn = 0; ii < data->n_tiles; ii++)
+      for(jj = 0; jj < data->tiles[ii]->n_subs; jj++) {
+         all[nn] = data->tiles[ii]->subs[jj];
+         all[nn].tile = data->tiles[ii];
+         order[nn].max_y = all[nn].max_y;
+         order[nn].min_x = all[nn].min_x;
+         order[nn].index = nn;
+         nn++;
+         }
+   qsort(order, nn, sizeof(MosaicKey_t), cmp_mosaic);
+
+   data->n_subs = 0;
+   for(ii = 0; ii < nn; ii++) {
+      sub  = &all[order[ii].index];
+      last = data->n_subs ? &data->subs[data->n_subs - 1] : NULL;
+      if(last && last->min_x == sub->min_x && last->max_x == sub->max_x &&
+         last->min_y == sub->min_y && last->max_y == sub->max_y) {
+         if(options->debug >= 1)
+            printf("%s: %s/%s repeats %s/%s, dropped\n", fn,
+                   sub->tile->tile_dir, sub->name, last->tile->tile_dir,
+                   last->name);
+         continue;
+         }
+      data->subs[data->n_subs++] = *sub;
+      }
+   free(all);
+   free(order);
+   if(options->debug >= 1)
+      printf("%s: %d subtiles from %d tiles\n", fn, data->n_subs,
+             data->n_tiles);
+   return 0;
+}
 
-   for(ii = 0; ii < n_pixels; ii++) {
-      for(jj = 0; jj < n_pixels ; jj++) {
-         offset = ii * n_pixels + jj;
-         i_offset = ii/scale * n_pixels/scale+ jj/scale;
-         data->value = (double)buf[offset];
+/*fs----------------------------------------------------------------------------
 
-      /* ---- Skip reading index image if no data value ---- */
-         if (data->value == no_data_val) {
-             out_buf[offset] = out_null;
-             continue;
-             }
+    Procedure:   get_coeffs
 
-       /* ---- Get value of pixel ---- */
-       data->index_value = (int)i_buf[i_offset];
-       if(data->index_value >= data->n_frames) {
-           printf("%s: %d at %d %d exceeds index range %d\n", name, 
-                 data->index_value, jj/scale, ii/scale, data->n_frames);
-           exit(1);
-           }
+    Purpose:   extract a list of coefficients from a line
 
-        data->x = min_x + jj * data->image_res;
-        data->y = max_y - ii * data->image_res;
+    Exits:   coefficients are returned in coeffs, exit status is 0,
+             1 if out of memory
 
-   /* ---- Convert value ---- */
+----------------------------------------------------------------------------fe*/
 
-        GetSigma0(options, data);
-        if(data->s0 == no_data_val) {
-            out_buf[offset] = out_null;
-            continue;
-            }
-        if(data->s0 < -30) data->s0 = -30;
-        if(data->s0 > 10) data->s0 = 10;
-        out_buf[offset] = (short)((data->s0 + off) * data_scale) - OUT_OFFSET;
-        }
-   }
+int get_coeffs(char *line, coeffs_t *coeffs, Options_t *options)
+{
+   char *strptr = strchr(line, ':');
+   char *eol = line + strlen(line);
 
-  sub->buf = out_buf; 
-  sub->i_buf = i_buf; 
-  if(write_sub(sub, data, options)) {
-     printf("error writing subtile\n");
-     return 1;
-     }
-  free(out_buf);
-  free(i_buf);
-  return 0;
+   return scan_coeffs(strptr ? strptr + 1 : eol, eol, coeffs, options);
 }
 
-
-
 /*fs----------------------------------------------------------------------------
 
-    Procedure:   int GetSigma0 (options, data)
+    Procedure:   compile_coeffs
 
-    Purpose:   To get value from line & sample that a selected x,y map to.
+    Purpose:   Rearrange the coefficients of a polynomial for evaluation
+               in Horner form by ApplyPlanAtPt.
 
-    Arguments:   Options_t *options - Pointer to command line options.
-      Data_t   *data      - Pointer to program data structure.
+               The key files list the terms of an order n polynomial
+               highest order first, x^n, x^(n-1)y, ... y^n, then order
+               n-1 and so on down to the constant.  For
+               p = A0(x) + y*(A1(x) + y*(A2(x) + ... y*An(x))),
+               coeffs->horner holds An(x) down to A0(x), each as its
+               x coefficients from the highest power down.  The array is
+               aligned to a cache line so one load brings in a whole
+               order 2 equation.
 
-  Other than getting the transformation parameters from the data structures,
-  this was taken directly from Pete's code.
- 
-    Returns:   Returns 0 on success. Otherwise, returns 1 on failure.
+    Exits:   0 on success, 1 if n_coeffs is not (n+1)(n+2)/2
 
 ----------------------------------------------------------------------------fe*/
-int GetSigma0 (
-          Options_t *options,
-          Data_t *data)
+
+int compile_coeffs(coeffs_t *coeffs)
 {
-  static char fn[] = "GetSigma0";
-  double scale, offset, min, max;
-  double x1, y1, aa, bb, cc, dd, diff;
-  coeff_t *coeffptr;
-  Frame_t *frame;
-  Block_t *block;
+   int   order, ii, jj, kk, oo, term;
+   size_t size;
+   void *ptr;
 
-  frame = &data->frames[data->index_value];
-  block = frame->block;
-  /* ---- Set the min max values alowed for the data type ---- */
-  min = 0;
-  max = 32767;
+   free(coeffs->horner);
+   coeffs->horner = NULL;
+   coeffs->order = -1;
 
-  /* ---- Initialize reversal value ---- */
-  data->s0 = data->value;
+   if(coeffs->n_coeffs < 1)
+      return 1;
 
-  /* ---- Reverse edge balancing for block ---- */
-  if (block->blk_edgeties.n_ties > 0) {
-    offset = FindOffsetAtPt
-      (data->x, data->y, block->blk_edgeties.tie,
-       block->blk_edgeties.n_ties, block->blk_edgeties.spacing);
-    data->s0 -= offset;
-    if (data->s0 < min)
-      data->s0 = min;
-    else if (data->s0 > max)
-      data->s0 = max;
-    if (options->debug >= 30) {
-      printf("%s: Reversing edge offset (%lf): %lf\n",
-         fn, offset, data->s0);
-    }
-  }
+   for(order = 0; (order + 1) * (order + 2) / 2 < coeffs->n_coeffs; order++)
+      ;
+   if((order + 1) * (order + 2) / 2 != coeffs->n_coeffs)
+      return 1;
 
+   size = (coeffs->n_coeffs * sizeof(double) + 63) & ~(size_t)63;
+   if(posix_memalign(&ptr, 64, size))
+      return 1;
+   coeffs->horner = (double *)ptr;
+
+   kk = 0;
+   for(jj = order; jj >= 0; jj--) {             /* power of y */
+      for(ii = order - jj; ii >= 0; ii--) {     /* power of x */
+         /* terms of order oo start after those of orders above it */
+         oo = ii + jj;
+         term = coeffs->n_coeffs - (oo + 1) * (oo + 2) / 2 + (oo - ii);
+         coeffs->horner[kk++] = coeffs->value[term];
+         }
+      }
 
-  /* ---- Reverse grand_rad ---- */
-  if (block->blk_offset.n_coeffs > 0) {
-    if ((offset = ApplyEqnAtPt(data->x, data->y, &block->blk_offset)) == -9999) {
-      printf("%s: Invalid equations\n", fn);
-      return(1);
-    }
+   coeffs->order = order;
+   return 0;
+}
 
-    data->s0 -= offset;
-    if (options->debug >= 30) {
-      printf("%s: Reversing offset (%lf): %lf\n",
-         fn, offset, data->s0);
-    }
+/*fs----------------------------------------------------------------------------
 
-    if ((scale = ApplyEqnAtPt(data->x, data->y, &block->blk_scale)) == -9999) {
-      printf("%s: Invalid equations\n", fn);
-      return(1);
-    }
-    scale = pow(10, scale);
-    data->s0 /= scale;
-    if (options->debug >= 30) {
-      printf("%s: Reversing scale (%lf): %lf\n",
-         fn, scale, data->s0);
-    }
-  }
+   Procedure:   double ApplyPlanAtPt(xx, yy, coeffs)
 
-  /* >>>> Reverse grand_geo <<<< */
+   Purpose: Evaluate a compiled equation at a map point.  The orders RAMS
+            writes are unrolled; anything higher takes the general loop.
+            The caller checks coeffs->order >= 0 first.
 
-  /* ---- Init ---- */
-  x1 = data->x;
-  y1 = data->y;
-  if (block->blk_geom.n_coeffs != 4) {
-    printf("%s: Invalid geometric equation coefficients", fn);
-    return(1);
+----------------------------------------------------------------------------fe*/
+
+static inline double ApplyPlanAtPt(double xx, double yy, const coeffs_t *coeffs)
+{
+   const double *c = coeffs->horner;
+   double acc, aa;
+   int ii, jj;
+
+   switch(coeffs->order) {
+      case 0:
+         return c[0];
+      case 1:
+         return c[0] * yy + (c[1] * xx + c[2]);
+      case 2:
+         return (c[0] * yy + (c[1] * xx + c[2])) * yy
+              + ((c[3] * xx + c[4]) * xx + c[5]);
+      case 3:
+         return ((c[0] * yy + (c[1] * xx + c[2])) * yy
+              + ((c[3] * xx + c[4]) * xx + c[5])) * yy
+              + (((c[6] * xx + c[7]) * xx + c[8]) * xx + c[9]);
+      }
+
+   acc = 0;
+   for(jj = coeffs->order; jj >= 0; jj--) {
+      aa = *c++;
+      for(ii = coeffs->order - jj; ii > 0; ii--)
+         aa = aa * xx + *c++;
+      acc = acc * yy + aa;
+      }
+   return acc;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   compile_geom
+
+    Purpose:   Check the grand_geo coefficients of a block and keep the
+               constant parts of their inversion.
+
+    Exits:   0 on success, 1 if the equation can't be inverted
+
+----------------------------------------------------------------------------fe*/
+
+int compile_geom(Block_t *block)
+{
+   GeoInv_t *geo = &block->geo;
+
+   memset(geo, 0, sizeof(GeoInv_t));
+   if(block->blk_geom.n_coeffs != 4 || block->blk_geom.value[2] == 0)
+      return 1;
+
+   geo->aa = block->blk_geom.value[0];
+   geo->bb = block->blk_geom.value[1];
+   geo->cc = block->blk_geom.value[2];
+   geo->dd = block->blk_geom.value[3];
+   geo->diff = geo->dd / geo->cc;
+   geo->diff_aa = geo->diff * geo->aa;
+   geo->denom = geo->diff * geo->dd + geo->cc;
+   geo->valid = 1;
+   return 0;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   index_ties
+
+    Purpose:   Bucket edge ties into a grid of cells at least spacing
+               wide, so any tie within spacing of a point lies in the
+               3x3 cells around it.  Each cell keeps the merged list of
+               its neighbourhood in ascending tie order, so a lookup
+               walks one list and sums the same terms in the same order
+               as the linear scan in FindOffsetAtPt.  Neighbouring
+               pixels of a row mostly land in the same cell and reuse
+               its list.  The cell grows if the ties are sparse enough
+               that the grid would outsize the tie array.
+
+    Exits:   0 on success, 1 if out of memory
+
+----------------------------------------------------------------------------fe*/
+
+static int cmp_int(const void *aa, const void *bb)
+{
+   return *(const int *)aa - *(const int *)bb;
+}
+
+int index_ties(EdgeTies_t *ties)
+{
+   TieGrid_t *grid = &ties->grid;
+   double min_x = HUGE_VAL, max_x = -HUGE_VAL;
+   double min_y = HUGE_VAL, max_y = -HUGE_VAL;
+   int *count = NULL, *first = NULL, *bucket = NULL, *home = NULL;
+   int ii, cx, cy, kx, ky, n_cells, n_list;
+
+   memset(grid, 0, sizeof(TieGrid_t));
+   if(ties->tie == NULL || ties->n_ties <= 0 || !(ties->spacing > 0))
+      return 0;
+
+   /* ---- extent of the usable ties ---- */
+   for(ii = 0; ii < ties->n_ties; ii++) {
+      DoubleXY_t *xy = &ties->tie[ii].map_xy;
+      if(!isfinite(xy->x) || !isfinite(xy->y))
+         continue;
+      if(xy->x < min_x) min_x = xy->x;
+      if(xy->x > max_x) max_x = xy->x;
+      if(xy->y < min_y) min_y = xy->y;
+      if(xy->y > max_y) max_y = xy->y;
+      }
+   if(min_x > max_x)
+      return 0;
+
+   /* ---- one cell of padding all round, so edge cells need no care ---- */
+   grid->cell = ties->spacing * (1 + 1e-6);
+   for(;;) {
+      double nx = floor((max_x - min_x) / grid->cell) + 3;
+      double ny = floor((max_y - min_y) / grid->cell) + 3;
+      if(nx * ny <= 4.0 * ties->n_ties + 1024) {
+         grid->nx = (int)nx;
+         grid->ny = (int)ny;
+         break;
+         }
+      grid->cell *= 2;
+      }
+   grid->x0 = min_x - grid->cell;
+   grid->y0 = min_y - grid->cell;
+   n_cells = grid->nx * grid->ny;
+
+   /* ---- which cell each tie sits in, -1 for unusable ties ---- */
+   home = (int *)malloc(ties->n_ties * sizeof(int));
+   count = (int *)calloc(n_cells + 1, sizeof(int));
+   first = (int *)calloc(n_cells + 1, sizeof(int));
+   grid->start = (int *)calloc(n_cells + 1, sizeof(int));
+   if(home == NULL || count == NULL || first == NULL || grid->start == NULL)
+      goto fail;
+   for(ii = 0; ii < ties->n_ties; ii++) {
+      DoubleXY_t *xy = &ties->tie[ii].map_xy;
+      home[ii] = -1;
+      if(!isfinite(xy->x) || !isfinite(xy->y))
+         continue;
+      cx = (int)((xy->x - grid->x0) / grid->cell);
+      cy = (int)((xy->y - grid->y0) / grid->cell);
+      if(cx > grid->nx - 2) cx = grid->nx - 2;
+      if(cy > grid->ny - 2) cy = grid->ny - 2;
+      home[ii] = cy * grid->nx + cx;
+      count[home[ii]]++;
+      }
+
+   /* ---- ties of each cell, in tie order ---- */
+   for(ii = 0; ii < n_cells; ii++)
+      first[ii + 1] = first[ii] + count[ii];
+   if((bucket = (int *)malloc((first[n_cells] + 1) * sizeof(int))) == NULL)
+      goto fail;
+   memset(count, 0, n_cells * sizeof(int));
+   for(ii = 0; ii < ties->n_ties; ii++)
+      if(home[ii] >= 0)
+         bucket[first[home[ii]] + count[home[ii]]++] = ii;
+
+   /* ---- merge each 3x3 neighbourhood ---- */
+   n_list = 0;
+   for(cy = 0; cy < grid->ny; cy++)
+      for(cx = 0; cx < grid->nx; cx++) {
+         grid->start[cy * grid->nx + cx] = n_list;
+         for(ky = cy - 1; ky <= cy + 1; ky++)
+            for(kx = cx - 1; kx <= cx + 1; kx++)
+               if(kx >= 0 && kx < grid->nx && ky >= 0 && ky < grid->ny)
+                  n_list += count[ky * grid->nx + kx];
+         }
+   grid->start[n_cells] = n_list;
+   if((grid->list = (int *)malloc((n_list + 1) * sizeof(int))) == NULL)
+      goto fail;
+   for(cy = 0; cy < grid->ny; cy++)
+      for(cx = 0; cx < grid->nx; cx++) {
+         int *list = &grid->list[grid->start[cy * grid->nx + cx]];
+         int nn = 0;
+         for(ky = cy - 1; ky <= cy + 1; ky++)
+            for(kx = cx - 1; kx <= cx + 1; kx++)
+               if(kx >= 0 && kx < grid->nx && ky >= 0 && ky < grid->ny) {
+                  ii = ky * grid->nx + kx;
+                  memcpy(&list[nn], &bucket[first[ii]], count[ii] * sizeof(int));
+                  nn += count[ii];
+                  }
+         qsort(list, nn, sizeof(int), cmp_int);
+         }
+
+   free(home);
+   free(count);
+   free(first);
+   free(bucket);
+   return 0;
+
+fail:
+   free(home);
+   free(count);
+   free(first);
+   free(bucket);
+   free(grid->start);
+   memset(grid, 0, sizeof(TieGrid_t));
+   return 1;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   compile_tile
+
+    Purpose:   Compile every block and frame equation once at load time.
+               Malformed equations are left for GetSigma0 to report when
+               a pixel needs them, as before; each frame's parts says
+               which corrections its pixels get, so GetSigma0 can pick
+               a kernel without them, or -1 if one it needs is
+               malformed.  With -db 20 each compiled
+               equation is checked against ApplyEqnAtPt at the corners of
+               every subtile.  Edge ties are indexed for lookup here
+               too.
+
+    Exits:   Exit status is 0, 1 if out of memory
+
+----------------------------------------------------------------------------fe*/
+
+static void check_plan(char *name, coeffs_t *coeffs, Data_t *data)
+{
+   double worst = 0, ref, val, diff;
+   int ii, jj;
+
+   if(coeffs->order < 1)
+      return;
+   for(ii = 0; ii < data->n_subs; ii++) {
+      for(jj = 0; jj < 4; jj++) {
+         double xx = (jj & 1) ? data->subs[ii].max_x : data->subs[ii].min_x;
+         double yy = (jj & 2) ? data->subs[ii].max_y : data->subs[ii].min_y;
+         ref = ApplyEqnAtPt(xx, yy, coeffs);
+         val = ApplyPlanAtPt(xx, yy, coeffs);
+         diff = fabs(val - ref) / (fabs(ref) > 1 ? fabs(ref) : 1);
+         if(diff > worst) worst = diff;
+         }
+      }
+   printf("  %s: order %d, worst relative difference %.3le\n",
+          name, coeffs->order, worst);
+}
+
+static int frame_parts(Frame_t *frame)
+{
+   Block_t *block = frame->block;
+   int parts = 0;
+
+   if(block->blk_edgeties.n_ties > 0)
+      parts |= PART_BLOCK_TIES;
+   if(block->blk_offset.n_coeffs > 0) {
+      if(block->blk_offset.order < 0 || block->blk_scale.order < 0)
+         return -1;
+      parts |= PART_BLOCK_EQN;
+      }
+   if(!block->geo.valid)
+      return -1;
+   if(frame->frm_edgeties.n_ties > 0)
+      parts |= PART_FRAME_TIES;
+   if(frame->frm_offset.n_coeffs > 0) {
+      if(frame->frm_offset.order < 0 || frame->frm_scale.order < 0)
+         return -1;
+      parts |= PART_FRAME_EQN;
+      }
+   return parts;
+}
+
+int compile_tile(Data_t *data, Options_t *options)
+{
+   Frame_t *frame;
+   Block_t *block;
+   int ii;
+
+   for(ii = 0; ii < data->n_blocks; ii++) {
+      block = &data->blocks[ii];
+      compile_coeffs(&block->blk_offset);
+      compile_coeffs(&block->blk_scale);
+      compile_geom(block);
+      if(index_ties(&block->blk_edgeties)) {
+         printf("no memory to index edge ties for %s\n", block->name);
+         return 1;
+         }
+      if(options->debug >= 20) {
+         printf("compiled equations for %s\n", block->name);
+         check_plan("offset", &block->blk_offset, data);
+         check_plan("scale", &block->blk_scale, data);
+         }
+      }
+
+   for(ii = 0; ii < data->n_frames; ii++) {
+      frame = &data->frames[ii];
+      compile_coeffs(&frame->frm_offset);
+      compile_coeffs(&frame->frm_scale);
+      if(index_ties(&frame->frm_edgeties)) {
+         printf("no memory to index edge ties for %s\n", frame->name);
+         return 1;
+         }
+      if(options->debug >= 20) {
+         printf("compiled equations for %s\n", frame->name);
+         check_plan("offset", &frame->frm_offset, data);
+         check_plan("scale", &frame->frm_scale, data);
+         }
+      frame->parts = frame_parts(frame);
+      }
+
+   return 0;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   stamp_keys, load_cache, save_cache
+
+    Purpose:   Keep the parsed and compiled tables of a tile in a binary
+               file, TILESIG.CACHE in the tile directory unless -cache
+               names another, so later runs map it instead of parsing
+               the key files.  The file holds the Frame_t, Block_t and
+               Subtile_t arrays as they are in memory with each pointer
+               replaced by the offset of what it points to, then the
+               names, coefficients, edge ties and tie grids.  Loading
+               copies the three arrays and points them back into the
+               map; everything else is used in place, read only, and
+               FreeTile knows not to free it.
+
+               stamp_keys takes the size, modification time and a hash
+               of MASTER.TXT, FRAMES.KEY and BLOCKS.KEY before they are
+               parsed.  A cache is used only if all three still match
+               and it was written by this version with these structure
+               layouts.  Anything else, or a cache whose contents fail
+               their hash or point outside it, means the key files are parsed as before and the
+               cache written again.  It is written to a temporary name
+               and renamed, so runs sharing a tile never see half of
+               one, and a tile that can't be written to is only slower.
+
+    Exits:   Exit status is 0 if the cache was used or saved, else 1.
+               stamp_keys returns 1 if -cache is off or a key file can't
+               be read.
+
+----------------------------------------------------------------------------fe*/
+
+#define CACHE_NAME    "TILESIG.CACHE"
+#define CACHE_MAGIC   "TSIGMETA"
+#define CACHE_VERSION 3         /* bump when what Depend loads changes */
+
+typedef struct {           /* start of the cache file */
+   char       magic[8];
+   uint32_t   version;
+   uint32_t   layout;           /* cache_layout() of the writer       */
+   KeyStamp_t key[N_KEY_FILES]; /* key files the tables came from     */
+   uint64_t   size;             /* of the whole file                  */
+   uint64_t   check;            /* hash_bytes of all after the head   */
+   double     image_res;
+   double     index_res;
+   double     tile_size;
+   int32_t    image_size;
+   int32_t    index_size;
+   int32_t    n_frames;
+   int32_t    n_blocks;
+   int32_t    n_subs;
+   int32_t    pad;
+   uint64_t   frames;           /* offsets of the arrays              */
+   uint64_t   blocks;
+   uint64_t   subs;
+} CacheHead_t;
+
+typedef struct {           /* a cache file being built */
+   char      *buf;
+   size_t     n;
+   size_t     size;
+   int        bad;              /* ran out of memory                  */
+} Blob_t;
+
+typedef struct {           /* a cache file being loaded */
+   const char *base;
+   size_t      size;
+   int         bad;             /* something lies outside the file    */
+} View_t;
+
+static const char *key_files[N_KEY_FILES] = {
+   "MASTER.TXT", INDEX_DIR "/FRAMES.KEY", INDEX_DIR "/BLOCKS.KEY"
+};
+
+/* ---- pointers are written as offsets from the start of the file ---- */
+#define STOW(ptr, off)  ((ptr) = (void *)(uintptr_t)(off))
+#define OFFSET_OF(ptr)  ((uint64_t)(uintptr_t)(ptr))
+
+static void cache_path(Options_t *options, Data_t *data, char *path,
+                       size_t size)
+{
+   if(options->cache)
+      snprintf(path, size, "%s", options->cache);
+   else
+      snprintf(path, size, "%s/%s", data->tile_dir, CACHE_NAME);
+}
+
+/* ---- structure sizes and byte order, a cache from another build won't do */
+static uint32_t cache_layout(void)
+{
+   return (uint32_t)(sizeof(Frame_t) << 20 ^ sizeof(Block_t) << 10 ^
+                     sizeof(Subtile_t) ^ sizeof(void *) << 28) ^
+          (uint32_t)host_big() << 31;
+}
+
+static uint64_t hash_bytes(const unsigned char *pp, size_t nn)
+{
+   uint64_t hh = 0xcbf29ce484222325ULL ^ nn, ww;
+   size_t   ii;
+
+   for(ii = 0; ii + 8 <= nn; ii += 8) {
+      memcpy(&ww, pp + ii, 8);
+      hh = (hh ^ ww) * 0x9e3779b97f4a7c15ULL;
+      hh ^= hh >> 29;
+      }
+   for(; ii < nn; ii++)
+      hh = (hh ^ pp[ii]) * 0x100000001b3ULL;
+   return hh;
+}
+
+int stamp_keys(Options_t *options, Data_t *data, KeyStamp_t *stamp)
+{
+   struct stat st;
+   char   path[1024];
+   void  *addr;
+   int    ii, fd;
+
+   if(options->cache && !strcmp(options->cache, "off"))
+      return 1;
+
+   for(ii = 0; ii < N_KEY_FILES; ii++) {
+      snprintf(path, sizeof(path), "%s/%s", data->tile_dir, key_files[ii]);
+      if((fd = open(path, O_RDONLY)) < 0)
+         return 1;
+      if(fstat(fd, &st)) {
+         close(fd);
+         return 1;
+         }
+      stamp[ii].size  = st.st_size;
+      stamp[ii].mtime = (long long)st.st_mtim.tv_sec * 1000000000 +
+                        st.st_mtim.tv_nsec;
+      stamp[ii].hash  = hash_bytes(NULL, 0);
+      if(st.st_size > 0) {
+         addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+         if(addr == MAP_FAILED) {
+            close(fd);
+            return 1;
+            }
+         stamp[ii].hash = hash_bytes((const unsigned char *)addr, st.st_size);
+         munmap(addr, st.st_size);
+         }
+      close(fd);
+      }
+   return 0;
+}
+
+/* ---- append bytes at an aligned offset, 0 for nothing ---- */
+static uint64_t blob_put(Blob_t *blob, const void *src, size_t bytes,
+                         size_t align)
+{
+   size_t at = (blob->n + align - 1) & ~(align - 1), size;
+   char  *buf;
+
+   if(src == NULL || bytes == 0 || blob->bad)
+      return 0;
+   if(at + bytes > blob->size) {
+      for(size = blob->size ? blob->size : 65536; size < at + bytes; size *= 2)
+         ;
+      if((buf = (char *)realloc(blob->buf, size)) == NULL) {
+         blob->bad = 1;
+         return 0;
+         }
+      memset(buf + blob->size, 0, size - blob->size);
+      blob->buf = buf;
+      blob->size = size;
+      }
+   memcpy(blob->buf + at, src, bytes);
+   blob->n = at + bytes;
+   return at;
+}
+
+static void stow_coeffs(Blob_t *blob, coeffs_t *coeffs)
+{
+   size_t bytes = coeffs->n_coeffs * sizeof(double);
+
+   STOW(coeffs->horner, blob_put(blob, coeffs->horner,
+                                 coeffs->order >= 0 ? bytes : 0, 64));
+   STOW(coeffs->value, blob_put(blob, coeffs->value, bytes, 8));
+}
+
+static void stow_ties(Blob_t *blob, EdgeTies_t *ties)
+{
+   TieGrid_t *grid = &ties->grid;
+   int        n_cells = grid->nx * grid->ny;
+
+   if(grid->start) {
+      STOW(grid->list, blob_put(blob, grid->list,
+                                grid->start[n_cells] * sizeof(int), 8));
+      STOW(grid->start, blob_put(blob, grid->start,
+                                 (n_cells + 1) * sizeof(int), 8));
+      }
+   STOW(ties->tie, blob_put(blob, ties->tie,
+                            ties->tie ? ties->n_ties * sizeof(EdgeTie_t) : 0, 8));
+}
+
+int save_cache(Options_t *options, Data_t *data, const KeyStamp_t *stamp)
+{
+   CacheHead_t head;
+   Blob_t      blob;
+   Frame_t    *frame, *frames;
+   Block_t    *block, *blocks;
+   char        path[1024], temp[1040];
+   int         ii, fd, status = 1;
+
+   memset(&head, 0, sizeof(head));
+   memset(&blob, 0, sizeof(blob));
+   frames = (Frame_t *)malloc((data->n_frames + 1) * sizeof(Frame_t));
+   blocks = (Block_t *)malloc((data->n_blocks + 1) * sizeof(Block_t));
+   blob.bad = frames == NULL || blocks == NULL;
+   blob_put(&blob, &head, sizeof(head), 8);         /* room for the head */
+
+   for(ii = 0; !blob.bad && ii < data->n_frames; ii++) {
+      frame = &frames[ii];
+      *frame = data->frames[ii];
+      STOW(frame->name, blob_put(&blob, frame->name, strlen(frame->name) + 1, 1));
+      stow_coeffs(&blob, &frame->frm_offset);
+      stow_coeffs(&blob, &frame->frm_scale);
+      stow_ties(&blob, &frame->frm_edgeties);
+      STOW(frame->block, frame->block - data->blocks);   /* block number */
+      }
+   for(ii = 0; !blob.bad && ii < data->n_blocks; ii++) {
+      block = &blocks[ii];
+      *block = data->blocks[ii];
+      STOW(block->name, blob_put(&blob, block->name, strlen(block->name) + 1, 1));
+      stow_coeffs(&blob, &block->blk_offset);
+      stow_coeffs(&blob, &block->blk_scale);
+      stow_coeffs(&blob, &block->blk_geom);
+      stow_ties(&blob, &block->blk_edgeties);
+      }
+   head.frames = blob_put(&blob, frames, data->n_frames * sizeof(Frame_t), 8);
+   head.blocks = blob_put(&blob, blocks, data->n_blocks * sizeof(Block_t), 8);
+   head.subs   = blob_put(&blob, data->subs, data->n_subs * sizeof(Subtile_t), 8);
+   free(frames);
+   free(blocks);
+
+   memcpy(head.magic, CACHE_MAGIC, sizeof(head.magic));
+   head.version    = CACHE_VERSION;
+   head.layout     = cache_layout();
+   memcpy(head.key, stamp, sizeof(head.key));
+   head.size       = blob.n;
+   head.image_res  = data->image_res;
+   head.index_res  = data->index_res;
+   head.tile_size  = data->tile_size;
+   head.image_size = data->image_size;
+   head.index_size = data->index_size;
+   head.n_frames   = data->n_frames;
+   head.n_blocks   = data->n_blocks;
+   head.n_subs     = data->n_subs;
+
+   cache_path(options, data, path, sizeof(path));
+   snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+   if(!blob.bad && (fd = mkstemp(temp)) >= 0) {
+      head.check = hash_bytes((unsigned char *)blob.buf + sizeof(head),
+                              blob.n - sizeof(head));
+      memcpy(blob.buf, &head, sizeof(head));
+      status = write(fd, blob.buf, blob.n) != (ssize_t)blob.n;
+      status |= fchmod(fd, 0644) != 0;
+      status |= close(fd) != 0;
+      if(status == 0)
+         status = rename(temp, path) != 0;
+      if(status)
+         unlink(temp);
+      }
+   free(blob.buf);
+
+   if(options->debug >= 5)
+      printf(status ? "could not save metadata cache %s\n"
+                    : "saved metadata cache %s\n", path);
+   return status;
+}
+
+/* ---- where an offset points in the file, NULL for 0 ---- */
+static void *view_at(View_t *view, uint64_t off, size_t bytes, size_t align)
+{
+   if(off == 0)
+      return NULL;
+   if(off % align || off > view->size || bytes > view->size - off) {
+      view->bad = 1;
+      return NULL;
+      }
+   return (void *)(view->base + off);
+}
+
+static char *aim_name(View_t *view, char *name)
+{
+   char *ss = (char *)view_at(view, OFFSET_OF(name), 1, 1);
+
+   if(ss == NULL || memchr(ss, 0, view->base + view->size - ss) == NULL) {
+      view->bad = 1;
+      return NULL;
+      }
+   return ss;
+}
+
+static void aim_coeffs(View_t *view, coeffs_t *coeffs)
+{
+   size_t bytes;
+
+   if(coeffs->n_coeffs < 0 || coeffs->order < -1 || coeffs->order > 1000 ||
+      (coeffs->order >= 0 &&
+       (coeffs->order + 1) * (coeffs->order + 2) / 2 != coeffs->n_coeffs)) {
+      view->bad = 1;
+      return;
+      }
+   bytes = coeffs->n_coeffs * sizeof(double);
+   coeffs->value  = (double *)view_at(view, OFFSET_OF(coeffs->value), bytes, 8);
+   coeffs->horner = (double *)view_at(view, OFFSET_OF(coeffs->horner), bytes, 64);
+   if((coeffs->n_coeffs > 0) != (coeffs->value != NULL) ||
+      (coeffs->order >= 0) != (coeffs->horner != NULL))
+      view->bad = 1;
+}
+
+static void aim_ties(View_t *view, EdgeTies_t *ties)
+{
+   TieGrid_t *grid = &ties->grid;
+   size_t     n_cells, ii;
+
+   if(ties->n_ties < 0 || grid->nx < 0 || grid->ny < 0) {
+      view->bad = 1;
+      return;
+      }
+   n_cells = (size_t)grid->nx * grid->ny;
+   ties->tie = (EdgeTie_t *)view_at(view, OFFSET_OF(ties->tie),
+                                    ties->n_ties * sizeof(EdgeTie_t), 8);
+   grid->start = (int *)view_at(view, OFFSET_OF(grid->start),
+                                (n_cells + 1) * sizeof(int), 8);
+   if(grid->start == NULL) {
+      grid->list = NULL;
+      return;
+      }
+
+   /* ---- FindOffsetInGrid trusts the grid, so check all of it ---- */
+   if(ties->tie == NULL || grid->start[0] != 0) {
+      view->bad = 1;
+      return;
+      }
+   for(ii = 0; ii < n_cells; ii++)
+      if(grid->start[ii + 1] < grid->start[ii]) {
+         view->bad = 1;
+         return;
+         }
+   grid->list = (int *)view_at(view, OFFSET_OF(grid->list),
+                               grid->start[n_cells] * sizeof(int), 8);
+   if(grid->start[n_cells] > 0 && grid->list == NULL) {
+      view->bad = 1;
+      return;
+      }
+   for(ii = 0; ii < (size_t)grid->start[n_cells]; ii++)
+      if(grid->list[ii] < 0 || grid->list[ii] >= ties->n_ties) {
+         view->bad = 1;
+         return;
+         }
+}
+
+int load_cache(Options_t *options, Data_t *data, const KeyStamp_t *stamp)
+{
+   const CacheHead_t *head;
+   const Frame_t     *frame_in;
+   const Block_t     *block_in;
+   const Subtile_t   *sub_in;
+   struct stat st;
+   Input_t     cache;
+   View_t      view;
+   Frame_t    *frames = NULL;
+   Block_t    *blocks = NULL;
+   Subtile_t  *subs = NULL;
+   uint64_t    nn;
+   char        path[1024];
+   int         ii;
+
+   cache_path(options, data, path, sizeof(path));
+   if(stat(path, &st) || (size_t)st.st_size < sizeof(CacheHead_t))
+      return 1;
+   if(open_input(path, st.st_size, 0, &cache))
+      return 1;
+
+   head = (const CacheHead_t *)cache.addr;
+   if(memcmp(head->magic, CACHE_MAGIC, sizeof(head->magic)) ||
+      head->version != CACHE_VERSION || head->layout != cache_layout() ||
+      head->size != cache.size ||
+      memcmp(head->key, stamp, sizeof(head->key)) ||
+      head->n_frames < 0 || head->n_blocks < 0 || head->n_subs <= 0) {
+      if(options->debug >= 5)
+         printf("metadata cache %s is out of date\n", path);
+      close_input(&cache);
+      return 1;
+      }
+
+   view.base = (const char *)cache.addr;
+   view.size = cache.size;
+   view.bad  = head->check != hash_bytes((const unsigned char *)(head + 1),
+                                         cache.size - sizeof(*head));
+   frame_in = (const Frame_t *)view_at(&view, head->frames,
+                                       head->n_frames * sizeof(Frame_t), 8);
+   block_in = (const Block_t *)view_at(&view, head->blocks,
+                                       head->n_blocks * sizeof(Block_t), 8);
+   sub_in   = (const Subtile_t *)view_at(&view, head->subs,
+                                         head->n_subs * sizeof(Subtile_t), 8);
+   frames = (Frame_t *)calloc(head->n_frames + 1, sizeof(Frame_t));
+   blocks = (Block_t *)calloc(head->n_blocks + 1, sizeof(Block_t));
+   subs   = (Subtile_t *)calloc(head->n_subs, sizeof(Subtile_t));
+   if(frames == NULL || blocks == NULL || subs == NULL || sub_in == NULL ||
+      (head->n_frames && frame_in == NULL) || (head->n_blocks && block_in == NULL))
+      view.bad = 1;
+
+   for(ii = 0; !view.bad && ii < head->n_blocks; ii++) {
+      blocks[ii] = block_in[ii];
+      blocks[ii].name = aim_name(&view, blocks[ii].name);
+      aim_coeffs(&view, &blocks[ii].blk_offset);
+      aim_coeffs(&view, &blocks[ii].blk_scale);
+      aim_coeffs(&view, &blocks[ii].blk_geom);
+      aim_ties(&view, &blocks[ii].blk_edgeties);
+      }
+   for(ii = 0; !view.bad && ii < head->n_frames; ii++) {
+      frames[ii] = frame_in[ii];
+      frames[ii].name = aim_name(&view, frames[ii].name);
+      aim_coeffs(&view, &frames[ii].frm_offset);
+      aim_coeffs(&view, &frames[ii].frm_scale);
+      aim_ties(&view, &frames[ii].frm_edgeties);
+      nn = OFFSET_OF(frames[ii].block);
+      if(nn >= (uint64_t)head->n_blocks)
+         view.bad = 1;
+      else
+         frames[ii].block = &blocks[nn];
+      }
+   for(ii = 0; !view.bad && ii < head->n_subs; ii++) {
+      memcpy(subs[ii].name, sub_in[ii].name, sizeof(subs[ii].name));
+      subs[ii].name[sizeof(subs[ii].name) - 1] = '\0';
+      subs[ii].min_x = sub_in[ii].min_x;
+      subs[ii].max_x = sub_in[ii].max_x;
+      subs[ii].min_y = sub_in[ii].min_y;
+      subs[ii].max_y = sub_in[ii].max_y;
+      }
+
+   if(view.bad) {
+      printf("metadata cache %s is damaged, reading the key files\n", path);
+      free(frames);
+      free(blocks);
+      free(subs);
+      close_input(&cache);
+      return 1;
+      }
+
+   data->image_res  = head->image_res;
+   data->index_res  = head->index_res;
+   data->tile_size  = head->tile_size;
+   data->image_size = head->image_size;
+   data->index_size = head->index_size;
+   data->frames     = frames;
+   data->n_frames   = head->n_frames;
+   data->blocks     = blocks;
+   data->n_blocks   = head->n_blocks;
+   data->subs       = subs;
+   data->n_subs     = head->n_subs;
+   data->cache      = cache;
+   if(options->debug >= 5)
+      printf("loaded %d frames and %d blocks from %s\n", data->n_frames,
+             data->n_blocks, path);
+   return 0;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   set_roi
+
+    Purpose:   Cut the tile down to -bbox min_x min_y max_x max_y and/or
+               the ring in -polygon file (one "x y" vertex per line,
+               blank lines and # comments skipped, closing vertex
+               optional).  The output extent becomes the region's box,
+               both if given, widened to whole index pixels, or to whole
+               subtiles for -format tiff, which wants a tile per subtile.
+               Subtiles outside it are dropped from data->subs, so
+               nothing reads, converts or writes them; the rest get
+               clip_x, clip_y, clip_nx and clip_ny, the part of them in
+               the box, and only those rows and columns are converted.
+               A subtile with no pixel centre in the polygon is dropped
+               too, and reads as no data in both outputs.  Otherwise the
+               data is masked to the polygon by pixel centre and the
+               index is clipped to the box but not masked.
+
+    Exits:   Exit status is 0 on success, 1 if the region misses the tile
+             or the polygon can't be read
+
+----------------------------------------------------------------------------fe*/
+
+static int load_polygon(Roi_t *roi, const char *path)
+{
+   Input_t     input;
+   Scan_t      scan;
+   DoubleXY_t *grown;
+   const char *line, *eol, *pp;
+   int         n_line = 0, cap = 0;
+   double      xx, yy;
+
+   if(map_key(path, &input, &scan))
+      return 1;
+   while(next_line(&scan, &line, &eol)) {
+      n_line++;
+      if(line == eol || *line == '#')
+         continue;
+      pp = line;
+      if(!scan_double(&pp, eol, &xx) || !scan_double(&pp, eol, &yy)) {
+         printf("%s line %d is not x y\n", path, n_line);
+         close_input(&input);
+         return 1;
+         }
+      if(roi->n_vertex == cap) {
+         cap = cap ? 2 * cap : 64;
+         grown = (DoubleXY_t *)realloc(roi->vertex, cap * sizeof(DoubleXY_t));
+         if(grown == NULL) {
+            printf("no memory for %d vertices\n", cap);
+            close_input(&input);
+            return 1;
+            }
+         roi->vertex = grown;
+         }
+      roi->vertex[roi->n_vertex].x = xx;
+      roi->vertex[roi->n_vertex].y = yy;
+      roi->n_vertex++;
+      }
+   close_input(&input);
+   if(roi->n_vertex < 3) {
+      printf("%s needs at least 3 vertices\n", path);
+      return 1;
+      }
+   return 0;
+}
+
+/*
+ * Which of n pixels, centres x0 + (jj + 0.5) res, are inside the
+ * polygon on the line at y, by even-odd crossings: each edge crossing
+ * y toggles everything right of it.  inside needs n + 1 bytes.
+ * Returns the number inside.
+ */
+static int roi_row(const Roi_t *roi, double yy, double x0, double res, int n,
+                   unsigned char *inside)
+{
+   const DoubleXY_t *aa, *bb;
+   double tt;
+   int    ii, kk, count = 0;
+
+   memset(inside, 0, n + 1);
+   for(ii = 0; ii < roi->n_vertex; ii++) {
+      aa = &roi->vertex[ii];
+      bb = &roi->vertex[ii + 1 < roi->n_vertex ? ii + 1 : 0];
+      if((aa->y > yy) == (bb->y > yy))
+         continue;
+      tt = (aa->x + (yy - aa->y) * (bb->x - aa->x) / (bb->y - aa->y) - x0) /
+           res - 0.5;
+      kk = tt < 0 ? 0 : tt >= n ? n : (int)floor(tt) + 1;
+      inside[kk] ^= 1;
+      }
+   for(kk = 0; kk < n; kk++) {
+      if(kk > 0)
+         inside[kk] ^= inside[kk - 1];
+      count += inside[kk];
+      }
+   return count;
+}
+
+/* ---- does the polygon hold any pixel centre of sub's clip window ---- */
+static int roi_touches(const Roi_t *roi, Subtile_t *sub, double res,
+                       unsigned char *inside)
+{
+   int ii;
+
+   for(ii = sub->clip_y; ii < sub->clip_y + sub->clip_ny; ii++)
+      if(roi_row(roi, sub->max_y - (ii + 0.5) * res,
+                 sub->min_x + sub->clip_x * res, res, sub->clip_nx, inside))
+         return 1;
+   return 0;
+}
+
+int set_roi(Data_t *data, Options_t *options)
+{
+   static char fn[] = "set_roi";
+   Roi_t     *roi;
+   Subtile_t *sub;
+   unsigned char *inside = NULL;
+   double     res = data->image_res, step, t_min_x, t_min_y, t_max_x, t_max_y;
+   double     x0, x1, y0, y1;
+   int        ii, kept;
+
+   for(ii = 0; ii < data->n_subs; ii++) {
+      sub = &data->subs[ii];
+      sub->clip_x = sub->clip_y = 0;
+      sub->clip_nx = sub->clip_ny = data->image_size;
+      }
+   if(!options->do_bbox && options->polygon == NULL)
+      return 0;
+
+   if((roi = (Roi_t *)calloc(1, sizeof(Roi_t))) == NULL)
+      return 1;
+   data->roi = roi;
+   if(options->polygon) {
+      if(load_polygon(roi, options->polygon))
+         return 1;
+      roi->min_x = roi->max_x = roi->vertex[0].x;
+      roi->min_y = roi->max_y = roi->vertex[0].y;
+      for(ii = 1; ii < roi->n_vertex; ii++) {
+         if(roi->min_x > roi->vertex[ii].x) roi->min_x = roi->vertex[ii].x;
+         if(roi->max_x < roi->vertex[ii].x) roi->max_x = roi->vertex[ii].x;
+         if(roi->min_y > roi->vertex[ii].y) roi->min_y = roi->vertex[ii].y;
+         if(roi->max_y < roi->vertex[ii].y) roi->max_y = roi->vertex[ii].y;
+         }
+      }
+   if(options->do_bbox) {
+      if(options->polygon == NULL || roi->min_x < options->bbox[0])
+         roi->min_x = options->bbox[0];
+      if(options->polygon == NULL || roi->min_y < options->bbox[1])
+         roi->min_y = options->bbox[1];
+      if(options->polygon == NULL || roi->max_x > options->bbox[2])
+         roi->max_x = options->bbox[2];
+      if(options->polygon == NULL || roi->max_y > options->bbox[3])
+         roi->max_y = options->bbox[3];
+      }
+
+   /* ---- the box, out to the grid, in the tile ---- */
+   t_min_x = data->subs[0].min_x;
+   t_min_y = data->subs[0].min_y;
+   t_max_x = data->subs[0].max_x;
+   t_max_y = data->subs[0].max_y;
+   for(ii = 1; ii < data->n_subs; ii++) {
+      sub = &data->subs[ii];
+      if(t_min_x > sub->min_x) t_min_x = sub->min_x;
+      if(t_min_y > sub->min_y) t_min_y = sub->min_y;
+      if(t_max_x < sub->max_x) t_max_x = sub->max_x;
+      if(t_max_y < sub->max_y) t_max_y = sub->max_y;
+      }
+   step = options->tiff ? data->tile_size : data->index_res;
+   x0 = t_min_x + floor((roi->min_x - t_min_x) / step) * step;
+   x1 = t_min_x + ceil((roi->max_x - t_min_x) / step) * step;
+   y1 = t_max_y - floor((t_max_y - roi->max_y) / step) * step;
+   y0 = t_max_y - ceil((t_max_y - roi->min_y) / step) * step;
+   roi->min_x = x0 > t_min_x ? x0 : t_min_x;
+   roi->max_x = x1 < t_max_x ? x1 : t_max_x;
+   roi->min_y = y0 > t_min_y ? y0 : t_min_y;
+   roi->max_y = y1 < t_max_y ? y1 : t_max_y;
+   if(!(roi->min_x < roi->max_x && roi->min_y < roi->max_y)) {
+      printf("%s: the region misses the tile\n", fn);
+      return 1;
+      }
+
+   /* ---- clip the subtiles to it, dropping those outside ---- */
+   if(roi->n_vertex &&
+      (inside = (unsigned char *)malloc(data->image_size + 1)) == NULL)
+      return 1;
+   for(ii = kept = 0; ii < data->n_subs; ii++) {
+      sub = &data->subs[ii];
+      x0 = sub->min_x > roi->min_x ? sub->min_x : roi->min_x;
+      x1 = sub->max_x < roi->max_x ? sub->max_x : roi->max_x;
+      y0 = sub->min_y > roi->min_y ? sub->min_y : roi->min_y;
+      y1 = sub->max_y < roi->max_y ? sub->max_y : roi->max_y;
+      if(x1 <= x0 || y1 <= y0)
+         continue;
+      sub->clip_x  = floor((x0 - sub->min_x) / res + 0.5);
+      sub->clip_nx = floor((x1 - x0) / res + 0.5);
+      sub->clip_y  = floor((sub->max_y - y1) / res + 0.5);
+      sub->clip_ny = floor((y1 - y0) / res + 0.5);
+      if(sub->clip_nx < 1 || sub->clip_ny < 1 ||
+         (inside && !roi_touches(roi, sub, res, inside)))
+         continue;
+      if(options->debug >= 5)
+         printf("%s: rows %d to %d, columns %d to %d\n", sub->name,
+                sub->clip_y, sub->clip_y + sub->clip_ny - 1, sub->clip_x,
+                sub->clip_x + sub->clip_nx - 1);
+      data->subs[kept++] = *sub;
+      }
+   free(inside);
+   if(options->debug >= 1)
+      printf("region %.0lf to %.0lf Easting, %.0lf to %.0lf Northing, "
+             "%d of %d subtiles\n", roi->min_x, roi->max_x, roi->min_y,
+             roi->max_y, kept, data->n_subs);
+   if(kept == 0) {
+      printf("%s: no subtile has data in the region\n", fn);
+      return 1;
+      }
+   data->n_subs = kept;
+   return 0;
+}
+
+void free_roi(Data_t *data)
+{
+   if(data->roi == NULL)
+      return;
+   free(data->roi->vertex);
+   free(data->roi);
+   data->roi = NULL;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   calculate_output_parameters
+
+    Purpose:   Calculate output file size and extents as well as
+               the subtile pixel coordinates for each subtile
+
+    Exits:   Exit status is 0 on success, 1 on failure
+
+----------------------------------------------------------------------------fe*/
+
+int calculate_output_parameters(Data_t *data, Options_t *options)
+{
+   Subtile_t *sub;
+   Image_t *out, *index = NULL;
+   int    ii;
+   double min_x, min_y, max_x, max_y, left, top;
+
+   if(set_roi(data, options))
+      return 1;
+
+   min_x = data->subs[0].min_x;
+   min_y = data->subs[0].min_y;
+   max_x = data->subs[0].max_x;
+   max_y = data->subs[0].max_y;
+
+ /* get overall extent */
+
+   for(ii = 0; ii < data->n_subs; ii++) {
+      sub = &data->subs[ii];
+      if(min_x > sub->min_x) min_x = sub->min_x;
+      if(min_y > sub->min_y) min_y = sub->min_y;
+      if(max_x < sub->max_x) max_x = sub->max_x;
+      if(max_y < sub->max_y) max_y = sub->max_y;
+      }
+   if(data->roi) {
+      min_x = data->roi->min_x;
+      min_y = data->roi->min_y;
+      max_x = data->roi->max_x;
+      max_y = data->roi->max_y;
+      }
+
+   out = (Image_t *)calloc(1, sizeof(Image_t));
+
+   if(options->index_file)
+      index = (Image_t *)calloc(1, sizeof(Image_t));
+
+   out->min_x = min_x;
+   out->min_y = min_y;
+   out->max_x = max_x;
+   out->max_y = max_y;
+
+   out->size_x = (max_x - min_x) / data->image_res;
+   out->size_y = (max_y - min_y) / data->image_res;
+
+   if(index) {
+      index->min_x  = min_x;
+      index->min_y  = min_y;
+      index->max_x  = max_x;
+      index->max_y  = max_y;
+      index->size_x = (max_x - min_x) / data->index_res;
+      index->size_y = (max_y - min_y) / data->index_res;
+      }
+
+   if(options->debug >= 5) {
+        printf("output extent %.0lf to %.0lf Easting,  %.0lf to %.0lf Northing\n",
+                min_x, max_x, min_y, max_y);
+        printf("image size will be %d  %d\n", out->size_x, out->size_y);
+        }
+
+   for(ii = 0; ii < data->n_subs; ii++) {
+      sub = &data->subs[ii];
+      left = sub->min_x + sub->clip_x * data->image_res;
+      top  = sub->max_y - sub->clip_y * data->image_res;
+      sub->img_ul_x = (left - out->min_x) / data->image_res;
+      sub->img_lr_x = sub->img_ul_x + sub->clip_nx;
+      sub->img_ul_y = (out->max_y - top) / data->image_res;
+      sub->img_lr_y = sub->img_ul_y + sub->clip_ny;
+      sub->index_ul_x = (left - out->min_x) / data->index_res;
+      sub->index_ul_y = (out->max_y - top) / data->index_res;
+      if(options->debug >= 20) 
+          printf("%s:  %d  %d  %d  %d\n", sub->name, sub->img_ul_x, 
+                  sub->img_lr_x, sub->img_ul_y, sub->img_lr_y);
+      }
+
+   data->output_image = out;
+   data->index_image =  index;
+
+   return 0;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   open_input
+
+    Purpose:   Map a subtile's IMG or IDX file read only, so the
+               conversion reads the page cache directly instead of a
+               calloced copy of it.  The file must be exactly size
+               bytes; a short or long file means the tile's image_size
+               or index_size doesn't describe it.  Where the file can't
+               be mapped it is read into memory instead, checking that
+               every byte arrives.
+
+    Exits:   Exit status is 0 on success, 1 on failure
+
+----------------------------------------------------------------------------fe*/
+
+/* ---- open path for reading if it is size bytes, else -1 ---- */
+static int open_sized(const char *path, size_t size)
+{
+   struct stat st;
+   int     fd;
+
+   if((fd = open(path, O_RDONLY)) < 0) {
+      printf("open_input: Unable to open %s\n", path);
+      return -1;
+      }
+   if(fstat(fd, &st) || (size_t)st.st_size != size) {
+      printf("open_input: %s is %ld bytes, expected %ld\n", path,
+             (long)st.st_size, (long)size);
+      close(fd);
+      return -1;
+      }
+   return fd;
+}
+
+int open_input(const char *path, size_t size, int writable, Input_t *input)
+{
+   static char fn[] = "open_input";
+   size_t  done;
+   ssize_t got;
+   int     fd;
+
+   memset(input, 0, sizeof(*input));
+   if((fd = open_sized(path, size)) < 0)
+      return 1;
+
+   input->size = size;
+   input->addr = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                      MAP_PRIVATE, fd, 0);
+   stats_count(COUNT_READ, size);
+   if(input->addr != MAP_FAILED) {
+      input->mapped = 1;
+      madvise(input->addr, size, MADV_SEQUENTIAL);
+      madvise(input->addr, size, MADV_WILLNEED);
+      close(fd);
+      return 0;
+      }
+
+   if((input->addr = malloc(size)) == NULL) {
+      printf("%s: out of memory for %s\n", fn, path);
+      close(fd);
+      return 1;
+      }
+   for(done = 0; done < size; done += got) {
+      got = pread(fd, (char *)input->addr + done, size - done, done);
+      if(got <= 0) {
+         printf("%s: short read on %s\n", fn, path);
+         free(input->addr);
+         input->addr = NULL;
+         close(fd);
+         return 1;
+         }
+      }
+   close(fd);
+   return 0;
+}
+
+void close_input(Input_t *input)
+{
+   if(input->addr == NULL)
+      return;
+   if(input->mapped)
+      munmap(input->addr, input->size);
+   else
+      free(input->addr);
+   input->addr = NULL;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   calculate_subs
+
+    Purpose:   Run every subtile in the tile through a three stage
+               pipeline, so reading, converting and writing overlap:
+
+               read     - one thread reads subtiles ahead, in MASTER.TXT
+                          order, into the loaded queue.  With io_uring
+                          the IMG and IDX of up to -prefetch subtiles are
+                          in flight at once, read into memory; otherwise
+                          the files are mapped and their pages touched so
+                          the faults happen here rather than in convert.
+               convert  - -threads workers take loaded subtiles, run
+                          convert_sub and pass the output on.  The
+                          calling thread is one of them.
+               write    - one thread hands converted subtiles to
+                          write_sub, which gathers them into bands.
+
+               Both queues are bounded at -prefetch subtiles (default
+               one more than the workers), which bounds the memory in
+               flight.  A subtile that fails at any stage is marked
+               failed and skipped, so its band still gets written.
+               A point query runs the subtiles serially instead, since
+               it bumps the debug level on the fly.
+
+    Exits:   Exit status is 0 on success, 1 if any subtile failed
+
+----------------------------------------------------------------------------fe*/
+
+typedef struct {           /* bounded queue of subtile numbers */
+   int             *item;
+   int              size;
+   int              head;           /* next to pop                   */
+   int              count;
+   int              closed;         /* no more pushes coming         */
+   pthread_mutex_t  lock;
+   pthread_cond_t   not_empty;
+   pthread_cond_t   not_full;
+} Queue_t;
+
+static int queue_init(Queue_t *qq, int size)
+{
+   memset(qq, 0, sizeof(*qq));
+   if((qq->item = (int *)malloc(size * sizeof(int))) == NULL)
+      return 1;
+   qq->size = size;
+   pthread_mutex_init(&qq->lock, NULL);
+   pthread_cond_init(&qq->not_empty, NULL);
+   pthread_cond_init(&qq->not_full, NULL);
+   return 0;
+}
+
+static void queue_free(Queue_t *qq)
+{
+   pthread_mutex_destroy(&qq->lock);
+   pthread_cond_destroy(&qq->not_empty);
+   pthread_cond_destroy(&qq->not_full);
+   free(qq->item);
+}
+
+static void queue_push(Queue_t *qq, int item)
+{
+   double t0 = 0;
+
+   pthread_mutex_lock(&qq->lock);
+   if(qq->count == qq->size)
+      t0 = stats_start();
+   while(qq->count == qq->size)
+      pthread_cond_wait(&qq->not_full, &qq->lock);
+   if(t0)
+      stats_stop(STAGE_WAIT, t0);
+   qq->item[(qq->head + qq->count++) % qq->size] = item;
+   pthread_cond_signal(&qq->not_empty);
+   pthread_mutex_unlock(&qq->lock);
+}
+
+/* next item, or -1 once the queue is closed and empty */
+static int queue_pop(Queue_t *qq)
+{
+   int    item = -1;
+   double t0 = 0;
+
+   pthread_mutex_lock(&qq->lock);
+   if(qq->count == 0 && !qq->closed)
+      t0 = stats_start();
+   while(qq->count == 0 && !qq->closed)
+      pthread_cond_wait(&qq->not_empty, &qq->lock);
+   if(t0)
+      stats_stop(STAGE_WAIT, t0);
+   if(qq->count > 0) {
+      item = qq->item[qq->head];
+      qq->head = (qq->head + 1) % qq->size;
+      qq->count--;
+      pthread_cond_signal(&qq->not_full);
+      }
+   pthread_mutex_unlock(&qq->lock);
+   return item;
+}
+
+static void queue_close(Queue_t *qq)
+{
+   pthread_mutex_lock(&qq->lock);
+   qq->closed = 1;
+   pthread_cond_broadcast(&qq->not_empty);
+   pthread_mutex_unlock(&qq->lock);
+}
+
+typedef struct {           /* shared state for the subtile pipeline */
+   Options_t       *options;
+   Data_t          *data;
+   int              prefetch;       /* subtiles read ahead           */
+   Queue_t          loaded;         /* read, waiting for convert     */
+   Queue_t          converted;      /* waiting for write             */
+} Pipe_t;
+
+static void fail_sub(Pipe_t *pipe, int ii)
+{
+   pipe->data->subs[ii].failed = 1;
+   skip_sub(&pipe->data->subs[ii], pipe->data);
+}
+
+/* ---- read stage, mapped: fault the pages in ahead of convert ---- */
+static void touch_input(const Input_t *input)
+{
+   const volatile char *addr = (const volatile char *)input->addr;
+   size_t page = sysconf(_SC_PAGESIZE), ii;
+
+   for(ii = 0; ii < input->size; ii += page)
+      (void)addr[ii];
+}
+
+static void read_mapped(Pipe_t *pipe, int first)
+{
+   Subtile_t *sub;
+   double     t0;
+   int        ii;
+
+   for(ii = first; ii < pipe->data->n_subs; ii++) {
+      sub = &pipe->data->subs[ii];
+      t0  = stats_start();
+      if(load_sub(sub, pipe->options, tile_of(pipe->data, sub))) {
+         fail_sub(pipe, ii);
+         continue;
+         }
+      touch_input(&sub->img_input);
+      touch_input(&sub->i_input);
+      stats_stop(STAGE_READ, t0);
+      queue_push(&pipe->loaded, ii);
+      }
+}
+
+#ifdef TILESIG_URING
+/* ---- read stage, io_uring: a ring set up by hand ---- */
+
+typedef struct {
+   int          fd;
+   unsigned    *sq_tail, *sq_mask, *sq_array;
+   unsigned    *cq_head, *cq_tail, *cq_mask;
+   struct io_uring_sqe *sqes;
+   struct io_uring_cqe *cqes;
+   void        *sq_ring, *cq_ring;
+   size_t       sq_bytes, cq_bytes, sqe_bytes;
+   unsigned     to_submit;
+} Ring_t;
+
+static void ring_free(Ring_t *ring)
+{
+   if(ring->sqes)
+      munmap(ring->sqes, ring->sqe_bytes);
+   if(ring->cq_ring && ring->cq_ring != ring->sq_ring)
+      munmap(ring->cq_ring, ring->cq_bytes);
+   if(ring->sq_ring)
+      munmap(ring->sq_ring, ring->sq_bytes);
+   if(ring->fd >= 0)
+      close(ring->fd);
+}
+
+static int ring_init(Ring_t *ring, unsigned entries)
+{
+   struct io_uring_params pp;
+   char  *sq, *cq;
+
+   memset(ring, 0, sizeof(*ring));
+   memset(&pp, 0, sizeof(pp));
+   if((ring->fd = syscall(__NR_io_uring_setup, entries, &pp)) < 0)
+      return 1;
+
+   ring->sq_bytes  = pp.sq_off.array + pp.sq_entries * sizeof(unsigned);
+   ring->cq_bytes  = pp.cq_off.cqes + pp.cq_entries * sizeof(struct io_uring_cqe);
+   ring->sqe_bytes = pp.sq_entries * sizeof(struct io_uring_sqe);
+   if(pp.features & IORING_FEAT_SINGLE_MMAP && ring->cq_bytes > ring->sq_bytes)
+      ring->sq_bytes = ring->cq_bytes;
+
+   ring->sq_ring = mmap(NULL, ring->sq_bytes, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+   if(ring->sq_ring == MAP_FAILED) {
+      ring->sq_ring = NULL;
+      ring_free(ring);
+      return 1;
+      }
+   if(pp.features & IORING_FEAT_SINGLE_MMAP)
+      ring->cq_ring = ring->sq_ring;
+   else {
+      ring->cq_ring = mmap(NULL, ring->cq_bytes, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+      if(ring->cq_ring == MAP_FAILED) {
+         ring->cq_ring = NULL;
+         ring_free(ring);
+         return 1;
+         }
+      }
+   ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqe_bytes,
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQES);
+   if(ring->sqes == MAP_FAILED) {
+      ring->sqes = NULL;
+      ring_free(ring);
+      return 1;
+      }
+
+   sq = (char *)ring->sq_ring;
+   cq = (char *)ring->cq_ring;
+   ring->sq_tail  = (unsigned *)(sq + pp.sq_off.tail);
+   ring->sq_mask  = (unsigned *)(sq + pp.sq_off.ring_mask);
+   ring->sq_array = (unsigned *)(sq + pp.sq_off.array);
+   ring->cq_head  = (unsigned *)(cq + pp.cq_off.head);
+   ring->cq_tail  = (unsigned *)(cq + pp.cq_off.tail);
+   ring->cq_mask  = (unsigned *)(cq + pp.cq_off.ring_mask);
+   ring->cqes     = (struct io_uring_cqe *)(cq + pp.cq_off.cqes);
+   return 0;
+}
+
+/* queue a read of iov, the caller keeps it alive until it completes */
+static void ring_readv(Ring_t *ring, int fd, struct iovec *iov, off_t offset,
+                       uint64_t tag)
+{
+   unsigned tail = *ring->sq_tail, idx = tail & *ring->sq_mask;
+   struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+   memset(sqe, 0, sizeof(*sqe));
+   sqe->opcode    = IORING_OP_READV;
+   sqe->fd        = fd;
+   sqe->addr      = (uint64_t)(uintptr_t)iov;
+   sqe->len       = 1;
+   sqe->off       = offset;
+   sqe->user_data = tag;
+   ring->sq_array[idx] = idx;
+   __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+   ring->to_submit++;
+}
+
+/* submit what is queued and wait for at least one completion */
+static int ring_wait(Ring_t *ring)
+{
+   long got;
+
+   do got = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0);
+   while(got < 0 && errno == EINTR);
+   if(got < 0)
+      return 1;
+   ring->to_submit -= got < (long)ring->to_submit ? got : ring->to_submit;
+   return 0;
+}
+
+typedef struct {           /* a subtile being read through the ring */
+   int          sub;            /* -1 when the slot is free           */
+   int          fd[2];          /* IMG then IDX                       */
+   Input_t     *input[2];
+   struct iovec iov[2];         /* what is left to read               */
+   off_t        offset[2];
+   int          pending;        /* reads not complete                 */
+   int          failed;
+} Fetch_t;
+
+/* open a subtile's files and allocate for them, the reads come later */
+static int start_fetch(Data_t *data, Fetch_t *fetch, int ss)
+{
+   Subtile_t *sub = &data->subs[ss];
+   const char *dir = tile_of(data, sub)->tile_dir;
+   char       path[1024];
+   size_t     size[2];
+   int        kk;
+
+   size[0] = (size_t)data->image_size * data->image_size * sizeof(short);
+   size[1] = (size_t)data->index_size * data->index_size;
+   fetch->input[0] = &sub->img_input;
+   fetch->input[1] = &sub->i_input;
+   memset(&sub->img_input, 0, sizeof(Input_t));
+   memset(&sub->i_input, 0, sizeof(Input_t));
+   fetch->fd[0] = fetch->fd[1] = -1;
+
+   for(kk = 0; kk < 2; kk++) {
+      if(kk == 0)
+         sprintf(path,"%s/IMAGES.DIR/%s.IMG", dir, sub->name);
+      else
+         sprintf(path,"%s/INDICES.DIR/%s.IDX", dir, sub->name);
+      if((fetch->fd[kk] = open_sized(path, size[kk])) < 0 ||
+         (fetch->input[kk]->addr = malloc(size[kk])) == NULL) {
+         printf("calculate_sub: can't read %s\n", sub->name);
+         for(kk = 0; kk < 2; kk++) {
+            if(fetch->fd[kk] >= 0)
+               close(fetch->fd[kk]);
+            close_input(fetch->input[kk]);
+            }
+         return 1;
+         }
+      fetch->input[kk]->size = size[kk];
+      }
+
+   fetch->sub     = ss;
+   fetch->failed  = 0;
+   fetch->pending = 2;
+   for(kk = 0; kk < 2; kk++) {
+      fetch->iov[kk].iov_base = fetch->input[kk]->addr;
+      fetch->iov[kk].iov_len  = size[kk];
+      fetch->offset[kk]       = 0;
+      }
+   return 0;
+}
+
+/* returns how many subtiles it got through, all of them unless the
+   ring itself fails; what is in flight then is failed and leaked, the
+   kernel may still be writing to it */
+static int read_uring(Pipe_t *pipe, Ring_t *ring)
+{
+   Fetch_t *fetch, *ff;
+   struct io_uring_cqe *cqe;
+   unsigned head, tail;
+   double   t0;
+   int      next = 0, in_flight = 0, kk, ii, res;
+
+   fetch = (Fetch_t *)calloc(pipe->prefetch, sizeof(Fetch_t));
+   if(fetch == NULL)
+      return 0;
+   for(ii = 0; ii < pipe->prefetch; ii++)
+      fetch[ii].sub = -1;
+
+   while(next < pipe->data->n_subs || in_flight > 0) {
+
+      /* ---- Keep prefetch subtiles in flight ---- */
+      for(ii = 0; ii < pipe->prefetch && next < pipe->data->n_subs; ii++) {
+         if(fetch[ii].sub >= 0)
+            continue;
+         while(next < pipe->data->n_subs &&
+               start_fetch(pipe->data, &fetch[ii], next))
+            fail_sub(pipe, next++);
+         if(next == pipe->data->n_subs)
+            break;
+         for(kk = 0; kk < 2; kk++)
+            ring_readv(ring, fetch[ii].fd[kk], &fetch[ii].iov[kk], 0,
+                       (uint64_t)ii * 2 + kk);
+         in_flight++;
+         next++;
+         }
+      if(in_flight == 0)
+         continue;
+
+      t0 = stats_start();
+      if(ring_wait(ring)) {
+         printf("calculate_subs: io_uring failed, reading with a thread\n");
+         for(ii = 0; ii < pipe->prefetch; ii++)
+            if(fetch[ii].sub >= 0)
+               fail_sub(pipe, fetch[ii].sub);
+         free(fetch);
+         return next;
+         }
+      stats_stop(STAGE_READ, t0);
+
+      /* ---- Reap, resubmitting the rest of short reads ---- */
+      head = *ring->cq_head;
+      tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+      for(; head != tail; head++) {
+         cqe = &ring->cqes[head & *ring->cq_mask];
+         ff  = &fetch[cqe->user_data / 2];
+         kk  = cqe->user_data % 2;
+         res = cqe->res;
+         if(res > 0)
+            stats_count(COUNT_READ, res);
+         if(res > 0 && (size_t)res < ff->iov[kk].iov_len) {
+            ff->iov[kk].iov_base = (char *)ff->iov[kk].iov_base + res;
+            ff->iov[kk].iov_len -= res;
+            ff->offset[kk] += res;
+            ring_readv(ring, ff->fd[kk], &ff->iov[kk], ff->offset[kk],
+                       cqe->user_data);
+            continue;
+            }
+         if(res <= 0) {
+            printf("calculate_sub: short read on %s\n",
+                   pipe->data->subs[ff->sub].name);
+            ff->failed = 1;
+            }
+         if(--ff->pending > 0)
+            continue;
+
+         close(ff->fd[0]);
+         close(ff->fd[1]);
+         if(ff->failed) {
+            close_input(ff->input[0]);
+            close_input(ff->input[1]);
+            fail_sub(pipe, ff->sub);
+            }
+         else {
+            order_input(&pipe->data->subs[ff->sub], pipe->options, pipe->data);
+            queue_push(&pipe->loaded, ff->sub);
+            }
+         ff->sub = -1;
+         in_flight--;
+         }
+      __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+      }
+
+   free(fetch);
+   return next;
+}
+#endif /* TILESIG_URING */
+
+static void *read_stage(void *arg)
+{
+   Pipe_t *pipe = (Pipe_t *)arg;
+   int     first = 0;
+#ifdef TILESIG_URING
+   Ring_t  ring;
+#endif
+
+   stats_thread(pipe->data, pipe->options, "read");
+#ifdef TILESIG_URING
+   if(!pipe->options->io || strcmp(pipe->options->io, "thread")) {
+      if(ring_init(&ring, 2 * pipe->prefetch) == 0) {
+         if(pipe->options->debug >= 1)
+            printf("reading %d subtiles ahead with io_uring\n", pipe->prefetch);
+         first = read_uring(pipe, &ring);
+         ring_free(&ring);
+         }
+      else if(pipe->options->io)
+         printf("calculate_subs: no io_uring here, reading with a thread\n");
+      }
+#endif
+   if(first < pipe->data->n_subs) {
+      if(pipe->options->debug >= 1)
+         printf("reading %d subtiles ahead with a thread\n", pipe->prefetch);
+      read_mapped(pipe, first);
+      }
+   queue_close(&pipe->loaded);
+   return NULL;
+}
+
+/* ---- convert_sub, counted ---- */
+static int timed_convert(Subtile_t *sub, Options_t *options, Data_t *data)
+{
+   double t0 = stats_start();
+   int    status = convert_sub(sub, options, data);
+
+   stats_stop(STAGE_CONVERT, t0);
+   stats_count(COUNT_SUBS, !status);
+   return status;
+}
+
+static void *convert_stage(void *arg)
+{
+   Pipe_t *pipe = (Pipe_t *)arg;
+   int     ii;
+
+   stats_thread(pipe->data, pipe->options, "convert");
+   while((ii = queue_pop(&pipe->loaded)) >= 0) {
+      if(timed_convert(&pipe->data->subs[ii], pipe->options,
+                       tile_of(pipe->data, &pipe->data->subs[ii])) ||
+         overview_sub(&pipe->data->subs[ii], pipe->data, pipe->options) ||
+         (pipe->options->tiff &&
+          pack_sub(&pipe->data->subs[ii], pipe->data, pipe->options)))
+         fail_sub(pipe, ii);
+      else
+         queue_push(&pipe->converted, ii);
+      }
+   return NULL;
+}
+
+static void *write_stage(void *arg)
+{
+   Pipe_t *pipe = (Pipe_t *)arg;
+   int     ii;
+
+   stats_thread(pipe->data, pipe->options, "write");
+   while((ii = queue_pop(&pipe->converted)) >= 0)
+      if(write_sub(&pipe->data->subs[ii], pipe->data, pipe->options)) {
+         printf("error writing subtile\n");
+         pipe->data->subs[ii].failed = 1;
+         }
+   return NULL;
+}
+
+static void calculate_serial(Data_t *data, Options_t *options)
+{
+   int ii;
+
+   for(ii = 0; ii < data->n_subs; ii++)
+      if(calculate_sub(&data->subs[ii], options, data)) {
+         data->subs[ii].failed = 1;
+         skip_sub(&data->subs[ii], data);
+         }
+}
+
+static void run_pipeline(Pipe_t *pipe, int n_threads)
+{
+   pthread_t  reader, writer, *workers;
+   int        ii;
+
+   if(pthread_create(&writer, NULL, write_stage, pipe)) {
+      printf("calculate_subs: unable to start writer, going serial\n");
+      calculate_serial(pipe->data, pipe->options);
+      return;
+      }
+   if(pthread_create(&reader, NULL, read_stage, pipe)) {
+      printf("calculate_subs: unable to start reader, going serial\n");
+      queue_close(&pipe->converted);
+      pthread_join(writer, NULL);
+      calculate_serial(pipe->data, pipe->options);
+      return;
+      }
+
+   /* the calling thread is worker 0 and mops up if a thread won't start */
+   workers = (pthread_t *)calloc(n_threads, sizeof(pthread_t));
+   for(ii = 1; ii < n_threads && workers; ii++) {
+      if(pthread_create(&workers[ii], NULL, convert_stage, pipe)) {
+         printf("calculate_subs: unable to start worker %d\n", ii);
+         break;
+         }
+      }
+   convert_stage(pipe);
+   while(workers && --ii >= 1)
+      pthread_join(workers[ii], NULL);
+   free(workers);
+
+   pthread_join(reader, NULL);
+   queue_close(&pipe->converted);
+   pthread_join(writer, NULL);
+}
+
+int calculate_subs(Data_t *data, Options_t *options)
+{
+   Pipe_t     pipe;
+   int        n_threads = options->n_threads;
+   int        ii;
+
+   if(n_threads < 1)
+      n_threads = 1;
+   if(n_threads > data->n_subs)
+      n_threads = data->n_subs;
+
+   memset(&pipe, 0, sizeof(pipe));
+   pipe.options  = options;
+   pipe.data     = data;
+   pipe.prefetch = options->prefetch > 0 ? options->prefetch : n_threads + 1;
+
+   /* the point query bumps the debug level on the fly, keep it serial */
+   if(options->do_point)
+      calculate_serial(data, options);
+   else if(queue_init(&pipe.loaded, pipe.prefetch) ||
+           queue_init(&pipe.converted, pipe.prefetch)) {
+      printf("calculate_subs: no memory for the pipeline, going serial\n");
+      calculate_serial(data, options);
+      }
+   else {
+      if(options->debug >= 1 && n_threads > 1)
+         printf("converting %d subtiles with %d threads\n", data->n_subs,
+                n_threads);
+      run_pipeline(&pipe, n_threads);
+      }
+   if(pipe.loaded.item)
+      queue_free(&pipe.loaded);
+   if(pipe.converted.item)
+      queue_free(&pipe.converted);
+
+   for(ii = 0; ii < data->n_subs; ii++)
+      if(data->subs[ii].failed)
+         return 1;
+   return 0;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   calculate_sub
+
+    Purpose:   Get sigma nought value for a subtile and write it to output
+
+               It is three steps, which the pipeline in calculate_subs
+               runs on separate threads: load_sub maps the IMG and IDX
+               into sub->img_input and sub->i_input, byte swapping the
+               IMG in place for -in_order, convert_sub turns
+               them into sub->buf (releasing both on failure) and
+               write_sub hands the result to the output layer.
+
+    Exits:   Exit status is 0 on success, 1 on failure
+
+----------------------------------------------------------------------------fe*/
+
+int load_sub(Subtile_t *sub, Options_t *options, Data_t *data)
+{
+   char path[1024];
+   int  n_pixels = data->image_size;
+
+   /* ---- Map <tile name>.IMG and <tile name>.IDX ---- */
+   sprintf(path,"%s/IMAGES.DIR/%s.IMG", data->tile_dir, sub->name);
+   if(open_input(path, (size_t)n_pixels * n_pixels * sizeof(short),
+                 options->swap_in, &sub->img_input)) {
+      printf("calculate_sub: can't read %s\n", sub->name);
+      return 1;
+      }
+   sprintf(path,"%s/INDICES.DIR/%s.IDX", data->tile_dir, sub->name);
+   if(open_input(path, (size_t)data->index_size * data->index_size, 0,
+                 &sub->i_input)) {
+      printf("calculate_sub: can't read %s\n", sub->name);
+      close_input(&sub->img_input);
+      return 1;
+      }
+   order_input(sub, options, data);
+   return 0;
+}
+
+/* ---- put a loaded IMG in host byte order, in place ---- */
+void order_input(Subtile_t *sub, Options_t *options, Data_t *data)
+{
+   if(options->swap_in)
+      data->kernel->swap((short *)sub->img_input.addr,
+                         sub->img_input.size / sizeof(short));
+}
+
+int calculate_sub(Subtile_t *sub, Options_t *options, Data_t *data)
+{
+   double t0;
+
+   if(options->do_point) {
+       if((options->map_x < sub->min_x) ||
+         (options->map_x > sub->max_x) ||
+         (options->map_y < sub->min_y) ||
+         (options->map_y > sub->max_y)) return 0;
+      }
+
+   t0 = stats_start();
+   if(load_sub(sub, options, tile_of(data, sub)))
+      return 1;
+   stats_stop(STAGE_READ, t0);
+   if(timed_convert(sub, options, tile_of(data, sub)))
+      return 1;
+   if(options->do_point)
+      return 0;
+
+   if(overview_sub(sub, data, options) || write_sub(sub, data, options)) {
+      printf("error writing subtile\n");
+      return 1;
+      }
+   return 0;
+}
+
+int convert_sub(Subtile_t *sub, Options_t *options, Data_t *data)
+{
+   char *name = sub->name;
+   static char fn[] = "calculate_sub";
+   int   n_pixels = data->image_size;
+   int buf_size = sub->clip_nx * sub->clip_ny;
+   int scale = data->index_res / data->image_res;
+
+   int ii, jj, offset, i_offset, o_offset;
+   const short *buf;
+   const unsigned char *i_buf; 
+   Input_t *img = &sub->img_input, *idx = &sub->i_input;
+   Sample_t pt;
+   Row_t *row;
+   unsigned char *keep = NULL;
+   short *row_out = NULL;
+
+   float min_x, max_y;
+   short *out_buf     = NULL;
+   short no_data_val  = NO_DATA_VAL;
+   short out_null     = OUT_NULL;
+   float data_scale   = DATA_SCALE;
+   short out_val, off = OFFSET;
+
+   if(options->debug >= 1)
+       printf("processing %s\n", sub->name);
+
+   buf   = (const short *)img->addr;
+   i_buf = (const unsigned char *)idx->addr;
+
+   if((out_buf = (short *)malloc((size_t)buf_size * sizeof(short))) == NULL) {
+      printf("%s: out of memory for %s\n", fn, name);
+      close_input(img);
+      close_input(idx);
+      return 1;
+      }
+
+   min_x = sub->min_x;
+   max_y = sub->max_y;
+
+  /* do the point thing */
+   if(options->do_point) {
+      if(options->debug > 0) options->debug += 30; // crank up the debug
+      ii = (sub->max_y - options->map_y) / data->image_res;
+      jj = (options->map_x - sub->min_x) / data->image_res;
+      /* a point on the subtile's bottom or right edge is in the last
+         pixel, not a row or column past the end of the mapping */
+      if(ii > n_pixels - 1) ii = n_pixels - 1;
+      if(jj > n_pixels - 1) jj = n_pixels - 1;
+      offset = ii * n_pixels + jj;
+      i_offset = ii/scale * n_pixels/scale+ jj/scale;
+      pt.value = (double)buf[offset];
+      if (pt.value == no_data_val) {
+         printf("%lf %lf: %lf\n", options->map_x, options->map_y, (double)no_data_val);
+         close_input(img);
+         free(out_buf);
+         close_input(idx);
+         return 0;
+         }
+      pt.index_value = (int)i_buf[i_offset];
+      pt.x = options->map_x;
+      pt.y = options->map_y;
+      GetSigma0(options, data, &pt);
+      out_val = (short)((int)((pt.s0 + off) * data_scale) - OUT_OFFSET);
+      printf("%lf %lf: %lf\n", options->map_x, options->map_y, pt.s0);
+      if(options->debug > 40) // print this if the user specified a debug level >= 10
+         printf("16bit encoded value = %d\n", out_val);
+      close_input(img);
+      free(out_buf);
+      close_input(idx);
+      return 0;
+      }
+
+   /* ---- Pixels in the region: the clip columns, or the polygon's ---- */
+   if(data->roi && (data->roi->n_vertex || sub->clip_nx < n_pixels)) {
+      if((keep = (unsigned char *)calloc(n_pixels + 1, 1)) == NULL ||
+         (row_out = (short *)malloc(n_pixels * sizeof(short))) == NULL) {
+         printf("%s: out of memory for %s\n", fn, name);
+         free(keep);
+         close_input(img);
+         free(out_buf);
+         close_input(idx);
+         return 1;
+         }
+      memset(&keep[sub->clip_x], 1, sub->clip_nx);
+      }
+
+   /* ---- Convert a row at a time unless tracing every pixel ---- */
+   if(options->debug < 30) {
+      if((row = alloc_row(n_pixels)) == NULL) {
+         printf("%s: out of memory for %s\n", fn, name);
+         free(keep);
+         free(row_out);
+         close_input(img);
+         free(out_buf);
+         close_input(idx);
+         return 1;
+         }
+      if(options->fd_every > 0) {
+         row->fd = (FwdDiff_t *)calloc(4 * data->n_blocks + 2 * data->n_frames,
+                                       sizeof(FwdDiff_t));
+         if(row->fd == NULL) {
+            printf("%s: out of memory for %s\n", fn, name);
+            free_row(row);
+            free(keep);
+            free(row_out);
+            close_input(img);
+            free(out_buf);
+            close_input(idx);
+            return 1;
+            }
+         row->fd_every = options->fd_every;
+         }
+      if(options->approx > 0 &&
+         (row->approx = build_approx(data, sub, options, buf, i_buf)) == NULL) {
+         printf("%s: out of memory gridding corrections for %s\n", fn, name);
+         free_row(row);
+         free(keep);
+         free(row_out);
+         close_input(img);
+         free(out_buf);
+         close_input(idx);
+         return 1;
+         }
+      row->fast  = options->fast_math;
+      row->mission = data->mission;
+      row->keep  = keep;
+      row->stats = thread_stats;
+      for(ii = sub->clip_y; ii < sub->clip_y + sub->clip_ny; ii++) {
+         o_offset = (ii - sub->clip_y) * sub->clip_nx;
+         if(data->roi && data->roi->n_vertex &&
+            !roi_row(data->roi, sub->max_y - (ii + 0.5) * data->image_res,
+                     sub->min_x + sub->clip_x * data->image_res,
+                     data->image_res, sub->clip_nx, &keep[sub->clip_x])) {
+            for(jj = 0; jj < sub->clip_nx; jj++)
+               out_buf[o_offset + jj] = out_null;
+            continue;
+            }
+         row->out = keep ? row_out : &out_buf[o_offset];
+         convert_row(data, sub, row, ii, &buf[ii * n_pixels], i_buf);
+         if(keep)
+            memcpy(&out_buf[o_offset], &row_out[sub->clip_x],
+                   sub->clip_nx * sizeof(short));
+         }
+      if(row->n_invalid)
+         printf("%s: %d pixels of %s have invalid equations\n", fn,
+                row->n_invalid, name);
+      if(row->fast && options->debug >= 5)
+         printf("%s: %d pixels of %s redone with libm\n", fn,
+                row->n_recheck, name);
+      free_row(row);
+      }
+   else for(ii = sub->clip_y; ii < sub->clip_y + sub->clip_ny; ii++) {
+      if(data->roi && data->roi->n_vertex)
+         roi_row(data->roi, sub->max_y - (ii + 0.5) * data->image_res,
+                 sub->min_x + sub->clip_x * data->image_res,
+                 data->image_res, sub->clip_nx, &keep[sub->clip_x]);
+      for(jj = sub->clip_x; jj < sub->clip_x + sub->clip_nx; jj++) {
+         offset = ii * n_pixels + jj;
+         i_offset = ii/scale * n_pixels/scale+ jj/scale;
+         o_offset = (ii - sub->clip_y) * sub->clip_nx + jj - sub->clip_x;
+         pt.value = (double)buf[offset];
+
+      /* ---- Skip reading index image if no data value ---- */
+         if (pt.value == no_data_val || (keep && !keep[jj])) {
+             out_buf[o_offset] = out_null;
+             continue;
+             }
+
+       /* ---- Get value of pixel ---- */
+       pt.index_value = (int)i_buf[i_offset];
+       if(pt.index_value >= data->n_frames) {
+           printf("%s: %d at %d %d exceeds index range %d\n", name, 
+                 pt.index_value, jj/scale, ii/scale, data->n_frames);
+           exit(1);
+           }
+
+        pt.x = min_x + jj * data->image_res;
+        pt.y = max_y - ii * data->image_res;
+
+   /* ---- Convert value ---- */
+
+        if(GetSigma0(options, data, &pt)) {
+            out_buf[o_offset] = out_null;
+            continue;
+            }
+        if(!(pt.s0 >= -30)) pt.s0 = -30;
+        if(pt.s0 > 10) pt.s0 = 10;
+        /* go through int, a straight double to short cast is undefined
+           above -10 dB and vectorizing compilers saturate it */
+        out_buf[o_offset] = (short)((int)((pt.s0 + off) * data_scale) - OUT_OFFSET);
+        }
+   }
+
+  free(keep);
+  free(row_out);
+  close_input(img);
+  sub->buf = out_buf; 
+  sub->i_buf = i_buf; 
+  return 0;
+}
+
+
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   Exp10Fast, Log10Fast
+
+    Purpose:   pow(10, x) and log10 for -math fast, in straight line
+               code the compiler and the row kernels can vectorize.
+               Exp10Fast splits x into n log10(2) / 64 + r, takes
+               2^(n/64) from a table and the exponent bits, and sums the
+               series for e^(r ln 10), |r ln 10| < 0.0055, to the 5th power.
+               Log10Fast splits x into m 2^e, sqrt(2)/2 < m <= sqrt(2),
+               and sums the atanh series for ln(m) to the 19th power.
+               Both truncate the series well below an ulp and are within
+               EXP10_FAST_ERR and LOG10_FAST_ERR of libm; verify_math
+               checks that for every float over the range that matters.
+               Zero, negative, subnormal, huge and NaN arguments go to
+               libm, as the fast forms don't handle them.
+
+               The conversion only needs 1/1638 dB, so recheck_pixel
+               takes each fast result with its error bound through
+               QuantizeDb.  Where both ends of the bound quantize alike
+               the fast output is the exact output; otherwise the pixel
+               is converted again with libm.
+
+----------------------------------------------------------------------------fe*/
+
+#define LOG2_10     3.321928094887362
+#define LOG10_2_HI  0x1.34413508p-2             /* 32 bits: n * hi exact */
+#define LOG10_2_LO  1.1451100898021838e-10
+#define LOG10_2_64_HI 0x1.34413508p-8           /* log10(2) / 64 */
+#define LOG10_2_64_LO 1.7892345153159123e-12
+#define LN10        2.302585092994046
+#define INV_LN10    0.4342944819032518
+#define SQRT2       1.4142135623730951
+#define ROUND_MAGIC 0x1.8p52                    /* + then - rounds to int */
+
+static inline double as_double(uint64_t bits)
+{
+   double xx;
+
+   memcpy(&xx, &bits, sizeof(xx));
+   return xx;
+}
+
+static inline uint64_t as_bits(double xx)
+{
+   uint64_t bits;
+
+   memcpy(&bits, &xx, sizeof(bits));
+   return bits;
+}
+
+static const double exp2_tab[64] = {      /* 2^(j/64), correctly rounded */
+   0x1p+0, 0x1.02c9a3e778061p+0, 0x1.059b0d3158574p+0,
+   0x1.0874518759bc8p+0, 0x1.0b5586cf9890fp+0, 0x1.0e3ec32d3d1a2p+0,
+   0x1.11301d0125b51p+0, 0x1.1429aaea92de0p+0, 0x1.172b83c7d517bp+0,
+   0x1.1a35beb6fcb75p+0, 0x1.1d4873168b9aap+0, 0x1.2063b88628cd6p+0,
+   0x1.2387a6e756238p+0, 0x1.26b4565e27cddp+0, 0x1.29e9df51fdee1p+0,
+   0x1.2d285a6e4030bp+0, 0x1.306fe0a31b715p+0, 0x1.33c08b26416ffp+0,
+   0x1.371a7373aa9cbp+0, 0x1.3a7db34e59ff7p+0, 0x1.3dea64c123422p+0,
+   0x1.4160a21f72e2ap+0, 0x1.44e086061892dp+0, 0x1.486a2b5c13cd0p+0,
+   0x1.4bfdad5362a27p+0, 0x1.4f9b2769d2ca7p+0, 0x1.5342b569d4f82p+0,
+   0x1.56f4736b527dap+0, 0x1.5ab07dd485429p+0, 0x1.5e76f15ad2148p+0,
+   0x1.6247eb03a5585p+0, 0x1.6623882552225p+0, 0x1.6a09e667f3bcdp+0,
+   0x1.6dfb23c651a2fp+0, 0x1.71f75e8ec5f74p+0, 0x1.75feb564267c9p+0,
+   0x1.7a11473eb0187p+0, 0x1.7e2f336cf4e62p+0, 0x1.82589994cce13p+0,
+   0x1.868d99b4492edp+0, 0x1.8ace5422aa0dbp+0, 0x1.8f1ae99157736p+0,
+   0x1.93737b0cdc5e5p+0, 0x1.97d829fde4e50p+0, 0x1.9c49182a3f090p+0,
+   0x1.a0c667b5de565p+0, 0x1.a5503b23e255dp+0, 0x1.a9e6b5579fdbfp+0,
+   0x1.ae89f995ad3adp+0, 0x1.b33a2b84f15fbp+0, 0x1.b7f76f2fb5e47p+0,
+   0x1.bcc1e904bc1d2p+0, 0x1.c199bdd85529cp+0, 0x1.c67f12e57d14bp+0,
+   0x1.cb720dcef9069p+0, 0x1.d072d4a07897cp+0, 0x1.d5818dcfba487p+0,
+   0x1.da9e603db3285p+0, 0x1.dfc97337b9b5fp+0, 0x1.e502ee78b3ff6p+0,
+   0x1.ea4afa2a490dap+0, 0x1.efa1bee615a27p+0, 0x1.f50765b6e4540p+0,
+   0x1.fa7c1819e90d8p+0
+   };
+
+static inline double fast_exp10(double xx)
+{
+   double  nn, rr, yy, pp;
+   int64_t kk;
+
+   if(!(fabs(xx) < 300))
+      return pow(10, xx);
+   nn = (xx * (64 * LOG2_10) + ROUND_MAGIC) - ROUND_MAGIC;
+   rr = (xx - nn * LOG10_2_64_HI) - nn * LOG10_2_64_LO;
+   yy = rr * LN10;
+   pp = 1.0/120 * yy + 1.0/24;
+   pp = pp * yy + 1.0/6;
+   pp = pp * yy + 0.5;
+   pp = pp * yy + 1;
+   pp = pp * yy + 1;
+   kk = (int64_t)nn;
+   return pp * exp2_tab[kk & 63] *
+          as_double((uint64_t)((kk - (kk & 63)) / 64 + 1023) << 52);
+}
+
+static inline double log_series(double zz)
+{
+   double pp;
+
+   pp = 1.0/19 * zz + 1.0/17;
+   pp = pp * zz + 1.0/15;
+   pp = pp * zz + 1.0/13;
+   pp = pp * zz + 1.0/11;
+   pp = pp * zz + 1.0/9;
+   pp = pp * zz + 1.0/7;
+   pp = pp * zz + 1.0/5;
+   return pp * zz + 1.0/3;
+}
+
+static inline double fast_log10(double xx)
+{
+   uint64_t bits = as_bits(xx);
+   double   ee, mm, ss, zz, ln_m;
+
+   if(!(xx >= 0x1p-1022 && xx < HUGE_VAL))
+      return log10(xx);
+   ee = (double)(int)(bits >> 52) - 1023;
+   mm = as_double((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+   if(mm > SQRT2) {
+      mm *= 0.5;
+      ee += 1;
+      }
+   ss = (mm - 1) / (mm + 1);
+   zz = ss * ss;
+   ss = ss + ss;
+   ln_m = ss + ss * zz * log_series(zz);
+   return ee * LOG10_2_HI + (ee * LOG10_2_LO + ln_m * INV_LN10);
+}
+
+double Exp10Fast(double xx)
+{
+   return fast_exp10(xx);
+}
+
+double Log10Fast(double xx)
+{
+   return fast_log10(xx);
+}
+
+static void set_identity(Row_t *row, int jj)
+{
+   row->lo[jj]         = -HUGE_VAL;
+   row->hi[jj]         = HUGE_VAL;
+   row->b_edge[jj]     = 0;
+   row->b_off[jj]      = 0;
+   row->b_scale[jj]    = 1;
+   row->f_edge[jj]     = 0;
+   row->f_off[jj]      = 0;
+   row->f_scale[jj]    = 1;
+   row->min_pwr[jj]    = 0;
+   row->cnvt_scale[jj] = 1;
+}
+
+/* ---- -incremental: equations stepped along the row ----
+
+   Along a row y is fixed and x = x0 + j * image_res, and the grand_geo
+   inverse is affine, so every block and frame equation is a polynomial
+   of the same order in the pixel number j.  fd_eqn keeps its forward
+   difference table and moves one pixel with one addition per order;
+   scales keep 10^ of each difference instead and step by multiplying.
+   The table is rebuilt from exact evaluations at j..j+order whenever it
+   is fd_every pixels old, on a new row, or the pixel's frame skipped back.
+
+   Drift: the differences start with a relative error of about 2^n eps
+   of the largest value at the anchor (n = order, eps = 2^-52), and m
+   steps multiply that by at most C(m+n, n).  With the default interval
+   of 64 that is within 130 eps for linear equations, 9e3 eps for
+   quadratics and 4e5 eps (1e-10 relative) for cubics.  Equations of
+   order above FD_MAX_ORDER are evaluated exactly at every pixel. */
+
+static void fd_anchor(FwdDiff_t *fd, Row_t *row, int order, double *q,
+                      int jj, int exp10)
+{
+   int ii, kk;
+
+   for(kk = 1; kk <= order; kk++)
+      for(ii = order; ii >= kk; ii--)
+         q[ii] -= q[ii - 1];
+   for(kk = 0; kk <= order; kk++)
+      fd->d[kk] = exp10 ? pow(10, q[kk]) : q[kk];
+   fd->order  = order;
+   fd->stamp  = row->fd_row;
+   fd->j      = jj;
+   fd->anchor = jj;
+}
+
+static inline int fd_seek(FwdDiff_t *fd, Row_t *row, int jj, int exp10)
+{
+   int kk;
+
+   if(fd->stamp != row->fd_row || jj < fd->j || jj - fd->anchor >= row->fd_every)
+      return 1;
+   for(; fd->j < jj; fd->j++) {
+      if(exp10)
+         for(kk = 0; kk < fd->order; kk++) fd->d[kk] *= fd->d[kk + 1];
+      else
+         for(kk = 0; kk < fd->order; kk++) fd->d[kk] += fd->d[kk + 1];
+      }
+   return 0;
+}
+
+static inline void geo_at(GeoInv_t *geo, double xx, double yy,
+                          double *geo_x, double *geo_y)
+{
+   *geo_y = (geo->diff * xx + yy - geo->diff_aa + geo->bb) / geo->denom;
+   *geo_x = (xx - geo->aa - geo->dd * yy) / geo->cc;
+}
+
+static double fd_eqn(FwdDiff_t *fd, Row_t *row, coeffs_t *coeffs, GeoInv_t *geo,
+                     int jj, double x0, double res, double yy, int exp10)
+{
+   double q[FD_MAX_ORDER + 1], xx, gx, gy;
+   int    kk, order = coeffs->order;
+
+   if(order > FD_MAX_ORDER || fd_seek(fd, row, jj, exp10)) {
+      for(kk = 0; kk <= order && kk <= FD_MAX_ORDER; kk++) {
+         xx = x0 + (jj + kk) * res;
+         if(geo) {
+            geo_at(geo, xx, yy, &gx, &gy);
+            q[kk] = ApplyPlanAtPt(gx, gy, coeffs);
+         } else {
+            q[kk] = ApplyPlanAtPt(xx, yy, coeffs);
+            }
+         }
+      if(order > FD_MAX_ORDER)
+         return exp10 ? pow(10, q[0]) : q[0];
+      fd_anchor(fd, row, order, q, jj, exp10);
+      }
+   return fd->d[0];
+}
+
+static double grid_offset(double xx, double yy, EdgeTies_t *ties,
+                          long *n_tried);
+
+/* Bodies written once with a frame's parts as a parameter, and
+   instantiated for each set of them, so a pixel runs no test for a
+   correction its frame doesn't have.  parts < 0: not known, look at
+   the frame and check the equations as it goes.  With split the edge
+   ties are left for run_ties and the frame's are only located. */
+#define INLINE static inline __attribute__((always_inline))
+#define HAS_PART(part, present) (parts < 0 ? (present) : (parts & (part)))
+
+INLINE int pixel_corrections_as(Data_t *data, Row_t *row, int jj,
+                                Frame_t *frame, FwdDiff_t *b_fd,
+                                FwdDiff_t *f_fd, double x0, double yy,
+                                int parts, int split)
+{
+   Block_t   *block = frame->block;
+   GeoInv_t  *geo   = &block->geo;
+   double     res   = data->image_res;
+   double     xx    = x0 + jj * res;
+   double     geo_x, geo_y, qx[2], qy[2];
+
+   /* ---- block edge balancing, clamped to the data type ---- */
+   if (!split && HAS_PART(PART_BLOCK_TIES, block->blk_edgeties.n_ties > 0)) {
+      row->b_edge[jj] = FindOffsetInGrid(xx, yy, &block->blk_edgeties);
+      row->lo[jj] = 0;
+      row->hi[jj] = 32767;
+   } else {
+      row->b_edge[jj] = 0;
+      row->lo[jj] = -HUGE_VAL;
+      row->hi[jj] = HUGE_VAL;
+      }
+
+   /* ---- grand_rad ---- */
+   if (HAS_PART(PART_BLOCK_EQN, block->blk_offset.n_coeffs > 0)) {
+      if (parts < 0 &&
+          (block->blk_offset.order < 0 || block->blk_scale.order < 0))
+         return 1;
+      if (b_fd) {
+         row->b_off[jj]   = fd_eqn(&b_fd[0], row, &block->blk_offset, NULL,
+                                   jj, x0, res, yy, 0);
+         row->b_scale[jj] = fd_eqn(&b_fd[1], row, &block->blk_scale, NULL,
+                                   jj, x0, res, yy, 1);
+      } else {
+         row->b_off[jj]   = ApplyPlanAtPt(xx, yy, &block->blk_offset);
+         row->b_scale[jj] = row->fast ?
+            fast_exp10(ApplyPlanAtPt(xx, yy, &block->blk_scale)) :
+            pow(10, ApplyPlanAtPt(xx, yy, &block->blk_scale));
+         }
+   } else {
+      row->b_off[jj]   = 0;
+      row->b_scale[jj] = 1;
+      }
+
+   /* ---- grand_geo ---- */
+   if (parts < 0 && !geo->valid)
+      return 1;
+   if (b_fd) {
+      if (fd_seek(&b_fd[2], row, jj, 0) || fd_seek(&b_fd[3], row, jj, 0)) {
+         geo_at(geo, xx, yy, &qx[0], &qy[0]);
+         geo_at(geo, x0 + (jj + 1) * res, yy, &qx[1], &qy[1]);
+         fd_anchor(&b_fd[2], row, 1, qx, jj, 0);
+         fd_anchor(&b_fd[3], row, 1, qy, jj, 0);
+         }
+      geo_x = b_fd[2].d[0];
+      geo_y = b_fd[3].d[0];
+   } else {
+      geo_at(geo, xx, yy, &geo_x, &geo_y);
+      }
+
+   /* ---- frame edge balancing and rad_bal at the geo coordinates ---- */
+   if (split && HAS_PART(PART_FRAME_TIES, 0)) {
+      row->geo_x[jj]  = geo_x;
+      row->geo_y[jj]  = geo_y;
+      row->f_edge[jj] = 0;
+      }
+   else if (HAS_PART(PART_FRAME_TIES, frame->frm_edgeties.n_ties > 0))
+      row->f_edge[jj] = FindOffsetInGrid(geo_x, geo_y, &frame->frm_edgeties);
+   else
+      row->f_edge[jj] = 0;
+
+   if (HAS_PART(PART_FRAME_EQN, frame->frm_offset.n_coeffs > 0)) {
+      if (parts < 0 &&
+          (frame->frm_offset.order < 0 || frame->frm_scale.order < 0))
+         return 1;
+      if (f_fd) {
+         row->f_off[jj]   = fd_eqn(&f_fd[0], row, &frame->frm_offset, geo,
+                                   jj, x0, res, yy, 0);
+         row->f_scale[jj] = fd_eqn(&f_fd[1], row, &frame->frm_scale, geo,
+                                   jj, x0, res, yy, 1);
+      } else {
+         row->f_off[jj]   = ApplyPlanAtPt(geo_x, geo_y, &frame->frm_offset);
+         row->f_scale[jj] = row->fast ?
+            fast_exp10(ApplyPlanAtPt(geo_x, geo_y, &frame->frm_scale)) :
+            pow(10, ApplyPlanAtPt(geo_x, geo_y, &frame->frm_scale));
+         }
+   } else {
+      row->f_off[jj]   = 0;
+      row->f_scale[jj] = 1;
+      }
+
+   row->min_pwr[jj]    = frame->min_pwr;
+   row->cnvt_scale[jj] = frame->cnvt_scale;
+   return 0;
+}
+
+/* -incremental state of the frame's block and of the frame, or NULL */
+static inline void frame_fd(Data_t *data, Row_t *row, Frame_t *frame,
+                            FwdDiff_t **b_fd, FwdDiff_t **f_fd)
+{
+   *b_fd = *f_fd = NULL;
+   if (row->fd) {
+      *b_fd = &row->fd[4 * (frame->block - data->blocks)];
+      *f_fd = &row->fd[4 * data->n_blocks + 2 * (frame - data->frames)];
+      }
+}
+
+static int pixel_corrections(Data_t *data, Row_t *row, int jj, Frame_t *frame,
+                             double x0, double yy)
+{
+   FwdDiff_t *b_fd, *f_fd;
+
+   frame_fd(data, row, frame, &b_fd, &f_fd);
+   return pixel_corrections_as(data, row, jj, frame, b_fd, f_fd, x0, yy,
+                               -1, 0);
+}
+
+/* ---- the corrections for pixels j0 to j1 - 1, all of one frame ----
+
+   The frame, its block and their -incremental state are looked up once
+   for the run, and each pixel does only the sums that depend on where
+   it is.  A frame with a malformed equation goes through
+   pixel_corrections, which finds it a pixel at a time as before.
+
+   With -stats the run kernels are the split ones: the run's edge ties
+   are left for run_ties, which looks up a whole row's in one batch so
+   that the batch can be timed on its own. */
+typedef void (*RunKernel_t)(Data_t *data, Row_t *row, int j0, int j1,
+                            Frame_t *frame, double x0, double yy);
+
+INLINE void run_corrections_as(Data_t *data, Row_t *row, int j0, int j1,
+                               Frame_t *frame, double x0, double yy,
+                               int parts, int split)
+{
+   FwdDiff_t *b_fd, *f_fd;
+   TieRun_t  *run;
+   int jj;
+
+   frame_fd(data, row, frame, &b_fd, &f_fd);
+   for(jj = j0; jj < j1; jj++) {
+      if(row->dn[jj] == NO_DATA_VAL)
+         set_identity(row, jj);
+      else
+         pixel_corrections_as(data, row, jj, frame, b_fd, f_fd, x0, yy,
+                              parts, split);
+      }
+   if(split && (parts & (PART_BLOCK_TIES | PART_FRAME_TIES))) {
+      run = &row->tie_run[row->n_tie_runs++];
+      run->j0 = j0;
+      run->j1 = j1;
+      run->frame = frame;
+      }
+}
+
+/* ---- -stats: the edge ties the split run kernels left, all at once ---- */
+static void run_ties(Data_t *data, Row_t *row, double x0, double yy)
+{
+   Stats_t   *st = row->stats;
+   TieRun_t  *run;
+   EdgeTies_t *b_ties, *f_ties;
+   double     res = data->image_res;
+   int        rr, jj;
+
+   for(rr = 0; rr < row->n_tie_runs; rr++) {
+      run = &row->tie_run[rr];
+      b_ties = &run->frame->block->blk_edgeties;
+      f_ties = &run->frame->frm_edgeties;
+      for(jj = run->j0; jj < run->j1; jj++) {
+         if(row->dn[jj] == NO_DATA_VAL)
+            continue;
+         if(b_ties->n_ties > 0) {
+            row->b_edge[jj] = grid_offset(x0 + jj * res, yy, b_ties,
+                                          &st->n[COUNT_TIES]);
+            row->lo[jj] = 0;
+            row->hi[jj] = 32767;
+            st->n[COUNT_LOOKUPS]++;
+            }
+         if(f_ties->n_ties > 0) {
+            row->f_edge[jj] = grid_offset(row->geo_x[jj], row->geo_y[jj],
+                                          f_ties, &st->n[COUNT_TIES]);
+            st->n[COUNT_LOOKUPS]++;
+            }
+         }
+      }
+   row->n_tie_runs = 0;
+}
+
+static void run_checked(Data_t *data, Row_t *row, int j0, int j1,
+                        Frame_t *frame, double x0, double yy)
+{
+   int jj;
+
+   for(jj = j0; jj < j1; jj++) {
+      if(row->dn[jj] == NO_DATA_VAL)
+         set_identity(row, jj);
+      else if(pixel_corrections(data, row, jj, frame, x0, yy)) {
+         row->dn[jj] = NO_DATA_VAL;
+         row->n_invalid++;
+         set_identity(row, jj);
+         }
+      }
+}
+
+#define RUN_KERNEL(pp) \
+   static void run_##pp(Data_t *data, Row_t *row, int j0, int j1, \
+                        Frame_t *frame, double x0, double yy) \
+      { run_corrections_as(data, row, j0, j1, frame, x0, yy, pp, 0); } \
+   static void run_split_##pp(Data_t *data, Row_t *row, int j0, int j1, \
+                              Frame_t *frame, double x0, double yy) \
+      { run_corrections_as(data, row, j0, j1, frame, x0, yy, pp, 1); }
+RUN_KERNEL(0)  RUN_KERNEL(1)  RUN_KERNEL(2)  RUN_KERNEL(3)
+RUN_KERNEL(4)  RUN_KERNEL(5)  RUN_KERNEL(6)  RUN_KERNEL(7)
+RUN_KERNEL(8)  RUN_KERNEL(9)  RUN_KERNEL(10) RUN_KERNEL(11)
+RUN_KERNEL(12) RUN_KERNEL(13) RUN_KERNEL(14) RUN_KERNEL(15)
+
+static const RunKernel_t run_kernels[2][N_PARTS] = {
+   { run_0,  run_1,  run_2,  run_3,  run_4,  run_5,  run_6,  run_7,
+     run_8,  run_9,  run_10, run_11, run_12, run_13, run_14, run_15 },
+   { run_split_0,  run_split_1,  run_split_2,  run_split_3,
+     run_split_4,  run_split_5,  run_split_6,  run_split_7,
+     run_split_8,  run_split_9,  run_split_10, run_split_11,
+     run_split_12, run_split_13, run_split_14, run_split_15 },
+};
+
+static inline void power_pixel(Row_t *row, int jj);
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   convert_row
+
+    Purpose:   Convert row ii of a subtile into row->out.
+
+               The work is split up so that the arithmetic can be done
+               several pixels at a time.  First the corrections for each
+               pixel are looked up: edge ties, the compiled equations,
+               10^scale and the grand_geo inversion.  The row is taken a
+               run of index cells holding the same frame at a time, so
+               the index is read, range checked and its frame and block
+               found once a run, by the run kernel for the corrections
+               the frame has.  A correction the
+               pixel's block or frame doesn't have is stored as a zero
+               offset, unit scale or infinite clamp so every lane does the
+               same sums.  The row kernel reverses the corrections down to
+               power, log10 is taken pixel by pixel, and the kernel clamps,
+               scales and packs the result with OUT_NULL wherever the
+               input was NO_DATA_VAL, or row->keep leaves the pixel out
+               of the region.  Every step is the same IEEE
+               operation in the same order as GetSigma0, so the output
+               matches the per-pixel path bit for bit.
+
+    Exits:   Exit status is 0.  Like the per-pixel loop, an index value
+             past the end of the frame table stops the program.
+
+----------------------------------------------------------------------------fe*/
+
+int convert_row(Data_t *data, Subtile_t *sub, Row_t *row, int ii,
+                const short *dn, const unsigned char *i_buf)
+{
+   int    n_pixels = data->image_size;
+   int    scale = data->index_res / data->image_res;
+   const unsigned char *i_row = &i_buf[ii/scale * n_pixels/scale];
+   float  min_x = sub->min_x, max_y = sub->max_y;
+   double yy, t0 = 0, t1;
+   int    jj, kk, end, next, cell, n_cells, index_value;
+   int    n_invalid = row->n_invalid, n_recheck = row->n_recheck;
+   Frame_t *frame;
+   ApproxFrame_t *af;
+
+   yy = max_y - ii * data->image_res;
+   row->fd_row++;
+   if(row->stats)
+      t0 = wall_now();
+
+   if(row->keep) {
+      for(jj = 0; jj < row->n; jj++)
+         row->dn[jj] = row->keep[jj] ? dn[jj] : NO_DATA_VAL;
+      }
+   else
+      memcpy(row->dn, dn, row->n * sizeof(short));
+
+   /* ---- a run at a time of index cells holding the same frame ---- */
+   n_cells = (row->n + scale - 1) / scale;
+   for(cell = 0; cell < n_cells; cell = kk) {
+      index_value = (int)i_row[cell];
+      for(kk = cell + 1; kk < n_cells && i_row[kk] == index_value; kk++)
+         ;
+      jj  = cell * scale;
+      end = kk * scale < row->n ? kk * scale : row->n;
+
+      if(index_value >= data->n_frames) {
+         for(; jj < end; jj++) {
+            if(row->dn[jj] != NO_DATA_VAL) {
+               printf("%s: %d at %d %d exceeds index range %d\n", sub->name,
+                     index_value, jj/scale, ii/scale, data->n_frames);
+               exit(1);
+               }
+            set_identity(row, jj);
+            }
+         continue;
+         }
+
+      /* ---- -approx interpolates a gridded frame's corrections, but
+              for the knot cells it converts exactly ---- */
+      frame = &data->frames[index_value];
+      af = row->approx ? &row->approx->frame[index_value] : NULL;
+      for(; jj < end; jj = next) {
+         next = end;
+         if(af && af->state != APPROX_EXACT &&
+            !approx_exact(af, ii, jj, &next)) {
+            for(; jj < next; jj++) {
+               if(row->dn[jj] == NO_DATA_VAL)
+                  set_identity(row, jj);
+               else if(approx_corrections(data, sub, row, ii, jj,
+                                          index_value)) {
+                  row->dn[jj] = NO_DATA_VAL;
+                  row->n_invalid++;
+                  set_identity(row, jj);
+                  }
+               }
+            }
+         else if(frame->parts < 0)
+            run_checked(data, row, jj, next, frame, min_x, yy);
+         else
+            run_kernels[row->stats != NULL][frame->parts](data, row, jj, next,
+                                                          frame, min_x, yy);
+         }
+      }
+   if(row->stats) {
+      t0 = stats_lap(row->stats, STAGE_CORRECT, t0);
+      if(row->n_tie_runs) {
+         t1 = t0;
+         run_ties(data, row, min_x, yy);
+         t0 = stats_lap(row->stats, STAGE_TIES, t0);
+         row->stats->t[STAGE_CORRECT] += t0 - t1;
+         }
+      }
+
+   data->kernel->power[row->mission](row);
+   if(row->stats)
+      t0 = stats_lap(row->stats, STAGE_POWER, t0);
+
+   if(row->fast)
+      data->kernel->decibel(row);
+   for(jj = 0; jj < row->n; jj++) {
+      if(row->dn[jj] == NO_DATA_VAL)
+         continue;
+      if(!row->fast) {
+         row->power[jj] = 10 * log10(row->power[jj]);
+         continue;
+         }
+      if(!recheck_pixel(row, jj))
+         continue;
+
+      /* ---- too near a quantization step: convert it with libm ---- */
+      row->fast = 0;
+      if(row->fd == NULL) {
+         index_value = (int)i_row[jj/scale];
+         if(row->approx)
+            approx_corrections(data, sub, row, ii, jj, index_value);
+         else
+            pixel_corrections(data, row, jj, &data->frames[index_value],
+                              min_x, yy);
+         }
+      power_pixel(row, jj);
+      row->power[jj] = 10 * log10(row->power[jj]);
+      row->fast = 1;
+      row->n_recheck++;
+      }
+   if(row->stats)
+      t0 = stats_lap(row->stats, STAGE_LOG10, t0);
+
+   data->kernel->quantize(row);
+   if(row->stats) {
+      stats_lap(row->stats, STAGE_QUANTIZE, t0);
+      count_row(row, n_invalid, n_recheck);
+      }
+   return 0;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   row kernels
+
+    Purpose:   The arithmetic stages of convert_row.  "power" reverses the
+               looked up corrections and the conversion parameters and
+               squares the amplitude; "quantize" clamps 10 log10(power) to
+               [-30, 10] dB (NaN to -30 as the casts always did), scales it
+               to the 16 bit output and writes OUT_NULL over no-data.
+               The scalar versions are the reference and the fallback;
+               the AVX2 and AVX-512 versions are picked at run time when
+               the cpu has them, or by name with -simd.
+
+----------------------------------------------------------------------------fe*/
+
+static const double q_scale = (float)DATA_SCALE;    /* as calculate_sub */
+
+/* Each stage is written once with the mission as a parameter and
+   instantiated per mission below, so the order of the conversion steps
+   is a constant in the kernel convert_row calls. */
+INLINE void power_pixel_as(Row_t *row, int jj, int mission)
+{
+   double s0 = row->dn[jj];
+
+   s0 -= row->b_edge[jj];
+   if (s0 < row->lo[jj])
+      s0 = row->lo[jj];
+   else if (s0 > row->hi[jj])
+      s0 = row->hi[jj];
+   s0 -= row->b_off[jj];
+   s0 /= row->b_scale[jj];
+   s0 -= row->f_edge[jj];
+   s0 -= row->f_off[jj];
+   s0 /= row->f_scale[jj];
+   if (mission == MISSION_MAMM) {
+      s0 -= row->min_pwr[jj];
+      s0 /= row->cnvt_scale[jj];
+      }
+   else {
+      s0 /= row->cnvt_scale[jj];
+      s0 -= row->min_pwr[jj];
+      }
+   row->power[jj] = s0 * s0;
+}
+
+static inline void power_pixel(Row_t *row, int jj)
+{
+   power_pixel_as(row, jj, row->mission);
+}
+
+/* a row kernel's stage for each mission, from its power_<name>_as */
+#define POWER_KERNELS(name, attr) \
+   attr static void power_##name##_mamm(Row_t *row) \
+      { power_##name##_as(row, MISSION_MAMM); } \
+   attr static void power_##name##_amm1(Row_t *row) \
+      { power_##name##_as(row, MISSION_AMM1); }
+
+short QuantizeDb(double db)
+{
+   if (!(db >= -30)) db = -30;
+   if (db > 10) db = 10;
+   return (short)((int)((db + OFFSET) * q_scale) - OUT_OFFSET);
+}
+
+static inline void quantize_pixel(Row_t *row, int jj)
+{
+   if (row->dn[jj] == NO_DATA_VAL) {
+      row->out[jj] = OUT_NULL;
+      return;
+      }
+   row->out[jj] = QuantizeDb(row->power[jj]);
+}
+
+/* ---- -math fast: is the quantized output of a fast pixel certain? ----
+
+   The scales came from Exp10Fast, so each is off by at most
+   EXP10_FAST_ERR relative, and that carries through the two divisions
+   to s0 as below.  Add Log10Fast's error and the pixel's dB value is
+   known to within err; if db - err and db + err quantize alike, so does
+   the libm result.  Returns 1 if the pixel must be done with libm. */
+int recheck_pixel(Row_t *row, int jj)
+{
+   double db = row->power[jj];
+   double cc, t1, t2, s0, e_s0, err;
+
+   if (db != db)
+      return 1;
+   cc = row->dn[jj] - row->b_edge[jj];
+   if (cc < row->lo[jj])
+      cc = row->lo[jj];
+   else if (cc > row->hi[jj])
+      cc = row->hi[jj];
+   t1 = (cc - row->b_off[jj]) / row->b_scale[jj];
+   t2 = (t1 - row->f_edge[jj] - row->f_off[jj]) / row->f_scale[jj];
+   if (row->mission == MISSION_MAMM)
+      s0 = (t2 - row->min_pwr[jj]) / row->cnvt_scale[jj];
+   else
+      s0 = t2 / row->cnvt_scale[jj] - row->min_pwr[jj];
+   e_s0 = EXP10_FAST_ERR * (fabs(t1 / row->f_scale[jj]) + fabs(t2))
+          / fabs(row->cnvt_scale[jj]);
+   if (!(fabs(s0) > 2 * e_s0))
+      return 1;
+   /* 20 log10(1 + e) <= 8.69 e, and 1e-12 dB covers the roundings */
+   err = 10 * LOG10_FAST_ERR * (1 + fabs(db) / 10)
+       + 8.6858896380650366 * 1.01 * e_s0 / fabs(s0) + 1e-12;
+   return QuantizeDb(db - err) != QuantizeDb(db + err);
+}
+
+static inline void decibel_pixel(Row_t *row, int jj)
+{
+   row->power[jj] = 10 * fast_log10(row->power[jj]);
+}
+
+INLINE void power_scalar_as(Row_t *row, int mission)
+{
+   int jj;
+
+   for(jj = 0; jj < row->n; jj++)
+      power_pixel_as(row, jj, mission);
+}
+POWER_KERNELS(scalar, )
+
+static void quantize_scalar(Row_t *row)
+{
+   int jj;
+
+   for(jj = 0; jj < row->n; jj++)
+      quantize_pixel(row, jj);
+}
+
+static void swap_scalar(short *buf, size_t n)
+{
+   unsigned short *uu = (unsigned short *)buf;
+   size_t jj;
+
+   for(jj = 0; jj < n; jj++)
+      uu[jj] = (unsigned short)(uu[jj] << 8 | uu[jj] >> 8);
+}
+
+/* how many of dn[0..n) have data, widening *lo, *hi to their values */
+static int scan_scalar(const short *dn, int n, short *lo, short *hi)
+{
+   short val, ll = *lo, hh = *hi;
+   int   jj, nn = 0;
+
+   for(jj = 0; jj < n; jj++) {
+      val = dn[jj];
+      nn += val != NO_DATA_VAL;
+      ll = val != NO_DATA_VAL && val < ll ? val : ll;
+      hh = val != NO_DATA_VAL && val > hh ? val : hh;
+      }
+   *lo = ll;
+   *hi = hh;
+   return nn;
+}
+
+static void decibel_scalar(Row_t *row)
+{
+   int jj;
+
+   for(jj = 0; jj < row->n; jj++)
+      if(row->dn[jj] != NO_DATA_VAL)
+         decibel_pixel(row, jj);
+}
+
+#ifdef TILESIG_X86
+
+__attribute__((target("avx2")))
+INLINE void power_avx2_as(Row_t *row, int mission)
+{
+   __m256d s0;
+   int jj;
+
+   for(jj = 0; jj + 4 <= row->n; jj += 4) {
+      s0 = _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(
+              _mm_loadl_epi64((__m128i *)&row->dn[jj])));
+      s0 = _mm256_sub_pd(s0, _mm256_loadu_pd(&row->b_edge[jj]));
+      s0 = _mm256_max_pd(s0, _mm256_loadu_pd(&row->lo[jj]));
+      s0 = _mm256_min_pd(s0, _mm256_loadu_pd(&row->hi[jj]));
+      s0 = _mm256_sub_pd(s0, _mm256_loadu_pd(&row->b_off[jj]));
+      s0 = _mm256_div_pd(s0, _mm256_loadu_pd(&row->b_scale[jj]));
+      s0 = _mm256_sub_pd(s0, _mm256_loadu_pd(&row->f_edge[jj]));
+      s0 = _mm256_sub_pd(s0, _mm256_loadu_pd(&row->f_off[jj]));
+      s0 = _mm256_div_pd(s0, _mm256_loadu_pd(&row->f_scale[jj]));
+      if (mission == MISSION_MAMM) {
+         s0 = _mm256_sub_pd(s0, _mm256_loadu_pd(&row->min_pwr[jj]));
+         s0 = _mm256_div_pd(s0, _mm256_loadu_pd(&row->cnvt_scale[jj]));
+         }
+      else {
+         s0 = _mm256_div_pd(s0, _mm256_loadu_pd(&row->cnvt_scale[jj]));
+         s0 = _mm256_sub_pd(s0, _mm256_loadu_pd(&row->min_pwr[jj]));
+         }
+      _mm256_storeu_pd(&row->power[jj], _mm256_mul_pd(s0, s0));
+      }
+   for(; jj < row->n; jj++)
+      power_pixel_as(row, jj, mission);
+}
+POWER_KERNELS(avx2, __attribute__((target("avx2"))))
+
+__attribute__((target("avx2")))
+static void quantize_avx2(Row_t *row)
+{
+   const __m256d lo   = _mm256_set1_pd(-30);
+   const __m256d hi   = _mm256_set1_pd(10);
+   const __m256d off  = _mm256_set1_pd(OFFSET);
+   const __m256d sc   = _mm256_set1_pd(q_scale);
+   const __m128i bias = _mm_set1_epi32(OUT_OFFSET);
+   const __m128i nd   = _mm_set1_epi16(NO_DATA_VAL);
+   const __m128i null = _mm_set1_epi16(OUT_NULL);
+   __m256d aa, bb;
+   __m128i ia, ib, qq, mask;
+   int jj;
+
+   for(jj = 0; jj + 8 <= row->n; jj += 8) {
+      /* max returns its second operand for NaN, so NaN clamps to -30 */
+      aa = _mm256_min_pd(_mm256_max_pd(_mm256_loadu_pd(&row->power[jj]), lo), hi);
+      bb = _mm256_min_pd(_mm256_max_pd(_mm256_loadu_pd(&row->power[jj + 4]), lo), hi);
+      ia = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_add_pd(aa, off), sc));
+      ib = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_add_pd(bb, off), sc));
+      qq = _mm_packs_epi32(_mm_sub_epi32(ia, bias), _mm_sub_epi32(ib, bias));
+      mask = _mm_cmpeq_epi16(_mm_loadu_si128((__m128i *)&row->dn[jj]), nd);
+      _mm_storeu_si128((__m128i *)&row->out[jj], _mm_blendv_epi8(qq, null, mask));
+      }
+   for(; jj < row->n; jj++)
+      quantize_pixel(row, jj);
+}
+
+/* byte swap sixteen shorts at a time */
+__attribute__((target("avx2")))
+static void swap_avx2(short *buf, size_t n)
+{
+   const __m256i pairs = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                          9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6,
+                                          9, 8, 11, 10, 13, 12, 15, 14);
+   size_t jj;
+
+   for(jj = 0; jj + 16 <= n; jj += 16)
+      _mm256_storeu_si256((__m256i *)&buf[jj],
+         _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *)&buf[jj]), pairs));
+   swap_scalar(&buf[jj], n - jj);
+}
+
+/* least of lo's and greatest of hi's eight lanes, by phminposuw on
+   them made unsigned, in order and in reverse order */
+__attribute__((target("avx2")))
+INLINE void scan_reduce(__m128i lo, __m128i hi, short *plo, short *phi)
+{
+   const __m128i sign = _mm_set1_epi16(SHRT_MIN);
+   const __m128i flip = _mm_set1_epi16(SHRT_MAX);
+
+   *plo = (short)(_mm_cvtsi128_si32(
+             _mm_minpos_epu16(_mm_xor_si128(lo, sign))) ^ SHRT_MIN);
+   *phi = (short)(_mm_cvtsi128_si32(
+             _mm_minpos_epu16(_mm_xor_si128(hi, flip))) ^ SHRT_MAX);
+}
+
+__attribute__((target("avx2")))
+static int scan_avx2(const short *dn, int n, short *lo, short *hi)
+{
+   const __m256i none = _mm256_set1_epi16(NO_DATA_VAL);
+   const __m256i smax = _mm256_set1_epi16(SHRT_MAX);
+   const __m256i smin = _mm256_set1_epi16(SHRT_MIN);
+   const __m256i lane = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7,
+                                          8, 9, 10, 11, 12, 13, 14, 15);
+   __m256i vlo = _mm256_set1_epi16(*lo), vhi = _mm256_set1_epi16(*hi);
+   __m256i val, miss;
+   int     jj, at, nn = 0;
+
+   /* ---- the last sixteen overlap those before, whose lanes are taken
+           as missing ---- */
+   for(jj = 0; n >= 16 && jj < n; jj += 16) {
+      at   = jj + 16 <= n ? jj : n - 16;
+      val  = _mm256_loadu_si256((__m256i *)&dn[at]);
+      miss = _mm256_or_si256(_mm256_cmpeq_epi16(val, none),
+                _mm256_cmpgt_epi16(_mm256_set1_epi16(jj - at), lane));
+      nn  += 16 - __builtin_popcount(_mm256_movemask_epi8(miss)) / 2;
+      vlo  = _mm256_min_epi16(vlo, _mm256_blendv_epi8(val, smax, miss));
+      vhi  = _mm256_max_epi16(vhi, _mm256_blendv_epi8(val, smin, miss));
+      }
+   scan_reduce(_mm_min_epi16(_mm256_castsi256_si128(vlo),
+                             _mm256_extracti128_si256(vlo, 1)),
+               _mm_max_epi16(_mm256_castsi256_si128(vhi),
+                             _mm256_extracti128_si256(vhi, 1)), lo, hi);
+   return n >= 16 ? nn : scan_scalar(dn, n, lo, hi);
+}
+
+/* Log10Fast four at a time; lanes it can't handle come back NaN */
+__attribute__((target("avx2")))
+static void decibel_avx2(Row_t *row)
+{
+   const __m256d tiny  = _mm256_set1_pd(0x1p-1022);
+   const __m256d inf   = _mm256_set1_pd(HUGE_VAL);
+   const __m256d one   = _mm256_set1_pd(1);
+   const __m256d half  = _mm256_set1_pd(0.5);
+   const __m256d sqrt2 = _mm256_set1_pd(SQRT2);
+   const __m256d two52 = _mm256_set1_pd(0x1p52);
+   const __m256i mant  = _mm256_set1_epi64x(0x000fffffffffffffLL);
+   const __m256i ebits = _mm256_set1_epi64x(0x4330000000000000LL);
+   const __m256i onebits = _mm256_set1_epi64x(0x3ff0000000000000LL);
+   __m256d xx, ok, ee, mm, big, ss, zz, pp;
+   __m256i bits;
+   int jj;
+
+   for(jj = 0; jj + 4 <= row->n; jj += 4) {
+      xx = _mm256_loadu_pd(&row->power[jj]);
+      ok = _mm256_and_pd(_mm256_cmp_pd(xx, tiny, _CMP_GE_OQ),
+                         _mm256_cmp_pd(xx, inf, _CMP_LT_OQ));
+      bits = _mm256_castpd_si256(xx);
+      ee = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(
+              _mm256_srli_epi64(bits, 52), ebits)), two52);
+      ee = _mm256_sub_pd(ee, _mm256_set1_pd(1023));
+      mm = _mm256_castsi256_pd(_mm256_or_si256(
+              _mm256_and_si256(bits, mant), onebits));
+      big = _mm256_cmp_pd(mm, sqrt2, _CMP_GT_OQ);
+      mm = _mm256_blendv_pd(mm, _mm256_mul_pd(mm, half), big);
+      ee = _mm256_add_pd(ee, _mm256_and_pd(big, one));
+      ss = _mm256_div_pd(_mm256_sub_pd(mm, one), _mm256_add_pd(mm, one));
+      zz = _mm256_mul_pd(ss, ss);
+      ss = _mm256_add_pd(ss, ss);
+      pp = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(1.0/19), zz),
+                         _mm256_set1_pd(1.0/17));
+      pp = _mm256_add_pd(_mm256_mul_pd(pp, zz), _mm256_set1_pd(1.0/15));
+      pp = _mm256_add_pd(_mm256_mul_pd(pp, zz), _mm256_set1_pd(1.0/13));
+      pp = _mm256_add_pd(_mm256_mul_pd(pp, zz), _mm256_set1_pd(1.0/11));
+      pp = _mm256_add_pd(_mm256_mul_pd(pp, zz), _mm256_set1_pd(1.0/9));
+      pp = _mm256_add_pd(_mm256_mul_pd(pp, zz), _mm256_set1_pd(1.0/7));
+      pp = _mm256_add_pd(_mm256_mul_pd(pp, zz), _mm256_set1_pd(1.0/5));
+      pp = _mm256_add_pd(_mm256_mul_pd(pp, zz), _mm256_set1_pd(1.0/3));
+      pp = _mm256_add_pd(ss, _mm256_mul_pd(_mm256_mul_pd(ss, zz), pp));
+      pp = _mm256_add_pd(_mm256_mul_pd(ee, _mm256_set1_pd(LOG10_2_HI)),
+              _mm256_add_pd(_mm256_mul_pd(ee, _mm256_set1_pd(LOG10_2_LO)),
+                            _mm256_mul_pd(pp, _mm256_set1_pd(INV_LN10))));
+      pp = _mm256_mul_pd(pp, _mm256_set1_pd(10));
+      _mm256_storeu_pd(&row->power[jj],
+                       _mm256_blendv_pd(_mm256_set1_pd(NAN), pp, ok));
+      }
+   for(; jj < row->n; jj++)
+      decibel_pixel(row, jj);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+INLINE void power_avx512_as(Row_t *row, int mission)
+{
+   __m512d s0;
+   __mmask8 mm;
+   int jj, left;
+
+   /* lanes past the end of the row or holding no-data are masked off */
+   for(jj = 0; jj < row->n; jj += 8) {
+      left = row->n - jj;
+      mm = left >= 8 ? 0xff : (__mmask8)((1 << left) - 1);
+      mm = _mm_mask_cmpneq_epi16_mask(mm,
+              _mm_maskz_loadu_epi16(mm, &row->dn[jj]), _mm_set1_epi16(NO_DATA_VAL));
+      s0 = _mm512_cvtepi32_pd(_mm256_cvtepi16_epi32(
+              _mm_maskz_loadu_epi16(mm, &row->dn[jj])));
+      s0 = _mm512_sub_pd(s0, _mm512_maskz_loadu_pd(mm, &row->b_edge[jj]));
+      s0 = _mm512_max_pd(s0, _mm512_maskz_loadu_pd(mm, &row->lo[jj]));
+      s0 = _mm512_min_pd(s0, _mm512_maskz_loadu_pd(mm, &row->hi[jj]));
+      s0 = _mm512_sub_pd(s0, _mm512_maskz_loadu_pd(mm, &row->b_off[jj]));
+      s0 = _mm512_maskz_div_pd(mm, s0, _mm512_maskz_loadu_pd(mm, &row->b_scale[jj]));
+      s0 = _mm512_sub_pd(s0, _mm512_maskz_loadu_pd(mm, &row->f_edge[jj]));
+      s0 = _mm512_sub_pd(s0, _mm512_maskz_loadu_pd(mm, &row->f_off[jj]));
+      s0 = _mm512_maskz_div_pd(mm, s0, _mm512_maskz_loadu_pd(mm, &row->f_scale[jj]));
+      if (mission == MISSION_MAMM) {
+         s0 = _mm512_sub_pd(s0, _mm512_maskz_loadu_pd(mm, &row->min_pwr[jj]));
+         s0 = _mm512_maskz_div_pd(mm, s0, _mm512_maskz_loadu_pd(mm, &row->cnvt_scale[jj]));
+         }
+      else {
+         s0 = _mm512_maskz_div_pd(mm, s0, _mm512_maskz_loadu_pd(mm, &row->cnvt_scale[jj]));
+         s0 = _mm512_sub_pd(s0, _mm512_maskz_loadu_pd(mm, &row->min_pwr[jj]));
+         }
+      _mm512_mask_storeu_pd(&row->power[jj], mm, _mm512_mul_pd(s0, s0));
+      }
+}
+POWER_KERNELS(avx512, __attribute__((target("avx512f,avx512bw,avx512vl"))))
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static void quantize_avx512(Row_t *row)
+{
+   const __m512d lo   = _mm512_set1_pd(-30);
+   const __m512d hi   = _mm512_set1_pd(10);
+   const __m512d off  = _mm512_set1_pd(OFFSET);
+   const __m512d sc   = _mm512_set1_pd(q_scale);
+   const __m512i bias = _mm512_set1_epi32(OUT_OFFSET);
+   const __m256i nd   = _mm256_set1_epi16(NO_DATA_VAL);
+   const __m256i null = _mm256_set1_epi16(OUT_NULL);
+   __m512d aa, bb;
+   __m512i ii;
+   __m256i qq, dd;
+   __mmask16 mm;
+   int jj, left;
+
+   for(jj = 0; jj < row->n; jj += 16) {
+      left = row->n - jj;
+      mm = left >= 16 ? 0xffff : (__mmask16)((1 << left) - 1);
+      aa = _mm512_maskz_loadu_pd((__mmask8)mm, &row->power[jj]);
+      bb = _mm512_maskz_loadu_pd((__mmask8)(mm >> 8), &row->power[jj + 8]);
+      /* max returns its second operand for NaN, so NaN clamps to -30 */
+      aa = _mm512_min_pd(_mm512_max_pd(aa, lo), hi);
+      bb = _mm512_min_pd(_mm512_max_pd(bb, lo), hi);
+      ii = _mm512_inserti64x4(_mm512_castsi256_si512(
+              _mm512_cvttpd_epi32(_mm512_mul_pd(_mm512_add_pd(aa, off), sc))),
+              _mm512_cvttpd_epi32(_mm512_mul_pd(_mm512_add_pd(bb, off), sc)), 1);
+      qq = _mm512_cvtsepi32_epi16(_mm512_sub_epi32(ii, bias));
+      dd = _mm256_maskz_loadu_epi16(mm, &row->dn[jj]);
+      qq = _mm256_mask_blend_epi16(_mm256_cmpeq_epi16_mask(dd, nd), qq, null);
+      _mm256_mask_storeu_epi16(&row->out[jj], mm, qq);
+      }
+}
+
+/* Log10Fast eight at a time; lanes it can't handle come back NaN */
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static void decibel_avx512(Row_t *row)
+{
+   const __m512d one   = _mm512_set1_pd(1);
+   const __m512d half  = _mm512_set1_pd(0.5);
+   const __m512d two52 = _mm512_set1_pd(0x1p52);
+   const __m512i mant  = _mm512_set1_epi64(0x000fffffffffffffLL);
+   const __m512i ebits = _mm512_set1_epi64(0x4330000000000000LL);
+   const __m512i onebits = _mm512_set1_epi64(0x3ff0000000000000LL);
+   __m512d xx, ee, mm, ss, zz, pp;
+   __m512i bits;
+   __mmask8 in, ok, big;
+   int jj, left;
+
+   for(jj = 0; jj < row->n; jj += 8) {
+      left = row->n - jj;
+      in = left >= 8 ? 0xff : (__mmask8)((1 << left) - 1);
+      xx = _mm512_maskz_loadu_pd(in, &row->power[jj]);
+      ok = _mm512_cmp_pd_mask(xx, _mm512_set1_pd(0x1p-1022), _CMP_GE_OQ) &
+           _mm512_cmp_pd_mask(xx, _mm512_set1_pd(HUGE_VAL), _CMP_LT_OQ);
+      bits = _mm512_castpd_si512(xx);
+      ee = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(
+              _mm512_srli_epi64(bits, 52), ebits)), two52);
+      ee = _mm512_sub_pd(ee, _mm512_set1_pd(1023));
+      mm = _mm512_castsi512_pd(_mm512_or_si512(
+              _mm512_and_si512(bits, mant), onebits));
+      big = _mm512_cmp_pd_mask(mm, _mm512_set1_pd(SQRT2), _CMP_GT_OQ);
+      mm = _mm512_mask_mul_pd(mm, big, mm, half);
+      ee = _mm512_mask_add_pd(ee, big, ee, one);
+      ss = _mm512_div_pd(_mm512_sub_pd(mm, one), _mm512_add_pd(mm, one));
+      zz = _mm512_mul_pd(ss, ss);
+      ss = _mm512_add_pd(ss, ss);
+      pp = _mm512_add_pd(_mm512_mul_pd(_mm512_set1_pd(1.0/19), zz),
+                         _mm512_set1_pd(1.0/17));
+      pp = _mm512_add_pd(_mm512_mul_pd(pp, zz), _mm512_set1_pd(1.0/15));
+      pp = _mm512_add_pd(_mm512_mul_pd(pp, zz), _mm512_set1_pd(1.0/13));
+      pp = _mm512_add_pd(_mm512_mul_pd(pp, zz), _mm512_set1_pd(1.0/11));
+      pp = _mm512_add_pd(_mm512_mul_pd(pp, zz), _mm512_set1_pd(1.0/9));
+      pp = _mm512_add_pd(_mm512_mul_pd(pp, zz), _mm512_set1_pd(1.0/7));
+      pp = _mm512_add_pd(_mm512_mul_pd(pp, zz), _mm512_set1_pd(1.0/5));
+      pp = _mm512_add_pd(_mm512_mul_pd(pp, zz), _mm512_set1_pd(1.0/3));
+      pp = _mm512_add_pd(ss, _mm512_mul_pd(_mm512_mul_pd(ss, zz), pp));
+      pp = _mm512_add_pd(_mm512_mul_pd(ee, _mm512_set1_pd(LOG10_2_HI)),
+              _mm512_add_pd(_mm512_mul_pd(ee, _mm512_set1_pd(LOG10_2_LO)),
+                            _mm512_mul_pd(pp, _mm512_set1_pd(INV_LN10))));
+      pp = _mm512_mul_pd(pp, _mm512_set1_pd(10));
+      _mm512_mask_storeu_pd(&row->power[jj], in,
+                            _mm512_mask_blend_pd(ok, _mm512_set1_pd(NAN), pp));
+      }
+}
+
+/* byte swap 32 shorts at a time, the tail under a mask */
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static void swap_avx512(short *buf, size_t n)
+{
+   const __m512i pairs = _mm512_broadcast_i32x4(
+                            _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                          9, 8, 11, 10, 13, 12, 15, 14));
+   __mmask32 tail;
+   size_t jj;
+
+   for(jj = 0; jj + 32 <= n; jj += 32)
+      _mm512_storeu_si512((void *)&buf[jj],
+         _mm512_shuffle_epi8(_mm512_loadu_si512((void *)&buf[jj]), pairs));
+   if(jj < n) {
+      tail = (__mmask32)((1ULL << (n - jj)) - 1);
+      _mm512_mask_storeu_epi16(&buf[jj], tail,
+         _mm512_shuffle_epi8(_mm512_maskz_loadu_epi16(tail, &buf[jj]), pairs));
+      }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static int scan_avx512(const short *dn, int n, short *lo, short *hi)
+{
+   const __m512i none = _mm512_set1_epi16(NO_DATA_VAL);
+   __m512i   vlo = _mm512_set1_epi16(*lo), vhi = _mm512_set1_epi16(*hi);
+   __m512i   val;
+   __m256i   lo4, hi4;
+   __mmask32 tail, have;
+   int       jj, nn = 0;
+
+   for(jj = 0; jj < n; jj += 32) {
+      tail = n - jj >= 32 ? ~(__mmask32)0 : (__mmask32)((1ULL << (n - jj)) - 1);
+      val  = _mm512_maskz_loadu_epi16(tail, &dn[jj]);
+      have = _mm512_mask_cmpneq_epi16_mask(tail, val, none);
+      nn  += __builtin_popcount(have);
+      vlo  = _mm512_mask_min_epi16(vlo, have, vlo, val);
+      vhi  = _mm512_mask_max_epi16(vhi, have, vhi, val);
+      }
+   lo4 = _mm256_min_epi16(_mm512_castsi512_si256(vlo),
+                          _mm512_extracti64x4_epi64(vlo, 1));
+   hi4 = _mm256_max_epi16(_mm512_castsi512_si256(vhi),
+                          _mm512_extracti64x4_epi64(vhi, 1));
+   scan_reduce(_mm_min_epi16(_mm256_castsi256_si128(lo4),
+                             _mm256_extracti128_si256(lo4, 1)),
+               _mm_max_epi16(_mm256_castsi256_si128(hi4),
+                             _mm256_extracti128_si256(hi4, 1)), lo, hi);
+   return nn;
+}
+
+#endif /* TILESIG_X86 */
+
+static RowKernel_t row_kernels[] = {
+#ifdef TILESIG_X86
+   { "avx512", { power_avx512_mamm, power_avx512_amm1 },
+               quantize_avx512, decibel_avx512, swap_avx512, scan_avx512 },
+   { "avx2",   { power_avx2_mamm,   power_avx2_amm1   },
+               quantize_avx2,   decibel_avx2,   swap_avx2,   scan_avx2   },
+#endif
+   { "scalar", { power_scalar_mamm, power_scalar_amm1 },
+               quantize_scalar, decibel_scalar, swap_scalar, scan_scalar },
+};
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   select_row_kernel
+
+    Purpose:   Pick the row kernel by name, or the widest one this cpu
+               runs when name is NULL.
+
+    Exits:   The kernel, or NULL if the named one is unknown or unsupported
+
+----------------------------------------------------------------------------fe*/
+
+RowKernel_t *select_row_kernel(char *name)
+{
+   RowKernel_t *kernel;
+   int ii, ok;
+
+#ifdef TILESIG_X86
+   __builtin_cpu_init();
+#endif
+   for(ii = 0; ii < (int)(sizeof(row_kernels) / sizeof(row_kernels[0])); ii++) {
+      kernel = &row_kernels[ii];
+      if(name && strcmp(name, kernel->name))
+         continue;
+      ok = 1;
+#ifdef TILESIG_X86
+      if(!strcmp(kernel->name, "avx512"))
+         ok = __builtin_cpu_supports("avx512f") &&
+              __builtin_cpu_supports("avx512bw") &&
+              __builtin_cpu_supports("avx512vl");
+      else if(!strcmp(kernel->name, "avx2"))
+         ok = __builtin_cpu_supports("avx2");
+#endif
+      if(ok)
+         return kernel;
+      }
+   return NULL;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   alloc_row, free_row
+
+    Purpose:   Scratch for convert_row, n pixels wide.  The arrays share
+               one allocation and each starts on a cache line.
+
+----------------------------------------------------------------------------fe*/
+
+Row_t *alloc_row(int n)
+{
+   Row_t  *row;
+   double *dd;
+   void   *ptr;
+   int     nn = (n + 15) & ~15;
+
+   if(posix_memalign(&ptr, 64, 13 * nn * sizeof(double) + nn * sizeof(short)))
+      return NULL;
+   row = (Row_t *)calloc(1, sizeof(Row_t));
+   if(row == NULL ||
+      (row->tie_run = (TieRun_t *)malloc(nn * sizeof(TieRun_t))) == NULL) {
+      free(row);
+      free(ptr);
+      return NULL;
+      }
+   dd = (double *)ptr;
+   row->lo         = dd;  dd += nn;
+   row->hi         = dd;  dd += nn;
+   row->b_edge     = dd;  dd += nn;
+   row->b_off      = dd;  dd += nn;
+   row->b_scale    = dd;  dd += nn;
+   row->f_edge     = dd;  dd += nn;
+   row->f_off      = dd;  dd += nn;
+   row->f_scale    = dd;  dd += nn;
+   row->min_pwr    = dd;  dd += nn;
+   row->cnvt_scale = dd;  dd += nn;
+   row->power      = dd;  dd += nn;
+   row->geo_x      = dd;  dd += nn;
+   row->geo_y      = dd;  dd += nn;
+   row->dn         = (short *)dd;
+   row->n          = n;
+   return row;
+}
+
+void free_row(Row_t *row)
+{
+   if(row == NULL)
+      return;
+   free(row->fd);
+   free_approx(row->approx);
+   free(row->lo);
+   free(row->tie_run);
+   free(row);
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   -approx correction grids
+
+    Purpose:   Sample the corrections of every frame in a subtile on a
+               grid of knots over the box of its valid pixels, and
+               interpolate them bilinearly per pixel instead of
+               evaluating equations and edge ties.  Rows are first
+               interpolated along the knot columns (approx_line), then
+               each pixel along the row.
+
+               The grid starts with knots 64 pixels apart and is made
+               finer until the worst error at every cell centre and edge
+               midpoint is within half of the -approx bound.  Sampling
+               and checking are charged, in exact pixel conversions,
+               against half of what converting the frame exactly would
+               cost, and no more than the subtile can afford: 1/128 of
+               its pixels, plus half of those of each frame gridded.  A
+               grid whose cells would cost more than what is left is not
+               tried, and the frame's pixels aren't even scanned for its
+               box if its index cells would cost too much, so a frame
+               too rough at the steps it can pay for, or too small or
+               scattered to be worth a grid, is given up on early and
+               converted exactly, by the run kernels as without -approx.
+               A frame with a malformed equation needs no sampling to
+               be found out.
+
+               Edge ties put kinks in the corrections, at a cone's apex
+               and rim, that bilinear interpolation can't follow and
+               sampling can miss.  Any cell a tie's cone reaches, found
+               from the tie positions rather than the samples, is
+               converted exactly instead, and a frame with most of its
+               cells so reached isn't gridded.  What is left is smooth:
+               the equations, 10^scale and grand_geo.  Bilinear error in
+               a quadratic peaks at the cell centre or an edge midpoint,
+               so the points checked find it; the other half of the
+               bound is margin for the higher terms over a cell.  The
+               error at a test point is the worst change in the clamped
+               dB output over every input value the frame has in the
+               subtile, so it holds for the faintest pixels too.
+               Quantization can add one count.
+
+----------------------------------------------------------------------------fe*/
+
+#define APPROX_KNOT_WORK 6      /* a knot sampled, in exact pixels      */
+#define APPROX_ERR_WORK  12     /* an approx_err, in exact pixels       */
+#define APPROX_CELL_WORK (APPROX_KNOT_WORK + \
+                          3 * (APPROX_KNOT_WORK + APPROX_ERR_WORK))
+                                /* a knot and three checks per cell     */
+
+static void get_fields(Row_t *row, int jj, double *ff)
+{
+   ff[0] = row->b_edge[jj];
+   ff[1] = row->b_off[jj];
+   ff[2] = row->b_scale[jj];
+   ff[3] = row->f_edge[jj];
+   ff[4] = row->f_off[jj];
+   ff[5] = row->f_scale[jj];
+}
+
+static void put_fields(Row_t *row, int jj, const double *ff,
+                       ApproxFrame_t *af, Frame_t *frame)
+{
+   row->b_edge[jj]     = ff[0];
+   row->b_off[jj]      = ff[1];
+   row->b_scale[jj]    = ff[2];
+   row->f_edge[jj]     = ff[3];
+   row->f_off[jj]      = ff[4];
+   row->f_scale[jj]    = ff[5];
+   row->lo[jj]         = af->lo;
+   row->hi[jj]         = af->hi;
+   row->min_pwr[jj]    = frame->min_pwr;
+   row->cnvt_scale[jj] = frame->cnvt_scale;
+}
+
+static inline int knot_pos(int kk, int step, int first, int last)
+{
+   int pp = first + kk * step;
+
+   return pp < last ? pp : last;
+}
+
+/* knot k0 at or before pixel pp, of the nn - 1 cells between nn knots */
+static inline int knot_at(int pp, int first, int step, int nn)
+{
+   int k0 = (pp - first) / step;
+
+   return nn < 2 ? 0 : k0 > nn - 2 ? nn - 2 : k0;
+}
+
+/* knots k0, k1 either side of pixel pp and its weight toward k1 */
+static inline void knot_cell(int pp, int first, int last, int step, int nn,
+                             int *k0, int *k1, double *tt)
+{
+   int p0, p1;
+
+   if(nn < 2) {
+      *k0 = *k1 = 0;
+      *tt = 0;
+      return;
+      }
+   *k0 = knot_at(pp, first, step, nn);
+   *k1 = *k0 + 1;
+   p0 = knot_pos(*k0, step, first, last);
+   p1 = knot_pos(*k1, step, first, last);
+   *tt = (double)(pp - p0) / (p1 - p0);
+}
+
+static void approx_line(ApproxFrame_t *af, int ii)
+{
+   double *r0, *r1, ty;
+   int     k0, k1, kk;
+
+   knot_cell(ii, af->y0, af->y1, af->step, af->ny, &k0, &k1, &ty);
+   r0 = &af->knot[k0 * af->nx * N_APPROX];
+   r1 = &af->knot[k1 * af->nx * N_APPROX];
+   for(kk = 0; kk < af->nx * N_APPROX; kk++)
+      af->line[kk] = r0[kk] + (r1[kk] - r0[kk]) * ty;
+   af->line_row = ii;
+   af->line_ky  = k0;
+}
+
+static inline void approx_at(ApproxFrame_t *af, int jj, double *ff)
+{
+   double *l0, *l1, tx;
+   int     k0, k1, kk;
+
+   knot_cell(jj, af->x0, af->x1, af->step, af->nx, &k0, &k1, &tx);
+   l0 = &af->line[k0 * N_APPROX];
+   l1 = &af->line[k1 * N_APPROX];
+   for(kk = 0; kk < N_APPROX; kk++)
+      ff[kk] = l0[kk] + (l1[kk] - l0[kk]) * tx;
+}
+
+static int approx_sample(Data_t *data, Subtile_t *sub, Row_t *scratch,
+                         Frame_t *frame, ApproxFrame_t *af, int jj, int ii,
+                         double *ff)
+{
+   float  min_x = sub->min_x, max_y = sub->max_y;
+   double yy = max_y - ii * data->image_res;
+
+   if(pixel_corrections(data, scratch, jj, frame, min_x, yy))
+      return 1;
+   get_fields(scratch, jj, ff);
+   af->lo = scratch->lo[jj];
+   af->hi = scratch->hi[jj];
+   return 0;
+}
+
+static double clamp_db(double power)
+{
+   double db = 10 * log10(power);
+
+   if (!(db >= -30)) db = -30;
+   if (db > 10) db = 10;
+   return db;
+}
+
+/* s0 before squaring, as power_pixel, for an unclamped c = dn - b_edge */
+static double s0_at(const double *ff, Frame_t *frame, double cc, int mission)
+{
+   double s0 = ((cc - ff[1]) / ff[2] - ff[3] - ff[4]) / ff[5];
+
+   if (mission == MISSION_MAMM)
+      return (s0 - frame->min_pwr) / frame->cnvt_scale;
+   return s0 / frame->cnvt_scale - frame->min_pwr;
+}
+
+/* Worst output error in dB at one point over the frame's input range.
+   Between break points the error is a ratio of affine functions of dn,
+   so it peaks at the ends of the range, where either clamp engages, or
+   where either s0 crosses the -30 or +10 dB output limits. */
+static double approx_err(Row_t *scratch, ApproxFrame_t *af, Frame_t *frame,
+                         const double *ex, const double *ap)
+{
+   static const double s0_lim[4] = { 3.1622776601683794e-02, 3.1622776601683795,
+                                     -3.1622776601683794e-02, -3.1622776601683795 };
+   const double *ff[2];
+   double dn[2 + 2 * 12], c_lim[2], aa, bb, at, db, worst = 0;
+   int    nn = 0, kk, ll;
+
+   ff[0] = ex;  ff[1] = ap;
+   c_lim[0] = af->lo;  c_lim[1] = af->hi;
+   dn[nn++] = af->dn_lo;
+   dn[nn++] = af->dn_hi;
+   for(kk = 0; kk < 2; kk++) {
+      for(ll = 0; ll < 2; ll++)
+         if(isfinite(c_lim[ll]))
+            dn[nn++] = c_lim[ll] + ff[kk][0];
+      bb = s0_at(ff[kk], frame, 0, scratch->mission);
+      aa = s0_at(ff[kk], frame, 1, scratch->mission) - bb;
+      for(ll = 0; ll < 4 && aa != 0; ll++)
+         dn[nn++] = (s0_lim[ll] - bb) / aa + ff[kk][0];
+      }
+
+   for(kk = 0; kk < 2 * nn; kk++) {
+      at = (kk & 1) ? ceil(dn[kk / 2]) : floor(dn[kk / 2]);
+      if(!(at >= af->dn_lo && at <= af->dn_hi) ||
+         ((kk & 1) && at == floor(dn[kk / 2])))
+         continue;
+      scratch->dn[0] = (short)at;
+      put_fields(scratch, 0, ex, af, frame);
+      power_pixel(scratch, 0);
+      db = clamp_db(scratch->power[0]);
+      put_fields(scratch, 0, ap, af, frame);
+      power_pixel(scratch, 0);
+      db = fabs(clamp_db(scratch->power[0]) - db);
+      if(!(db <= worst))
+         worst = db;
+      }
+   return worst;
+}
+
+#define NEED_CELL  1               /* need[] cell with this top left knot */
+#define NEED_KNOT  2               /* need[] knot sampled                 */
+#define NEED_DONE  4               /* need[] cell checked                 */
+#define NEED_EXACT 8               /* need[] cell converted exactly       */
+
+/* sample knot kx, ky unless it already is */
+static int approx_knot(Data_t *data, Subtile_t *sub, Row_t *scratch,
+                       Frame_t *frame, ApproxFrame_t *af, int kx, int ky)
+{
+   int kk = ky * af->nx + kx;
+
+   if(af->need[kk] & NEED_KNOT)
+      return 0;
+   af->need[kk] |= NEED_KNOT;
+   af->work -= APPROX_KNOT_WORK;
+   return approx_sample(data, sub, scratch, frame, af,
+                        knot_pos(kx, af->step, af->x0, af->x1),
+                        knot_pos(ky, af->step, af->y0, af->y1),
+                        &af->knot[kk * N_APPROX]);
+}
+
+/* error at pixel px, py, interpolated as approx_line and approx_at would */
+static int approx_test(Data_t *data, Subtile_t *sub, Row_t *scratch,
+                       Frame_t *frame, ApproxFrame_t *af, int px, int py,
+                       double *err)
+{
+   double  ex[N_APPROX], ap[N_APPROX], l0, l1, tx, ty, *r0, *r1;
+   int     kx0, kx1, ky0, ky1, dx, kk;
+
+   knot_cell(px, af->x0, af->x1, af->step, af->nx, &kx0, &kx1, &tx);
+   knot_cell(py, af->y0, af->y1, af->step, af->ny, &ky0, &ky1, &ty);
+   r0 = &af->knot[(ky0 * af->nx + kx0) * N_APPROX];
+   r1 = &af->knot[(ky1 * af->nx + kx0) * N_APPROX];
+   dx = (kx1 - kx0) * N_APPROX;
+   for(kk = 0; kk < N_APPROX; kk++) {
+      l0 = r0[kk] + (r1[kk] - r0[kk]) * ty;
+      l1 = r0[kk + dx] + (r1[kk + dx] - r0[kk + dx]) * ty;
+      ap[kk] = l0 + (l1 - l0) * tx;
+      }
+   af->work -= APPROX_KNOT_WORK + APPROX_ERR_WORK;
+   if(approx_sample(data, sub, scratch, frame, af, px, py, ex))
+      return -1;
+   *err = approx_err(scratch, af, frame, ex, ap);
+   return 0;
+}
+
+/* lay knots step apart over the frame's box and mark the knot cells
+   its index cells overlap, as frames interleave in a subtile; cell holds
+   the n_cell index cells, row by row of nc, that hold the frame, taken a
+   run of neighbours at a time.  The number of cells marked, -1 if out of
+   memory. */
+static long approx_need(ApproxFrame_t *af, int step, int scale,
+                        const int *cell, int n_cell, int nc)
+{
+   int    px, px1, py, cy, c0, c1, r0, r1, ll, end;
+   long   n_need = 0;
+   unsigned char *uptr;
+
+   af->step = step;
+   af->nx = (af->x1 - af->x0 + step - 1) / step + 1;
+   af->ny = (af->y1 - af->y0 + step - 1) / step + 1;
+   if((uptr = (unsigned char *)realloc(af->need, af->nx * af->ny)) == NULL)
+      return -1;
+   af->need = uptr;
+   memset(af->need, 0, af->nx * af->ny);
+
+   /* ---- knot cells under the frame's index cells ---- */
+   for(ll = 0; ll < n_cell; ll = end) {
+      for(end = ll + 1; end < n_cell && cell[end] == cell[end - 1] + 1 &&
+          cell[end] % nc != 0; end++)
+         ;
+      py = cell[ll] / nc * scale;
+      px = cell[ll] % nc * scale;
+      px1 = cell[end - 1] % nc * scale + scale - 1;
+      if(px1 < af->x0 || px > af->x1 ||
+         py + scale - 1 < af->y0 || py > af->y1)
+         continue;
+      c0 = knot_at(px > af->x0 ? px : af->x0, af->x0, step, af->nx);
+      c1 = knot_at(px1 < af->x1 ? px1 : af->x1, af->x0, step, af->nx);
+      r0 = knot_at(py > af->y0 ? py : af->y0, af->y0, step, af->ny);
+      r1 = knot_at(py + scale - 1 < af->y1 ? py + scale - 1 : af->y1,
+                   af->y0, step, af->ny);
+      for(cy = r0; cy <= r1; cy++)
+         memset(&af->need[cy * af->nx + c0], NEED_CELL, c1 - c0 + 1);
+      }
+   for(ll = 0; ll < af->nx * af->ny; ll++)
+      n_need += af->need[ll];
+   return n_need;
+}
+
+/* sample cell cx, cy's knots, then check its top and left edge
+   midpoints and centre, and its bottom and right ones where no needed
+   cell follows to check them: 0 within budget, 1 not (*err is then the
+   error found over it, at *fx, *fy), -1 the equations can't be used */
+static int approx_cell(Data_t *data, Subtile_t *sub, Row_t *scratch,
+                       Frame_t *frame, ApproxFrame_t *af, int cx, int cy,
+                       double budget, double *err, int *fx, int *fy)
+{
+   int    cnx = af->nx > 1 ? af->nx - 1 : 1;
+   int    cny = af->ny > 1 ? af->ny - 1 : 1;
+   int    px, py, ll, nn;
+   int    xx[2], yy[2], mx[3], my[3];
+
+   af->need[cy * af->nx + cx] |= NEED_DONE;
+   xx[0] = knot_pos(cx, af->step, af->x0, af->x1);
+   xx[1] = knot_pos(cx + 1, af->step, af->x0, af->x1);
+   yy[0] = knot_pos(cy, af->step, af->y0, af->y1);
+   yy[1] = knot_pos(cy + 1, af->step, af->y0, af->y1);
+   for(ll = 0; ll < 4; ll++)
+      if(cx + (ll & 1) < af->nx && cy + (ll >> 1) < af->ny &&
+         approx_knot(data, sub, scratch, frame, af,
+                     cx + (ll & 1), cy + (ll >> 1)))
+         return -1;
+
+   /* ---- midpoint columns mx and rows my, -1 = none ---- */
+   mx[0] = xx[0];
+   mx[1] = xx[1] - xx[0] < 2 ? -1 : (xx[0] + xx[1]) / 2;
+   mx[2] = cx + 1 < cnx &&
+           (af->need[cy * af->nx + cx + 1] & NEED_CELL) ? -1 : xx[1];
+   my[0] = yy[0];
+   my[1] = yy[1] - yy[0] < 2 ? -1 : (yy[0] + yy[1]) / 2;
+   my[2] = cy + 1 < cny &&
+           (af->need[(cy + 1) * af->nx + cx] & NEED_CELL) ? -1 : yy[1];
+   for(ll = 0; ll < 9; ll++) {
+      px = mx[ll % 3];
+      py = my[ll / 3];
+      nn = (ll % 3 == 1) + (ll / 3 == 1);
+      if(px < 0 || py < 0 || nn == 0 ||
+         (ll % 3 == 2 && xx[1] == xx[0]) ||
+         (ll / 3 == 2 && yy[1] == yy[0]))
+         continue;
+      if(approx_test(data, sub, scratch, frame, af, px, py, err))
+         return -1;
+      if(!(*err <= budget)) {
+         *fx = px;
+         *fy = py;
+         return 1;
+         }
+      }
+   return 0;
+}
+
+/* 1 if a tie in ties that moves anything lies within spacing of the
+   box x0..x1, y0..y1.  A point's ties are all listed by the grid cell it
+   is in, and a point off the grid has none, so the cells the box covers
+   list every tie that can reach it. */
+static int ties_reach(EdgeTies_t *ties, double x0, double y0, double x1,
+                      double y1)
+{
+   TieGrid_t *grid = &ties->grid;
+   EdgeTie_t *tie;
+   double     reach = ties->spacing * (1 + 1e-9), dx, dy;
+   double     fx0, fx1, fy0, fy1;
+   int        c0, c1, r0, r1, cx, cy, kk;
+
+   if(grid->start == NULL)
+      return 0;
+   fx0 = (x0 - grid->x0) / grid->cell;
+   fx1 = (x1 - grid->x0) / grid->cell;
+   fy0 = (y0 - grid->y0) / grid->cell;
+   fy1 = (y1 - grid->y0) / grid->cell;
+   if(fx1 < 0 || fx0 >= grid->nx || fy1 < 0 || fy0 >= grid->ny)
+      return 0;
+   c0 = fx0 < 0 ? 0 : (int)fx0;
+   c1 = fx1 >= grid->nx ? grid->nx - 1 : (int)fx1;
+   r0 = fy0 < 0 ? 0 : (int)fy0;
+   r1 = fy1 >= grid->ny ? grid->ny - 1 : (int)fy1;
+   for(cy = r0; cy <= r1; cy++)
+      for(cx = c0; cx <= c1; cx++)
+         for(kk = grid->start[cy * grid->nx + cx];
+             kk < grid->start[cy * grid->nx + cx + 1]; kk++) {
+            tie = &ties->tie[grid->list[kk]];
+            if(tie->target - tie->avg == 0)
+               continue;
+            dx = tie->map_xy.x < x0 ? x0 - tie->map_xy.x :
+                 tie->map_xy.x > x1 ? tie->map_xy.x - x1 : 0;
+            dy = tie->map_xy.y < y0 ? y0 - tie->map_xy.y :
+                 tie->map_xy.y > y1 ? tie->map_xy.y - y1 : 0;
+            if(!(dx * dx + dy * dy >= reach * reach))
+               return 1;
+            }
+   return 0;
+}
+
+/* 1 if an edge tie's cone reaches cell cx, cy: block ties where its
+   pixels are on the map, frame ties where they are in grand_geo, which
+   is affine, so the box of the corners holds the cell */
+static int approx_tied(Data_t *data, Subtile_t *sub, Frame_t *frame,
+                       ApproxFrame_t *af, int cx, int cy)
+{
+   float   min_x = sub->min_x, max_y = sub->max_y;
+   double  res = data->image_res, xx[2], yy[2], gx, gy;
+   double  lo_x = HUGE_VAL, hi_x = -HUGE_VAL, lo_y = HUGE_VAL, hi_y = -HUGE_VAL;
+   int     ll;
+
+   xx[0] = min_x + knot_pos(cx, af->step, af->x0, af->x1) * res;
+   xx[1] = min_x + knot_pos(cx + 1, af->step, af->x0, af->x1) * res;
+   yy[0] = max_y - knot_pos(cy + 1, af->step, af->y0, af->y1) * res;
+   yy[1] = max_y - knot_pos(cy, af->step, af->y0, af->y1) * res;
+   if(frame->block->blk_edgeties.n_ties > 0 &&
+      ties_reach(&frame->block->blk_edgeties, xx[0], yy[0], xx[1], yy[1]))
+      return 1;
+   if(frame->frm_edgeties.n_ties == 0)
+      return 0;
+   for(ll = 0; ll < 4; ll++) {
+      geo_at(&frame->block->geo, xx[ll & 1], yy[ll >> 1], &gx, &gy);
+      if(gx < lo_x) lo_x = gx;
+      if(gx > hi_x) hi_x = gx;
+      if(gy < lo_y) lo_y = gy;
+      if(gy > hi_y) hi_y = gy;
+      }
+   if(!(lo_x <= hi_x && lo_y <= hi_y))
+      return 1;
+   return ties_reach(&frame->frm_edgeties, lo_x, lo_y, hi_x, hi_y);
+}
+
+/* grid the frame with knots step apart: 0 within budget, 1 too rough
+   (*err is then the first error found over budget, at *fx, *fy), 2 not
+   worth the af->work left, -1 the equations can't be used, -2 out of
+   memory.  Only the knots of cells approx_need marks are sampled, less
+   those an edge tie reaches, which are left to be converted exactly, and
+   checking stops at the first cell over budget, so a rough frame fails
+   without its whole grid checked.  *fx < 0 on the first grid tried,
+   else where the one before failed. */
+static int approx_grid(Data_t *data, Subtile_t *sub, Row_t *scratch,
+                       int kk, const int *cell, int n_cell, int nc,
+                       ApproxFrame_t *af, int step, double budget, double *err,
+                       int *fx, int *fy)
+{
+   Frame_t *frame = &data->frames[kk];
+   double  *ptr;
+   int      cx, cy, cnx, cny, c0, r0, status;
+   long     n_need, n_exact = 0;
+
+   n_need = approx_need(af, step, data->index_res / data->image_res,
+                        cell, n_cell, nc);
+   if(n_need < 0)
+      return -2;
+   if(n_need * APPROX_CELL_WORK > af->work)
+      return 2;
+   cnx = af->nx > 1 ? af->nx - 1 : 1;
+   cny = af->ny > 1 ? af->ny - 1 : 1;
+
+   /* ---- bilinear interpolation can't follow the kinks of an edge
+           tie's cone, so the cells one reaches are converted exactly;
+           a frame they mostly cover isn't worth a grid ---- */
+   for(cy = 0; cy < cny; cy++)
+      for(cx = 0; cx < cnx; cx++)
+         if((af->need[cy * af->nx + cx] & NEED_CELL) &&
+            approx_tied(data, sub, frame, af, cx, cy)) {
+            af->need[cy * af->nx + cx] = NEED_EXACT;
+            n_exact++;
+            }
+   if(2 * n_exact > n_need)
+      return 2;
+
+   if((ptr = (double *)realloc(af->knot,
+            af->nx * af->ny * N_APPROX * sizeof(double))) == NULL)
+      return -2;
+   af->knot = ptr;
+   memset(af->knot, 0, af->nx * af->ny * N_APPROX * sizeof(double));
+   if((ptr = (double *)realloc(af->line,
+            af->nx * N_APPROX * sizeof(double))) == NULL)
+      return -2;
+   af->line = ptr;
+   af->line_row = -1;
+
+   /* ---- a finer grid first checks the cells around where the one
+           before failed, as that spot may now be a knot ---- */
+   if(*fx >= 0) {
+      c0 = knot_at(*fx, af->x0, step, af->nx);
+      r0 = knot_at(*fy, af->y0, step, af->ny);
+      for(cy = r0 > 0 ? r0 - 1 : 0; cy <= r0 && cy < cny; cy++)
+         for(cx = c0 > 0 ? c0 - 1 : 0; cx <= c0 && cx < cnx; cx++)
+            if((af->need[cy * af->nx + cx] & NEED_CELL) &&
+               (status = approx_cell(data, sub, scratch, frame, af, cx, cy,
+                                     budget, err, fx, fy)) != 0)
+               return status;
+      }
+
+   for(cy = 0; cy < cny; cy++)
+      for(cx = 0; cx < cnx; cx++)
+         if((af->need[cy * af->nx + cx] & (NEED_CELL | NEED_DONE)) ==
+            NEED_CELL &&
+            (status = approx_cell(data, sub, scratch, frame, af, cx, cy,
+                                  budget, err, fx, fy)) != 0)
+            return status;
+   return 0;
+}
+
+/* box, input range and count of the frame's valid pixels, from the
+   n_cell index cells in cell, a run of neighbouring index cells' stretch
+   of a row at a time; a stretch's ends are only searched for when it
+   has no-data pixels */
+static void approx_scan(RowKernel_t *kernel, ApproxFrame_t *af,
+                        const short *dn, int n_pixels, int scale,
+                        const int *cell, int n_cell, int nc)
+{
+   const short *d_row;
+   short        lo = SHRT_MAX, hi = SHRT_MIN;
+   int          ii, ll, end, px, py, nx, j0, j1, nn;
+
+   af->x0 = af->y0 = n_pixels;
+   af->x1 = af->y1 = -1;
+   af->n_pixels = 0;
+   for(ll = 0; ll < n_cell; ll = end) {
+      for(end = ll + 1; end < n_cell && cell[end] == cell[end - 1] + 1 &&
+          cell[end] % nc != 0; end++)
+         ;
+      py = cell[ll] / nc * scale;
+      px = cell[ll] % nc * scale;
+      nx = (end - ll) * scale;
+      for(ii = py; ii < py + scale; ii++) {
+         d_row = &dn[ii * n_pixels + px];
+         nn = kernel->scan(d_row, nx, &lo, &hi);
+         if(nn == 0)
+            continue;
+         for(j0 = 0; nn < nx && d_row[j0] == NO_DATA_VAL; j0++)
+            ;
+         for(j1 = nx - 1; nn < nx && d_row[j1] == NO_DATA_VAL; j1--)
+            ;
+         af->n_pixels += nn;
+         if(px + j0 < af->x0) af->x0 = px + j0;
+         if(px + j1 > af->x1) af->x1 = px + j1;
+         if(ii < af->y0) af->y0 = ii;
+         if(ii > af->y1) af->y1 = ii;
+         }
+      }
+   af->dn_lo = lo;
+   af->dn_hi = hi;
+}
+
+/* approx_grid the frame at ever finer steps while it could pay, and
+   the subtile can afford: 0 gridded, 1 or 2 converted exactly, -1
+   invalid, -2 out of memory, 3 no valid pixels; fc holds its n_cell
+   index cells */
+static int approx_frame(Data_t *data, Subtile_t *sub, Row_t *scratch,
+                        int kk, const short *dn, const int *fc, int n_cell,
+                        int nc, ApproxFrame_t *af, double budget, long afford)
+{
+   int    n_pixels = data->image_size;
+   int    scale = data->index_res / data->image_res;
+   int    ii, jj, step = 64, next, status;
+   int    fx = -1, fy = -1;
+   long   n_need;
+   double err;
+
+   if(data->frames[kk].parts < 0)
+      return -1;                       /* no pixel of it can be done */
+   if(afford < APPROX_CELL_WORK)
+      return 2;
+
+   /* ---- a frame whose index cells would cost more than half of what
+           they could hold to grid isn't worth a scan ---- */
+   af->x0 = n_pixels;
+   af->x1 = 0;
+   for(ii = 0; ii < n_cell; ii++) {
+      jj = fc[ii] % nc * scale;
+      if(jj < af->x0) af->x0 = jj;
+      if(jj + scale - 1 > af->x1) af->x1 = jj + scale - 1;
+      }
+   af->y0 = fc[0] / nc * scale;
+   af->y1 = fc[n_cell - 1] / nc * scale + scale - 1;
+   af->work = (long)n_cell * scale * scale / 2;
+   if(af->work > afford)
+      af->work = afford;
+   if((n_need = approx_need(af, step, scale, fc, n_cell, nc)) < 0)
+      return -2;
+   if(n_need * APPROX_CELL_WORK > af->work)
+      return 2;
+
+   approx_scan(data->kernel, af, dn, n_pixels, scale, fc, n_cell, nc);
+   if(af->n_pixels == 0)
+      return 3;
+   af->work = af->n_pixels / 2 < afford ? af->n_pixels / 2 : afford;
+
+   /* ---- bilinear error falls as step^2, so jump straight to the step
+           the first error over budget asks for; err is a lower bound on
+           the worst, so the jump never overshoots ---- */
+   for(;;) {
+      status = approx_grid(data, sub, scratch, kk, fc, n_cell, nc,
+                           af, step, budget, &err, &fx, &fy);
+      if(status != 1)
+         return status;
+      for(next = step / 2; next >= 8 &&
+          (double)next * next / step / step > budget / err; )
+         next /= 2;
+      if(next < 8)
+         return 1;
+      step = next;
+      }
+}
+
+Approx_t *build_approx(Data_t *data, Subtile_t *sub, Options_t *options,
+                       const short *dn, const unsigned char *i_buf)
+{
+   int            n_pixels = data->image_size;
+   int            scale = data->index_res / data->image_res;
+   Approx_t      *approx;
+   ApproxFrame_t *af;
+   Row_t         *scratch;
+   double         budget = options->approx / 2;
+   long           afford = (long)n_pixels * n_pixels / 128, work;
+   int            ii, kk, status, n_cell;
+   int            nc = n_pixels / scale, *first, *cell;
+   const int     *fc;
+
+   approx = (Approx_t *)calloc(1, sizeof(Approx_t));
+   if(approx == NULL)
+      return NULL;
+   approx->max_db = options->approx;
+   approx->n_frames = data->n_frames;
+   approx->frame = (ApproxFrame_t *)calloc(data->n_frames, sizeof(ApproxFrame_t));
+   first = (int *)calloc(data->n_frames + 1, sizeof(int));
+   cell = (int *)malloc(nc * nc * sizeof(int));
+   if(approx->frame == NULL || first == NULL || cell == NULL ||
+      (scratch = alloc_row(n_pixels)) == NULL) {
+      free(first);
+      free(cell);
+      free_approx(approx);
+      return NULL;
+      }
+   scratch->mission = data->mission;
+
+   /* ---- index cells of each frame, cell[first[kk]..first[kk+1]) ---- */
+   for(ii = 0; ii < nc * nc; ii++)
+      if(i_buf[ii] < data->n_frames)
+         first[i_buf[ii] + 1]++;
+   for(kk = 0; kk < data->n_frames; kk++)
+      first[kk + 1] += first[kk];
+   for(ii = 0; ii < nc * nc; ii++)
+      if(i_buf[ii] < data->n_frames)
+         cell[first[i_buf[ii]]++] = ii;
+   for(kk = data->n_frames; kk > 0; kk--)
+      first[kk] = first[kk - 1];
+   first[0] = 0;
+
+   for(kk = 0; kk < data->n_frames; kk++) {
+      af = &approx->frame[kk];
+      fc = &cell[first[kk]];
+      n_cell = first[kk + 1] - first[kk];
+      if(n_cell == 0)
+         continue;
+      af->n_pixels = 0;
+      status = approx_frame(data, sub, scratch, kk, dn, fc, n_cell, nc,
+                            af, budget, afford);
+      /* ---- what trying spent comes off what the subtile can afford,
+              and a grid pays about half its pixels back ---- */
+      work = af->n_pixels / 2 < afford ? af->n_pixels / 2 : afford;
+      if(af->n_pixels > 0)
+         afford -= work - af->work;
+      if(status == 0)
+         afford += af->n_pixels / 2;
+      if(status == 3)
+         continue;
+      af->state = APPROX_GRID;
+      if(status == -2) {
+         free_row(scratch);
+         free(first);
+         free(cell);
+         free_approx(approx);
+         return NULL;
+         }
+      if(status != 0) {
+         af->state = status < 0 ? APPROX_BAD : APPROX_EXACT;
+         free(af->knot);
+         free(af->line);
+         free(af->need);
+         af->knot = af->line = NULL;
+         af->need = NULL;
+         }
+      if(options->debug >= 10)
+         printf("%s: frame %s %s\n", sub->name, data->frames[kk].name,
+                af->state == APPROX_GRID ? "gridded" :
+                af->state == APPROX_EXACT ? "exact" : "invalid");
+      if(options->debug >= 10 && af->state == APPROX_GRID) {
+         for(ii = n_cell = 0; ii < af->nx * af->ny; ii++)
+            n_cell += (af->need[ii] & NEED_EXACT) != 0;
+         printf("   %d x %d knots %d pixels apart, %d cells exact\n",
+                af->nx, af->ny, af->step, n_cell);
+         }
+      }
+
+   free_row(scratch);
+   free(first);
+   free(cell);
+   return approx;
+}
+
+int approx_corrections(Data_t *data, Subtile_t *sub, Row_t *row,
+                       int ii, int jj, int index_value)
+{
+   ApproxFrame_t *af = &row->approx->frame[index_value];
+   Frame_t       *frame = &data->frames[index_value];
+   float          min_x = sub->min_x, max_y = sub->max_y;
+   double         ff[N_APPROX];
+
+   switch(af->state) {
+      case APPROX_GRID:
+         if(af->line_row != ii)
+            approx_line(af, ii);
+         if(af->need[af->line_ky * af->nx +
+                     knot_at(jj, af->x0, af->step, af->nx)] & NEED_EXACT)
+            break;
+         approx_at(af, jj, ff);
+         put_fields(row, jj, ff, af, frame);
+         return 0;
+      case APPROX_BAD:
+         return 1;
+      default:
+         break;
+      }
+   return pixel_corrections(data, row, jj, frame, min_x,
+                            max_y - ii * data->image_res);
+}
+
+/* 1 if pixel jj of row ii is in a cell of the frame's grid converted
+   exactly; *end is cut back to the first pixel past jj that isn't
+   alike, so the run kernels can take the exact ones a stretch at a time */
+int approx_exact(ApproxFrame_t *af, int ii, int jj, int *end)
+{
+   const unsigned char *need;
+   int kx, exact, pp;
+
+   if(af->state != APPROX_GRID)
+      return 0;
+   if(af->line_row != ii)
+      approx_line(af, ii);
+   need  = &af->need[af->line_ky * af->nx];
+   kx    = jj < af->x0 ? 0 : knot_at(jj, af->x0, af->step, af->nx);
+   exact = (need[kx] & NEED_EXACT) != 0;
+   for(kx++; kx < af->nx - 1; kx++) {
+      pp = knot_pos(kx, af->step, af->x0, af->x1);
+      if(pp >= *end)
+         break;
+      if(((need[kx] & NEED_EXACT) != 0) != exact) {
+         *end = pp;
+         break;
+         }
+      }
+   return exact;
+}
+
+void free_approx(Approx_t *approx)
+{
+   int ii;
+
+   if(approx == NULL)
+      return;
+   if(approx->frame != NULL)
+      for(ii = 0; ii < approx->n_frames; ii++) {
+         free(approx->frame[ii].knot);
+         free(approx->frame[ii].line);
+         free(approx->frame[ii].need);
+         }
+   free(approx->frame);
+   free(approx);
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   int GetSigma0 (options, data, pt)
+
+    Purpose:   To get value from line & sample that a selected x,y map to.
+
+    Arguments:   Options_t *options - Pointer to command line options.
+      Data_t   *data      - Pointer to program data structure.
+      Sample_t *pt        - Pixel to convert; s0 and geo_x/y are set.
+
+  Other than getting the transformation parameters from the data structures,
+  this was taken directly from Pete's code.
+
+  sigma0_as is the one body.  It is instantiated for each mission, with
+  and without -db 30 tracing and for each set of the frame's parts, and
+  GetSigma0 calls the one the tile and the frame need, so a pixel runs
+  no test for a correction it doesn't get.  A frame with a malformed
+  equation goes through the body with every test made as it goes, to
+  report it as before.
+ 
+    Returns:   Returns 0 on success. Otherwise, returns 1 on failure.
+
+----------------------------------------------------------------------------fe*/
+
+INLINE int sigma0_as(
+          Options_t *options,
+          Data_t *data,
+          Sample_t *pt,
+          int mission,
+          int trace,
+          int parts)
+{
+  static char fn[] = "GetSigma0";
+  double scale, offset, min, max;
+  double x1, y1;
+  GeoInv_t *geo;
+  Frame_t *frame;
+  Block_t *block;
+
+  (void)options;
+  frame = &data->frames[pt->index_value];
+  block = frame->block;
+  /* ---- Set the min max values alowed for the data type ---- */
+  min = 0;
+  max = 32767;
+
+  /* ---- Initialize reversal value ---- */
+  pt->s0 = pt->value;
+
+  /* ---- Reverse edge balancing for block ---- */
+  if (HAS_PART(PART_BLOCK_TIES, block->blk_edgeties.n_ties > 0)) {
+    offset = FindOffsetInGrid(pt->x, pt->y, &block->blk_edgeties);
+    pt->s0 -= offset;
+    if (pt->s0 < min)
+      pt->s0 = min;
+    else if (pt->s0 > max)
+      pt->s0 = max;
+    if (trace) {
+      printf("%s: Reversing edge offset (%lf): %lf\n",
+         fn, offset, pt->s0);
+    }
+  }
+
+
+  /* ---- Reverse grand_rad ---- */
+  if (HAS_PART(PART_BLOCK_EQN, block->blk_offset.n_coeffs > 0)) {
+    if (parts < 0 && block->blk_offset.order < 0) {
+      printf("%s: Invalid equations\n", fn);
+      return(1);
+    }
+    offset = ApplyPlanAtPt(pt->x, pt->y, &block->blk_offset);
+
+    pt->s0 -= offset;
+    if (trace) {
+      printf("%s: Reversing offset (%lf): %lf\n",
+         fn, offset, pt->s0);
+    }
+
+    if (parts < 0 && block->blk_scale.order < 0) {
+      printf("%s: Invalid equations\n", fn);
+      return(1);
+    }
+    scale = ApplyPlanAtPt(pt->x, pt->y, &block->blk_scale);
+    scale = pow(10, scale);
+    pt->s0 /= scale;
+    if (trace) {
+      printf("%s: Reversing scale (%lf): %lf\n",
+         fn, scale, pt->s0);
+    }
   }
-  coeffptr = block->blk_geom.firstcoeff;
-  aa  = coeffptr->value;
-  coeffptr = coeffptr->next;
-  bb  = coeffptr->value;
-  coeffptr = coeffptr->next;
-  cc  = coeffptr->value;
-  coeffptr = coeffptr->next;
-  if (cc == 0) {
+
+  /* >>>> Reverse grand_geo <<<< */
+
+  /* ---- Init ---- */
+  x1 = pt->x;
+  y1 = pt->y;
+  geo = &block->geo;
+  if (parts < 0 && !geo->valid) {
     printf("%s: Invalid geometric equation coefficients", fn);
     return(1);
   }
-  dd  = coeffptr->value;
-  diff = dd / cc;
 
-  /* ---- Compute x, y location prior to geometric transformation ---- */
-  data->geo_y = (diff * x1 + y1 - diff * aa + bb) / (diff * dd + cc);
-  data->geo_x = (x1 - aa - dd * y1) / cc;
+  /* ---- Compute x, y location prior to geometric transformation ---- */
+  pt->geo_y = (geo->diff * x1 + y1 - geo->diff_aa + geo->bb) / geo->denom;
+  pt->geo_x = (x1 - geo->aa - geo->dd * y1) / geo->cc;
+
+    if (trace) {
+    printf("%s: Reversing geometric adj:", fn);
+    printf(" (%.2lf, %.2lf)->(%.2lf, %.2lf)\n",
+       pt->x, pt->y, pt->geo_x, pt->geo_y);
+  }
+
+  /* ---- Reverse edge balancing using coords from grand_geo reversal ---- */
+  if (HAS_PART(PART_FRAME_TIES, frame->frm_edgeties.n_ties > 0)) {
+    offset = FindOffsetInGrid(pt->geo_x, pt->geo_y, &frame->frm_edgeties);
+    pt->s0 -= offset;
+    if (trace) {
+      printf("%s: Reversing edge offset (%lf): %lf\n",
+         fn, offset, pt->s0);
+    }
+  }
+
+  /* ---- Reverse rad_bal using coords from grand_geo reversal ---- */
+  if (HAS_PART(PART_FRAME_EQN, frame->frm_offset.n_coeffs > 0)) {
+    if (parts < 0 && frame->frm_offset.order < 0) {
+      printf("%s: Invalid equation\n", fn);
+      return(1);
+    }
+    offset = ApplyPlanAtPt(pt->geo_x, pt->geo_y, &frame->frm_offset);
+    pt->s0 -= offset;
+    if (trace) {
+      printf("%s: Reversing offset (%lf): %lf\n",
+         fn, offset, pt->s0);
+    }
+
+    if (parts < 0 && frame->frm_scale.order < 0) {
+      printf("%s: Invalid equation", fn);
+      return(1);
+    }
+    scale = ApplyPlanAtPt(pt->geo_x, pt->geo_y, &frame->frm_scale);
+    scale = pow(10, scale);
+    pt->s0 /= scale;
+    if (trace) {
+      printf("%s: Reversing scale (%lf): %lf\n", fn, scale, pt->s0);
+    }
+  }
+
+  if (mission == MISSION_MAMM) {
+/* this is the mamm version of the scale/offset calculation */
+
+  pt->s0 -= frame->min_pwr;
+
+    if (trace) {
+    printf("%s: Reversing offset (%lf): %lf\n",
+            fn, frame->min_pwr, pt->s0);
+  }
+
+  pt->s0 /= frame->cnvt_scale;
+
+    if (trace) {
+    printf("%s: Reversing scale (%lf): %lf\n",
+       fn, frame->cnvt_scale, pt->s0);
+  }
+
+  } else {
+
+/* this is the amm1 version.  */
+
+  pt->s0 /= frame->cnvt_scale;
+
+  /* ---- Reverse original scale / offset ---- */
+    if (trace) {
+    printf("%s: Reversing scale (%lf): %lf\n",
+       fn, frame->cnvt_scale, pt->s0);
+  }
+
+  pt->s0 -= frame->min_pwr;
+
+    if (trace) {
+    printf("%s: Reversing offset (%lf): %lf\n",
+            fn, frame->min_pwr, pt->s0);
+  }
+
+  }
+
+  /* ---- Reverse conversion to amplitude from power ---- */
+    if (trace) {
+    printf("%s: Amplitude: %lf\n", fn, pt->s0);
+  }
+  pt->s0 *= pt->s0;
+    if (trace) {
+    printf("%s: Power: %lf\n", fn, pt->s0);
+  }
+
+  /* ---- Obtain sigma0 from power ---- */
+  pt->s0 = 10 * log10(pt->s0);
+    if (trace) {
+    printf("%s: Sigma Nought: %lf\n", fn, pt->s0);
+  }
+
+  /* ---- Return success ---- */
+  return(0);
+}
+
+typedef int (*Sigma0Kernel_t)(Options_t *options, Data_t *data, Sample_t *pt);
+
+/* sigma0_<mission>_<trace>_<parts>; the mission is MISSION_MAMM or
+   MISSION_AMM1 spelled as a number so it pastes into the name */
+#define SIGMA0_KERNEL(mm, tt, pp) \
+   static int sigma0_##mm##_##tt##_##pp(Options_t *options, Data_t *data, \
+                                        Sample_t *pt) \
+      { return sigma0_as(options, data, pt, mm, tt, pp); }
+#define SIGMA0_KERNELS(mm, tt) \
+   SIGMA0_KERNEL(mm, tt, 0)  SIGMA0_KERNEL(mm, tt, 1)  \
+   SIGMA0_KERNEL(mm, tt, 2)  SIGMA0_KERNEL(mm, tt, 3)  \
+   SIGMA0_KERNEL(mm, tt, 4)  SIGMA0_KERNEL(mm, tt, 5)  \
+   SIGMA0_KERNEL(mm, tt, 6)  SIGMA0_KERNEL(mm, tt, 7)  \
+   SIGMA0_KERNEL(mm, tt, 8)  SIGMA0_KERNEL(mm, tt, 9)  \
+   SIGMA0_KERNEL(mm, tt, 10) SIGMA0_KERNEL(mm, tt, 11) \
+   SIGMA0_KERNEL(mm, tt, 12) SIGMA0_KERNEL(mm, tt, 13) \
+   SIGMA0_KERNEL(mm, tt, 14) SIGMA0_KERNEL(mm, tt, 15)
+#define SIGMA0_ROW(mm, tt) { \
+   sigma0_##mm##_##tt##_0,  sigma0_##mm##_##tt##_1,  \
+   sigma0_##mm##_##tt##_2,  sigma0_##mm##_##tt##_3,  \
+   sigma0_##mm##_##tt##_4,  sigma0_##mm##_##tt##_5,  \
+   sigma0_##mm##_##tt##_6,  sigma0_##mm##_##tt##_7,  \
+   sigma0_##mm##_##tt##_8,  sigma0_##mm##_##tt##_9,  \
+   sigma0_##mm##_##tt##_10, sigma0_##mm##_##tt##_11, \
+   sigma0_##mm##_##tt##_12, sigma0_##mm##_##tt##_13, \
+   sigma0_##mm##_##tt##_14, sigma0_##mm##_##tt##_15 }
+
+SIGMA0_KERNELS(0, 0) SIGMA0_KERNELS(0, 1)
+SIGMA0_KERNELS(1, 0) SIGMA0_KERNELS(1, 1)
+
+static const Sigma0Kernel_t sigma0_kernels[N_MISSIONS][2][N_PARTS] = {
+   { SIGMA0_ROW(0, 0), SIGMA0_ROW(0, 1) },
+   { SIGMA0_ROW(1, 0), SIGMA0_ROW(1, 1) },
+};
+
+/* a frame with a malformed equation, checked a step at a time */
+static int sigma0_checked(Options_t *options, Data_t *data, Sample_t *pt)
+{
+  return sigma0_as(options, data, pt, data->mission, options->debug >= 30, -1);
+}
+
+int GetSigma0 (
+          Options_t *options,
+          Data_t *data,
+          Sample_t *pt)
+{
+  int parts = data->frames[pt->index_value].parts;
+
+  if (parts < 0)
+    return sigma0_checked(options, data, pt);
+  return sigma0_kernels[data->mission][options->debug >= 30][parts](
+            options, data, pt);
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   query_points
+
+    Purpose:   Sigma nought at every coordinate in a file, or stdin for
+               "-", one "x y" per line, blank lines and # comments
+               skipped.  Each point goes to the first subtile in
+               MASTER.TXT holding it, as -point does.  The points are
+               grouped by subtile and -threads workers take a subtile
+               at a time, reading just the pixels and index values the
+               points need.  A record "x y sigma0 frame block" is
+               printed for every point, in the order given, as soon
+               as the points before it are done.  Points off the tile
+               or on no data give NO_DATA_VAL with frame and block -1.
+
+    Exits:   Exit status is 0 on success, 1 if a subtile could not be
+             read or a point could not be converted
+
+----------------------------------------------------------------------------fe*/
+
+typedef struct {           /* one -points coordinate */
+   double  x, y;
+   double  s0;                  /* NO_DATA_VAL until converted       */
+   int     frame;               /* index value, -1 if none           */
+   int     block;               /* block id, -1 if none              */
+   int     sub;                 /* subtile holding it, -1 if none    */
+} Point_t;
+
+typedef struct {           /* shared by the -points workers */
+   Data_t          *data;
+   Options_t       *options;
+   Point_t         *point;
+   int              n_points;
+   int             *order;          /* point numbers grouped by subtile */
+   int             *first;          /* n_subs + 1 offsets into order    */
+   unsigned char   *done;           /* per point                        */
+   int              next_sub;       /* next subtile to take             */
+   int              next_out;       /* first point not yet printed      */
+   int              n_failed;       /* points that couldn't be done     */
+   pthread_mutex_t  lock;
+} Points_t;
+
+/* ---- all of a file, or stdin for "-" ---- */
+static char *read_text(const char *path, size_t *size)
+{
+   FILE   *fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+   char   *text = NULL, *grown;
+   size_t  nn = 0, got, cap = 0;
+
+   if(fp == NULL) {
+      printf("missing %s\n", path);
+      return NULL;
+      }
+   do {
+      if(nn == cap) {
+         cap = cap ? 2 * cap : 65536;
+         if((grown = (char *)realloc(text, cap)) == NULL) {
+            printf("no memory for %s\n", path);
+            free(text);
+            text = NULL;
+            break;
+            }
+         text = grown;
+         }
+      nn += got = fread(text + nn, 1, cap - nn, fp);
+      } while(got > 0);
+   if(fp != stdin)
+      fclose(fp);
+   *size = nn;
+   return text;
+}
+
+static int load_points(Points_t *pp, const char *path)
+{
+   Scan_t      scan;
+   Subtile_t  *sub;
+   Point_t    *point, *grown;
+   const char *line, *eol, *at;
+   char       *text;
+   size_t      size;
+   int         n_line = 0, cap = 0, ss;
+
+   if((text = read_text(path, &size)) == NULL)
+      return 1;
+   scan.pos = text;
+   scan.end = text + size;
+   while(next_line(&scan, &line, &eol)) {
+      n_line++;
+      if(line == eol || *line == '#')
+         continue;
+      if(pp->n_points == cap) {
+         cap = cap ? 2 * cap : 1024;
+         if((grown = (Point_t *)realloc(pp->point, cap * sizeof(Point_t))) == NULL) {
+            printf("no memory for %d points\n", cap);
+            free(text);
+            return 1;
+            }
+         pp->point = grown;
+         }
+      point = &pp->point[pp->n_points];
+      at = line;
+      if(!scan_double(&at, eol, &point->x) || !scan_double(&at, eol, &point->y)) {
+         printf("%s line %d is not x y, skipped\n", path, n_line);
+         continue;
+         }
+      point->s0 = NO_DATA_VAL;
+      point->frame = point->block = point->sub = -1;
+      for(ss = 0; ss < pp->data->n_subs && point->sub < 0; ss++) {
+         sub = &pp->data->subs[ss];
+         if(point->x >= sub->min_x && point->x <= sub->max_x &&
+            point->y >= sub->min_y && point->y <= sub->max_y)
+            point->sub = ss;
+         }
+      pp->n_points++;
+      }
+   free(text);
+   return 0;
+}
+
+/* ---- the points in one subtile, a pixel and index value each ---- */
+static int query_sub(Points_t *pp, int ss)
+{
+   Subtile_t *sub = &pp->data->subs[ss];
+   Data_t    *data = tile_of(pp->data, sub);
+   Options_t *options = pp->options;
+   Point_t   *point;
+   Sample_t   pt;
+   char       path[1024];
+   int        n_pixels = data->image_size;
+   int        scale = data->index_res / data->image_res;
+   int        fd_img, fd_idx, kk, ii, jj, status = 0;
+   short      dn;
+   unsigned char index;
+   off_t      offset, i_offset;
+
+   sprintf(path, "%s/IMAGES.DIR/%s.IMG", data->tile_dir, sub->name);
+   fd_img = open_sized(path, (size_t)n_pixels * n_pixels * sizeof(short));
+   sprintf(path, "%s/INDICES.DIR/%s.IDX", data->tile_dir, sub->name);
+   fd_idx = fd_img < 0 ? -1 :
+            open_sized(path, (size_t)data->index_size * data->index_size);
+   if(fd_idx < 0) {
+      printf("query_points: can't read %s\n", sub->name);
+      if(fd_img >= 0)
+         close(fd_img);
+      return pp->first[ss + 1] - pp->first[ss];
+      }
+
+   for(kk = pp->first[ss]; kk < pp->first[ss + 1]; kk++) {
+      point = &pp->point[pp->order[kk]];
+      ii = (sub->max_y - point->y) / data->image_res;
+      jj = (point->x - sub->min_x) / data->image_res;
+      if(ii > n_pixels - 1) ii = n_pixels - 1;
+      if(jj > n_pixels - 1) jj = n_pixels - 1;
+      offset = (off_t)ii * n_pixels + jj;
+      i_offset = ii/scale * n_pixels/scale+ jj/scale;
+      if(pread(fd_img, &dn, sizeof(dn), offset * sizeof(short)) != sizeof(dn) ||
+         pread(fd_idx, &index, 1, i_offset) != 1) {
+         status++;
+         continue;
+         }
+      if(options->swap_in)
+         data->kernel->swap(&dn, 1);
+      if(dn == NO_DATA_VAL)
+         continue;
+      if(index >= data->n_frames) {
+         status++;
+         continue;
+         }
+      pt.value = (double)dn;
+      pt.index_value = index;
+      pt.x = point->x;
+      pt.y = point->y;
+      point->frame = index;
+      point->block = data->frames[index].block->id;
+      if(GetSigma0(options, data, &pt)) {
+         status++;
+         continue;
+         }
+      point->s0 = pt.s0;
+      }
+
+   close(fd_img);
+   close(fd_idx);
+   return status;
+}
+
+/* ---- mark a subtile's points done and print what is now in order ---- */
+static void flush_points(Points_t *pp, int ss, int n_failed)
+{
+   Point_t *point;
+   int      kk;
+
+   pthread_mutex_lock(&pp->lock);
+   pp->n_failed += n_failed;
+   for(kk = pp->first[ss]; kk < pp->first[ss + 1]; kk++)
+      pp->done[pp->order[kk]] = 1;
+   for(; pp->next_out < pp->n_points && pp->done[pp->next_out]; pp->next_out++) {
+      point = &pp->point[pp->next_out];
+      printf("%lf %lf %lf %d %d\n", point->x, point->y, point->s0,
+             point->frame, point->block);
+      }
+   pthread_mutex_unlock(&pp->lock);
+}
+
+static void *points_stage(void *arg)
+{
+   Points_t *pp = (Points_t *)arg;
+   double    t0;
+   int       ss, n_failed;
+
+   stats_thread(pp->data, pp->options, "points");
+   for(;;) {
+      pthread_mutex_lock(&pp->lock);
+      while(pp->next_sub < pp->data->n_subs &&
+            pp->first[pp->next_sub] == pp->first[pp->next_sub + 1])
+         pp->next_sub++;
+      ss = pp->next_sub++;
+      pthread_mutex_unlock(&pp->lock);
+      if(ss >= pp->data->n_subs)
+         return NULL;
+      t0 = stats_start();
+      n_failed = query_sub(pp, ss);
+      stats_stop(STAGE_CONVERT, t0);
+      stats_count(COUNT_SUBS, 1);
+      stats_count(COUNT_PIXELS, pp->first[ss + 1] - pp->first[ss]);
+      flush_points(pp, ss, n_failed);
+      }
+}
+
+int query_points(Data_t *data, Options_t *options)
+{
+   Points_t   pp;
+   pthread_t *workers;
+   int        ii, ss, n_groups = 0, n_threads = options->n_threads;
+
+   memset(&pp, 0, sizeof(pp));
+   pp.data = data;
+   pp.options = options;
+   pthread_mutex_init(&pp.lock, NULL);
+   if(load_points(&pp, options->points)) {
+      free(pp.point);
+      return 1;
+      }
+
+   /* ---- group the point numbers by subtile, in input order ---- */
+   pp.first = (int *)calloc(data->n_subs + 2, sizeof(int));
+   pp.order = (int *)malloc((pp.n_points + 1) * sizeof(int));
+   pp.done  = (unsigned char *)calloc(pp.n_points + 1, 1);
+   if(pp.first == NULL || pp.order == NULL || pp.done == NULL) {
+      printf("no memory for %d points\n", pp.n_points);
+      free(pp.point);
+      free(pp.first);
+      free(pp.order);
+      free(pp.done);
+      return 1;
+      }
+   for(ii = 0; ii < pp.n_points; ii++)
+      if((ss = pp.point[ii].sub) >= 0)
+         pp.first[ss + 2]++;
+      else
+         pp.done[ii] = 1;
+   for(ss = 0; ss < data->n_subs; ss++) {
+      n_groups += pp.first[ss + 2] > 0;
+      pp.first[ss + 2] += pp.first[ss + 1];
+      }
+   for(ii = 0; ii < pp.n_points; ii++)
+      if((ss = pp.point[ii].sub) >= 0)
+         pp.order[pp.first[ss + 1]++] = ii;
+
+   if(n_threads > n_groups)
+      n_threads = n_groups;
+   if(n_threads < 1)
+      n_threads = 1;
+   if(options->debug >= 1)
+      printf("querying %d points in %d subtiles with %d threads\n",
+             pp.n_points, n_groups, n_threads);
+
+   /* ---- the calling thread is a worker too ---- */
+   workers = (pthread_t *)calloc(n_threads, sizeof(pthread_t));
+   for(ii = 1; ii < n_threads && workers; ii++)
+      if(pthread_create(&workers[ii], NULL, points_stage, &pp)) {
+         printf("query_points: unable to start worker %d\n", ii);
+         break;
+         }
+   points_stage(&pp);
+   while(workers && --ii >= 1)
+      pthread_join(workers[ii], NULL);
+   free(workers);
+
+   /* ---- points off the tile that no subtile flushed ---- */
+   for(; pp.next_out < pp.n_points; pp.next_out++) {
+      Point_t *point = &pp.point[pp.next_out];
+      printf("%lf %lf %lf %d %d\n", point->x, point->y, point->s0,
+             point->frame, point->block);
+      }
+   if(pp.n_failed)
+      printf("query_points: %d points could not be converted\n", pp.n_failed);
+
+   pthread_mutex_destroy(&pp.lock);
+   free(pp.point);
+   free(pp.first);
+   free(pp.order);
+   free(pp.done);
+   return pp.n_failed != 0;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   serve
+
+    Purpose:   Answer sigma nought queries for as long as asked, with the
+               tile loaded once.  -serve - reads requests on stdin and
+               answers on stdout; -serve path listens on a Unix domain
+               socket there, each connection in a thread of its own.
+               One request per line, one answer per request:
+
+                  point x y
+                     ok x y sigma0 frame block usec
+                  window x y nx ny
+                     ok nx ny usec, then ny lines of nx sigma0, the
+                     pixel holding x, y first, then east and south
+                  stats
+                     ok requests n errors n hits n misses n
+                        mean_us t max_us t resident n
+                  reload
+                     ok reloaded usec
+                  quit
+
+               anything wrong gives "error <why>".  usec is the time the
+               request took in the server.  No data and points off the
+               tile give NO_DATA_VAL, frame and block -1.
+
+               The IMG and IDX of the last -resident subtiles used (16
+               by default) stay mapped, least recently used going first,
+               so a query in one of them touches no file at all.  Once a
+               second at most the key files are checked and, if their
+               size or time has changed, the tile is loaded again, via
+               the metadata cache, between requests.  A -tiles mosaic
+               is only loaded again when asked with reload.
+
+    Exits:   Exit status is 0 when stdin ends, 1 if the socket can't be
+             set up
+
+----------------------------------------------------------------------------fe*/
+
+#define SERVE_WINDOW_MAX (1 << 20)  /* pixels in one window answer */
+
+typedef struct {           /* a subtile kept mapped by -serve */
+   int                 sub;         /* subtile number, -1 = empty      */
+   int                 refs;        /* requests using it               */
+   int                 ready;       /* 0 loading, 1 mapped, -1 failed  */
+   unsigned long long  used;        /* serve clock when last used      */
+   Input_t             img;         /* in host order                   */
+   Input_t             idx;
+} Resident_t;
+
+typedef struct {           /* shared by the -serve sessions */
+   Data_t             *data;        /* the tile, replaced by reloads   */
+   const char         *tile_dir;    /* a copy, outlives reloads        */
+   Options_t          *options;
+   KeyStamp_t          stamp[N_KEY_FILES];  /* size and time, no hash  */
+   double              checked;     /* when the key files were last    */
+   pthread_rwlock_t    tile;        /* requests read, reloads write    */
+   pthread_mutex_t     lock;        /* everything below                */
+   pthread_cond_t      change;      /* a resident loaded or released   */
+   Resident_t         *res;
+   int                 n_res;
+   unsigned long long  clock;
+   unsigned long long  n_requests, n_errors, n_hits, n_misses;
+   double              total_us, max_us;
+} Serve_t;
+
+/* ---- size and time of the key files, 1 if one is missing ---- */
+static int stat_keys(const char *tile_dir, KeyStamp_t *stamp)
+{
+   struct stat st;
+   char        path[1024];
+   int         ii;
+
+   memset(stamp, 0, N_KEY_FILES * sizeof(KeyStamp_t));
+   for(ii = 0; ii < N_KEY_FILES; ii++) {
+      snprintf(path, sizeof(path), "%s/%s", tile_dir, key_files[ii]);
+      if(stat(path, &st))
+         return 1;
+      stamp[ii].size  = st.st_size;
+      stamp[ii].mtime = (long long)st.st_mtim.tv_sec * 1000000000 +
+                        st.st_mtim.tv_nsec;
+      }
+   return 0;
+}
+
+/* ---- unmap every resident subtile, no request may hold one ---- */
+static void drop_residents(Serve_t *sv)
+{
+   int ii;
+
+   for(ii = 0; ii < sv->n_res; ii++) {
+      close_input(&sv->res[ii].img);
+      close_input(&sv->res[ii].idx);
+      sv->res[ii].sub = -1;
+      sv->res[ii].ready = 0;
+      }
+}
+
+/* ---- load the tile again, taking the place of the old one ---- */
+static int reload_tile(Serve_t *sv)
+{
+   Data_t *data = (Data_t *)calloc(1, sizeof(Data_t));
+
+   if(data == NULL)
+      return 1;
+   data->tile_dir = strdup(sv->tile_dir);
+   if(Depend(sv->options, data)) {
+      FreeTile(data);
+      return 1;
+      }
+   pthread_mutex_lock(&sv->lock);
+   drop_residents(sv);
+   pthread_mutex_unlock(&sv->lock);
+   FreeTile(sv->data);
+   sv->data = data;
+   stat_keys(sv->tile_dir, sv->stamp);
+   if(sv->options->debug >= 1)
+      printf("serve: reloaded %s\n", data->tile_dir);
+   return 0;
+}
+
+/* ---- between requests, reload if the key files changed ---- */
+static void check_keys(Serve_t *sv)
+{
+   KeyStamp_t stamp[N_KEY_FILES];
+   double     now = wall_now();
+   int        changed;
+
+   pthread_mutex_lock(&sv->lock);
+   if(now - sv->checked < 1) {
+      pthread_mutex_unlock(&sv->lock);
+      return;
+      }
+   sv->checked = now;
+   pthread_mutex_unlock(&sv->lock);
+
+   if(stat_keys(sv->tile_dir, stamp))
+      return;
+   pthread_rwlock_rdlock(&sv->tile);
+   changed = memcmp(stamp, sv->stamp, sizeof(stamp));
+   pthread_rwlock_unlock(&sv->tile);
+   if(changed) {
+      pthread_rwlock_wrlock(&sv->tile);
+      if(memcmp(stamp, sv->stamp, sizeof(stamp)) && reload_tile(sv))
+         printf("serve: key files changed but would not load, "
+                "keeping the old tile\n");
+      pthread_rwlock_unlock(&sv->tile);
+      }
+}
+
+/* ---- map subtile ss, or find it mapped; NULL if it can't be read ---- */
+static Resident_t *hold_sub(Serve_t *sv, int ss)
+{
+   Data_t     *data = sv->data;
+   Resident_t *res, *pick;
+   char        path[1024];
+   int         ii, ok;
+
+   pthread_mutex_lock(&sv->lock);
+   for(;;) {
+      pick = NULL;
+      for(ii = 0; ii < sv->n_res; ii++) {
+         res = &sv->res[ii];
+         if(res->sub == ss)
+            break;
+         if(res->refs == 0 && (pick == NULL || (pick->sub >= 0 &&
+                               (res->sub < 0 || res->used < pick->used))))
+            pick = res;
+         }
+      if(ii < sv->n_res || pick)
+         break;
+      pthread_cond_wait(&sv->change, &sv->lock);    /* all in use */
+      }
+
+   if(ii < sv->n_res) {
+      res->refs++;
+      res->used = ++sv->clock;
+      sv->n_hits++;
+      while(res->ready == 0)
+         pthread_cond_wait(&sv->change, &sv->lock);
+      ok = res->ready > 0;
+      if(!ok && --res->refs == 0)
+         res->sub = -1;
+      pthread_mutex_unlock(&sv->lock);
+      return ok ? res : NULL;
+      }
+
+   /* ---- a miss: take the slot and map it without the lock ---- */
+   res = pick;
+   close_input(&res->img);
+   close_input(&res->idx);
+   res->sub = ss;
+   res->refs = 1;
+   res->ready = 0;
+   res->used = ++sv->clock;
+   sv->n_misses++;
+   pthread_mutex_unlock(&sv->lock);
+
+   sprintf(path, "%s/IMAGES.DIR/%s.IMG", tile_of(data, &data->subs[ss])->tile_dir,
+           data->subs[ss].name);
+   ok = !open_input(path, (size_t)data->image_size * data->image_size *
+                    sizeof(short), sv->options->swap_in, &res->img);
+   sprintf(path, "%s/INDICES.DIR/%s.IDX", tile_of(data, &data->subs[ss])->tile_dir,
+           data->subs[ss].name);
+   ok = ok && !open_input(path, (size_t)data->index_size * data->index_size,
+                          0, &res->idx);
+   if(ok && sv->options->swap_in)
+      data->kernel->swap((short *)res->img.addr,
+                         res->img.size / sizeof(short));
+   if(!ok) {
+      close_input(&res->img);
+      close_input(&res->idx);
+      }
+
+   pthread_mutex_lock(&sv->lock);
+   res->ready = ok ? 1 : -1;
+   if(!ok && --res->refs == 0)
+      res->sub = -1;
+   pthread_cond_broadcast(&sv->change);
+   pthread_mutex_unlock(&sv->lock);
+   return ok ? res : NULL;
+}
+
+static void let_go(Serve_t *sv, Resident_t *res)
+{
+   if(res == NULL)
+      return;
+   pthread_mutex_lock(&sv->lock);
+   res->refs--;
+   pthread_cond_broadcast(&sv->change);
+   pthread_mutex_unlock(&sv->lock);
+}
+
+/*
+ * Sigma nought of the pixel holding xx, yy, which is in the first
+ * subtile holding it, as -point does.  *held is the resident subtile
+ * the request has in hand, kept while its pixels stay in that one.  Returns
+ * 0 with NO_DATA_VAL and frame -1 for no data or off the tile, 1 if
+ * the subtile can't be read or the pixel converted.
+ */
+static int serve_pixel(Serve_t *sv, Resident_t **held, double xx, double yy,
+                       double *s0, int *frame, int *block)
+{
+   Data_t    *data = sv->data, *tile;
+   Subtile_t *sub = NULL;
+   Sample_t   pt;
+   int        n_pixels = data->image_size;
+   int        scale = data->index_res / data->image_res;
+   int        ss, ii, jj, index;
+   short      dn;
+
+   *s0 = NO_DATA_VAL;
+   *frame = *block = -1;
+
+   for(ss = 0; ss < data->n_subs; ss++) {
+      sub = &data->subs[ss];
+      if(xx >= sub->min_x && xx <= sub->max_x &&
+         yy >= sub->min_y && yy <= sub->max_y)
+         break;
+      }
+   if(ss == data->n_subs)
+      return 0;
+   if(*held == NULL || (*held)->sub != ss) {
+      let_go(sv, *held);
+      if((*held = hold_sub(sv, ss)) == NULL)
+         return 1;
+      }
+
+   ii = (sub->max_y - yy) / data->image_res;
+   jj = (xx - sub->min_x) / data->image_res;
+   if(ii > n_pixels - 1) ii = n_pixels - 1;
+   if(jj > n_pixels - 1) jj = n_pixels - 1;
+   dn = ((const short *)(*held)->img.addr)[ii * n_pixels + jj];
+   if(dn == NO_DATA_VAL)
+      return 0;
+   index = ((const unsigned char *)(*held)->idx.addr)
+              [ii/scale * n_pixels/scale+ jj/scale];
+   tile = tile_of(data, sub);
+   if(index >= tile->n_frames)
+      return 1;
+
+   pt.value = (double)dn;
+   pt.index_value = index;
+   pt.x = xx;
+   pt.y = yy;
+   if(GetSigma0(sv->options, tile, &pt))
+      return 1;
+   *s0 = pt.s0;
+   *frame = index;
+   *block = tile->frames[index].block->id;
+   return 0;
+}
+
+/* ---- one request line; 1 to end the session ---- */
+static int serve_request(Serve_t *sv, const char *line, const char *eol,
+                         FILE *out)
+{
+   Resident_t *held = NULL;
+   const char *pp = line, *word;
+   double      t0 = wall_now(), us, xx, yy, *value;
+   size_t      len;
+   int         nx, ny, ii, jj, frame, block, status = 0;
+
+   word = scan_word(&pp, eol, &len);
+   if(word == NULL)
+      return 0;
+   if(len == 4 && !memcmp(word, "quit", 4))
+      return 1;
+   check_keys(sv);
+
+   if(len == 5 && !memcmp(word, "point", 5)) {
+      if(!scan_double(&pp, eol, &xx) || !scan_double(&pp, eol, &yy)) {
+         fprintf(out, "error point takes x y\n");
+         status = 1;
+         }
+      else {
+         double s0;
+         pthread_rwlock_rdlock(&sv->tile);
+         status = serve_pixel(sv, &held, xx, yy, &s0, &frame, &block);
+         let_go(sv, held);
+         pthread_rwlock_unlock(&sv->tile);
+         us = (wall_now() - t0) * 1e6;
+         if(status)
+            fprintf(out, "error can't convert %lf %lf\n", xx, yy);
+         else
+            fprintf(out, "ok %lf %lf %lf %d %d %.1f\n", xx, yy, s0, frame,
+                    block, us);
+         }
+      }
+   else if(len == 6 && !memcmp(word, "window", 6)) {
+      if(!scan_double(&pp, eol, &xx) || !scan_double(&pp, eol, &yy) ||
+         !scan_int(&pp, eol, &nx) || !scan_int(&pp, eol, &ny) ||
+         nx < 1 || ny < 1 || (double)nx * ny > SERVE_WINDOW_MAX) {
+         fprintf(out, "error window takes x y nx ny, at most %d pixels\n",
+                 SERVE_WINDOW_MAX);
+         status = 1;
+         }
+      else if((value = (double *)malloc((size_t)nx * ny * sizeof(double))) == NULL) {
+         fprintf(out, "error no memory for the window\n");
+         status = 1;
+         }
+      else {
+         pthread_rwlock_rdlock(&sv->tile);
+         for(ii = 0; ii < ny && !status; ii++)
+            for(jj = 0; jj < nx && !status; jj++)
+               status = serve_pixel(sv, &held, xx + jj * sv->data->image_res,
+                                    yy - ii * sv->data->image_res,
+                                    &value[ii * nx + jj], &frame, &block);
+         let_go(sv, held);
+         pthread_rwlock_unlock(&sv->tile);
+         us = (wall_now() - t0) * 1e6;
+         if(status)
+            fprintf(out, "error can't convert the window\n");
+         else {
+            fprintf(out, "ok %d %d %.1f\n", nx, ny, us);
+            for(ii = 0; ii < ny; ii++)
+               for(jj = 0; jj < nx; jj++)
+                  fprintf(out, jj < nx - 1 ? "%lf " : "%lf\n", value[ii * nx + jj]);
+            }
+         free(value);
+         }
+      }
+   else if(len == 5 && !memcmp(word, "stats", 5)) {
+      pthread_mutex_lock(&sv->lock);
+      for(ii = nx = 0; ii < sv->n_res; ii++)
+         nx += sv->res[ii].sub >= 0;
+      fprintf(out, "ok requests %llu errors %llu hits %llu misses %llu "
+              "mean_us %.1f max_us %.1f resident %d\n", sv->n_requests,
+              sv->n_errors, sv->n_hits, sv->n_misses,
+              sv->n_requests ? sv->total_us / sv->n_requests : 0.0,
+              sv->max_us, nx);
+      pthread_mutex_unlock(&sv->lock);
+      fflush(out);
+      return 0;
+      }
+   else if(len == 6 && !memcmp(word, "reload", 6)) {
+      pthread_rwlock_wrlock(&sv->tile);
+      status = reload_tile(sv);
+      pthread_rwlock_unlock(&sv->tile);
+      if(status)
+         fprintf(out, "error reload failed, keeping the old tile\n");
+      else
+         fprintf(out, "ok reloaded %.1f\n", (wall_now() - t0) * 1e6);
+      }
+   else {
+      fprintf(out, "error unknown request %.*s\n", (int)len, word);
+      status = 1;
+      }
+   fflush(out);
+
+   us = (wall_now() - t0) * 1e6;
+   pthread_mutex_lock(&sv->lock);
+   sv->n_requests++;
+   sv->n_errors += status != 0;
+   sv->total_us += us;
+   if(us > sv->max_us)
+      sv->max_us = us;
+   pthread_mutex_unlock(&sv->lock);
+   return 0;
+}
+
+static void serve_session(Serve_t *sv, FILE *in, FILE *out)
+{
+   char    *line = NULL;
+   size_t   cap = 0;
+   ssize_t  len;
+
+   while((len = getline(&line, &cap, in)) >= 0) {
+      while(len > 0 && (line[len - 1] == '\n' || is_blank(line[len - 1])))
+         len--;
+      if(serve_request(sv, line, line + len, out))
+         break;
+      }
+   free(line);
+}
+
+typedef struct {           /* a socket connection's thread */
+   Serve_t *sv;
+   int      fd;
+} Client_t;
+
+static void *serve_client(void *arg)
+{
+   Client_t *client = (Client_t *)arg;
+   FILE     *in, *out;
+   int       fd2 = dup(client->fd);
+
+   in  = fdopen(client->fd, "r");
+   out = fd2 < 0 ? NULL : fdopen(fd2, "w");
+   if(in && out)
+      serve_session(client->sv, in, out);
+   if(in) fclose(in); else close(client->fd);
+   if(out) fclose(out); else if(fd2 >= 0) close(fd2);
+   free(client);
+   return NULL;
+}
+
+int serve(Data_t *data, Options_t *options)
+{
+   static char fn[] = "serve";
+   struct sockaddr_un addr;
+   Serve_t    sv;
+   Client_t  *client;
+   pthread_t  thread;
+   int        ii, fd, conn, status = 0;
+
+   memset(&sv, 0, sizeof(sv));
+   sv.data = data;
+   sv.tile_dir = strdup(data->tile_dir);
+   sv.options = options;
+   sv.n_res = options->resident > 0 ? options->resident : 16;
+   if((sv.res = (Resident_t *)calloc(sv.n_res, sizeof(Resident_t))) == NULL) {
+      printf("%s: no memory for %d resident subtiles\n", fn, sv.n_res);
+      return 1;
+      }
+   for(ii = 0; ii < sv.n_res; ii++)
+      sv.res[ii].sub = -1;
+   pthread_rwlock_init(&sv.tile, NULL);
+   pthread_mutex_init(&sv.lock, NULL);
+   pthread_cond_init(&sv.change, NULL);
+   stat_keys(data->tile_dir, sv.stamp);
+   sv.checked = wall_now();
+   signal(SIGPIPE, SIG_IGN);
+
+   if(!strcmp(options->serve, "-")) {
+      setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+      serve_session(&sv, stdin, stdout);
+      }
+   else {
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if(strlen(options->serve) >= sizeof(addr.sun_path)) {
+         printf("%s: socket path %s is too long\n", fn, options->serve);
+         status = 1;
+         }
+      else if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+         status = 1;
+      else {
+         strcpy(addr.sun_path, options->serve);
+         unlink(options->serve);
+         if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+            listen(fd, 64)) {
+            printf("%s: can't listen on %s\n", fn, options->serve);
+            status = 1;
+            }
+         if(status == 0 && options->debug >= 1)
+            printf("%s: listening on %s\n", fn, options->serve);
+         fflush(stdout);
+         while(status == 0 && (conn = accept(fd, NULL, NULL)) >= 0) {
+            client = (Client_t *)malloc(sizeof(Client_t));
+            if(client == NULL) {
+               close(conn);
+               continue;
+               }
+            client->sv = &sv;
+            client->fd = conn;
+            if(pthread_create(&thread, NULL, serve_client, client)) {
+               close(conn);
+               free(client);
+               continue;
+               }
+            pthread_detach(thread);
+            }
+         close(fd);
+         }
+      }
+
+   drop_residents(&sv);
+   free(sv.res);
+   pthread_rwlock_destroy(&sv.tile);
+   pthread_mutex_destroy(&sv.lock);
+   pthread_cond_destroy(&sv.change);
+   FreeTile(sv.data);
+   free((char *)sv.tile_dir);
+   return status;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   Data_t *LoadTile(tile_dir, debug)
+
+    Purpose:   Collect the frame, block and subtile tables of the RAMS
+               tile in tile_dir, the same way Depend does for tilesig, so
+               that other programs can convert pixels in-process.  It
+               uses and refreshes the tile's TILESIG.CACHE as tilesig
+               does.
+
+    Arguments:   char *tile_dir - directory holding MASTER.TXT, NULL for "."
+                 int   debug    - debug print level while loading
+
+    Returns:   The loaded tile, or NULL on failure.
+
+----------------------------------------------------------------------------fe*/
+Data_t *LoadTile(const char *tile_dir, int debug)
+{
+   Options_t options;
+   Data_t   *data;
+
+   memset(&options, 0, sizeof(options));
+   options.debug = debug;
+
+   if((data = (Data_t *)calloc(1, sizeof(Data_t))) == NULL)
+      return NULL;
+   if((data->tile_dir = strdup(tile_dir ? tile_dir : ".")) == NULL) {
+      free(data);
+      return NULL;
+      }
+
+   if(Depend(&options, data)) {
+      FreeTile(data);
+      return NULL;
+      }
+   return data;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   int GetSigma0Block(data, n, x, y, dn, index, s0)
+
+    Purpose:   Convert a buffer of n image values to sigma nought.  Pixel
+               ii has value dn[ii], frame index[ii] and map coordinates
+               x[ii], y[ii].  Nothing outside the caller's buffers is
+               written, so this is safe to call from several threads on
+               the same tile.
+
+    Returns:   s0[] holds unclamped sigma nought in dB, or NO_DATA_VAL for
+               no-data input and for pixels that could not be converted.
+               Returns 0 on success, 1 if any pixel could not be converted.
+
+----------------------------------------------------------------------------fe*/
+int GetSigma0Block(Data_t *data, int n, const double *x, const double *y,
+                   const short *dn, const unsigned char *index, double *s0)
+{
+   Options_t options;       /* library calls never trace */
+   Sample_t  pt;
+   int       ii, status = 0;
+
+   memset(&options, 0, sizeof(options));
+
+   for(ii = 0; ii < n; ii++) {
+      pt.value = (double)dn[ii];
+      if(pt.value == NO_DATA_VAL) {
+         s0[ii] = NO_DATA_VAL;
+         continue;
+         }
+      pt.index_value = (int)index[ii];
+      if(pt.index_value >= data->n_frames) {
+         s0[ii] = NO_DATA_VAL;
+         status = 1;
+         continue;
+         }
+      pt.x = x[ii];
+      pt.y = y[ii];
+      if(GetSigma0(&options, data, &pt)) {
+         s0[ii] = NO_DATA_VAL;
+         status = 1;
+         continue;
+         }
+      s0[ii] = pt.s0;
+      }
+
+   return status;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   FreeTile(data)
+
+    Purpose:   Release everything LoadTile allocated for a tile.
+
+----------------------------------------------------------------------------fe*/
+
+/* ---- tables loaded by load_cache point into its map ---- */
+static void free_owned(Data_t *data, void *ptr)
+{
+   uintptr_t at = (uintptr_t)ptr, base = (uintptr_t)data->cache.addr;
+
+   if(data->cache.addr && at >= base && at < base + data->cache.size)
+      return;
+   free(ptr);
+}
+
+static void free_coeffs(Data_t *data, coeffs_t *coeffs)
+{
+   free_owned(data, coeffs->value);
+   free_owned(data, coeffs->horner);
+   coeffs->value = NULL;
+   coeffs->horner = NULL;
+   coeffs->n_coeffs = 0;
+}
+
+void FreeTile(Data_t *data)
+{
+   int ii;
+
+   if(data == NULL)
+      return;
+
+   /* ---- a mosaic's tiles share its region ---- */
+   for(ii = 0; ii < data->n_tiles; ii++) {
+      data->tiles[ii]->roi = NULL;
+      FreeTile(data->tiles[ii]);
+      }
+   free(data->tiles);
+
+   for(ii = 0; ii < data->n_frames; ii++) {
+      free_owned(data, data->frames[ii].name);
+      free_coeffs(data, &data->frames[ii].frm_offset);
+      free_coeffs(data, &data->frames[ii].frm_scale);
+      free_owned(data, data->frames[ii].frm_edgeties.tie);
+      free_owned(data, data->frames[ii].frm_edgeties.grid.start);
+      free_owned(data, data->frames[ii].frm_edgeties.grid.list);
+      }
+   for(ii = 0; ii < data->n_blocks; ii++) {
+      free_owned(data, data->blocks[ii].name);
+      free_coeffs(data, &data->blocks[ii].blk_offset);
+      free_coeffs(data, &data->blocks[ii].blk_scale);
+      free_coeffs(data, &data->blocks[ii].blk_geom);
+      free_owned(data, data->blocks[ii].blk_edgeties.tie);
+      free_owned(data, data->blocks[ii].blk_edgeties.grid.start);
+      free_owned(data, data->blocks[ii].blk_edgeties.grid.list);
+      }
+   free(data->frames);
+   free(data->blocks);
+   free(data->subs);
+   free_roi(data);
+   free_writer(data);
+   free(data->output_image);
+   free(data->index_image);
+   free(data->overview);
+   free(data->tile_dir);
+   close_input(&data->cache);
+   free(data);
+}
+
+/*fs----------------------------------------------------------------------------
+
+   Procedure: double FindOffsetAtPt(xx, yy, tie_array, n_ties, spacing)
+
+   Purpose:   To compute offset at point based on distance to tie points and
+      corresponding tie offset values.
+
+   Arguments:
+      double       xx, yy     - Map coordinates at which to compute offset
+      EdgeTie_t    *tie_array - Ptr to array of tie points
+      int          n_ties     - Number of ties in tie_array
+      double       spacing    - Tie point spacing
+
+   Returns:   Offset value.
+
+----------------------------------------------------------------------------fe*/
+double FindOffsetAtPt(
+   double     xx,
+   double     yy,
+   EdgeTie_t  *tie_array,
+   int        n_ties,
+   double     spacing)
+{
+   int max, min, mid, ii;
+   double mid_x;
+   double dx, dy, dist;
+   double offset;
+
+
+   /* ---- Init ---- */
+   offset = 0;
+   min = 0;
+   max = n_ties - 1;
+
+
+   /* >>>> Find ties within spacing distance <<<< */
+
+   /* ---- Find lowest valid x value ---- */
+   while (tie_array[max].map_xy.x > tie_array[min].map_xy.x)
+   {
+      mid = (max + min) / 2;
+      mid_x = tie_array[mid].map_xy.x;
+      if (mid_x >= xx - spacing) {
+         max = mid;
+      }
+      else {
+     if (min == mid) {
+            min = max;
+     }
+         else {
+            min = mid;
+     }
+      }
+   }
+
+   /* ---- Step through ties until out of target range ---- */
+   for (ii = min; ii < n_ties; ii++) {
+
+      /* ---- See if we've passed x range ---- */
+      dx = tie_array[ii].map_xy.x - xx;
+      if (dx > spacing) {
+         break;
+      }
+
+      /* ---- See if y is within range ---- */
+      dy = tie_array[ii].map_xy.y - yy;
+      if (dy < 0) dy = -dy;
+      if (dy > spacing) continue;
+
+      /* ---- Check distance ---- */
+      dist = sqrt(dx * dx + dy * dy);
+      if (dist > spacing) continue;
+
+      /* ---- See if point is close enough to contribute to offset ---- */
+      if (dist < spacing) {
+
+         /* ---- Pt found, calculate contribution to offset ---- */
+         offset += (tie_array[ii].target - tie_array[ii].avg) *
+               ((spacing - dist) / spacing);
+
+      }
+   }
+
+   /* ---- Return offset ---- */
+   return(offset);
+}
+
+/*fs----------------------------------------------------------------------------
+
+   Procedure: double FindOffsetInGrid(xx, yy, ties)
+
+   Purpose:   FindOffsetAtPt through the grid built by index_ties.  Only
+      the ties listed for the cell holding the point are tried, with the
+      same tests and in the same order, so the offset matches the x
+      ordered scan bit for bit.  A point outside the grid is more than
+      spacing from every tie.
+
+   Arguments:
+      double       xx, yy     - Map coordinates at which to compute offset
+      EdgeTies_t   *ties      - Indexed edge ties
+
+   Returns:   Offset value.
+
+----------------------------------------------------------------------------fe*/
+double FindOffsetInGrid(
+   double     xx,
+   double     yy,
+   EdgeTies_t *ties)
+{
+   return grid_offset(xx, yy, ties, NULL);
+}
+
+/* ---- and with n_tried, how many ties the cell listed are added to it */
+static double grid_offset(double xx, double yy, EdgeTies_t *ties,
+                          long *n_tried)
+{
+   TieGrid_t *grid = &ties->grid;
+   double spacing = ties->spacing;
+   double lo_x = xx - spacing;
+   double fx, fy, dx, dy, dist;
+   double offset = 0;
+   int kk, cell;
+
+   if(grid->start == NULL)
+      return(0);
+   fx = (xx - grid->x0) / grid->cell;
+   fy = (yy - grid->y0) / grid->cell;
+   if(!(fx >= 0 && fx < grid->nx && fy >= 0 && fy < grid->ny))
+      return(0);
+   cell = (int)fy * grid->nx + (int)fx;
+   if (n_tried)
+      *n_tried += grid->start[cell + 1] - grid->start[cell];
+
+   for (kk = grid->start[cell]; kk < grid->start[cell + 1]; kk++) {
+      EdgeTie_t *tie = &ties->tie[grid->list[kk]];
+
+      /* ---- the scan in FindOffsetAtPt starts at xx - spacing ---- */
+      if (tie->map_xy.x < lo_x) continue;
+      dx = tie->map_xy.x - xx;
+      if (dx > spacing) continue;
+
+      dy = tie->map_xy.y - yy;
+      if (dy < 0) dy = -dy;
+      if (dy > spacing) continue;
+
+      dist = sqrt(dx * dx + dy * dy);
+      if (dist < spacing)
+         offset += (tie->target - tie->avg) * ((spacing - dist) / spacing);
+   }
+
+   return(offset);
+}
+
+/*fs----------------------------------------------------------------------------
+
+   Procedure:   double ApplyEqnAtPt(xx, yy, coeffs)
+
+   Purpose: To apply equation to a map point.  This is the original
+            term by term evaluation; the conversion itself uses the
+            compiled form (ApplyPlanAtPt) and this is kept as the
+            reference it is checked against.
+
+   Arguments:
+      double xx, yy   - Map coords of location to apply equation.
+      coeffs_t *coeffs - Structure containing equation coefficients.
+
+   Returns: Returns value on success or -9999 on failure.
+
+----------------------------------------------------------------------------fe*/
+double ApplyEqnAtPt(
+   double xx,
+   double yy,
+   coeffs_t *coeffs)
+{
+   static char fn[] = "ApplyEqnAtPt";
+   int order;
+   int terms;
+   int ii;
+   int kk;
+   double pow_x, pow_y, offset;
+
+   /* ---- Init ---- */
+   order  = 0;
+   terms  = 0;
+   offset = 0;
+   kk     = 0;
+   if ((coeffs == NULL) || (coeffs->value == NULL)) {
+      printf("%s: Invalid list of equation coefficients\n", fn);
+      return -9999;
+   }
+
+   /* ---- Get order from number of terms ---- */
+   while (terms < coeffs->n_coeffs ) {
+      order++;
+      terms = 0;
+      for (ii = order; ii > 0; ii-- ) {
+         terms += ii;
+      }
+      terms += order + 1;
+   }
+
+   /* ---- Calculate value for x, y ---- */
+   while (order > 0) {
+      pow_y = 0;
+      for (pow_x = order; pow_x >= 0; pow_x--) {
+         offset += pow(xx, pow_x) * pow(yy, pow_y) * coeffs->value[kk];
+         pow_y++;
+         kk++;
+
+         /* ---- Check list just in case ---- */
+         if (kk >= coeffs->n_coeffs) {
+            printf("%s: Invalid list of equation coefficients\n", fn);
+            return -9999;
+     }
+      }
+      order--;
+   }
+   offset += coeffs->value[kk];
+
+   /* ---- Return value ---- */
+   return offset;
+}
+
+/*fs----------------------------------------------------------------------------
+
+   Procedure:   write_sub
+
+   Purpose:     Hand a converted subtile to the output layer, which owns
+                sub->buf and sub->i_input from here on.
+
+                Subtiles are written a band at a time, a band being the
+                subtiles that share a top row.  Finished subtiles are
+                held until their whole band is done, then its rows go
+                out left to right through a pwritev coalescer that
+                merges every piece landing next to the previous one in
+                the file.  Side by side subtiles become one call per
+                row, and subtiles spanning the mosaic's full width make
+                the band one contiguous run written IOV_MAX pieces at a
+                time.  Offsets are explicit, so any worker may flush a
+                band; the lock only guards the band counts.
+
+                If more than HOLD_BYTES are waiting on incomplete bands,
+                as when MASTER.TXT lists subtiles down columns, a
+                subtile is written on its own instead of held.
+
+                skip_sub tells the layer a subtile won't come, so its
+                band can still go out.  For -out_order the subtile is
+                byte swapped in place on the way in, by the row kernel's
+                swap stage.
+
+   Exits:       Exit status is 0 on success, 1 on failure
+
+----------------------------------------------------------------------------fe*/
+
+#define HOLD_BYTES ((size_t)256 << 20)
+
+#define SUB_PENDING 0
+#define SUB_HELD    1
+#define SUB_DONE    2      /* written, or skipped */
+
+typedef struct {           /* subtiles sharing a top row */
+   int         n_subs;
+   int         n_done;          /* held, written or skipped           */
+   int        *subs;            /* into data->subs, left to right     */
+   int        *held;            /* scratch for the one that flushes   */
+} Band_t;
+
+struct Writer_s {          /* output layer state */
+   pthread_mutex_t lock;
+   int         n_bands;
+   Band_t     *bands;
+   int        *band_of;         /* each subtile's band                */
+   char       *state;           /* each subtile's SUB_ state          */
+   size_t      held;            /* bytes in held subtiles             */
+};
+
+typedef struct {           /* pieces waiting to go out in one pwritev */
+   int         fd;
+   off_t       offset;          /* file offset of the first piece     */
+   size_t      bytes;
+   int         n;
+   struct iovec iov[IOV_MAX];
+} Gather_t;
+
+static int gather_flush(Gather_t *gg)
+{
+   ssize_t done;
+
+   if(gg->n == 0)
+      return 0;
+   done = gg->n == 1 ?
+          pwrite(gg->fd, gg->iov[0].iov_base, gg->bytes, gg->offset) :
+          pwritev(gg->fd, gg->iov, gg->n, gg->offset);
+   gg->n = 0;
+   stats_count(COUNT_WRITTEN, done > 0 ? done : 0);
+   return done != (ssize_t)gg->bytes;
+}
+
+static int gather(Gather_t *gg, const void *ptr, size_t len, off_t offset)
+{
+   if(gg->n > 0 &&
+      (gg->n == IOV_MAX || offset != gg->offset + (off_t)gg->bytes))
+      if(gather_flush(gg))
+         return 1;
+   if(gg->n == 0) {
+      gg->offset = offset;
+      gg->bytes  = 0;
+      }
+   gg->iov[gg->n].iov_base = (void *)ptr;
+   gg->iov[gg->n].iov_len  = len;
+   gg->n++;
+   gg->bytes += len;
+   return 0;
+}
+
+/* ---- rows of subs[0..n_subs-1], in x order, data then index ---- */
+static int write_subs(Data_t *data, const int *subs, int n_subs)
+{
+   Gather_t   gg;                   /* 16k, fine on a worker's stack */
+   Subtile_t *sub;
+   Image_t   *out = data->output_image, *index = data->index_image;
+   int        scale = data->index_res / data->image_res;
+   int        ii, kk, n_rows = 0, status = 0;
+
+   for(kk = 0; kk < n_subs; kk++)
+      if(n_rows < data->subs[subs[kk]].clip_ny)
+         n_rows = data->subs[subs[kk]].clip_ny;
+
+   gg.fd = out->fd;
+   gg.n  = 0;
+   for(ii = 0; ii < n_rows && !status; ii++)
+      for(kk = 0; kk < n_subs && !status; kk++) {
+         sub = &data->subs[subs[kk]];
+         if(ii >= sub->clip_ny)
+            continue;
+         status = gather(&gg, &sub->buf[(size_t)ii * sub->clip_nx],
+                         sub->clip_nx * sizeof(short),
+                         ((off_t)(sub->img_ul_y + ii) * out->size_x +
+                          sub->img_ul_x) * sizeof(short));
+         }
+   if(!status)
+      status = gather_flush(&gg);
+
+   if(index == NULL || status)
+      return status;
+
+   /* ---- the index rows are in the mapped IDX, clip them out of it ---- */
+   gg.fd = index->fd;
+   gg.n  = 0;
+   for(ii = 0; ii < n_rows / scale && !status; ii++)
+      for(kk = 0; kk < n_subs && !status; kk++) {
+         sub = &data->subs[subs[kk]];
+         if(ii >= sub->clip_ny / scale)
+            continue;
+         status = gather(&gg, &sub->i_buf[(size_t)(sub->clip_y / scale + ii) *
+                                          data->index_size + sub->clip_x / scale],
+                         sub->clip_nx / scale,
+                         (off_t)(sub->index_ul_y + ii) * index->size_x +
+                         sub->index_ul_x);
+         }
+   if(!status)
+      status = gather_flush(&gg);
+   return status;
+}
+
+static void release_sub(Subtile_t *sub)
+{
+   free(sub->buf);
+   sub->buf = NULL;
+   close_input(&sub->i_input);
+   sub->i_buf = NULL;
+}
+
+/* ---- sort subtiles by top row, then left column ---- */
+typedef struct {           /* a subtile's corner, for sorting */
+   int y, x, index;
+   } SubKey_t;
+
+static int cmp_sub(const void *aa, const void *bb)
+{
+   const SubKey_t *k1 = (const SubKey_t *)aa;
+   const SubKey_t *k2 = (const SubKey_t *)bb;
+
+   if(k1->y != k2->y)
+      return k1->y - k2->y;
+   return k1->x - k2->x;
+}
+
+int plan_writes(Data_t *data)
+{
+   Writer_t *wr;
+   SubKey_t *key;
+   int      *order;
+   int       ii, nb;
+
+   wr = (Writer_t *)calloc(1, sizeof(Writer_t));
+   order = (int *)malloc(2 * data->n_subs * sizeof(int));
+   key = (SubKey_t *)malloc((data->n_subs + 1) * sizeof(SubKey_t));
+   if(wr == NULL || order == NULL || key == NULL) {
+      free(wr);
+      free(order);
+      free(key);
+      return 1;
+      }
+   wr->bands   = (Band_t *)calloc(data->n_subs, sizeof(Band_t));
+   wr->band_of = (int *)malloc(data->n_subs * sizeof(int));
+   wr->state   = (char *)calloc(data->n_subs, 1);
+   if(!wr->bands || !wr->band_of || !wr->state) {
+      free(wr->bands);
+      free(wr->band_of);
+      free(wr->state);
+      free(wr);
+      free(order);
+      free(key);
+      return 1;
+      }
+
+   for(ii = 0; ii < data->n_subs; ii++) {
+      key[ii].y     = data->subs[ii].img_ul_y;
+      key[ii].x     = data->subs[ii].img_ul_x;
+      key[ii].index = ii;
+      }
+   qsort(key, data->n_subs, sizeof(SubKey_t), cmp_sub);
+   for(ii = 0; ii < data->n_subs; ii++)
+      order[ii] = key[ii].index;
+   free(key);
+
+   /* bands point into order, which the writer keeps, and the
+      second half of it */
+   for(ii = 0, nb = -1; ii < data->n_subs; ii++) {
+      if(nb < 0 || data->subs[order[ii]].img_ul_y !=
+                   data->subs[wr->bands[nb].subs[0]].img_ul_y) {
+         nb++;
+         wr->bands[nb].subs = &order[ii];
+         wr->bands[nb].held = &order[data->n_subs + ii];
+         }
+      wr->bands[nb].n_subs++;
+      wr->band_of[order[ii]] = nb;
+      }
+   wr->n_bands = nb + 1;
+   pthread_mutex_init(&wr->lock, NULL);
+   data->writer = wr;
+   return 0;
+}
 
-    if (options->debug >= 30) {
-    printf("%s: Reversing geometric adj:", fn);
-    printf(" (%.2lf, %.2lf)->(%.2lf, %.2lf)\n",
-       data->x, data->y, data->geo_x, data->geo_y);
-  }
+void free_writer(Data_t *data)
+{
+   Writer_t *wr = data->writer;
+
+   if(wr == NULL)
+      return;
+   pthread_mutex_destroy(&wr->lock);
+   if(wr->n_bands > 0)
+      free(wr->bands[0].subs);
+   free(wr->bands);
+   free(wr->band_of);
+   free(wr->state);
+   free(wr);
+   data->writer = NULL;
+}
 
-  /* ---- Reverse edge balancing using coords from grand_geo reversal ---- */
-  if (frame->frm_edgeties.n_ties > 0) {
-    offset = FindOffsetAtPt(data->geo_x, data->geo_y, frame->frm_edgeties.tie,
-            frame->frm_edgeties.n_ties, frame->frm_edgeties.spacing);
-    data->s0 -= offset;
-    if (options->debug >= 30) {
-      printf("%s: Reversing edge offset (%lf): %lf\n",
-         fn, offset, data->s0);
-    }
-  }
+/* ---- mark sub done or held, and write it and/or its band ---- */
+static int finish_sub(Subtile_t *sub, Data_t *data, int have)
+{
+   Writer_t *wr = data->writer;
+   Band_t   *band;
+   int       ii, nn, status = 0, alone = 0, flush;
+   int       ss = sub - data->subs;
+   int      *held;
+   size_t    bytes = (size_t)sub->clip_nx * sub->clip_ny * sizeof(short);
+
+   pthread_mutex_lock(&wr->lock);
+   if(wr->state[ss] != SUB_PENDING) {
+      pthread_mutex_unlock(&wr->lock);
+      return 0;
+      }
+   band = &wr->bands[wr->band_of[ss]];
+   held = band->held;
+   band->n_done++;
+   flush = band->n_done == band->n_subs;
+   if(have && !flush && wr->held + bytes > HOLD_BYTES)
+      alone = 1;
+   wr->state[ss] = have && !alone ? SUB_HELD : SUB_DONE;
+   if(wr->state[ss] == SUB_HELD)
+      wr->held += bytes;
+
+   /* the whole band is in, take its held subtiles */
+   nn = 0;
+   if(flush)
+      for(ii = 0; ii < band->n_subs; ii++)
+         if(wr->state[band->subs[ii]] == SUB_HELD) {
+            held[nn++] = band->subs[ii];
+            wr->state[band->subs[ii]] = SUB_DONE;
+            wr->held -= (size_t)data->subs[band->subs[ii]].clip_nx *
+                        data->subs[band->subs[ii]].clip_ny * sizeof(short);
+            }
+   pthread_mutex_unlock(&wr->lock);
 
-  /* ---- Reverse rad_bal using coords from grand_geo reversal ---- */
-  if (frame->frm_offset.n_coeffs > 0) {
-    if ((offset = ApplyEqnAtPt(data->geo_x, data->geo_y,
-               &frame->frm_offset)) == -9999) {
-      printf("%s: Invalid equation\n", fn);
-      return(1);
-    }
-    data->s0 -= offset;
-    if (options->debug >= 30) {
-      printf("%s: Reversing offset (%lf): %lf\n",
-         fn, offset, data->s0);
-    }
+   if(alone) {
+      status = write_subs(data, &ss, 1);
+      release_sub(sub);
+      }
+   if(nn > 0) {
+      if(write_subs(data, held, nn)) {
+         status = 1;
+         for(ii = 0; ii < nn; ii++)
+            data->subs[held[ii]].failed = 1;
+         }
+      for(ii = 0; ii < nn; ii++)
+         release_sub(&data->subs[held[ii]]);
+      }
+   return status;
+}
 
-    if ((scale = ApplyEqnAtPt(data->geo_x, data->geo_y,
-               &frame->frm_scale)) == -9999) {
-      printf("%s: Invalid equation", fn);
-      return(1);
-    }
-    scale = pow(10, scale);
-    data->s0 /= scale;
-    if (options->debug >= 30) {
-      printf("%s: Reversing scale (%lf): %lf\n", fn, scale, data->s0);
-    }
-  }
-/* this is the mamm version of the scale/offset calculation */
-#ifdef MAMM
+int write_sub(Subtile_t *sub, Data_t *data, Options_t *options)
+{
+   double t0 = stats_start();
+   int    ss = sub - data->subs, status;
+
+   if(options->debug > 0)
+       printf("writing %s\n", sub->name);
 
-  data->s0 -= frame->min_pwr;
+   if(data->output_image->tiff)
+      status = write_tiff_sub(sub, data, options);
+   else {
+      /* ---- -out_order, in place: the buffer is ours now ---- */
+      if(options->swap_out)
+         data->kernel->swap(sub->buf, (size_t)sub->clip_nx * sub->clip_ny);
 
-    if (options->debug >= 30) {
-    printf("%s: Reversing offset (%lf): %lf\n",
-            fn, frame->min_pwr, data->s0);
-  }
+      if(data->writer == NULL) {
+         status = write_subs(data, &ss, 1);
+         release_sub(sub);
+         }
+      else
+         status = finish_sub(sub, data, 1);
+      }
+   stats_stop(STAGE_WRITE, t0);
+   return status;
+}
 
-  data->s0 /= frame->cnvt_scale;
+int skip_sub(Subtile_t *sub, Data_t *data)
+{
+   if(data->writer == NULL)
+      return 0;
+   return finish_sub(sub, data, 0);
+}
 
-    if (options->debug >= 30) {
-    printf("%s: Reversing scale (%lf): %lf\n",
-       fn, frame->cnvt_scale, data->s0);
-  }
+/*fs----------------------------------------------------------------------------
 
-#else
+   Procedure:   give_head
 
-/* this is the amm1 version.  */
+   Purpose:     Generate corners files and rams format header files for
+                the data, index and raw overview output.  The endian
+                line gives the order the data was really written in,
+                -out_order or this host's.
 
-  data->s0 /= frame->cnvt_scale;
+----------------------------------------------------------------------------fe*/
 
-  /* ---- Reverse original scale / offset ---- */
-    if (options->debug >= 30) {
-    printf("%s: Reversing scale (%lf): %lf\n",
-       fn, frame->cnvt_scale, data->s0);
-  }
+static int out_big(Options_t *options)
+{
+   return options->out_order == ORDER_BIG ||
+         (options->out_order == ORDER_NATIVE && host_big());
+}
 
-  data->s0 -= frame->min_pwr;
+/* ---- <file>.h, the rams header for a raw image of type short or byte ---- */
+static int head_file(char *file, Image_t *image, char *type,
+                     Options_t *options)
+{
+   char path[1024];
+   FILE *fp;
 
-    if (options->debug >= 30) {
-    printf("%s: Reversing offset (%lf): %lf\n",
-            fn, frame->min_pwr, data->s0);
-  }
+   sprintf(path, "%s.h", file);
+   if((fp = fopen(path, "w")) == NULL)
+      return 1;
+
+   fprintf(fp, "#       @(#)image.c     2.2  7/13/0\n");
+   fprintf(fp, "#       (c) Copyright 2005 Vexcel Corporation.\n");
+   fprintf(fp, "#       All Rights Reserved\n");
+   fprintf(fp, "#\n");
+   fprintf(fp, "Vexcel Image Header\n");
+   fprintf(fp, "lines   %d\n", image->size_y);
+   fprintf(fp, "pixels  %d\n", image->size_x);
+   fprintf(fp, "banding BIL\n");
+   fprintf(fp, "bands   1\n");
+   fprintf(fp, "data    %s\n", type);
+   fprintf(fp, "endian  %s\n", out_big(options) ? "BIG" : "LITTLE");
+   fprintf(fp, "file    '%s'\n", file);
+   return fclose(fp) != 0;
+}
+
+/* ---- <file>.corners ---- */
+static int corners_file(char *file, Image_t *image)
+{
+   char path[1024];
+   FILE *fp;
+
+   sprintf(path, "%s.corners", file);
+   if((fp = fopen(path, "w")) == NULL)
+      return 1;
+
+   fprintf(fp, "#       @(#)rectxy.c    2.2     7/13/0\n");
+   fprintf(fp, "#       (c) Copyright 2005 Vexcel Corporation.\n");
+   fprintf(fp, "#       All Rights Reserved\n");
+   fprintf(fp, "#\n");
+   fprintf(fp, "Vexcel Rectangular XY coordinates\n");
+   fprintf(fp, "max_x   %f\n", (float)image->max_x);
+   fprintf(fp, "max_y   %f\n", (float)image->max_y);
+   fprintf(fp, "min_x   %f\n", (float)image->min_x);
+   fprintf(fp, "min_y   %f\n", (float)image->min_y);
+   return fclose(fp) != 0;
+}
+
+int give_head(Data_t *data, Options_t *options)
+{
+   char path[1024];
+   int  kk;
+
+   /* a GeoTIFF describes itself, it only gets the corners */
+   if(!options->tiff &&
+      head_file(options->output_file, data->output_image, "short", options))
+      return 1;
+   if(corners_file(options->output_file, data->output_image))
+      return 1;
+
+   /* ---- a GeoTIFF's overviews are in it, raw ones are companions ---- */
+   for(kk = 0; kk < data->n_overviews && !options->tiff; kk++) {
+      sprintf(path, "%s.ov%d", options->output_file, 2 << kk);
+      if(head_file(path, &data->overview[kk], "short", options) ||
+         corners_file(path, &data->overview[kk]))
+         return 1;
+      }
+
+   if(options->index_file == NULL || options->tiff)
+      return 0;
+
+   return head_file(options->index_file, data->index_image, "byte", options);
+}
+
+/*fs----------------------------------------------------------------------------
+
+   Procedure:   prepare_output
+
+   Purpose:     Create the output files for both the index and data at
+                full size.  ftruncate sizes them without writing and
+                fallocate reserves their blocks where the filesystem
+                can, then fill_output puts no_data values only where no
+                subtile will write.  The file descriptors for each stay
+                open and are returned with the images.
 
+   Exits:       Exit status is 0 on success, 1 on failure
+
+----------------------------------------------------------------------------fe*/
+
+static int open_output(char *path, Image_t *image, int el_size)
+{
+   off_t size = (off_t)image->size_x * image->size_y * el_size;
+
+   if((image->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0664)) < 0) {
+      printf("prepare_output: Unable to create %s\n", path);
+      return 1;
+      }
+   if(ftruncate(image->fd, size)) {
+      printf("prepare_output: Unable to size %s to %ld bytes\n", path,
+             (long)size);
+      return 1;
+      }
+#ifdef FALLOC_FL_KEEP_SIZE
+   /* only a hint, tmpfs and friends may not do it */
+   fallocate(image->fd, 0, 0, size);
 #endif
+   return 0;
+}
 
-  /* ---- Reverse conversion to amplitude from power ---- */
-    if (options->debug >= 30) {
-    printf("%s: Amplitude: %lf\n", fn, data->s0);
-  }
-  data->s0 *= data->s0;
-    if (options->debug >= 30) {
-    printf("%s: Power: %lf\n", fn, data->s0);
-  }
+int prepare_output(Data_t *data, Options_t *options)
+{
+   if(options->debug >= 1)
+       printf("preparing output image\n");
 
-  /* ---- Obtain sigma0 from power ---- */
-  data->s0 = 10 * log10(data->s0);
-    if (options->debug >= 30) {
-    printf("%s: Sigma Nought: %lf\n", fn, data->s0);
-  }
+   if(options->tiff)
+      return prepare_tiff(data, options) || prepare_overviews(data, options);
 
-  /* ---- Return success ---- */
-  return(0);
+   if(open_output(options->output_file, data->output_image, sizeof(short)))
+      return 1;
+   if(options->index_file &&
+      open_output(options->index_file, data->index_image, 1))
+      return 1;
+   if(plan_writes(data)) {
+      printf("prepare_output: no memory to plan subtile writes\n");
+      return 1;
+      }
+   if(prepare_overviews(data, options))
+      return 1;
+
+   return fill_output(data, options, 0);
 }
 
 /*fs----------------------------------------------------------------------------
 
-   Procedure: double FindOffsetAtPt(xx, yy, tie_array, n_ties, spacing)
+   Procedure:   fill_output
 
-   Purpose:   To compute offset at point based on distance to tie points and
-      corresponding tie offset values.
+   Purpose:     Write no_data values, -32767 in the data and 255 in the
+                index, over the parts of the output no subtile writes.
 
-   Arguments:
-      double       xx, yy     - Map coordinates at which to compute offset
-      EdgeTie_t    *tie_array - Ptr to array of tie points
-      int          n_ties     - Number of ties in tie_array
-      double       spacing    - Tie point spacing
+                Coverage is worked out in bands of rows between the
+                subtiles' top and bottom edges.  Every row of a band
+                is crossed by the same subtiles, so the band's gaps are
+                the same columns all the way down and a band no subtile
+                touches is written as one contiguous run.
 
-   Returns:   Offset value.
+                With failed set, the subtiles calculate_sub couldn't do
+                count as gaps and only their footprint is filled, so they
+                read as no data rather than as zeros.
+
+   Exits:       Exit status is 0 on success, 1 on failure
 
 ----------------------------------------------------------------------------fe*/
-double FindOffsetAtPt(
-   double     xx,
-   double     yy,
-   EdgeTie_t  *tie_array,
-   int        n_ties,
-   double     spacing)
+
+#define FILL_ROWS 64               /* rows per write in a full width run */
+
+typedef struct {           /* columns x0 up to x1 of a band */
+   int x0, x1;
+   } Span_t;
+
+static int cmp_span(const void *aa, const void *bb)
+{
+   return ((const Span_t *)aa)->x0 - ((const Span_t *)bb)->x0;
+}
+
+static int fill_rect(Image_t *image, const char *fill, int el_size,
+                     int x0, int x1, int y0, int y1)
+{
+   size_t n_bytes;
+   int    yy, n_rows;
+
+   stats_count(COUNT_WRITTEN, (long)(x1 - x0) * (y1 - y0) * el_size);
+   if(x0 == 0 && x1 == image->size_x) {
+      for(yy = y0; yy < y1; yy += n_rows) {
+         n_rows  = y1 - yy < FILL_ROWS ? y1 - yy : FILL_ROWS;
+         n_bytes = (size_t)n_rows * image->size_x * el_size;
+         if(pwrite(image->fd, fill, n_bytes,
+                   (off_t)yy * image->size_x * el_size) != (ssize_t)n_bytes)
+            return 1;
+         }
+      return 0;
+      }
+
+   n_bytes = (size_t)(x1 - x0) * el_size;
+   for(yy = y0; yy < y1; yy++)
+      if(pwrite(image->fd, fill, n_bytes,
+                ((off_t)yy * image->size_x + x0) * el_size) != (ssize_t)n_bytes)
+         return 1;
+   return 0;
+}
+
+static int fill_image(Data_t *data, Image_t *image, int index, int scale,
+                      int failed, int swap)
+{
+   int     el_size = index ? 1 : sizeof(short);
+   int    *edge;
+   Span_t *cover, *target;
+   char   *fill;
+   int     ii, jj, kk, n_edge, n_cover, n_target, y0, y1, xx, ul_x, ul_y;
+   int     nx, ny;
+   int     status = 0;
+   short   no_data = swap ? (short)0x0180 : -32767;   /* 0x8001 */
+
+   edge   = (int *)malloc((2 * data->n_subs + 2) * sizeof(int));
+   cover  = (Span_t *)malloc((data->n_subs + 1) * sizeof(Span_t));
+   target = (Span_t *)malloc((data->n_subs + 1) * sizeof(Span_t));
+   fill   = (char *)malloc((size_t)FILL_ROWS * image->size_x * el_size);
+   if(!edge || !cover || !target || !fill) {
+      free(edge); free(cover); free(target); free(fill);
+      return 1;
+      }
+   for(ii = 0; ii < FILL_ROWS * image->size_x; ii++)
+      if(index)
+         fill[ii] = (char)255;
+      else
+         memcpy(&fill[ii * sizeof(short)], &no_data, sizeof(short));
+
+   /* ---- Band edges, clipped to the image ---- */
+   n_edge = 0;
+   edge[n_edge++] = 0;
+   edge[n_edge++] = image->size_y;
+   for(ii = 0; ii < data->n_subs; ii++) {
+      ul_y = index ? data->subs[ii].index_ul_y
+                   : data->subs[ii].img_ul_y / scale;
+      ny   = data->subs[ii].clip_ny / scale;
+      if(ul_y > 0 && ul_y < image->size_y)
+         edge[n_edge++] = ul_y;
+      if(ul_y + ny > 0 && ul_y + ny < image->size_y)
+         edge[n_edge++] = ul_y + ny;
+      }
+   qsort(edge, n_edge, sizeof(int), cmp_int);
+
+   for(kk = 0; kk + 1 < n_edge && !status; kk++) {
+      y0 = edge[kk];
+      y1 = edge[kk + 1];
+      if(y0 == y1)
+         continue;
+
+      /* ---- Subtiles across this band, done ones and failed ones ---- */
+      n_cover = n_target = 0;
+      for(ii = 0; ii < data->n_subs; ii++) {
+         ul_x = index ? data->subs[ii].index_ul_x
+                      : data->subs[ii].img_ul_x / scale;
+         ul_y = index ? data->subs[ii].index_ul_y
+                      : data->subs[ii].img_ul_y / scale;
+         nx   = data->subs[ii].clip_nx / scale;
+         ny   = data->subs[ii].clip_ny / scale;
+         if(ul_y > y0 || ul_y + ny < y1)
+            continue;
+         if(data->subs[ii].failed) {
+            target[n_target].x0 = ul_x < 0 ? 0 : ul_x;
+            target[n_target].x1 = ul_x + nx;
+            n_target++;
+            }
+         else {
+            cover[n_cover].x0 = ul_x;
+            cover[n_cover].x1 = ul_x + nx;
+            n_cover++;
+            }
+         }
+      if(!failed) {
+         target[0].x0 = 0;
+         target[0].x1 = image->size_x;
+         n_target = 1;
+         }
+      qsort(cover, n_cover, sizeof(Span_t), cmp_span);
+
+      /* ---- Fill the gaps between covering subtiles ---- */
+      for(ii = 0; ii < n_target && !status; ii++) {
+         if(target[ii].x1 > image->size_x)
+            target[ii].x1 = image->size_x;
+         xx = target[ii].x0;
+         for(jj = 0; jj < n_cover && xx < target[ii].x1 && !status; jj++) {
+            if(cover[jj].x1 <= xx)
+               continue;
+            if(cover[jj].x0 >= target[ii].x1)
+               break;
+            if(cover[jj].x0 > xx)
+               status = fill_rect(image, fill, el_size, xx, cover[jj].x0,
+                                  y0, y1);
+            xx = cover[jj].x1;
+            }
+         if(xx < target[ii].x1 && !status)
+            status = fill_rect(image, fill, el_size, xx, target[ii].x1, y0, y1);
+         }
+      }
+
+   free(edge);
+   free(cover);
+   free(target);
+   free(fill);
+   return status;
+}
+
+int fill_output(Data_t *data, Options_t *options, int failed)
+{
+   double t0 = stats_start();
+   int    kk;
+
+   /* a GeoTIFF's holes are filled when it is closed */
+   if(data->output_image->tiff)
+      return 0;
+
+   if(fill_image(data, data->output_image, 0, 1, failed, options->swap_out)) {
+      printf("fill_output: Unable to write no data to %s\n",
+             options->output_file);
+      return 1;
+      }
+   if(data->index_image &&
+      fill_image(data, data->index_image, 1, data->index_res / data->image_res,
+                 failed, 0)) {
+      printf("fill_output: Unable to write no data to %s\n",
+             options->index_file);
+      return 1;
+      }
+   for(kk = 0; kk < data->n_overviews; kk++)
+      if(fill_image(data, &data->overview[kk], 0, 2 << kk, failed,
+                    options->swap_out)) {
+         printf("fill_output: Unable to write no data to %s.ov%d\n",
+                options->output_file, 2 << kk);
+         return 1;
+         }
+   stats_stop(STAGE_FILL, t0);
+   return 0;
+}
+
+/*fs----------------------------------------------------------------------------
+
+   Procedure:   prepare_tiff
+
+   Purpose:     -format tiff: set the data and index outputs up as
+                internally tiled GeoTIFFs, one TIFF tile per subtile, so
+                each subtile is compressed on its own by the worker that
+                converted it and appended once, never rewritten.  That
+                needs the subtiles on a grid of their own size and, as
+                TIFF tiles must be, a multiple of 16 pixels on a side.
+
+                Tiles go out as they come, in whatever order the workers
+                finish them.  close_output points every tile no subtile
+                wrote at one shared compressed tile of no_data, then
+                writes the IFD after the tiles and patches the header to
+                point at it.  The file is BigTIFF when it could pass
+                4 Gb at its worst compression.
+
+                The header and IFD are in -out_order, like the samples.
+                Compression is -compress: lzw (built in), deflate (with
+                -DTILESIG_ZLIB, link -lz), zstd (with -DTILESIG_ZSTD,
+                link -lzstd) or none.  Compressed tiles carry each
+                sample less the one to its left, TIFF predictor 2, as
+                neighbouring pixels differ by little and that packs far
+                smaller than the values themselves.
+
+   Exits:       Exit status is 0 on success, 1 on failure
+
+----------------------------------------------------------------------------fe*/
+
+#ifdef TILESIG_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TILESIG_ZSTD
+#include <zstd.h>
+#endif
+
+#define TIFF_ASCII   2
+#define TIFF_SHORT   3
+#define TIFF_LONG    4
+#define TIFF_DOUBLE 12
+#define TIFF_LONG8  16
+
+struct Tiff_s {            /* a tiled GeoTIFF being written */
+   pthread_mutex_t lock;
+   int         big;             /* BigTIFF, 8 byte offsets            */
+   int         swap;            /* file order isn't host order        */
+   int         method;          /* TIFF compression code              */
+   int         tile;            /* tile edge in pixels                */
+   int         el_size;         /* bytes per sample                   */
+   int         nx, ny;          /* tiles across and down              */
+   uint64_t   *offset;          /* each tile's bytes, 0 = unwritten   */
+   uint64_t   *count;
+   uint64_t    end;             /* where the next tile goes           */
+   struct Tiff_s *home;         /* holds end and the lock: itself, or */
+};                              /* the full resolution one's overview */
+
+/* ---- LZW as TIFF has it: MSB first, 9 to 12 bit codes, early change ---- */
+
+#define LZW_CLEAR  256
+#define LZW_EOI    257
+#define LZW_FIRST  258
+#define LZW_MAX    4095
+#define LZW_HASH   9001             /* prime, a bit over twice LZW_MAX */
+
+typedef struct {
+   unsigned char *out;
+   size_t         n;
+   uint32_t       acc;              /* bits not yet a whole byte      */
+   int            bits;
+} Bits_t;
+
+static inline void put_code(Bits_t *bb, int code, int n_bits)
+{
+   bb->acc = bb->acc << n_bits | code;
+   bb->bits += n_bits;
+   while(bb->bits >= 8) {
+      bb->bits -= 8;
+      bb->out[bb->n++] = (unsigned char)(bb->acc >> bb->bits);
+      }
+}
+
+static size_t lzw_pack(const unsigned char *src, size_t n, unsigned char *dst)
+{
+   int32_t  key[LZW_HASH];
+   int16_t  code[LZW_HASH];
+   Bits_t   bb;
+   int32_t  kk;
+   int      ent, n_bits = 9, max_code = 511, next = LZW_FIRST, hh;
+   size_t   ii;
+
+   memset(&bb, 0, sizeof(bb));
+   bb.out = dst;
+   memset(key, -1, sizeof(key));
+   put_code(&bb, LZW_CLEAR, n_bits);
+   if(n == 0) {
+      put_code(&bb, LZW_EOI, n_bits);
+      bb.out[bb.n++] = (unsigned char)(bb.acc << (8 - bb.bits));
+      return bb.n;
+      }
+
+   ent = src[0];
+   for(ii = 1; ii < n; ii++) {
+      kk = ent << 8 | src[ii];
+      for(hh = kk % LZW_HASH; key[hh] >= 0 && key[hh] != kk; )
+         if(++hh == LZW_HASH)
+            hh = 0;
+      if(key[hh] == kk) {
+         ent = code[hh];
+         continue;
+         }
+
+      put_code(&bb, ent, n_bits);
+      key[hh]  = kk;
+      code[hh] = next++;
+      if(next == LZW_MAX - 1) {
+         put_code(&bb, LZW_CLEAR, n_bits);
+         memset(key, -1, sizeof(key));
+         next     = LZW_FIRST;
+         n_bits   = 9;
+         max_code = 511;
+         }
+      else if(next > max_code) {
+         n_bits++;
+         max_code = (1 << n_bits) - 1;
+         }
+      ent = src[ii];
+      }
+
+   /* the last string, then EOI at the width the decoder will expect */
+   put_code(&bb, ent, n_bits);
+   if(++next == LZW_MAX - 1) {
+      put_code(&bb, LZW_CLEAR, n_bits);
+      n_bits = 9;
+      }
+   else if(next > max_code)
+      n_bits++;
+   put_code(&bb, LZW_EOI, n_bits);
+
+   if(bb.bits > 0)
+      bb.out[bb.n++] = (unsigned char)(bb.acc << (8 - bb.bits));
+   return bb.n;
+}
+
+/* ---- whether this build can do a TIFF compression code ---- */
+static int have_method(int method)
+{
+   switch(method) {
+#ifdef TILESIG_ZLIB
+      case 8:
+#endif
+#ifdef TILESIG_ZSTD
+      case 50000:
+#endif
+      case 1:
+      case 5:      return 1;
+      default:     return 0;
+      }
+}
+
+/* ---- room a tile of n bytes could need compressed ---- */
+static size_t pack_bound(size_t n, int method)
+{
+   switch(method) {
+#ifdef TILESIG_ZLIB
+      case 8:      return compressBound(n);
+#endif
+#ifdef TILESIG_ZSTD
+      case 50000:  return ZSTD_compressBound(n);
+#endif
+      case 5:      return n * 3 / 2 + 16;    /* 12 bits a byte at worst */
+      default:     return n;
+      }
+}
+
+/* ---- compress n bytes into dst, cap bytes long, 0 on failure ---- */
+static size_t pack_tile(const void *src, size_t n, int method,
+                        unsigned char *dst, size_t cap)
+{
+#ifdef TILESIG_ZLIB
+   uLongf zn = cap;
+#endif
+
+   switch(method) {
+      case 5:
+         if(cap < pack_bound(n, 5))
+            return 0;
+         return lzw_pack((const unsigned char *)src, n, dst);
+#ifdef TILESIG_ZLIB
+      case 8:
+         if(compress2(dst, &zn, (const Bytef *)src, n, 6) != Z_OK)
+            return 0;
+         return zn;
+#endif
+#ifdef TILESIG_ZSTD
+      case 50000: {
+         size_t sn = ZSTD_compress(dst, cap, src, n, 9);
+
+         return ZSTD_isError(sn) ? 0 : sn;
+         }
+#endif
+      default:
+         if(cap < n)
+            return 0;
+         memcpy(dst, src, n);
+         return n;
+      }
+}
+
+/* ---- host order value of size bytes into the file's order ---- */
+static void put_value(unsigned char *dst, const void *src, int size, int swap)
 {
-   int max, min, mid, ii;
-   double mid_x;
-   double dx, dy, dist;
-   double offset;
+   const unsigned char *ss = (const unsigned char *)src;
+   int ii;
 
+   for(ii = 0; ii < size; ii++)
+      dst[ii] = ss[swap ? size - 1 - ii : ii];
+}
 
-   /* ---- Init ---- */
-   offset = 0;
-   min = 0;
-   max = n_ties - 1;
+static int open_tiff(Image_t *image, Options_t *options, int tile, int el_size,
+                     Tiff_t *home)
+{
+   Tiff_t        *tf;
+   unsigned char  head[16];
+   uint16_t       magic;
+   uint64_t       worst;
+   size_t         n_head;
 
+   if((tf = (Tiff_t *)calloc(1, sizeof(Tiff_t))) == NULL)
+      return 1;
+   tf->swap    = options->swap_out;
+   tf->method  = options->compress;
+   tf->tile    = tile;
+   tf->el_size = el_size;
+   tf->nx      = (image->size_x + tile - 1) / tile;
+   tf->ny      = (image->size_y + tile - 1) / tile;
+   tf->offset  = (uint64_t *)calloc((size_t)tf->nx * tf->ny, sizeof(uint64_t));
+   tf->count   = (uint64_t *)calloc((size_t)tf->nx * tf->ny, sizeof(uint64_t));
+   if(!tf->offset || !tf->count) {
+      free(tf->offset);
+      free(tf->count);
+      free(tf);
+      return 1;
+      }
 
-   /* >>>> Find ties within spacing distance <<<< */
+   /* ---- an overview's tiles go in its full resolution image's file ---- */
+   if(home) {
+      tf->big  = home->big;
+      tf->home = home;
+      image->tiff = tf;
+      return 0;
+      }
 
-   /* ---- Find lowest valid x value ---- */
-   while (tie_array[max].map_xy.x > tie_array[min].map_xy.x)
-   {
-      mid = (max + min) / 2;
-      mid_x = tie_array[mid].map_xy.x;
-      if (mid_x >= xx - spacing) {
-         max = mid;
+   worst = (uint64_t)tf->nx * tf->ny *
+           (pack_bound((size_t)tile * tile * el_size, tf->method) + 16) +
+           (uint64_t)tf->nx * tf->ny * 16 + 4096;
+   if(options->overviews)
+      worst += worst / 3;           /* 1/4 + 1/16 + ... of it again */
+   tf->big = worst > 0xffffffffULL;
+
+   memset(head, 0, sizeof(head));
+   head[0] = head[1] = out_big(options) ? 'M' : 'I';
+   magic = tf->big ? 43 : 42;
+   put_value(&head[2], &magic, 2, tf->swap);
+   if(tf->big) {
+      magic = 8;                    /* bytes in an offset */
+      put_value(&head[4], &magic, 2, tf->swap);
       }
-      else {
-     if (min == mid) {
-            min = max;
-     }
-         else {
-            min = mid;
-     }
+   n_head = tf->big ? 16 : 8;       /* IFD offset patched at close */
+   if(pwrite(image->fd, head, n_head, 0) != (ssize_t)n_head) {
+      free(tf->offset);
+      free(tf->count);
+      free(tf);
+      return 1;
       }
-   }
+   tf->end  = n_head;
+   tf->home = tf;
+   pthread_mutex_init(&tf->lock, NULL);
+   image->tiff = tf;
+   return 0;
+}
 
-   /* ---- Step through ties until out of target range ---- */
-   for (ii = min; ii < n_ties; ii++) {
+int prepare_tiff(Data_t *data, Options_t *options)
+{
+   Subtile_t *sub;
+   int        ii, ok = 1;
 
-      /* ---- See if we've passed x range ---- */
-      dx = tie_array[ii].map_xy.x - xx;
-      if (dx > spacing) {
-         break;
+   ok = data->image_size % 16 == 0 &&
+        (options->index_file == NULL || data->index_size % 16 == 0);
+   for(ii = 0; ii < data->n_subs && ok; ii++) {
+      sub = &data->subs[ii];
+      ok = sub->img_ul_x % data->image_size == 0 &&
+           sub->img_ul_y % data->image_size == 0 &&
+           sub->index_ul_x % data->index_size == 0 &&
+           sub->index_ul_y % data->index_size == 0;
+      }
+   if(!ok) {
+      printf("prepare_tiff: -format tiff needs subtiles on a grid, "
+             "%d and %d pixels a multiple of 16\n", data->image_size,
+             data->index_size);
+      return 1;
+      }
+   if(!have_method(options->compress)) {
+      printf("prepare_tiff: this tilesig was built without %s\n",
+             options->compress == 8 ? "deflate, -DTILESIG_ZLIB" :
+                                      "zstd, -DTILESIG_ZSTD");
+      return 1;
       }
 
-      /* ---- See if y is within range ---- */
-      dy = tie_array[ii].map_xy.y - yy;
-      if (dy < 0) dy = -dy;
-      if (dy > spacing) continue;
+   data->output_image->fd = open(options->output_file,
+                                 O_WRONLY | O_CREAT | O_TRUNC, 0664);
+   if(data->output_image->fd < 0 ||
+      open_tiff(data->output_image, options, data->image_size, sizeof(short),
+                NULL)) {
+      printf("prepare_tiff: Unable to create %s\n", options->output_file);
+      return 1;
+      }
+   if(options->index_file == NULL)
+      return 0;
+   data->index_image->fd = open(options->index_file,
+                                O_WRONLY | O_CREAT | O_TRUNC, 0664);
+   if(data->index_image->fd < 0 ||
+      open_tiff(data->index_image, options, data->index_size, 1, NULL)) {
+      printf("prepare_tiff: Unable to create %s\n", options->index_file);
+      return 1;
+      }
+   return 0;
+}
 
-      /* ---- Check distance ---- */
-      dist = sqrt(dx * dx + dy * dy);
-      if (dist > spacing) continue;
+/*fs----------------------------------------------------------------------------
 
-      /* ---- See if point is close enough to contribute to offset ---- */
-      if (dist < spacing) {
+   Procedure:   pack_sub
 
-         /* ---- Pt found, calculate contribution to offset ---- */
-         offset += (tie_array[ii].target - tie_array[ii].avg) *
-               ((spacing - dist) / spacing);
+   Purpose:     Compress a converted subtile's data and index into TIFF
+                tiles, sub->packed, and let go of the raw buffers.  The
+                pipeline does this in the convert stage so tiles are
+                compressed in parallel; write_sub does it itself for
+                subtiles that come another way.
 
-      }
-   }
+   Exits:       Exit status is 0 on success, 1 on failure
 
-   /* ---- Return offset ---- */
-   return(offset);
+----------------------------------------------------------------------------fe*/
+
+/* ---- TIFF predictor 2: each sample of a row less the one to its left,
+        mod 2^bits, src and dst in the file's byte order ---- */
+static void predict_tile(const Tiff_t *tf, const unsigned char *src,
+                         size_t n, unsigned char *dst)
+{
+   size_t   row = (size_t)tf->tile * tf->el_size, ii, jj;
+   uint16_t vv, last, dd;
+
+   for(ii = 0; ii < n; ii += row) {
+      if(tf->el_size == 1) {
+         dst[ii] = src[ii];
+         for(jj = ii + 1; jj < ii + row && jj < n; jj++)
+            dst[jj] = (unsigned char)(src[jj] - src[jj - 1]);
+         continue;
+         }
+      for(jj = ii, last = 0; jj + 1 < ii + row && jj + 1 < n; jj += 2) {
+         put_value((unsigned char *)&vv, &src[jj], 2, tf->swap);
+         dd   = (uint16_t)(vv - last);
+         last = vv;
+         put_value(&dst[jj], &dd, 2, tf->swap);
+         }
+      }
 }
 
-/*fs----------------------------------------------------------------------------
+static int pack_one(Tiff_t *tf, const void *src, size_t n,
+                    unsigned char **packed, size_t *n_packed)
+{
+   size_t         cap = pack_bound(n, tf->method);
+   unsigned char *diff = NULL;
 
-   Procedure:   double ApplyEqnAtPt(xx, yy, coeffs)
+   if((*packed = (unsigned char *)malloc(cap)) == NULL)
+      return 1;
+   if(tf->method != 1) {
+      if((diff = (unsigned char *)malloc(n + 1)) == NULL) {
+         free(*packed);
+         *packed = NULL;
+         return 1;
+         }
+      predict_tile(tf, (const unsigned char *)src, n, diff);
+      src = diff;
+      }
+   *n_packed = pack_tile(src, n, tf->method, *packed, cap);
+   free(diff);
+   if(*n_packed == 0) {
+      free(*packed);
+      *packed = NULL;
+      return 1;
+      }
+   return 0;
+}
 
-   Purpose: To apply equation to a map point.
+static void free_packed(Subtile_t *sub)
+{
+   free(sub->packed[0]);
+   free(sub->packed[1]);
+   sub->packed[0] = sub->packed[1] = NULL;
+}
 
-   Arguments:
-      double xx, yy   - Map coords of location to apply equation.
-      coeff_t *coeffs - Structure containing equation coefficients.
+int pack_sub(Subtile_t *sub, Data_t *data, Options_t *options)
+{
+   size_t n_pixels = (size_t)data->image_size * data->image_size;
+   double t0;
+   int    status;
 
-   Returns: Returns value on success or -9999 on failure.
+   if(sub->packed[0])
+      return 0;
+   t0 = stats_start();
+   if(options->swap_out)
+      data->kernel->swap(sub->buf, n_pixels);
+   status = pack_one(data->output_image->tiff, sub->buf,
+                     n_pixels * sizeof(short), &sub->packed[0],
+                     &sub->n_packed[0]);
+   if(!status && data->index_image)
+      status = pack_one(data->index_image->tiff, sub->i_buf,
+                        (size_t)data->index_size * data->index_size,
+                        &sub->packed[1], &sub->n_packed[1]);
+   release_sub(sub);
+   stats_stop(STAGE_PACK, t0);
+   if(status) {
+      printf("pack_sub: unable to compress %s\n", sub->name);
+      free_packed(sub);
+      }
+   return status;
+}
 
-----------------------------------------------------------------------------fe*/
-double ApplyEqnAtPt(
-   double xx,
-   double yy,
-   coeffs_t *coeffs)
+/* ---- append n packed bytes, returning where they went or 0 ---- */
+static uint64_t append_tile(Image_t *image, const unsigned char *bytes,
+                            size_t n)
 {
-   static char fn[] = "ApplyEqnAtPt";
-   int order;
-   int terms;
-   int ii;
-   double pow_x, pow_y, offset;
-   coeff_t *coeffptr;
+   Tiff_t  *tf = image->tiff->home;
+   uint64_t at;
 
-   /* ---- Init ---- */
-   order  = 0;
-   terms  = 0;
-   offset = 0;
-   if ((coeffs == NULL) ||
-      ((coeffptr = coeffs->firstcoeff) == NULL)) {
-      printf("%s: Invalid list of equation coefficients\n", fn);
-      return -9999;
-   }
+   pthread_mutex_lock(&tf->lock);
+   at = tf->end;
+   tf->end += (n + 1) & ~(size_t)1;         /* tiles on word boundaries */
+   pthread_mutex_unlock(&tf->lock);
 
-   /* ---- Get order from number of terms ---- */
-   while (terms < coeffs->n_coeffs ) {
-      order++;
-      terms = 0;
-      for (ii = order; ii > 0; ii-- ) {
-         terms += ii;
-      }
-      terms += order + 1;
-   }
+   if(pwrite(image->fd, bytes, n, (off_t)at) != (ssize_t)n)
+      return 0;
+   stats_count(COUNT_WRITTEN, n);
+   return at;
+}
 
-   /* ---- Calculate value for x, y ---- */
-   while (order > 0) {
-      pow_y = 0;
-      for (pow_x = order; pow_x >= 0; pow_x--) {
-         offset += pow(xx, pow_x) * pow(yy, pow_y) * coeffptr->value;
-         pow_y++;
-         coeffptr = coeffptr->next;
+static int put_tile(Image_t *image, int tx, int ty,
+                    const unsigned char *bytes, size_t n)
+{
+   Tiff_t  *tf = image->tiff;
+   uint64_t at;
 
-         /* ---- Check list just in case ---- */
-         if (coeffptr == NULL) {
-            printf("%s: Invalid list of equation coefficients\n", fn);
-            return -9999;
-     }
-      }
-      order--;
-   }
-   offset += coeffptr->value;
+   if((at = append_tile(image, bytes, n)) == 0)
+      return 1;
+   tf->offset[(size_t)ty * tf->nx + tx] = at;
+   tf->count[(size_t)ty * tf->nx + tx]  = n;
+   return 0;
+}
 
-   /* ---- Return value ---- */
-   return offset;
+int write_tiff_sub(Subtile_t *sub, Data_t *data, Options_t *options)
+{
+   int status;
+
+   if(pack_sub(sub, data, options))
+      return 1;
+   status = put_tile(data->output_image, sub->img_ul_x / data->image_size,
+                     sub->img_ul_y / data->image_size, sub->packed[0],
+                     sub->n_packed[0]);
+   if(!status && data->index_image)
+      status = put_tile(data->index_image, sub->index_ul_x / data->index_size,
+                        sub->index_ul_y / data->index_size, sub->packed[1],
+                        sub->n_packed[1]);
+   free_packed(sub);
+   return status;
 }
 
 /*fs----------------------------------------------------------------------------
 
-   Procedure:   write_sub
+   Procedure:   close_output
 
-   Purpose:     write the data from a subtile into the output 
-                data and index files.
+   Purpose:     Finish the outputs and close them.  A GeoTIFF gets its
+                missing tiles, its IFD and its header's IFD offset, then
+                its overviews' IFDs chained after it; a raw mosaic is
+                already complete.
+
+   Exits:       Exit status is 0 on success, 1 on failure
 
 ----------------------------------------------------------------------------fe*/
 
-int write_sub(Subtile_t *sub, Data_t *data, Options_t *options)
+typedef struct {           /* one IFD entry, values in host order */
+   uint16_t    tag;
+   uint16_t    type;
+   uint64_t    count;
+   const void *value;
+} TiffTag_t;
+
+static int type_size(int type)
 {
-   long int offset;
-   int jj, ii, out_i;
-   void *data_ptr;
-   int  n_bytes = data->image_size * sizeof(short);
-   if(options->debug > 0)
-       printf("writing %s\n", sub->name);
+   switch(type) {
+      case TIFF_SHORT:  return 2;
+      case TIFF_LONG:   return 4;
+      case TIFF_DOUBLE:
+      case TIFF_LONG8:  return 8;
+      default:          return 1;
+      }
+}
 
-   for(ii = 0; ii < data->image_size; ii++) {
-      out_i = sub->img_ul_y + ii;
-      offset = (out_i * data->output_image->size_x + sub->img_ul_x) * sizeof(short);
-      lseek(data->output_image->fd, offset, SEEK_SET);
-      jj = ii * data->image_size;
-      data_ptr = (void *)&sub->buf[jj];
-      write(data->output_image->fd, data_ptr, n_bytes); 
+/* ---- the IFD goes after everything, and *link, the header's first IFD
+        offset or the last IFD's next, is patched to point at it ---- */
+static int write_ifd(Image_t *image, TiffTag_t *tag, int n_tags,
+                     uint64_t *link)
+{
+   Tiff_t        *tf = image->tiff->home;
+   int            entry = tf->big ? 20 : 12, word = tf->big ? 8 : 4;
+   uint64_t       ifd, extra, bytes, total, nn;
+   unsigned char *buf, *pp, *vv;
+   uint32_t       u32;
+   uint16_t       u16;
+   int            ii, size;
+   uint64_t       jj;
+
+   ifd   = (tf->end + 7) & ~(uint64_t)7;
+   total = (tf->big ? 8 : 2) + (uint64_t)n_tags * entry + word;
+   total = (total + 7) & ~(uint64_t)7;
+   for(ii = 0; ii < n_tags; ii++) {
+      bytes = tag[ii].count * type_size(tag[ii].type);
+      if(bytes > (uint64_t)word)
+         total += (bytes + 7) & ~(uint64_t)7;
       }
+   if((buf = (unsigned char *)calloc(total, 1)) == NULL)
+      return 1;
 
-   if(!data->index_image)
-      return 0;
+   pp = buf;
+   if(tf->big) {
+      nn = n_tags;
+      put_value(pp, &nn, 8, tf->swap);
+      pp += 8;
+      }
+   else {
+      u16 = n_tags;
+      put_value(pp, &u16, 2, tf->swap);
+      pp += 2;
+      }
+   extra = ((tf->big ? 8 : 2) + (uint64_t)n_tags * entry + word + 7) &
+           ~(uint64_t)7;
+
+   for(ii = 0; ii < n_tags; ii++, pp += entry) {
+      size  = type_size(tag[ii].type);
+      bytes = tag[ii].count * size;
+      put_value(pp, &tag[ii].tag, 2, tf->swap);
+      put_value(pp + 2, &tag[ii].type, 2, tf->swap);
+      if(tf->big)
+         put_value(pp + 4, &tag[ii].count, 8, tf->swap);
+      else {
+         u32 = tag[ii].count;
+         put_value(pp + 4, &u32, 4, tf->swap);
+         }
+      vv = pp + (tf->big ? 12 : 8);
+      if(bytes > (uint64_t)word) {
+         nn = ifd + extra;
+         if(tf->big)
+            put_value(vv, &nn, 8, tf->swap);
+         else {
+            u32 = nn;
+            put_value(vv, &u32, 4, tf->swap);
+            }
+         vv = buf + extra;
+         extra += (bytes + 7) & ~(uint64_t)7;
+         }
+      for(jj = 0; jj < tag[ii].count; jj++)
+         put_value(vv + jj * size, (const char *)tag[ii].value + jj * size,
+                   size, tf->swap);
+      }
+   /* next IFD offset stays 0 until an overview follows */
 
-   n_bytes = data->index_size;
-   for(ii = 0; ii < data->index_size; ii++) {
-      out_i = sub->index_ul_y + ii;
-      offset = (out_i * data->index_image->size_x + sub->index_ul_x);
-      lseek(data->index_image->fd, offset, SEEK_SET);
-      jj = ii * data->index_size;
-      data_ptr = (void *)&sub->i_buf[jj];
-      write(data->index_image->fd, data_ptr, n_bytes); 
+   if(pwrite(image->fd, buf, total, (off_t)ifd) != (ssize_t)total) {
+      free(buf);
+      return 1;
       }
+   free(buf);
+   stats_count(COUNT_WRITTEN, total);
+   tf->end = ifd + total;
 
+   if(tf->big) {
+      put_value((unsigned char *)&nn, &ifd, 8, tf->swap);
+      if(pwrite(image->fd, &nn, 8, (off_t)*link) != 8)
+         return 1;
+      }
+   else {
+      u32 = ifd;
+      put_value((unsigned char *)&nn, &u32, 4, tf->swap);
+      if(pwrite(image->fd, &nn, 4, (off_t)*link) != 4)
+         return 1;
+      }
+   *link = ifd + (tf->big ? 8 : 2) + (uint64_t)n_tags * entry;
    return 0;
 }
 
-/*fs----------------------------------------------------------------------------
+static int finish_tiff(Image_t *image, double res, int index, int reduced,
+                       uint64_t *link, Options_t *options)
+{
+   Tiff_t        *tf = image->tiff;
+   size_t         n_tiles = (size_t)tf->nx * tf->ny, n_fill, ii;
+   uint64_t       fill_at = 0;
+   size_t         tile_bytes = (size_t)tf->tile * tf->tile * tf->el_size;
+   unsigned char *fill, *packed = NULL;
+   uint32_t      *off32 = NULL, *cnt32 = NULL;
+   uint32_t       width = image->size_x, length = image->size_y;
+   uint32_t       tile = tf->tile;
+   uint16_t       bits = tf->el_size * 8, method = tf->method, one = 1;
+   uint16_t       predictor = 2;                     /* horizontal */
+   uint32_t       subfile = 1;                       /* reduced image */
+   uint16_t       format = index ? 1 : 2;
+   uint16_t       geo_keys[] = { 1, 1, 0, 2,          /* version, 2 keys   */
+                                 1024, 0, 1, 1,      /* projected model   */
+                                 1025, 0, 1, 1 };    /* pixel is area     */
+   double         scale[3], tie[6];
+   const char    *no_data = index ? "255" : "-32767";
+   short          nd = -32767;
+   int            status = 0;
+   TiffTag_t      tag[18];
+   int            nt = 0;
+
+   /* ---- One no_data tile for all the holes ---- */
+   for(ii = 0, n_fill = 0; ii < n_tiles; ii++)
+      if(tf->count[ii] == 0)
+         n_fill++;
+   if(n_fill > 0) {
+      if((fill = (unsigned char *)malloc(tile_bytes)) == NULL)
+         return 1;
+      if(options->swap_out)
+         nd = (short)0x0180;                         /* 0x8001 swapped */
+      for(ii = 0; ii < tile_bytes; ii += tf->el_size)
+         if(index)
+            fill[ii] = 255;
+         else
+            memcpy(&fill[ii], &nd, sizeof(short));
+      status = pack_one(tf, fill, tile_bytes, &packed, &n_fill);
+      free(fill);
+      if(status || (fill_at = append_tile(image, packed, n_fill)) == 0) {
+         free(packed);
+         return 1;
+         }
+      free(packed);
+      }
+   for(ii = 0; ii < n_tiles; ii++)
+      if(tf->count[ii] == 0) {
+         tf->offset[ii] = fill_at;
+         tf->count[ii]  = n_fill;
+         }
 
-   Procedure:   give_head
+   scale[0] = res;
+   scale[1] = res;
+   scale[2] = 0;
+   tie[0] = tie[1] = tie[2] = tie[5] = 0;
+   tie[3] = image->min_x;
+   tie[4] = image->max_y;
+
+   if(!tf->big) {
+      off32 = (uint32_t *)malloc(n_tiles * sizeof(uint32_t));
+      cnt32 = (uint32_t *)malloc(n_tiles * sizeof(uint32_t));
+      if(!off32 || !cnt32) {
+         free(off32);
+         free(cnt32);
+         return 1;
+         }
+      for(ii = 0; ii < n_tiles; ii++) {
+         off32[ii] = tf->offset[ii];
+         cnt32[ii] = tf->count[ii];
+         }
+      }
 
-   Purpose:     Generate corners files and rams format header files for
-                both the data and index output.  
+   /* ---- Tags, in ascending order as TIFF wants ---- */
+   if(reduced)
+      tag[nt++] = (TiffTag_t){ 254, TIFF_LONG, 1, &subfile };
+   tag[nt++] = (TiffTag_t){ 256, TIFF_LONG, 1, &width };
+   tag[nt++] = (TiffTag_t){ 257, TIFF_LONG, 1, &length };
+   tag[nt++] = (TiffTag_t){ 258, TIFF_SHORT, 1, &bits };
+   tag[nt++] = (TiffTag_t){ 259, TIFF_SHORT, 1, &method };
+   tag[nt++] = (TiffTag_t){ 262, TIFF_SHORT, 1, &one };   /* black is zero */
+   tag[nt++] = (TiffTag_t){ 277, TIFF_SHORT, 1, &one };   /* samples/pixel */
+   tag[nt++] = (TiffTag_t){ 284, TIFF_SHORT, 1, &one };   /* contiguous    */
+   if(method != 1)
+      tag[nt++] = (TiffTag_t){ 317, TIFF_SHORT, 1, &predictor };
+   tag[nt++] = (TiffTag_t){ 322, TIFF_LONG, 1, &tile };
+   tag[nt++] = (TiffTag_t){ 323, TIFF_LONG, 1, &tile };
+   if(tf->big) {
+      tag[nt++] = (TiffTag_t){ 324, TIFF_LONG8, n_tiles, tf->offset };
+      tag[nt++] = (TiffTag_t){ 325, TIFF_LONG8, n_tiles, tf->count };
+      }
+   else {
+      tag[nt++] = (TiffTag_t){ 324, TIFF_LONG, n_tiles, off32 };
+      tag[nt++] = (TiffTag_t){ 325, TIFF_LONG, n_tiles, cnt32 };
+      }
+   tag[nt++] = (TiffTag_t){ 339, TIFF_SHORT, 1, &format };
+   tag[nt++] = (TiffTag_t){ 33550, TIFF_DOUBLE, 3, scale };
+   tag[nt++] = (TiffTag_t){ 33922, TIFF_DOUBLE, 6, tie };
+   tag[nt++] = (TiffTag_t){ 34735, TIFF_SHORT,
+                            sizeof(geo_keys) / sizeof(geo_keys[0]), geo_keys };
+   tag[nt++] = (TiffTag_t){ 42113, TIFF_ASCII, strlen(no_data) + 1, no_data };
+
+   status = write_ifd(image, tag, nt, link);
+   free(off32);
+   free(cnt32);
+   return status;
+}
 
-----------------------------------------------------------------------------fe*/
+static void free_tiff(Image_t *image)
+{
+   if(image == NULL || image->tiff == NULL)
+      return;
+   if(image->tiff->home == image->tiff)
+      pthread_mutex_destroy(&image->tiff->lock);
+   free(image->tiff->offset);
+   free(image->tiff->count);
+   free(image->tiff);
+   image->tiff = NULL;
+}
 
-int give_head(Data_t *data, Options_t *options)
+int close_output(Data_t *data, Options_t *options)
 {
-   char path[1024];
-   FILE *fp;
+   uint64_t link;
+   double   t0 = stats_start();
+   int      status = 0, kk;
+
+   if(data->output_image->tiff) {
+      link   = data->output_image->tiff->big ? 8 : 4;
+      status = finish_tiff(data->output_image, data->image_res, 0, 0, &link,
+                           options);
+      for(kk = 0; kk < data->n_overviews && !status; kk++)
+         status = finish_tiff(&data->overview[kk], data->image_res * (2 << kk),
+                              0, 1, &link, options);
+      if(!status && data->index_image) {
+         link   = data->index_image->tiff->big ? 8 : 4;
+         status = finish_tiff(data->index_image, data->index_res, 1, 0, &link,
+                              options);
+         }
+      for(kk = 0; kk < data->n_overviews; kk++)
+         free_tiff(&data->overview[kk]);
+      free_tiff(data->output_image);
+      free_tiff(data->index_image);
+      }
+   else
+      for(kk = 0; kk < data->n_overviews; kk++)
+         if(close(data->overview[kk].fd))
+            status = 1;
+
+   if(close(data->output_image->fd))
+      status = 1;
+   if(data->index_image && close(data->index_image->fd))
+      status = 1;
+   stats_stop(STAGE_CLOSE, t0);
+   return status;
+}
 
-   sprintf(path, "%s.h", options->output_file);
-   fp = fopen(path, "w");
+/*fs----------------------------------------------------------------------------
 
-   fprintf(fp, "#       @(#)image.c     2.2  7/13/0\n");
-   fprintf(fp, "#       (c) Copyright 2005 Vexcel Corporation.\n");
-   fprintf(fp, "#       All Rights Reserved\n");
-   fprintf(fp, "#\n");
-   fprintf(fp, "Vexcel Image Header\n");
-   fprintf(fp, "lines   %d\n", data->output_image->size_y);
-   fprintf(fp, "pixels  %d\n", data->output_image->size_x);
-   fprintf(fp, "banding BIL\n");
-   fprintf(fp, "bands   1\n");
-   fprintf(fp, "data    short\n");
-   fprintf(fp, "endian  BIG\n");
-   fprintf(fp, "file    '%s'\n", options->output_file);
-   fclose(fp);
+   Procedure:   prepare_overviews, overview_sub
 
-   sprintf(path, "%s.corners", options->output_file);
-   fp = fopen(path, "w");
+   Purpose:     -overviews n: reduced resolution copies of the output,
+                2x, 4x ... 2^n x coarser, built from each subtile's
+                output as it is converted so the mosaic is never read
+                back.  A level's pixel is the mean linear power of the
+                pixels under it that aren't OUT_NULL, back in dB, and
+                OUT_NULL if there are none.  Each output value is taken
+                as the middle of its quantization step, so a block of
+                one value reduces to that value.
 
-   fprintf(fp, "#       @(#)rectxy.c    2.2     7/13/0\n");
-   fprintf(fp, "#       (c) Copyright 2005 Vexcel Corporation.\n");
-   fprintf(fp, "#       All Rights Reserved\n");
-   fprintf(fp, "#\n");
-   fprintf(fp, "Vexcel Rectangular XY coordinates\n");
-   fprintf(fp, "max_x   %f\n", (float)data->output_image->max_x);
-   fprintf(fp, "max_y   %f\n", (float)data->output_image->max_y);
-   fprintf(fp, "min_x   %f\n", (float)data->output_image->min_x);
-   fprintf(fp, "min_y   %f\n", (float)data->output_image->min_y);
+                A raw mosaic's levels are raw companions, <out>.ov2,
+                <out>.ov4 ..., each with its own header and corners.  A
+                GeoTIFF's are reduced resolution IFDs in the same file,
+                chained after the full one, one tile per subtile.
 
-   fclose(fp);
+                A level can only be as coarse as every subtile's window
+                divides evenly, and for a GeoTIFF keep its tiles a
+                multiple of 16; the levels past that are dropped with a
+                note.
 
-   if(options->index_file == NULL)
-      return 0;
+   Exits:       Exit status is 0 on success, 1 on failure
 
-   sprintf(path, "%s.h", options->index_file);
-   fp = fopen(path, "w");
+----------------------------------------------------------------------------fe*/
 
-   fprintf(fp, "#       @(#)image.c     2.2  7/13/0\n");
-   fprintf(fp, "#       (c) Copyright 2005 Vexcel Corporation.\n");
-   fprintf(fp, "#       All Rights Reserved\n");
-   fprintf(fp, "#\n");
-   fprintf(fp, "Vexcel Image Header\n");
-   fprintf(fp, "lines   %d\n", data->index_image->size_y);
-   fprintf(fp, "pixels  %d\n", data->index_image->size_x);
-   fprintf(fp, "banding BIL\n");
-   fprintf(fp, "bands   1\n");
-   fprintf(fp, "data    byte\n");
-   fprintf(fp, "endian  BIG\n");
-   fprintf(fp, "file    '%s'\n", options->index_file);
-   fclose(fp);
+static double         level_power[65536];    /* each output value's power */
+static pthread_once_t level_once = PTHREAD_ONCE_INIT;
 
-   return 0;
+static void fill_level_power(void)
+{
+   int vv;
+
+   for(vv = SHRT_MIN; vv <= SHRT_MAX; vv++)
+      level_power[(unsigned short)vv] =
+         pow(10, ((vv + OUT_OFFSET + 0.5) / q_scale - OFFSET) / 10);
 }
 
-/*fs----------------------------------------------------------------------------
+int prepare_overviews(Data_t *data, Options_t *options)
+{
+   Image_t   *out = data->output_image, *image;
+   Subtile_t *sub;
+   char       path[1024];
+   int        ii, kk, nn, ff, grid = 0;
 
-   Procedure:   prepare_output
+   if(options->overviews <= 0)
+      return 0;
 
-   Purpose:     Generate output files for both the index and 
-                data initialized with no_data values.  
-                the file descriptors for each stay open and
-                are returned with the images. 
+   /* ---- the lowest bit any window edge has is as coarse as it goes ---- */
+   for(ii = 0; ii < data->n_subs; ii++) {
+      sub   = &data->subs[ii];
+      grid |= sub->img_ul_x | sub->img_ul_y | sub->clip_nx | sub->clip_ny;
+      }
+   if(out->tiff)
+      grid |= data->image_size / 16;
+   nn = options->overviews < 16 ? options->overviews : 16;
+   while(nn > 0 && (grid & ((1 << nn) - 1)))
+      nn--;
+   if(nn < options->overviews)
+      printf("prepare_overviews: the subtiles only allow %d of %d levels\n",
+             nn, options->overviews);
+   if(nn == 0)
+      return 0;
 
-----------------------------------------------------------------------------fe*/
+   if((data->overview = (Image_t *)calloc(nn, sizeof(Image_t))) == NULL) {
+      printf("prepare_overviews: no memory for %d levels\n", nn);
+      return 1;
+      }
+   for(kk = 0; kk < nn; kk++, data->n_overviews++) {
+      image = &data->overview[kk];
+      ff    = 2 << kk;
+      image->size_x = (out->size_x + ff - 1) / ff;
+      image->size_y = (out->size_y + ff - 1) / ff;
+      image->min_x  = out->min_x;
+      image->max_y  = out->max_y;
+      image->max_x  = out->min_x + image->size_x * ff * data->image_res;
+      image->min_y  = out->max_y - image->size_y * ff * data->image_res;
+      if(out->tiff) {
+         image->fd = out->fd;
+         if(open_tiff(image, options, data->image_size / ff, sizeof(short),
+                      out->tiff)) {
+            printf("prepare_overviews: no memory for the %dx level\n", ff);
+            return 1;
+            }
+         }
+      else {
+         sprintf(path, "%s.ov%d", options->output_file, ff);
+         if(open_output(path, image, sizeof(short)))
+            return 1;
+         }
+      }
+   return 0;
+}
 
-int prepare_output(Data_t *data, Options_t *options)
+/* ---- one level's part of a subtile, out in host order ---- */
+static int write_level(Subtile_t *sub, Data_t *data, Options_t *options,
+                       int kk, short *out, int nx, int ny)
 {
-   int fd;
-   int ii, n_bytes;
-   void *buf;
-   short *s_buf;
-   unsigned char *i_buf;
+   Image_t       *image = &data->overview[kk];
+   unsigned char *packed = NULL;
+   size_t         n_packed, n_bytes = (size_t)nx * sizeof(short);
+   int            ul_x = sub->img_ul_x / (2 << kk);
+   int            ul_y = sub->img_ul_y / (2 << kk);
+   int            ii, status = 0;
+
+   if(options->swap_out)
+      data->kernel->swap(out, (size_t)nx * ny);
+
+   if(image->tiff) {
+      status = pack_one(image->tiff, out, n_bytes * ny, &packed, &n_packed) ||
+               put_tile(image, sub->img_ul_x / data->image_size,
+                        sub->img_ul_y / data->image_size, packed, n_packed);
+      free(packed);
+      return status;
+      }
 
-   if(options->debug >= 1)
-       printf("preparing output image\n");
+   stats_count(COUNT_WRITTEN, (long)n_bytes * ny);
+   if(nx == image->size_x)
+      return pwrite(image->fd, out, n_bytes * ny,
+                    (off_t)ul_y * n_bytes) != (ssize_t)(n_bytes * ny);
+   for(ii = 0; ii < ny && !status; ii++)
+      status = pwrite(image->fd, out + (size_t)ii * nx, n_bytes,
+                      ((off_t)(ul_y + ii) * image->size_x + ul_x) *
+                      sizeof(short)) != (ssize_t)n_bytes;
+   return status;
+}
 
-   n_bytes = data->output_image->size_x * sizeof(short);
-   buf = calloc(data->output_image->size_x, sizeof(short));
-   s_buf = (short *)buf;
-   for(ii = 0; ii <  data->output_image->size_x; ii++) 
-      s_buf[ii] = -32767;
+int overview_sub(Subtile_t *sub, Data_t *data, Options_t *options)
+{
+   int     nx = sub->clip_nx / 2, ny = sub->clip_ny / 2;
+   double *sum, pp, t0;
+   int    *count, nn;
+   short  *out, vv;
+   int     ii, jj, di, dj, kk, status = 0;
 
-   fd = open(options->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+   if(data->n_overviews == 0)
+      return 0;
+   t0 = stats_start();
+   pthread_once(&level_once, fill_level_power);
+
+   sum   = (double *)malloc((size_t)nx * ny * sizeof(double));
+   count = (int *)malloc((size_t)nx * ny * sizeof(int));
+   out   = (short *)malloc((size_t)nx * ny * sizeof(short));
+   if(!sum || !count || !out) {
+      printf("overview_sub: out of memory for %s\n", sub->name);
+      free(sum); free(count); free(out);
+      return 1;
+      }
 
-   for(ii = 0; ii < data->output_image->size_y; ii++) {
-       write(fd, buf, n_bytes); 
-       }
-   data->output_image->fd = fd;
-   free(buf);
+   /* ---- 2x from the subtile's own output ---- */
+   for(ii = 0; ii < ny; ii++)
+      for(jj = 0; jj < nx; jj++) {
+         pp = 0;
+         nn = 0;
+         for(di = 0; di < 2; di++)
+            for(dj = 0; dj < 2; dj++) {
+               vv = sub->buf[(size_t)(2 * ii + di) * sub->clip_nx +
+                             2 * jj + dj];
+               if(vv != OUT_NULL) {
+                  pp += level_power[(unsigned short)vv];
+                  nn++;
+                  }
+               }
+         sum[(size_t)ii * nx + jj]   = pp;
+         count[(size_t)ii * nx + jj] = nn;
+         }
 
-   if(options->index_file == NULL)
-      return 0;
+   for(kk = 0; kk < data->n_overviews && !status; kk++) {
+      /* ---- each coarser level from the sums of the one before, in
+              place since a pixel's sources never come before it ---- */
+      if(kk > 0) {
+         for(ii = 0; ii < ny / 2; ii++)
+            for(jj = 0; jj < nx / 2; jj++) {
+               pp = 0;
+               nn = 0;
+               for(di = 0; di < 2; di++)
+                  for(dj = 0; dj < 2; dj++) {
+                     pp += sum[(size_t)(2 * ii + di) * nx + 2 * jj + dj];
+                     nn += count[(size_t)(2 * ii + di) * nx + 2 * jj + dj];
+                     }
+               sum[(size_t)ii * (nx / 2) + jj]   = pp;
+               count[(size_t)ii * (nx / 2) + jj] = nn;
+               }
+         nx /= 2;
+         ny /= 2;
+         }
 
-   n_bytes = data->index_image->size_x;
-   buf = calloc(data->index_image->size_x, 1);
-   i_buf = (unsigned char *)buf;
-   for(ii = 0; ii <  data->index_image->size_x; ii++) 
-      i_buf[ii] = 255;
-   fd = open(options->index_file, O_WRONLY | O_CREAT | O_TRUNC, 0664);
-
-   for(ii = 0; ii < data->index_image->size_y; ii++) {
-       write(fd, buf, n_bytes);
-       }
-   data->index_image->fd = fd;
-   free(buf);
+      for(ii = 0; ii < nx * ny; ii++)
+         out[ii] = count[ii] ? QuantizeDb(10 * log10(sum[ii] / count[ii]))
+                             : OUT_NULL;
+      if(write_level(sub, data, options, kk, out, nx, ny)) {
+         printf("overview_sub: unable to write %s's %dx level\n", sub->name,
+                2 << kk);
+         status = 1;
+         }
+      }
 
-   return 0;
+   free(sum);
+   free(count);
+   free(out);
+   stats_stop(STAGE_OVERVIEW, t0);
+   return status;
 }
@@ -0,0 +1,484 @@
+/*ms----------------------------------------------------------------------------
+
+   tilesig.h
+
+   Purpose:
+      Data types and procedures shared by the tilesig program and by
+      programs that link the sigma nought inversion in-process.
+
+   Library use:
+      Compiling tilesig.c with TILESIG_LIBRARY defined leaves out main()
+      so the object can be archived and linked by other tools:
+
+         cc -O2 -DTILESIG_LIBRARY -c tilesig.c
+         ar rc libtilesig.a tilesig.o
+
+      A caller loads a tile's metadata once with LoadTile, converts as many
+      buffers as it likes with GetSigma0Block and releases the tables with
+      FreeTile.  GetSigma0Block only reads the loaded Data_t, so any number
+      of threads may call it on the same tile at once.  LoadTile sets the
+      tile up as MAMM; for AMM1 set data->mission to MISSION_AMM1 before
+      converting.
+
+----------------------------------------------------------------------------me*/
+
+#ifndef TILESIG_H
+#define TILESIG_H
+
+#define INDEX_DIR "IMGINDEX.DIR"
+
+#define NO_DATA_VAL  -9999
+#define OUT_NULL     -32767
+#define DATA_SCALE    1638.35
+#define OFFSET        30.0
+#define OUT_OFFSET    32766
+
+/* ---- Data types ---- */
+
+#define ORDER_NATIVE 0     /* byte order of shorts on disk */
+#define ORDER_BIG    1
+#define ORDER_LITTLE 2
+
+#define MISSION_MAMM 0     /* order the conversion parameters come off */
+#define MISSION_AMM1 1     /* in, -mission                             */
+#define N_MISSIONS   2
+
+typedef struct {           /* command line options...      */
+   char   *output_file;     /* output file name            */
+   char   *index_file;      /* index file name            */
+   double  map_x;           /* user specified coordinate  */
+   double  map_y;
+   int     do_point;        /* flag that user gave point   */
+   double  bbox[4];         /* -bbox min_x min_y max_x max_y */
+   int     do_bbox;         /* flag that user gave a box   */
+   char   *polygon;         /* -polygon vertex file        */
+   char   *points;          /* -points file, "-" = stdin    */
+   char   *tiles;           /* -tiles list of tile directories, or one */
+   char   *serve;           /* -serve socket path, "-" = stdin */
+   int     resident;        /* subtiles -serve keeps mapped, 0 = 16 */
+   int     n_threads;       /* number of subtile workers   */
+   int     prefetch;        /* subtiles read ahead, 0 = threads + 1 */
+   char   *io;              /* read ahead with, NULL = uring if it works */
+   char   *cache;           /* metadata cache file, NULL = the tile's,
+                               "off" = none */
+   char   *simd;            /* row kernel to use, NULL = best */
+   int     in_order;        /* ORDER_ of the IMG files     */
+   int     out_order;       /* ORDER_ to write the output in */
+   int     swap_in;         /* in_order isn't host order   */
+   int     swap_out;        /* out_order isn't host order  */
+   int     tiff;            /* -format tiff                */
+   int     compress;        /* TIFF compression code       */
+   int     overviews;       /* -overviews levels, 2x to 2^n x coarser */
+   char   *stats;           /* -stats report file, NULL = off */
+   int     fd_every;        /* -incremental re-anchor interval */
+   double  approx;          /* -approx error bound in dB, 0 = exact */
+   int     fast_math;       /* -math fast: Exp10Fast and Log10Fast  */
+   int     mission;         /* MISSION_ of the tile, -mission */
+   int     depend;          /* Was "-depend" specified?    */
+   int     debug;           /* Was "-db" specified?        */
+   int     help;            /* Was "-h" specified?         */
+} Options_t;
+
+typedef struct IntXY_t {
+   int x, y;
+} IntXY_t;
+
+typedef struct DoubleXY_t {
+   double x, y;
+} DoubleXY_t;
+
+typedef struct {
+   double  *value;         /* coefficients in key file order       */
+   int      n_coeffs;
+   int      order;         /* polynomial order, -1 if malformed    */
+   double  *horner;        /* same terms compiled by compile_coeffs */
+} coeffs_t;
+
+typedef struct {           /* grand_geo inverse, set up by compile_geom */
+   int      valid;         /* 4 coefficients and cc != 0           */
+   double   aa, bb, cc, dd;
+   double   diff;          /* dd / cc                              */
+   double   diff_aa;       /* diff * aa                            */
+   double   denom;         /* diff * dd + cc                       */
+} GeoInv_t;
+
+typedef struct {
+    DoubleXY_t  map_xy;     /* map coords of chip center in parent image */
+    DoubleXY_t  ul;         /* coords of upper-left chip corner in parent */
+    double      avg;        /* chip magnitude */
+    double      target;     /* target avg for balancing */
+} EdgeTie_t;
+
+typedef struct {           /* ties bucketed by index_ties             */
+    double      x0, y0;     /* map coords of the corner of cell 0      */
+    double      cell;       /* cell size, at least spacing             */
+    int         nx, ny;     /* cells across and down                   */
+    int         *start;     /* nx*ny+1 offsets into list               */
+    int         *list;      /* per cell, ascending tie numbers of its  */
+                            /* 3x3 neighbourhood                       */
+} TieGrid_t;
+
+typedef struct {
+    EdgeTie_t   *tie;       /* array of edge ties */
+    int         n_ties;     /* number of ties in array */
+    IntXY_t     size;       /* size of chip */
+    double      spacing;    /* spacing between ties */
+    TieGrid_t   grid;       /* lookup grid, empty if no ties */
+} EdgeTies_t;
+
+
+typedef struct {           /* Block definition */
+   int           id;              /* block id associated with frame */
+   char         *name;            /* block name from master file    */
+   coeffs_t      blk_offset;      /* list of coefficients           */
+   coeffs_t      blk_scale;       /* list of coefficients           */
+   coeffs_t      blk_geom;        /* list of coefficients           */
+   GeoInv_t      geo;             /* blk_geom ready for inversion   */
+   EdgeTies_t    blk_edgeties;    /* edge balancing pts for block   */
+   } Block_t;
+
+typedef struct {           /* Frame definition            */
+   int           index;            /* index number from index file   */
+   char         *name;             /* frame name from master file    */
+   int           block_id;         /* id of associated block         */
+   double        min_pwr;          /* conversion min power parameter */
+   double        cnvt_scale;       /* conversion scale paramter      */
+   coeffs_t      frm_offset;       /* list of coefficients           */
+   coeffs_t      frm_scale;        /* list of coefficients           */
+   EdgeTies_t    frm_edgeties;     /* edge balancing pts for frame   */
+   Block_t      *block;            /* block reference for index      */
+   int           parts;            /* PART_ its pixels need, -1 if an
+                                      equation it needs is malformed */
+   } Frame_t;
+
+#define PART_BLOCK_TIES  1   /* the corrections a frame's pixels get, */
+#define PART_BLOCK_EQN   2   /* set by compile_tile                   */
+#define PART_FRAME_TIES  4
+#define PART_FRAME_EQN   8
+#define N_PARTS         16
+
+typedef struct {           /* a subtile input file          */
+   void  *addr;            /* contents, read only           */
+   size_t size;            /* bytes                         */
+   int    mapped;          /* mmapped, else malloced        */
+   }  Input_t;
+
+#define N_KEY_FILES 3       /* MASTER.TXT, FRAMES.KEY, BLOCKS.KEY */
+
+typedef struct {           /* a key file as the metadata cache saw it */
+   unsigned long long size;     /* bytes                         */
+   long long          mtime;    /* nanoseconds since the epoch   */
+   unsigned long long hash;     /* of the contents               */
+   }  KeyStamp_t;
+
+typedef struct Data_s Data_t;       /* a tile, or a -tiles mosaic, see below */
+
+typedef struct {           /* Subtile definition            */
+   char  name[12];          /* base subtile name             */
+   double min_x;           /* map extents                   */
+   double max_x;
+   double min_y;
+   double max_y;
+   int    img_ul_x;        /* pixel extents in output file  */
+   int    img_ul_y;
+   int    img_lr_x;
+   int    img_lr_y;
+   int    index_ul_x;        /* pixel extents in output file  */
+   int    index_ul_y;
+   int    clip_x;          /* first column and row converted */
+   int    clip_y;
+   int    clip_nx;         /* columns and rows converted,   */
+   int    clip_ny;         /* image_size without a region   */
+   short         *buf;
+   const unsigned char *i_buf; 
+   unsigned char *packed[2];    /* -format tiff: data, index tiles */
+   size_t         n_packed[2];
+   Input_t img_input;      /* the IMG file, while converting */
+   Input_t i_input;        /* the IDX file i_buf is in      */
+   int    failed;          /* calculate_sub couldn't do it  */
+   Data_t *tile;           /* -tiles: the tile it is from,  */
+                           /* NULL = the Data_t holding it  */
+   }  Subtile_t;
+
+typedef struct {           /* -bbox and -polygon region     */
+   double      min_x;           /* the output extent it gives         */
+   double      max_x;
+   double      min_y;
+   double      max_y;
+   DoubleXY_t *vertex;          /* -polygon ring, NULL = box only     */
+   int         n_vertex;
+   }  Roi_t;
+
+typedef struct Tiff_s Tiff_t;       /* GeoTIFF writer, see prepare_tiff */
+
+typedef struct {           /* Subtile definition            */
+   char  *name;            /* base subtile name             */
+   float *buf;
+   double min_x;           /* map extents                   */
+   double max_x;
+   double min_y;
+   double max_y;
+   int    size_x;
+   int    size_y;
+   int    fd;
+   Tiff_t *tiff;           /* NULL = raw mosaic             */
+   }  Image_t;
+
+typedef struct {           /* per-pixel conversion scratch, one per worker */
+   double      x;               /* current x coord to convert         */
+   double      y;               /* current y coord to convert         */
+   double      geo_x;           /* geometric map x adjustment         */
+   double      geo_y;           /* geometric map y adjustment         */
+   double      s0;              /* returned sigma nought value        */
+   double      value;           /* input image value                  */
+   int         index_value;     /* image index value                  */
+} Sample_t;
+
+#define FD_MAX_ORDER 3     /* highest order stepped by -incremental */
+
+typedef struct {           /* an equation stepped along a row by differences */
+   int         stamp;           /* row the table belongs to           */
+   int         j;               /* pixel the table is at              */
+   int         anchor;          /* pixel last evaluated exactly       */
+   int         order;
+   double      d[FD_MAX_ORDER + 1];   /* q(j) and its differences,
+                                         or 10 to the power of each    */
+} FwdDiff_t;
+
+#define N_APPROX     6     /* corrections gridded by -approx: b_edge,
+                              b_off, b_scale, f_edge, f_off, f_scale */
+
+typedef struct {           /* -approx: one frame's corrections on a grid */
+   int         state;           /* APPROX_ABSENT, _GRID, _EXACT, _BAD */
+   int         x0, y0, x1, y1;  /* pixel box of the frame's valid data */
+   short       dn_lo, dn_hi;    /* range of its input values          */
+   long        n_pixels;        /* how many there are                 */
+   long        work;            /* sampling it may still cost, pixels */
+   int         step;            /* pixels between knots               */
+   int         nx, ny;          /* knots across and down              */
+   double      lo, hi;          /* block edge clamp                   */
+   double     *knot;            /* ny rows of nx knots of N_APPROX    */
+   double     *line;            /* knot columns interpolated to a row */
+   unsigned char *need;         /* NEED_ flags by knot: cell to grid,
+                                   knot sampled, cell checked, cell
+                                   converted exactly                  */
+   int         line_row;        /* row held in line, -1 = none        */
+   int         line_ky;         /* and its cells' row of knots        */
+} ApproxFrame_t;
+
+#define APPROX_ABSENT 0
+#define APPROX_GRID   1
+#define APPROX_EXACT  2    /* too rough or small to grid, converted
+                              exactly                               */
+#define APPROX_BAD    3    /* equations can't be used              */
+
+typedef struct {           /* -approx state for one subtile */
+   double         max_db;       /* error bound asked for              */
+   int            n_frames;
+   ApproxFrame_t *frame;        /* one per frame in the index         */
+} Approx_t;
+
+#define STAGE_KEYS      0     /* -stats wall time: key files or cache    */
+#define STAGE_SETUP     1     /* kernel, region and output extent        */
+#define STAGE_READ      2     /* IMG and IDX in                          */
+#define STAGE_WAIT      3     /* blocked on a pipeline queue             */
+#define STAGE_CONVERT   4     /* convert_sub, all of it                  */
+#define STAGE_CORRECT   5     /*   per-pixel corrections, ties included  */
+#define STAGE_TIES      6     /*     edge tie lookups                    */
+#define STAGE_POWER     7     /*   power kernel                          */
+#define STAGE_LOG10     8     /*   decibels, and -math fast rechecks     */
+#define STAGE_QUANTIZE  9     /*   quantize kernel                       */
+#define STAGE_OVERVIEW 10     /* -overviews levels                       */
+#define STAGE_PACK     11     /* GeoTIFF tile compression                */
+#define STAGE_WRITE    12     /* write_sub                               */
+#define STAGE_FILL     13     /* no data over the gaps                   */
+#define STAGE_CLOSE    14     /* close_output and the headers            */
+#define N_STAGES       15
+
+#define COUNT_SUBS      0     /* -stats counters: subtiles converted     */
+#define COUNT_ROWS      1
+#define COUNT_PIXELS    2     /* pixels looked at by convert_row         */
+#define COUNT_NO_DATA   3     /*   of them no data or outside the region */
+#define COUNT_INVALID   4     /*   of them with bad equations            */
+#define COUNT_RECHECK   5     /* -math fast pixels redone with libm      */
+#define COUNT_LOOKUPS   6     /* edge tie lookups                        */
+#define COUNT_TIES      7     /* tie candidates they examined            */
+#define COUNT_READ      8     /* bytes read                              */
+#define COUNT_WRITTEN   9     /* bytes written                           */
+#define N_COUNTS       10
+
+typedef struct Stats_s {   /* -stats, one per thread, see stats_thread */
+   char       *name;            /* what the thread does               */
+   double      born;            /* when it started                    */
+   double      t[N_STAGES];     /* seconds in each stage              */
+   long        n[N_COUNTS];
+   struct Stats_s *next;
+} Stats_t;
+
+typedef struct {           /* -stats: a run whose edge ties wait for run_ties */
+   int         j0, j1;          /* its pixels                         */
+   Frame_t    *frame;
+} TieRun_t;
+
+typedef struct {           /* one scanline of conversion scratch, per worker */
+   int         n;               /* pixels in the row                  */
+   short      *dn;              /* input values, NO_DATA_VAL = skip   */
+   double     *lo;              /* clamp after block edge offset      */
+   double     *hi;
+   double     *b_edge;          /* block edge tie offset              */
+   double     *b_off;           /* block radiometric offset           */
+   double     *b_scale;         /* 10^block radiometric scale         */
+   double     *f_edge;          /* frame edge tie offset              */
+   double     *f_off;           /* frame radiometric offset           */
+   double     *f_scale;         /* 10^frame radiometric scale         */
+   double     *min_pwr;         /* frame conversion parameters        */
+   double     *cnvt_scale;
+   double     *power;           /* power, then 10 log10(power)        */
+   double     *geo_x;           /* -stats: where the frame edge ties  */
+   double     *geo_y;           /* are looked up                      */
+   TieRun_t   *tie_run;         /* -stats: runs waiting for their ties */
+   int         n_tie_runs;
+   short      *out;             /* quantized output row               */
+   const unsigned char *keep;   /* pixels in the region, NULL = all   */
+   int         n_invalid;       /* pixels whose equations were bad    */
+   FwdDiff_t  *fd;              /* -incremental tables, NULL = exact  */
+   int         fd_every;        /* pixels between exact re-anchors    */
+   int         fd_row;          /* stamp of the row being converted   */
+   Approx_t   *approx;          /* -approx grids, NULL = exact        */
+   int         fast;            /* -math fast                         */
+   int         mission;         /* MISSION_, as the tile's            */
+   int         n_recheck;       /* fast pixels redone with libm       */
+   Stats_t    *stats;           /* -stats, the thread's, NULL = off   */
+} Row_t;
+
+typedef struct {           /* arithmetic stages of the row conversion */
+   char       *name;
+   void      (*power[N_MISSIONS])(Row_t *row);
+                                       /* corrections through power, in
+                                          each mission's order        */
+   void      (*quantize)(Row_t *row);   /* clamp, scale and pack      */
+   void      (*decibel)(Row_t *row);    /* 10 Log10Fast(power), NaN
+                                           where it can't be trusted  */
+   void      (*swap)(short *buf, size_t n);   /* byte swap in place   */
+   int       (*scan)(const short *dn, int n, short *lo, short *hi);
+                                       /* pixels with data, widening
+                                          lo, hi to their values      */
+} RowKernel_t;
+
+#define EXP10_FAST_ERR  1e-14   /* Exp10Fast relative to pow(10, x)        */
+#define LOG10_FAST_ERR  1e-14   /* Log10Fast - log10, times 1 + |log10|    */
+
+typedef struct Writer_s Writer_t;   /* output layer, see write_sub */
+
+struct Data_s {            /* data to be passed around like some cheap tart */
+ /* this stuff will stay put, it is shared read-only by the workers */
+   char       *tile_dir;        /* directory holding MASTER.TXT       */
+   double      image_res;       /* image pixel spacing                */
+   double      index_res;       /* index image pixel spacing          */
+   double      tile_size;       /* edge length of square subtile      */
+   int         image_size;      /* number of pixels/lines on a side   */
+   int         index_size;      /* number of pixels/lines on a side   */
+   Frame_t    *frames;          /* array of frames                    */
+   int         n_frames;        /* number of frames expected in index */
+   Block_t    *blocks;          /* array of blocks                    */
+   int         n_blocks;        /* number of blocks in tile           */
+   Subtile_t  *subs;            /* array of subs to be calculated     */
+   int         n_subs;          /* number of subtiles in tile         */
+   Image_t    *output_image;    /* output data */
+   Image_t    *index_image;     /* output data */
+   Image_t    *overview;        /* -overviews, [k] is 2^(k+1) coarser */
+   int         n_overviews;
+   Roi_t      *roi;             /* -bbox/-polygon, NULL = whole tile  */
+   RowKernel_t *kernel;         /* row kernel picked for this cpu     */
+   int         mission;         /* MISSION_, set by Depend            */
+   Input_t     cache;           /* load_cache map the tables point into */
+   Data_t    **tiles;           /* -tiles: each tile's own tables,    */
+   int         n_tiles;         /* the subs point back at them        */
+ /* the workers share this through its own lock */
+   Writer_t   *writer;          /* subtile bands waiting to be written */
+   Stats_t    *stats;           /* -stats, every thread's, in order   */
+};
+
+/* ---- Function Prototypes ---- */
+
+/* user interface */
+void usage(char *cmd);
+int ParseArgs(int argc, char *argv[], Options_t *options);
+int host_big(void);
+int order_swaps(int order);
+
+/* -stats */
+double wall_now(void);
+void stats_thread(Data_t *data, Options_t *options, char *name);
+int write_stats(Data_t *data, Options_t *options);
+
+/* upfront collection of parameters */
+
+int Depend( Options_t *options, Data_t *data);
+int load_tables(Options_t *options, Data_t *data);
+int load_tiles(Options_t *options, Data_t *data);
+int read_keys(Options_t *options, Data_t *data);
+int stamp_keys(Options_t *options, Data_t *data, KeyStamp_t *stamp);
+int load_cache(Options_t *options, Data_t *data, const KeyStamp_t *stamp);
+int save_cache(Options_t *options, Data_t *data, const KeyStamp_t *stamp);
+int get_coeffs(char *line, coeffs_t *coeffs, Options_t *);
+int compile_coeffs(coeffs_t *coeffs);
+int compile_geom(Block_t *block);
+int index_ties(EdgeTies_t *ties);
+int compile_tile(Data_t *data, Options_t *options);
+int set_roi(Data_t *data, Options_t *options);
+void free_roi(Data_t *data);
+int calculate_output_parameters(Data_t *data, Options_t *options);
+
+/* bulk of the work goes here */
+int GetSigma0 (Options_t *options, Data_t *data, Sample_t *pt);
+int query_points(Data_t *data, Options_t *options);
+int serve(Data_t *data, Options_t *options);
+int calculate_subs(Data_t *data, Options_t *options);
+int calculate_sub(Subtile_t *sub, Options_t *options, Data_t *data);
+int load_sub(Subtile_t *sub, Options_t *options, Data_t *data);
+void order_input(Subtile_t *sub, Options_t *options, Data_t *data);
+int convert_sub(Subtile_t *sub, Options_t *options, Data_t *data);
+int open_input(const char *path, size_t size, int writable, Input_t *input);
+void close_input(Input_t *input);
+RowKernel_t *select_row_kernel(char *name);
+Row_t *alloc_row(int n);
+void free_row(Row_t *row);
+Approx_t *build_approx(Data_t *data, Subtile_t *sub, Options_t *options,
+                       const short *dn, const unsigned char *i_buf);
+int approx_corrections(Data_t *data, Subtile_t *sub, Row_t *row,
+                       int ii, int jj, int index_value);
+int approx_exact(ApproxFrame_t *af, int ii, int jj, int *end);
+void free_approx(Approx_t *approx);
+double Exp10Fast(double xx);
+double Log10Fast(double xx);
+short QuantizeDb(double db);
+int recheck_pixel(Row_t *row, int jj);
+int convert_row(Data_t *data, Subtile_t *sub, Row_t *row, int ii,
+                const short *dn, const unsigned char *i_buf);
+double ApplyEqnAtPt(double xx, double yy, coeffs_t *coeffs);
+double FindOffsetAtPt(double xx, double yy, EdgeTie_t *tie_array, int n_ties, double spacing);
+double FindOffsetInGrid(double xx, double yy, EdgeTies_t *ties);
+
+/* write to output */
+int prepare_output(Data_t *data, Options_t *options);
+int fill_output(Data_t *data, Options_t *options, int failed);
+int prepare_tiff(Data_t *data, Options_t *options);
+int pack_sub(Subtile_t *sub, Data_t *data, Options_t *options);
+int write_tiff_sub(Subtile_t *sub, Data_t *data, Options_t *options);
+int close_output(Data_t *data, Options_t *options);
+int prepare_overviews(Data_t *data, Options_t *options);
+int overview_sub(Subtile_t *sub, Data_t *data, Options_t *options);
+int write_sub(Subtile_t *sub, Data_t *data, Options_t *options);
+int skip_sub(Subtile_t *sub, Data_t *data);
+int plan_writes(Data_t *data);
+void free_writer(Data_t *data);
+int give_head(Data_t *data, Options_t *options);
+
+/* in-process conversion */
+Data_t *LoadTile(const char *tile_dir, int debug);
+int GetSigma0Block(Data_t *data, int n, const double *x, const double *y,
+                   const short *dn, const unsigned char *index, double *s0);
+void FreeTile(Data_t *data);
+
+#endif /* TILESIG_H */
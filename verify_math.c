@@ -0,0 +1,333 @@
+/*ms----------------------------------------------------------------------------
+
+   verify_math.c
+
+   Purpose:
+      To show that tilesig -math fast writes the same 16 bit output as
+      -math exact.
+
+   Build:
+      cc -O2 -DTILESIG_LIBRARY -o verify_math verify_math.c tilesig.c \
+         -lm -lpthread
+
+   Interface: verify_math
+         [-quick]  - try every 64th float instead of every one
+
+   Description:
+      The fast output equals the exact output when three things hold,
+      and this checks each of them exhaustively over the floats that
+      matter, for every row kernel the cpu runs:
+
+      exp10    - Exp10Fast is within EXP10_FAST_ERR of pow(10, x) for
+                 every float x with 2^-30 <= |x| <= 3, far beyond any
+                 radiometric scale exponent.
+      log10    - each kernel's decibel stage is within LOG10_FAST_ERR of
+                 10 log10(p) for every float power p from 1e-5 to 1e3,
+                 30 dB either side of the output range, and wherever
+                 recheck_pixel lets a fast value through it quantizes
+                 as the libm one does.
+      pixels   - random pixels and corrections, with scales from
+                 Exp10Fast and pow, through the power, decibel and
+                 recheck stages, in both missions' order: every pixel
+                 recheck_pixel passes must quantize as the exact one.
+
+      It also times the fast functions against libm.  Exits 0 if every
+      check held, 1 if any failed.
+
+----------------------------------------------------------------------------me*/
+
+/* ---- Include Files ---- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "tilesig.h"
+
+#define ROW_N 4096
+
+static char *kernel_names[] = { "avx512", "avx2", "scalar" };
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* the float stride ulps further from zero */
+static float next_float(float ff, int stride)
+{
+   uint32_t bits;
+
+   memcpy(&bits, &ff, sizeof(bits));
+   bits += stride;
+   memcpy(&ff, &bits, sizeof(ff));
+   return ff;
+}
+
+/* identity corrections, so s0 is 1 and power is whatever is put there */
+static void identity_row(Row_t *row)
+{
+   int jj;
+
+   for(jj = 0; jj < row->n; jj++) {
+      row->dn[jj] = 1;
+      row->lo[jj] = -HUGE_VAL;
+      row->hi[jj] = HUGE_VAL;
+      row->b_edge[jj] = row->b_off[jj] = 0;
+      row->f_edge[jj] = row->f_off[jj] = 0;
+      row->b_scale[jj] = row->f_scale[jj] = 1;
+      row->min_pwr[jj] = 0;
+      row->cnvt_scale[jj] = 1;
+      }
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   check_exp10
+
+    Purpose:   Exp10Fast against pow(10, x) for every float x, both
+               signs, with lo <= |x| <= hi.
+
+    Returns:   Number of x outside EXP10_FAST_ERR
+
+----------------------------------------------------------------------------fe*/
+
+static long check_exp10(float lo, float hi, int stride)
+{
+   double worst = 0, err;
+   long   bad = 0, count = 0;
+   float  xx;
+   int    sign;
+
+   for(sign = -1; sign <= 1; sign += 2)
+      for(xx = sign * lo; fabsf(xx) <= hi; xx = next_float(xx, stride)) {
+         err = fabs(Exp10Fast(xx) / pow(10, xx) - 1);
+         if(!(err <= EXP10_FAST_ERR))
+            bad++;
+         if(err > worst)
+            worst = err;
+         count++;
+         }
+
+   printf("exp10:  %ld floats, worst relative error %.3e (%.2f ulp), %ld over %.0e\n",
+          count, worst, worst / 0x1p-53, bad, EXP10_FAST_ERR);
+   return bad;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   check_log10
+
+    Purpose:   A kernel's decibel stage against 10 log10(p) for every
+               float power from lo to hi, and recheck_pixel's verdict on
+               each against the exact quantized output.
+
+    Returns:   Number of powers outside LOG10_FAST_ERR or quantized wrong
+
+----------------------------------------------------------------------------fe*/
+
+static long check_log10(RowKernel_t *kernel, float lo, float hi, int stride)
+{
+   Row_t  *row = alloc_row(ROW_N);
+   float   pp[ROW_N], ff = lo;
+   double  worst = 0, err, exact;
+   long    bad = 0, wrong = 0, redo = 0, count = 0;
+   int     jj, nn;
+
+   identity_row(row);
+   while(ff <= hi) {
+      for(nn = 0; nn < ROW_N && ff <= hi; nn++, ff = next_float(ff, stride))
+         row->power[nn] = pp[nn] = ff;
+      for(jj = nn; jj < ROW_N; jj++)
+         row->power[jj] = 1;
+      kernel->decibel(row);
+      for(jj = 0; jj < nn; jj++) {
+         exact = 10 * log10(pp[jj]);
+         err = fabs(row->power[jj] - exact) / 10 / (1 + fabs(exact) / 10);
+         if(!(err <= LOG10_FAST_ERR))
+            bad++;
+         if(err > worst)
+            worst = err;
+         if(recheck_pixel(row, jj))
+            redo++;
+         else if(QuantizeDb(row->power[jj]) != QuantizeDb(exact))
+            wrong++;
+         }
+      count += nn;
+      }
+   free_row(row);
+
+   printf("log10:  %-6s %ld floats, worst error %.3e (%.2f ulp of 1), "
+          "%ld over %.0e\n", kernel->name, count, worst, worst / 0x1p-53,
+          bad, LOG10_FAST_ERR);
+   printf("        %ld rechecked with libm (%.2e), %ld quantized differently\n",
+          redo, (double)redo / count, wrong);
+   return bad + wrong;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   check_pixels
+
+    Purpose:   Random pixels through the whole fast path, a mission's
+               power kernel, decibel stage and recheck, against libm.
+               The ranges are wide enough to cover the clamps,
+               cancellation in the offsets and both output limits.
+
+    Returns:   Number of pixels quantized differently
+
+----------------------------------------------------------------------------fe*/
+
+static double uniform(double lo, double hi)
+{
+   return lo + (hi - lo) * (rand() / (RAND_MAX + 1.0));
+}
+
+static long check_pixels(RowKernel_t *kernel, int mission, long n_pixels)
+{
+   Row_t  *fast = alloc_row(ROW_N), *exact = alloc_row(ROW_N);
+   static double b_exp[ROW_N], f_exp[ROW_N];
+   double  db;
+   long    wrong = 0, redo = 0, count;
+   int     jj;
+
+   fast->mission = exact->mission = mission;
+   srand(1);
+   for(count = 0; count < n_pixels; count += ROW_N) {
+      for(jj = 0; jj < ROW_N; jj++) {
+         exact->dn[jj]         = (short)uniform(-2000, 32767);
+         exact->b_edge[jj]     = uniform(-100, 100);
+         exact->lo[jj]         = jj & 1 ? 0 : -HUGE_VAL;
+         exact->hi[jj]         = jj & 1 ? 32767 : HUGE_VAL;
+         exact->b_off[jj]      = uniform(-200, 200);
+         exact->f_edge[jj]     = uniform(-100, 100);
+         exact->f_off[jj]      = uniform(-200, 200);
+         exact->min_pwr[jj]    = uniform(-3, 3);
+         exact->cnvt_scale[jj] = uniform(2000, 20000);
+         b_exp[jj]             = uniform(-0.5, 0.5);
+         f_exp[jj]             = uniform(-0.5, 0.5);
+         exact->b_scale[jj]    = pow(10, b_exp[jj]);
+         exact->f_scale[jj]    = pow(10, f_exp[jj]);
+
+         fast->dn[jj]          = exact->dn[jj];
+         fast->b_edge[jj]      = exact->b_edge[jj];
+         fast->lo[jj]          = exact->lo[jj];
+         fast->hi[jj]          = exact->hi[jj];
+         fast->b_off[jj]       = exact->b_off[jj];
+         fast->f_edge[jj]      = exact->f_edge[jj];
+         fast->f_off[jj]       = exact->f_off[jj];
+         fast->min_pwr[jj]     = exact->min_pwr[jj];
+         fast->cnvt_scale[jj]  = exact->cnvt_scale[jj];
+         fast->b_scale[jj]     = Exp10Fast(b_exp[jj]);
+         fast->f_scale[jj]     = Exp10Fast(f_exp[jj]);
+         }
+      kernel->power[mission](exact);
+      kernel->power[mission](fast);
+      kernel->decibel(fast);
+      for(jj = 0; jj < ROW_N; jj++) {
+         db = 10 * log10(exact->power[jj]);
+         if(recheck_pixel(fast, jj))
+            redo++;
+         else if(QuantizeDb(fast->power[jj]) != QuantizeDb(db))
+            wrong++;
+         }
+      }
+   free_row(fast);
+   free_row(exact);
+
+   printf("pixels: %-6s %s %ld random, %ld rechecked with libm (%.2e), "
+          "%ld quantized differently\n", kernel->name,
+          mission == MISSION_MAMM ? "mamm" : "amm1", count, redo,
+          (double)redo / count, wrong);
+   return wrong;
+}
+
+/*fs----------------------------------------------------------------------------
+
+    Procedure:   time_math
+
+    Purpose:   Nanoseconds per call of libm and the fast functions, and
+               per pixel of the widest decibel stage.
+
+----------------------------------------------------------------------------fe*/
+
+static void time_math(void)
+{
+   static double xx[ROW_N];
+   volatile double sink = 0;
+   RowKernel_t *kernel = select_row_kernel(NULL);
+   Row_t  *row = alloc_row(ROW_N);
+   double t0, t1, t2, t3, t4, t5;
+   double sum;
+   int    ii, jj, reps = 2000;
+
+   for(jj = 0; jj < ROW_N; jj++)
+      xx[jj] = 0.001 + jj * (1.0 / ROW_N);
+
+   t0 = now();
+   for(ii = 0, sum = 0; ii < reps; ii++)
+      for(jj = 0; jj < ROW_N; jj++) sum += pow(10, xx[jj]);
+   t1 = now();
+   for(ii = 0; ii < reps; ii++)
+      for(jj = 0; jj < ROW_N; jj++) sum += Exp10Fast(xx[jj]);
+   t2 = now();
+   for(ii = 0; ii < reps; ii++)
+      for(jj = 0; jj < ROW_N; jj++) sum += log10(xx[jj]);
+   t3 = now();
+   for(ii = 0; ii < reps; ii++)
+      for(jj = 0; jj < ROW_N; jj++) sum += Log10Fast(xx[jj]);
+   t4 = now();
+   identity_row(row);
+   for(ii = 0; ii < reps; ii++) {
+      memcpy(row->power, xx, sizeof(xx));
+      kernel->decibel(row);
+      sum += row->power[ii & (ROW_N - 1)];
+      }
+   t5 = now();
+   sink = sum;
+   (void)sink;
+   free_row(row);
+
+   printf("time:   pow(10, x) %.1f ns, Exp10Fast %.1f ns, "
+          "log10 %.1f ns, Log10Fast %.1f ns, %s decibel %.1f ns\n",
+          (t1 - t0) / reps / ROW_N * 1e9, (t2 - t1) / reps / ROW_N * 1e9,
+          (t3 - t2) / reps / ROW_N * 1e9, (t4 - t3) / reps / ROW_N * 1e9,
+          kernel->name, (t5 - t4) / reps / ROW_N * 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+   RowKernel_t *kernel;
+   long bad = 0;
+   int  ii, mm, stride = 1;
+
+   for(ii = 1; ii < argc; ii++) {
+      if(!strcmp(argv[ii], "-quick"))
+         stride = 64;
+      else {
+         printf("usage: %s [-quick]\n", argv[0]);
+         return 1;
+         }
+      }
+
+   bad += check_exp10(0x1p-30f, 3, stride);
+   for(ii = 0; ii < (int)(sizeof(kernel_names) / sizeof(kernel_names[0])); ii++) {
+      if((kernel = select_row_kernel(kernel_names[ii])) == NULL) {
+         printf("%s kernel not available on this cpu\n", kernel_names[ii]);
+         continue;
+         }
+      bad += check_log10(kernel, 1e-5f, 1e3f, stride);
+      for(mm = 0; mm < N_MISSIONS; mm++)
+         bad += check_pixels(kernel, mm, stride > 1 ? 1L << 20 : 1L << 24);
+      }
+   time_math();
+
+   printf("%s\n", bad ? "FAILED" : "fast output matches exact");
+   return bad != 0;
+}